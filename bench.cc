@@ -0,0 +1,480 @@
+/**
+ * @file bench.cc
+ * @brief B+树的性能测试
+ *
+ * 覆盖随机、顺序、 zipfian 分布的插入，点查找，范围扫描和混合读写，每个测试都在
+ * key_size 为 4/8/16 和几组 max_idx_num/max_data_num 上运行。默认输出 JSON ：
+ *   ns_per_op    每次操作的纳秒数
+ *   items_per_second 每秒的操作数
+ *   bytes_per_key 树上所有结点占用的内存除以 key 的个数
+ *   CACHE-MISSES 每次迭代的缓存缺失次数，需要 libbenchmark 支持 libpfm 并且有权限
+ *                读取性能计数器，否则没有这一项
+ * 命令行上指定了 --benchmark_format 或者 --benchmark_perf_counters 时使用指定的值。
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "libbplus.h"
+}
+
+/**
+ * @brief 每棵树上预先插入的 key 的个数
+ */
+#define BENCH_KEY_NUM (1 << 18)
+
+/**
+ * @brief key 的分布
+ */
+enum bench_pattern {
+	BENCH_RANDOM,
+	BENCH_SEQUENTIAL,
+	BENCH_ZIPFIAN,
+};
+
+/**
+ * @brief 统计结点内存的分配器
+ */
+struct bench_allocator {
+	bp_allocator_t allocator;
+	int64_t        bytes; /** 当前分配出去的内存 */
+};
+
+static void *bench_alloc(void *ctx, int size)
+{
+	((struct bench_allocator *)ctx)->bytes += size;
+
+	return malloc(size);
+}
+
+static void bench_free(void *ctx, void *ptr, int size)
+{
+	((struct bench_allocator *)ctx)->bytes -= size;
+	free(ptr);
+}
+
+static void bench_allocator_init(struct bench_allocator *allocator)
+{
+	allocator->allocator.alloc = bench_alloc;
+	allocator->allocator.free  = bench_free;
+	allocator->allocator.ctx   = allocator;
+	allocator->bytes           = 0;
+}
+
+static uint64_t bench_mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+
+	return x;
+}
+
+/**
+ * @brief 把 v 按大端保存为 key_size 字节的 key ， 16 字节的 key 低 8 字节由 v 计算
+ *        得到，保证 key 的顺序和 v 相同
+ */
+static void bench_make_key(unsigned char *key, int key_size, uint64_t v)
+{
+	int i;
+
+	if (4 == key_size)
+		v &= 0xffffffffull;
+
+	for (i = 0; i < key_size && i < 8; i++)
+		key[i] = (unsigned char)(v >> (8 * ((key_size < 8 ? key_size : 8) - 1 - i)));
+
+	if (16 == key_size) {
+		v = bench_mix64(v);
+		for (i = 0; i < 8; i++)
+			key[8 + i] = (unsigned char)(v >> (56 - 8 * i));
+	}
+}
+
+/**
+ * @brief YCSB 的 zipfian 分布生成器， theta 为 0.99
+ */
+struct bench_zipf {
+	uint64_t n;
+	double   theta;
+	double   alpha;
+	double   zetan;
+	double   eta;
+};
+
+static void bench_zipf_init(struct bench_zipf *zipf, uint64_t n)
+{
+	double   zeta2;
+	uint64_t i;
+
+	zipf->n     = n;
+	zipf->theta = 0.99;
+	zipf->zetan = 0;
+	for (i = 1; i <= n; i++)
+		zipf->zetan += 1.0 / pow((double)i, zipf->theta);
+	zeta2       = 1.0 + 1.0 / pow(2.0, zipf->theta);
+	zipf->alpha = 1.0 / (1.0 - zipf->theta);
+	zipf->eta   = (1.0 - pow(2.0 / n, 1.0 - zipf->theta)) / (1.0 - zeta2 / zipf->zetan);
+}
+
+static uint64_t bench_zipf_next(struct bench_zipf *zipf, uint64_t *seed)
+{
+	double u;
+	double uz;
+
+	*seed = bench_mix64(*seed + 0x9e3779b97f4a7c15ull);
+	u     = (double)(*seed >> 11) / (double)(1ull << 53);
+	uz    = u * zipf->zetan;
+	if (uz < 1.0)
+		return 0;
+
+	if (uz < 1.0 + pow(0.5, zipf->theta))
+		return 1;
+
+	return (uint64_t)(zipf->n * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha))
+		% zipf->n;
+}
+
+/**
+ * @brief 按分布生成 num 个 key 的原始值
+ */
+static std::vector<uint64_t> bench_gen_values(int pattern, int num, uint64_t seed)
+{
+	std::vector<uint64_t> values(num);
+	struct bench_zipf     zipf;
+	int                   i;
+
+	if (BENCH_ZIPFIAN == pattern)
+		bench_zipf_init(&zipf, num);
+
+	for (i = 0; i < num; i++) {
+		if (BENCH_SEQUENTIAL == pattern)
+			values[i] = i;
+		else if (BENCH_ZIPFIAN == pattern)
+			values[i] = bench_mix64(bench_zipf_next(&zipf, &seed)) >> 1;
+		else
+			values[i] = bench_mix64((seed << 32) + i) >> 1;
+	}
+
+	return values;
+}
+
+/**
+ * @brief 生成 num 个 key_size 字节的 key ，连续保存
+ */
+static std::vector<unsigned char> bench_gen_keys(
+	int      pattern,
+	int      key_size,
+	int      num,
+	uint64_t seed)
+{
+	std::vector<unsigned char> keys((size_t)num * key_size);
+	std::vector<uint64_t>      values;
+	int                        i;
+
+	values = bench_gen_values(pattern, num, seed);
+	for (i = 0; i < num; i++)
+		bench_make_key(&keys[(size_t)i * key_size], key_size, values[i]);
+
+	return keys;
+}
+
+/**
+ * @brief 每次操作的纳秒数、每秒的操作数和每个 key 占用的内存
+ */
+static void bench_report(benchmark::State &state, int64_t ops, int64_t bytes, int64_t keys)
+{
+	state.SetItemsProcessed(ops);
+	state.counters["ns_per_op"] = benchmark::Counter(
+		(double)ops / 1e9, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+	if (keys > 0)
+		state.counters["bytes_per_key"] = (double)bytes / keys;
+}
+
+/**
+ * @brief 按 range(1) 和 range(2) 创建一棵空树， range(1) 不大于 0 时结点容量由
+ *        bp_tree_auto_fanout 按 -range(1) 对应的 bp_profile_e 选择
+ */
+static bp_tree_t *bench_create_tree(
+	benchmark::State       &state,
+	struct bench_allocator *allocator,
+	int                     key_size)
+{
+	int max_idx_num;
+	int max_data_num;
+
+	max_idx_num  = state.range(1);
+	max_data_num = state.range(2);
+	if (max_idx_num <= 0
+		&& -1 == bp_tree_auto_fanout(key_size, sizeof(uint64_t),
+									 (bp_profile_e)-max_idx_num, &max_idx_num,
+									 &max_data_num))
+		return NULL;
+
+	bench_allocator_init(allocator);
+
+	return bp_create_tree_with_allocator(max_idx_num, max_data_num, key_size,
+										 sizeof(uint64_t), NULL, &allocator->allocator);
+}
+
+/**
+ * @brief 创建一棵插入了 keys 的树
+ */
+static bp_tree_t *bench_build_tree(
+	benchmark::State                 &state,
+	struct bench_allocator           *allocator,
+	int                               key_size,
+	const std::vector<unsigned char> &keys)
+{
+	bp_tree_t *tree;
+	uint64_t   value;
+	size_t     i;
+
+	tree = bench_create_tree(state, allocator, key_size);
+	if (NULL == tree)
+		return NULL;
+
+	for (i = 0; i < keys.size() / key_size; i++) {
+		value = i;
+		bp_insert(tree, (unsigned char *)&keys[i * key_size], key_size,
+				  (unsigned char *)&value, sizeof(value));
+	}
+
+	return tree;
+}
+
+/**
+ * @brief 逐个插入 BENCH_KEY_NUM 个 key ， range(0) 为 key 的分布
+ */
+template <int key_size>
+static void BM_Insert(benchmark::State &state)
+{
+	std::vector<unsigned char> keys;
+	struct bench_allocator     allocator;
+	bp_tree_t                 *tree;
+	int64_t                    bytes;
+	uint64_t                   value;
+	int                        i;
+
+	keys  = bench_gen_keys(state.range(0), key_size, BENCH_KEY_NUM, 1);
+	bytes = 0;
+	for (auto _ : state) {
+		state.PauseTiming();
+		tree = bench_create_tree(state, &allocator, key_size);
+		if (NULL == tree) {
+			state.SkipWithError("bench_create_tree failed");
+			break;
+		}
+		state.ResumeTiming();
+
+		for (i = 0; i < BENCH_KEY_NUM; i++) {
+			value = i;
+			bp_insert(tree, &keys[(size_t)i * key_size], key_size,
+					  (unsigned char *)&value, sizeof(value));
+		}
+
+		state.PauseTiming();
+		bytes = allocator.bytes;
+		bp_destroy_tree(tree);
+		state.ResumeTiming();
+	}
+
+	bench_report(state, state.iterations() * BENCH_KEY_NUM, bytes, BENCH_KEY_NUM);
+}
+
+/**
+ * @brief 在 BENCH_KEY_NUM 个 key 的树上查找已经存在的 key
+ */
+template <int key_size>
+static void BM_Search(benchmark::State &state)
+{
+	std::vector<unsigned char> keys;
+	std::vector<unsigned char> probes;
+	struct bench_allocator     allocator;
+	bp_tree_t                 *tree;
+	uint64_t                   value;
+	int                        i;
+
+	keys = bench_gen_keys(state.range(0), key_size, BENCH_KEY_NUM, 1);
+	probes.resize(keys.size());
+	// 查找的 key 从插入的 key 中随机选取
+	for (i = 0; i < BENCH_KEY_NUM; i++)
+		memcpy(&probes[(size_t)i * key_size],
+			   &keys[(size_t)(bench_mix64(i + 7) % BENCH_KEY_NUM) * key_size], key_size);
+
+	tree = bench_build_tree(state, &allocator, key_size, keys);
+	if (NULL == tree) {
+		state.SkipWithError("bench_build_tree failed");
+		return;
+	}
+
+	i = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(bp_search(tree, &probes[(size_t)i * key_size],
+										   key_size, (unsigned char *)&value));
+		i = (i + 1) & (BENCH_KEY_NUM - 1);
+	}
+
+	bench_report(state, state.iterations(), allocator.bytes, BENCH_KEY_NUM);
+	bp_destroy_tree(tree);
+}
+
+/**
+ * @brief 从随机的位置开始用游标顺序读取 100 个数据项
+ */
+template <int key_size>
+static void BM_Scan(benchmark::State &state)
+{
+	std::vector<unsigned char> keys;
+	struct bench_allocator     allocator;
+	bp_tree_t                 *tree;
+	bp_cursor_t               *cursor;
+	unsigned char             *key;
+	unsigned char             *value;
+	int64_t                    items;
+	int                        i;
+	int                        j;
+
+	keys = bench_gen_keys(state.range(0), key_size, BENCH_KEY_NUM, 1);
+	tree = bench_build_tree(state, &allocator, key_size, keys);
+	if (NULL == tree) {
+		state.SkipWithError("bench_build_tree failed");
+		return;
+	}
+
+	i     = 0;
+	items = 0;
+	for (auto _ : state) {
+		cursor = bp_cursor_open(tree, &keys[(size_t)i * key_size], NULL);
+		for (j = 0; j < 100 && bp_cursor_next(cursor, &key, &value); j++)
+			benchmark::DoNotOptimize(value);
+		bp_cursor_close(cursor);
+		items += j;
+		i = (i + 7919) & (BENCH_KEY_NUM - 1);
+	}
+
+	bench_report(state, items, allocator.bytes, BENCH_KEY_NUM);
+	bp_destroy_tree(tree);
+}
+
+/**
+ * @brief 80% 查找， 10% 插入新的 key ， 10% 删除最早插入的 key ，树的大小保持不变
+ */
+template <int key_size>
+static void BM_Mixed(benchmark::State &state)
+{
+	std::vector<unsigned char> keys;
+	std::vector<unsigned char> fresh;
+	struct bench_allocator     allocator;
+	bp_tree_t                 *tree;
+	uint64_t                   value;
+	uint64_t                   seed;
+	int                        ins;
+	int                        del;
+	int                        op;
+
+	keys  = bench_gen_keys(state.range(0), key_size, BENCH_KEY_NUM, 1);
+	fresh = bench_gen_keys(state.range(0), key_size, BENCH_KEY_NUM, 3);
+	tree  = bench_build_tree(state, &allocator, key_size, keys);
+	if (NULL == tree) {
+		state.SkipWithError("bench_build_tree failed");
+		return;
+	}
+
+	seed = 0;
+	ins  = 0;
+	del  = 0;
+	for (auto _ : state) {
+		seed = bench_mix64(seed + 1);
+		op   = seed % 10;
+		if (op == 0 && ins < BENCH_KEY_NUM) {
+			value = ins;
+			bp_insert(tree, &fresh[(size_t)ins++ * key_size], key_size,
+					  (unsigned char *)&value, sizeof(value));
+		} else if (op == 1 && del < BENCH_KEY_NUM) {
+			bp_delete(tree, &keys[(size_t)del++ * key_size], key_size, NULL);
+		} else {
+			benchmark::DoNotOptimize(bp_search(
+				tree, &keys[(size_t)((seed >> 8) % BENCH_KEY_NUM) * key_size],
+				key_size, (unsigned char *)&value));
+		}
+	}
+
+	bench_report(state, state.iterations(), allocator.bytes, BENCH_KEY_NUM + ins - del);
+	bp_destroy_tree(tree);
+}
+
+/**
+ * @brief 每个测试在三种分布和几组结点大小上运行，参数为 {分布, max_idx_num, max_data_num}，
+ *        最后两组分别按 BP_PROFILE_MEMORY 和 BP_PROFILE_PAGE_4K 自动选择结点容量
+ */
+static void bench_args(benchmark::internal::Benchmark *b)
+{
+	static const int nodes[][2] = {
+		{16, 32}, {64, 128}, {256, 256},
+		{-BP_PROFILE_MEMORY, 0}, {-BP_PROFILE_PAGE_4K, 0},
+	};
+	int              pattern;
+	size_t           i;
+
+	b->ArgNames({"pattern", "max_idx_num", "max_data_num"});
+	for (pattern = BENCH_RANDOM; pattern <= BENCH_ZIPFIAN; pattern++)
+		for (i = 0; i < sizeof(nodes) / sizeof(nodes[0]); i++)
+			b->Args({pattern, nodes[i][0], nodes[i][1]});
+}
+
+#define BENCH_KEY_SIZES(_bm)                                                     \
+	BENCHMARK_TEMPLATE(_bm, 4)->Apply(bench_args);                               \
+	BENCHMARK_TEMPLATE(_bm, 8)->Apply(bench_args);                               \
+	BENCHMARK_TEMPLATE(_bm, 16)->Apply(bench_args)
+
+BENCH_KEY_SIZES(BM_Insert);
+BENCH_KEY_SIZES(BM_Search);
+BENCH_KEY_SIZES(BM_Scan);
+BENCH_KEY_SIZES(BM_Mixed);
+
+/**
+ * @brief 命令行上没有指定时默认输出 JSON 并统计缓存缺失
+ */
+int main(int argc, char **argv)
+{
+	std::vector<char *> args(argv, argv + argc);
+	std::string         format("--benchmark_format=json");
+	std::string         counters("--benchmark_perf_counters=CACHE-MISSES");
+	int                 has_format;
+	int                 has_counters;
+	int                 i;
+
+	has_format   = 0;
+	has_counters = 0;
+	for (i = 1; i < argc; i++) {
+		if (0 == strncmp(argv[i], "--benchmark_format", 18))
+			has_format = 1;
+		if (0 == strncmp(argv[i], "--benchmark_perf_counters", 25))
+			has_counters = 1;
+	}
+	if (!has_format)
+		args.push_back(&format[0]);
+	if (!has_counters)
+		args.push_back(&counters[0]);
+
+	argc = (int)args.size();
+	benchmark::Initialize(&argc, args.data());
+	if (benchmark::ReportUnrecognizedArguments(argc, args.data()))
+		return 1;
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	return 0;
+}
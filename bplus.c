@@ -54,12 +54,41 @@
  * 2. n <= b
  * 3. 每个叶子结点至少包含 ceil(a/2) 个值
  * 4. 所有的叶子结点在同一层
+ *
+ * 创建树时可以选择 BP_LAYOUT_SPLIT ，此时结点上的 key 连续保存，查找时只会访问 key
+ * 所在的缓存行，定长的 key 也可以直接用 SIMD 指令加载：
+ * +---------------------------------------------------------------+
+ * |P_1 P_2 ... P_n ... P_max P_max+1|K_1 K_2 ... K_n ... K_max    |
+ * +---------------------------------------------------------------+
+ * +---------------------------------------------------------------+
+ * |K_1 K_2 ... K_n ... K_max|V_1 V_2 ... V_n ... V_max|P_next      |
+ * +---------------------------------------------------------------+
+ * 内部结点的第一个指针和数据结点的 P_next 的位置与交错保存时相同，结点的大小也相同。
+ *
+ * 选择 BP_LAYOUT_PREFIX 时内部结点的子树里所有 key 共有的前缀 Pre 只保存一次，每个
+ * key 只保存去掉前缀之后的后缀 S_i ，前缀越长每个 P|S 越短，结点能保存的 key 越多：
+ * +---------------------------------------------------------+
+ * |Pre     |P_1 S_1|P_2 S_2|...|P_n S_n|      ...           |
+ * +---------------------------------------------------------+
+ * 结点内查找先比较一次前缀，再在后缀上查找， 4/8/16 字节的后缀同样按大端整数比较。
  */
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "libbplus.h"
+#include "bpsimd.h"
 
 typedef int (* bp_node_insert_f)(
 	bp_node_t      *node,
@@ -72,6 +101,21 @@ typedef int (* bp_node_get_max_key_f)(
 	unsigned char *key_buf,
 	int            key_buf_len);
 
+/**
+ * @brief
+ *  结点内查找时比较 key 值的方式
+ *
+ * @details
+ *  没有指定比较函数时 key 按 memcmp 的顺序排列，4/8/16 字节的 key 等价于按大端整数
+ *  比较，创建结点时会自动选择对应的方式，查找时不需要经过函数指针调用 memcmp
+ */
+typedef enum bp_key_type {
+	BP_KEY_TYPE_COMPARE, /** 使用 compare 比较，没有 compare 时使用 memcmp */
+	BP_KEY_TYPE_BE32, /** 4 字节的 key ，按大端 32 位整数比较 */
+	BP_KEY_TYPE_BE64, /** 8 字节的 key ，按大端 64 位整数比较 */
+	BP_KEY_TYPE_BE128, /** 16 字节的 key ，按两个大端 64 位整数比较 */
+} bp_key_type_e;
+
 /**
  * @brief
  *  内部结点和数据结点通用的信息
@@ -87,6 +131,16 @@ typedef struct bp_node_common {
 	bp_node_insert_f      insert; /** 用于向当前结点插入数据 */
 	bp_node_get_max_key_f max_key; /** 用于获取当前结点保存的最大 key 值 */
 	bp_compare_f          compare; /** 用于比较 key 值 */
+	bp_allocator_t       *allocator; /** 分配结点内存的分配器， NULL 表示使用 malloc */
+	bp_key_type_e         key_type; /** 结点内查找时比较 key 值的方式 */
+	bp_layout_e           layout; /** 结点上数据项的排列方式 */
+
+	uint64_t               version; /** 并发模式下结点的版本号，见 BP_VERSION_LOCKED ；
+										 写时复制模式下为创建或者删除结点时的 epoch */
+	struct bp_node_common *latch_next; /** 写操作加锁的结点或者等待释放的结点的链表 */
+	uint64_t               generation; /** 最后一次修改结点时树的代数，内部结点不小于所有
+										   子结点的代数，见 bp_export_delta ；并发模式下
+										   已经从树上删除的结点上为删除时的 epoch */
 
 	int max_key_num; /** 可以保存的被索引项最大个数 */
 	int min_key_num; /** 至少要保存的被索引项的个数 */
@@ -103,6 +157,9 @@ typedef struct bp_data_node {
 	int key_size; /** 被索引项的大小 */
 	int value_size; /** 位置信息的大小 */
 
+	unsigned char *frozen; /** bp_freeze 之后按 Eytzinger 顺序保存的 key ，见
+							   bp_data_node_fill_frozen ，没有冻结时为 NULL */
+
 	int            content_len; /** content的长度 */
 	unsigned char  content[0]; /** 保存的数据 */
 } bp_data_node_t;
@@ -112,35 +169,205 @@ typedef struct bp_inner_node {
 
 	int key_size; /** 被索引项的大小 */
 	int key_total; /** 所有子树最终指向的数据结点的被索引项的个数 */
+	int prefix_len; /** BP_LAYOUT_PREFIX 的结点上子树里所有 key 共有的前缀的长度 */
 
 	int            content_len; /** content的长度 */
 	unsigned char  content[0]; /** 保存的数据 */
 } bp_inner_node_t;
 
-bp_node_t *bp_create_data_node(
-	int          max_kv_num,
-	int          min_kv_num,
-	int          key_size,
-	int          value_size,
-	bp_compare_f compare);
+/**
+ * @brief 记录读者进入的 epoch 的位置个数
+ */
+#define BP_EPOCH_SLOT_NUM 64
+
+/**
+ * @brief
+ *  一个正在访问快照的读者进入的 epoch
+ */
+typedef struct bp_epoch_slot {
+	uint64_t      epoch; /** 读者开始访问时的 epoch ， 0 表示没有被使用 */
+	unsigned char pad[64 - sizeof(uint64_t)]; /** 每个位置独占一个缓存行 */
+} bp_epoch_slot_t;
+
+/**
+ * @brief
+ *  并发模式的B+树上用于读写同步的信息
+ *
+ * @details
+ *  写操作之间用 write_lock 互斥。写操作修改一个结点之前先给结点加写锁，整个写操作
+ *  完成之后再释放所有的写锁，这样查找时看到的每个结点都是一次完整的写操作之前或者之后
+ *  的状态。查找不加锁，只在读完结点之后检查结点的版本号是否变化，变化了就从根结点重新
+ *  查找。从树上删除的结点可能还有查找在访问，所以不会马上释放，而是记下当时的 epoch
+ *  放到 retired 链表上。查找开始前在 slots 上记下进入时的 epoch ，写操作结束时把
+ *  epoch 加一，并释放比所有正在进行的查找的 epoch 都小的结点
+ *
+ *  写时复制模式下写操作同样用 write_lock 互斥，但是不给结点加锁：写操作开始时复制
+ *  根结点，之后每个要修改的子结点都先复制一份再修改，所以已经发布的结点永远不会被
+ *  修改。写操作完成后把新的根结点发布到 root ，再把 epoch 加一。被复制或者删除的结点
+ *  记下当时的 epoch 放到 retired 链表上，所有正在访问快照的读者的 epoch 都比它大时
+ *  才释放
+ */
+struct bp_sync {
+	pthread_mutex_t   write_lock; /** 写操作之间互斥 */
+	bp_node_common_t *latched; /** 当前写操作加了写锁的结点 */
+	bp_node_common_t *retired; /** 已经从树上删除，等待释放的结点 */
+
+	int              cow; /** 是否为写时复制模式 */
+	bp_tree_t       *tree; /** 所属的B+树 */
+	bp_node_t       *root; /** 写时复制模式下最近一次发布的根结点 */
+	uint64_t         epoch; /** 当前的 epoch ，每次写操作完成后加一 */
+	bp_epoch_slot_t  slots[BP_EPOCH_SLOT_NUM]; /** 正在访问快照或者查找的读者 */
+};
+
+/**
+ * @brief
+ *  写时复制模式的B+树上的只读快照
+ */
+struct bp_snapshot {
+	bp_tree_t *tree; /** 所属的B+树 */
+	bp_node_t *root; /** 打开快照时已经发布的根结点 */
+	int        slot; /** 记录读者 epoch 的位置 */
+};
+
+/**
+ * @brief 从根结点到数据结点经过的内部结点的最大个数
+ */
+#define BP_MAX_DEPTH 64
+
+/**
+ * @brief
+ *  从根结点到一个数据结点的路径，在快照上不通过 pnext 移动到下一个数据结点
+ *
+ * @details
+ *  写时复制模式下复制一个数据结点时不会复制它左边的数据结点，左边结点的 pnext 仍然
+ *  指向旧的结点，所以快照上只能沿着内部结点移动
+ */
+typedef struct bp_path {
+	int              depth; /** 经过的内部结点的个数 */
+	bp_inner_node_t *nodes[BP_MAX_DEPTH]; /** 经过的内部结点 */
+	int              idx[BP_MAX_DEPTH]; /** 在每个内部结点上经过的子结点的下标 */
+} bp_path_t;
+
+/**
+ * @brief 版本号的最低位表示结点加了写锁，第二位表示结点已经从树上删除，其余的位在每次
+ *        释放写锁时加一
+ */
+#define BP_VERSION_LOCKED   1ull
+#define BP_VERSION_OBSOLETE 2ull
+#define BP_VERSION_STEP     4ull
+
+/**
+ * @brief
+ *  顺序访问数据结点上被索引项的游标
+ */
+struct bp_cursor {
+	bp_data_node_t *data; /** 当前所在的数据结点 */
+	int             idx; /** 下一个要返回的数据项在 data 上的下标 */
+	int             end; /** data 上第一个超出查找范围的数据项的下标 */
+	int             last; /** data 是否为查找范围内的最后一个数据结点 */
+	int             has_hi; /** 是否有查找范围的上限 */
+	int             key_size; /** 被索引项的大小 */
+	bp_snapshot_t  *snapshot; /** 在快照上访问时不为 NULL ，通过 path 移动 */
+	int             own_snapshot; /** 快照是否由游标自己打开 */
+	bp_path_t       path; /** 从快照的根结点到 data 的路径 */
+	unsigned char  *buf; /** 插入缓冲中排好序的 K|V ，和数据结点上的数据按顺序合并返回 */
+	int             buf_idx; /** 下一个要返回的缓冲中的数据项的下标 */
+	int             buf_end; /** 缓冲中第一个超出查找范围的数据项的下标 */
+	int             item_size; /** 缓冲中一个数据项的大小 */
+	bp_compare_f    compare; /** 比较 key 值的函数 */
+	bp_key_type_e   key_type; /** 在缓冲中查找时比较 key 值的方式 */
+	unsigned char   hi[0]; /** 查找范围的上限 */
+};
+
+/**
+ * @brief 编译时定义 BP_STATS 才统计当前线程的查找次数和插入时移动的数据量，否则
+ *        bp_get_thread_stats 总是返回 0
+ */
+#ifdef BP_STATS
+static __thread bp_thread_stats_t bp_thread_stats;
+#define BP_STAT_ADD(_field, _num) (bp_thread_stats._field += (_num))
+#else
+#define BP_STAT_ADD(_field, _num) ((void)0)
+#endif
 
-bp_node_t *bp_create_inner_node(int max_key_num, int key_size, bp_compare_f compare);
+bp_node_t *bp_alloc_data_node(
+	bp_allocator_t *allocator,
+	bp_layout_e     layout,
+	int             max_kv_num,
+	int             min_kv_num,
+	int             key_size,
+	int             value_size,
+	bp_compare_f    compare);
+
+bp_node_t *bp_alloc_inner_node(
+	bp_allocator_t *allocator,
+	bp_layout_e     layout,
+	int             max_key_num,
+	int             key_size,
+	bp_compare_f    compare);
+
+void bp_node_free(bp_node_t *node);
+
+unsigned char *bp_node_get_content(bp_node_t *node);
 
 #define bp_data_node_get_item_size(_node) \
 	((_node)->key_size + (_node)->value_size)
 #define bp_data_node_get_valid_data_len(_node, _item_size) \
 	((_node)->common.key_num * item_size)
 
+#if defined(__GNUC__)
+#define bp_prefetch(_addr) __builtin_prefetch((_addr), 0, 3)
+#else
+#define bp_prefetch(_addr) ((void)(_addr))
+#endif
+
+/**
+ * @brief 并发模式下乐观读的结点内容可能正在被写操作修改，读到的数据在版本号检查
+ *        通过之后才会被使用。用 ThreadSanitizer 编译时让它忽略这段读取，其它位置的
+ *        数据竞争仍然会被报告
+ */
+#if defined(__SANITIZE_THREAD__)
+#define BP_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define BP_TSAN 1
+#endif
+#endif
+
+#ifdef BP_TSAN
+void AnnotateIgnoreReadsBegin(const char *file, int line);
+void AnnotateIgnoreReadsEnd(const char *file, int line);
+#define bp_optimistic_read_begin() AnnotateIgnoreReadsBegin(__FILE__, __LINE__)
+#define bp_optimistic_read_end()   AnnotateIgnoreReadsEnd(__FILE__, __LINE__)
+#else
+#define bp_optimistic_read_begin() ((void)0)
+#define bp_optimistic_read_end()   ((void)0)
+#endif
+
+/**
+ * @brief BP_LAYOUT_PREFIX 的内部结点在数据区域最前面保存前缀的空间的大小
+ */
+#define bp_inner_node_prefix_area(_key_size) (((_key_size) + 7) & ~7)
+
 /**
  * @brief 计算内部结点保存数据需要的占用的内存
  *
+ * @param layout 数据项的排列方式
  * @param max_key_num 内部节点可以保存的最大的 key 的个数
  * @param key_size 被索引项的数据长度
  * @return int 内部结点数据区域的大小
  */
-int bp_calc_inner_node_content_len(int max_key_num, int key_size)
+int bp_calc_inner_node_content_len(
+	bp_layout_e layout,
+	int         max_key_num,
+	int         key_size)
 {
-	// 需要保存 max_key_num 个 key 和 max_key_num + 1 个指针
+	// BP_LAYOUT_PREFIX 在前面多保存一个前缀，没有前缀时正好可以保存 max_key_num 个 P|K
+	if (BP_LAYOUT_PREFIX == layout)
+		return bp_inner_node_prefix_area(key_size)
+			+ max_key_num * (key_size + sizeof(bp_node_t *));
+
+	// 需要保存 max_key_num 个 key 和 max_key_num + 1 个指针，两种排列方式的大小相同
 	return max_key_num * (key_size + sizeof(bp_node_t *)) + sizeof(bp_node_t *);
 }
 
@@ -157,757 +384,7500 @@ int bp_calc_data_node_content_len(
 	int key_size,
 	int value_size)
 {
-	// 需要保存 max_kv_num 个 key value 和 1 个指针
+	// 需要保存 max_kv_num 个 key value 和 1 个指针，两种排列方式的大小相同
 	return max_kv_num * (key_size + value_size)	+ sizeof(bp_data_node_t *);
 }
 
-static int bp_compare(unsigned char *a, unsigned char *b, int size)
+/**
+ * @brief 返回数据结点上第 idx 个 key 的位置
+ *
+ */
+static inline unsigned char *bp_data_node_key(bp_data_node_t *data, int idx)
 {
-	return memcmp(a, b, size);
+	if (BP_LAYOUT_SPLIT == data->common.layout)
+		return data->content + idx * data->key_size;
+
+	return data->content + idx * (data->key_size + data->value_size);
 }
 
 /**
- * @brief 在节点 content 的 item 列表中查找 target
+ * @brief 返回数据结点上第 idx 个 value 的位置
  *
- * @param content 结点内容，可以是内部结点也可以是叶子结点
- * @param content_len 内容长度，这里需要传入的是实际已经插入的数据的长度，而不是全部长度
- * @param item_len content 中一个数据项的长度，对于内部结点，数据项内容为 ptr + key，
- *                 item_len 为 sizeof(ptr) + sizeof(key)，对于叶子结点，数据项内容
- *                 为 key + value， item_len 为 sizeof(key) + sizeof(value)
- * @param target 要查找的内容
- * @param target_size 要查找内容的长度
- * @param offset 要查找内容在 item 中的偏移量，内部结点的数据格式为 ptr + key，需要传入
- *               的查找偏移量为 sizeof(ptr)，叶子结点的数据格式为 key + value，需要传
- *               入的查找偏移量为 0
- * @param compare 比较 key 值的函数
- * @param found_idx 如果找到了则返回找到的位置，否则返回比 target 大的第一个值的位置
- * @return int 找到返回1，否则返回0
  */
-int bp_bi_search_one(
-	unsigned char *content,
-	int            content_len,
-	int            item_size,
-	unsigned char *target,
-	int            target_size,
-	int            offset,
-	bp_compare_f   compare,
-	int           *found_idx)
+static inline unsigned char *bp_data_node_value(bp_data_node_t *data, int idx)
 {
-	int            item_num;
-	int            comp_res;
-	int            half_item_num;
-	unsigned char *low;
-	unsigned char *high;
-	unsigned char *mid;
-
-	if (0 == content_len) {
-		*found_idx = 0;
-
-		return 0;
-	}
-
-	compare = compare ? compare : bp_compare;
-	item_num = content_len / item_size;
-	low      = content;
-	high     = low + (item_num - 1) * item_size;
-	while (low <= high) {
-		half_item_num = (item_num) / 2;
-		half_item_num = half_item_num == 0 ? 1 : half_item_num;
-		mid           = low + (half_item_num - 1) * item_size;
-		comp_res      = compare(target, mid + offset, target_size);
-
-		if (0 == comp_res) {
-			*found_idx = (mid - content) / item_size;
-
-			return 1;
-		}
+	if (BP_LAYOUT_SPLIT == data->common.layout)
+		return data->content + data->common.max_key_num * data->key_size
+			+ idx * data->value_size;
 
-		if (0 < comp_res) {
-			low      = mid + item_size;
-			item_num = item_num - half_item_num;
-		} else {
-			high     = mid - item_size;
-			item_num = half_item_num - 1;
-		}
-	}
+	return data->content + idx * (data->key_size + data->value_size)
+		+ data->key_size;
+}
 
-	if (comp_res < 0)
-		*found_idx = (mid - content) / item_size;
-	else
-		*found_idx = (low - content) / item_size;
+/**
+ * @brief 返回数据结点上相邻两个 key 的间隔，用于结点内查找
+ *
+ */
+static inline int bp_data_node_key_stride(bp_data_node_t *data)
+{
+	if (BP_LAYOUT_SPLIT == data->common.layout)
+		return data->key_size;
 
-	return 0;
+	return data->key_size + data->value_size;
 }
 
 /**
- * @brief 在节点 content 的 item 列表中查找第一个 target
+ * @brief 返回内部结点上每个 key 实际保存的长度， BP_LAYOUT_PREFIX 的结点只保存后缀
  *
- * @param content 结点内容，可以是内部结点也可以是叶子结点
- * @param content_len 内容长度，这里需要传入的是实际已经插入的数据的长度，而不是全部长度
- * @param item_len content 中一个数据项的长度，对于内部结点，数据项内容为 ptr + key，
- *                 item_len 为 sizeof(ptr) + sizeof(key)，对于叶子结点，数据项内容
- *                 为 key + value， item_len 为 sizeof(key) + sizeof(value)
- * @param target 要查找的内容
- * @param target_size 要查找内容的长度
- * @param offset 要查找内容在 item 中的偏移量，内部结点的数据格式为 ptr + key，需要传入
- *               的查找偏移量为 sizeof(ptr)，叶子结点的数据格式为 key + value，需要传
- *               入的查找偏移量为 0
- * @param found_idx 如果找到了则返回找到的第一个数据的位置，否则返回第一个大于 target
- *                  的第一个数据的位置
- * @param compare 比较 key 值的函数
- * @return int 找到返回1，否则返回0
  */
-int bp_bi_search_first(
-	unsigned char *content,
-	int            content_len,
-	int            item_size,
-	unsigned char *target,
-	int            target_size,
-	int            offset,
-	bp_compare_f   compare,
-	int           *found_idx)
+static inline int bp_inner_node_key_len(bp_inner_node_t *inner)
 {
-	int found;
-
-	compare = compare ? compare : bp_compare;
+	return inner->key_size - inner->prefix_len;
+}
 
-	found = bp_bi_search_one(content, content_len, item_size, target,
-							 target_size, offset, compare, found_idx);
+/**
+ * @brief 返回 BP_LAYOUT_PREFIX 的内部结点上第一个 P|S 的位置
+ *
+ */
+static inline unsigned char *bp_inner_node_slots(bp_inner_node_t *inner)
+{
+	return inner->content + bp_inner_node_prefix_area(inner->key_size);
+}
 
-	if (0 == found)
-		return 0;
+/**
+ * @brief 返回内部结点上第 idx 个 key 的位置， BP_LAYOUT_PREFIX 的结点上是后缀的位置
+ *
+ */
+static inline unsigned char *bp_inner_node_key(bp_inner_node_t *inner, int idx)
+{
+	if (BP_LAYOUT_SPLIT == inner->common.layout)
+		return inner->content + (inner->common.max_key_num + 1)
+			* sizeof(bp_node_t *) + idx * inner->key_size;
 
-	while (*found_idx > 0)
-		if (0 == compare(content + (*found_idx - 1) * item_size + offset,
-							target, target_size))
-			*found_idx = *found_idx - 1;
-		else
-			break;
+	if (BP_LAYOUT_PREFIX == inner->common.layout)
+		return bp_inner_node_slots(inner) + idx * (sizeof(bp_node_t *)
+			+ bp_inner_node_key_len(inner)) + sizeof(bp_node_t *);
 
-	return 1;
+	return inner->content + idx * (sizeof(bp_node_t *) + inner->key_size)
+		+ sizeof(bp_node_t *);
 }
 
 /**
- * @brief 在节点 content 的 item 列表中查找最后一个 target
+ * @brief 返回内部结点上保存第 idx 个子结点指针的位置
  *
- * @param content 结点内容，可以是内部结点也可以是叶子结点
- * @param content_len 内容长度，这里需要传入的是实际已经插入的数据的长度，而不是全部长度
- * @param item_len content 中一个数据项的长度，对于内部结点，数据项内容为 ptr + key，
- *                 item_len 为 sizeof(ptr) + sizeof(key)，对于叶子结点，数据项内容
- *                 为 key + value， item_len 为 sizeof(key) + sizeof(value)
- * @param target 要查找的内容
- * @param target_size 要查找内容的长度
- * @param offset 要查找内容在 item 中的偏移量，内部结点的数据格式为 ptr + key，需要传入
- *               的查找偏移量为 sizeof(ptr)，叶子结点的数据格式为 key + value，需要传
- *               入的查找偏移量为 0
- * @param compare 比较 key 值的函数
- * @param found_idx 如果找到了则返回找到的最后一个数据的位置，否则返回第一个大于 target
- *                  的第一个数据的位置
- * @return int 找到返回1，否则返回0
  */
-int bp_bi_search_last(
-	unsigned char *content,
-	int            content_len,
-	int            item_size,
-	unsigned char *target,
-	int            target_size,
-	int            offset,
-	bp_compare_f   compare,
-	int           *found_idx)
+static inline bp_node_t **bp_inner_node_child_pos(bp_inner_node_t *inner, int idx)
 {
-	int found;
-
-	compare = compare ? compare : bp_compare;
-	found = bp_bi_search_one(content, content_len, item_size, target,
-							 target_size, offset, compare, found_idx);
+	if (BP_LAYOUT_SPLIT == inner->common.layout)
+		return (bp_node_t **)(inner->content + idx * sizeof(bp_node_t *));
 
-	if (0 == found)
-		return 0;
-
-	while (*found_idx < content_len / item_size - 1)
-		if (0 == compare(content + (*found_idx + 1) * item_size + offset,
-							target, target_size))
-			*found_idx = *found_idx + 1;
-		else
-			break;
+	if (BP_LAYOUT_PREFIX == inner->common.layout)
+		return (bp_node_t **)(bp_inner_node_slots(inner)
+			+ idx * (sizeof(bp_node_t *) + bp_inner_node_key_len(inner)));
 
-	return 1;
+	return (bp_node_t **)(inner->content
+		+ idx * (sizeof(bp_node_t *) + inner->key_size));
 }
 
+#define bp_inner_node_get_child(_inner, _idx) \
+	(*bp_inner_node_child_pos((_inner), (_idx)))
+
 /**
- * @brief 数据结点是否需要分裂
+ * @brief 返回内部结点上相邻两个 key 的间隔，用于结点内查找
  *
- * @param data 数据结点
- * @return int 需要分裂返回 1 ，否则返回 0
  */
-int bp_data_node_need_split(bp_data_node_t *data)
+static inline int bp_inner_node_key_stride(bp_inner_node_t *inner)
 {
-	return data->common.key_num >= data->common.max_key_num;
+	if (BP_LAYOUT_SPLIT == inner->common.layout)
+		return inner->key_size;
+
+	return sizeof(bp_node_t *) + bp_inner_node_key_len(inner);
 }
 
 /**
- * @brief 从数据结点的 content 上找到日后的 pnext 的保存位置
+ * @brief 返回 BP_LAYOUT_PREFIX 的内部结点在前缀长度为 prefix_len 时最多可以保存的
+ *        key 的个数
  *
- * @param data 数据结点
- * @return data 的 content 上保存 pnext 的地方
+ * @details
+ *  分裂出的两个结点都要能在没有前缀时保存下来，所以不超过创建时指定个数的两倍减二
+ *
+ * @param inner 内部结点
+ * @param prefix_len 前缀的长度
+ * @return int key 的最大个数
  */
-bp_data_node_t **bp_data_node_get_pnext_save_position(bp_data_node_t *data)
+static int bp_inner_node_capacity(bp_inner_node_t *inner, int prefix_len)
 {
-	return (bp_data_node_t **)(data->content + data->content_len
-		- sizeof(bp_data_node_t *));
+	int avail;
+	int limit;
+	int num;
+
+	avail = inner->content_len - bp_inner_node_prefix_area(inner->key_size);
+	limit = avail / (int)(sizeof(bp_node_t *) + inner->key_size);
+	limit = limit > 2 ? 2 * limit - 2 : limit;
+	num   = avail / (int)(sizeof(bp_node_t *) + inner->key_size - prefix_len);
+
+	return num < limit ? num : limit;
 }
 
 /**
- * @brief 返回 data 结点的 pnext 值
+ * @brief 返回内部结点创建时指定的 key 的最大个数，分裂时新结点也按这个个数创建
  *
- * @param data 数据结点
- * @return data 结点的 pnext 值
  */
-bp_data_node_t *bp_data_node_get_pnext(bp_data_node_t *data)
+static int bp_inner_node_nominal_num(bp_inner_node_t *inner)
 {
-	return *bp_data_node_get_pnext_save_position(data);
+	if (BP_LAYOUT_PREFIX == inner->common.layout)
+		return bp_inner_node_capacity(inner, 0);
+
+	return inner->common.max_key_num;
 }
 
 /**
- * @brief 设置 data 结点的 pnext 值
+ * @brief 计算两段数据相同的前缀的长度
  *
- * @param data 数据结点
- * @param pnext 要设置的值
+ * @param a 第一段数据
+ * @param b 第二段数据
+ * @param len 最多比较的长度
+ * @return int 相同的前缀的长度
  */
-void bp_data_node_set_pnext(bp_data_node_t *data, bp_data_node_t *pnext)
+static int bp_common_prefix_len(
+	const unsigned char *a,
+	const unsigned char *b,
+	int                  len)
 {
-	bp_data_node_t **pp_next;
+	int i;
 
-	pp_next = bp_data_node_get_pnext_save_position(data);
+	for (i = 0; i < len && a[i] == b[i]; i++)
+		;
+
+	return i;
+}
+
+/**
+ * @brief 把 src 上第 src_idx 个 key 写到 BP_LAYOUT_PREFIX 的 dst 上第 dst_idx 个 key
+ *        的位置，两个结点的前缀长度可以不同
+ *
+ * @details
+ *  dst 的前缀必须也是这个 key 的前缀。 src 和 dst 是同一个结点时直接复制后缀
+ *
+ * @param dst 目标结点
+ * @param dst_idx 目标结点上的下标
+ * @param src 源结点
+ * @param src_idx 源结点上的下标
+ */
+static void bp_inner_node_copy_key(
+	bp_inner_node_t *dst,
+	int              dst_idx,
+	bp_inner_node_t *src,
+	int              src_idx)
+{
+	unsigned char *to;
+	unsigned char *from;
+	int            gap;
+
+	to   = bp_inner_node_key(dst, dst_idx);
+	from = bp_inner_node_key(src, src_idx);
+	if (dst->prefix_len >= src->prefix_len) {
+		memmove(to, from + dst->prefix_len - src->prefix_len,
+				bp_inner_node_key_len(dst));
+
+		return;
+	}
+
+	// dst 的后缀更长，前面的部分在 src 的前缀上
+	gap = src->prefix_len - dst->prefix_len;
+	memcpy(to, src->content + dst->prefix_len, gap);
+	memcpy(to + gap, from, bp_inner_node_key_len(src));
+}
+
+/**
+ * @brief 把 src 上从 src_idx 开始的 num 个数据项移动到 dst 上从 dst_idx 开始的位置
+ *
+ * @details
+ *  src 和 dst 是同一个结点时移动的范围可以重叠。两个结点的类型和排列方式必须相同，
+ *  BP_LAYOUT_SPLIT 的结点需要分别移动 key 和 value （或者子结点指针）。 BP_LAYOUT_PREFIX
+ *  的内部结点之间移动时 dst 的前缀必须是所有移动的 key 的前缀
+ *
+ * @param dst 目标结点
+ * @param dst_idx 目标结点上的下标
+ * @param src 源结点
+ * @param src_idx 源结点上的下标
+ * @param num 数据项的个数
+ */
+static void bp_node_move_items(
+	bp_node_t *dst,
+	int        dst_idx,
+	bp_node_t *src,
+	int        src_idx,
+	int        num)
+{
+	bp_data_node_t  *dst_data;
+	bp_data_node_t  *src_data;
+	bp_inner_node_t *dst_inner;
+	bp_inner_node_t *src_inner;
+	int              i;
+
+	if (num <= 0)
+		return;
+
+	if (BP_NODE_TYPE_DATA == dst->type) {
+		dst_data = (bp_data_node_t *)dst;
+		src_data = (bp_data_node_t *)src;
+		BP_STAT_ADD(move_bytes,
+					num * (dst_data->key_size + dst_data->value_size));
+		if (BP_LAYOUT_SPLIT == dst_data->common.layout) {
+			memmove(bp_data_node_key(dst_data, dst_idx),
+					bp_data_node_key(src_data, src_idx),
+					num * dst_data->key_size);
+			memmove(bp_data_node_value(dst_data, dst_idx),
+					bp_data_node_value(src_data, src_idx),
+					num * dst_data->value_size);
+		} else {
+			memmove(bp_data_node_key(dst_data, dst_idx),
+					bp_data_node_key(src_data, src_idx),
+					num * (dst_data->key_size + dst_data->value_size));
+		}
+
+		return;
+	}
+
+	dst_inner = (bp_inner_node_t *)dst;
+	src_inner = (bp_inner_node_t *)src;
+	BP_STAT_ADD(move_bytes, num * bp_inner_node_key_stride(dst_inner));
+	if (BP_LAYOUT_PREFIX == dst_inner->common.layout && dst != src) {
+		// 两个结点的前缀长度可能不同，每个 key 都要重新按 dst 的前缀保存
+		for (i = 0; i < num; i++) {
+			*bp_inner_node_child_pos(dst_inner, dst_idx + i) =
+				bp_inner_node_get_child(src_inner, src_idx + i);
+			bp_inner_node_copy_key(dst_inner, dst_idx + i, src_inner,
+								   src_idx + i);
+		}
+	} else if (BP_LAYOUT_SPLIT == dst_inner->common.layout) {
+		memmove(bp_inner_node_child_pos(dst_inner, dst_idx),
+				bp_inner_node_child_pos(src_inner, src_idx),
+				num * sizeof(bp_node_t *));
+		memmove(bp_inner_node_key(dst_inner, dst_idx),
+				bp_inner_node_key(src_inner, src_idx),
+				num * dst_inner->key_size);
+	} else {
+		memmove(bp_inner_node_child_pos(dst_inner, dst_idx),
+				bp_inner_node_child_pos(src_inner, src_idx),
+				num * bp_inner_node_key_stride(dst_inner));
+	}
+}
+
+/**
+ * @brief 把 K|V 数组中的 num 个数据项复制到数据结点上从 idx 开始的位置
+ *
+ * @param data 数据结点
+ * @param idx 数据结点上的下标
+ * @param items K|V 数组
+ * @param num 数据项的个数
+ */
+static void bp_data_node_put_items(
+	bp_data_node_t *data,
+	int             idx,
+	unsigned char  *items,
+	int             num)
+{
+	int item_size;
+	int i;
+
+	item_size = data->key_size + data->value_size;
+	if (BP_LAYOUT_SPLIT != data->common.layout) {
+		memcpy(bp_data_node_key(data, idx), items, num * item_size);
+
+		return;
+	}
+
+	for (i = 0; i < num; i++) {
+		memcpy(bp_data_node_key(data, idx + i), items + i * item_size,
+			   data->key_size);
+		memcpy(bp_data_node_value(data, idx + i),
+			   items + i * item_size + data->key_size, data->value_size);
+	}
+}
+
+/**
+ * @brief 当前线程正在执行写操作的并发模式的B+树，不是并发模式时为 NULL
+ */
+static __thread bp_sync_t *bp_write_sync;
+
+/**
+ * @brief 当前线程正在执行写操作的B+树，修改或者新建的结点记下这棵树当前的代数，
+ *        分裂结点时读取 split_fill 并统计分裂次数。结点的回调拿不到所属的B+树，
+ *        直接调用结点的插入函数时为 NULL
+ */
+static __thread bp_tree_t *bp_write_tree;
+
+/**
+ * @brief 写操作修改结点之前给结点加写锁，只有并发模式的写操作中才需要
+ *
+ * @details
+ *  所有的写操作在修改结点之前都会调用，所以同时在结点上记下修改时的代数
+ *
+ * @param node 要修改的结点
+ */
+static void bp_node_write_lock(bp_node_t *node)
+{
+	bp_node_common_t *common;
+
+	common = (bp_node_common_t *)node;
+	if (bp_write_tree)
+		common->generation = bp_write_tree->generation;
+
+	// 写时复制模式下写操作修改的都是自己复制出来的结点，查找看不到，不需要加锁
+	if (NULL == bp_write_sync || bp_write_sync->cow)
+		return;
+
+	if (common->version & BP_VERSION_LOCKED)
+		return;
+
+	// 版本号先变成加锁的状态，之后对结点的修改才可以被查找看到
+	__atomic_store_n(&common->version, common->version | BP_VERSION_LOCKED,
+					 __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	common->latch_next     = bp_write_sync->latched;
+	bp_write_sync->latched = common;
+}
+
+/**
+ * @brief 在结点上记下修改时的代数，用于只更新 key_total 、不需要加锁的内部结点
+ *
+ * @param node 要修改的结点
+ */
+static inline void bp_node_touch(bp_node_t *node)
+{
+	if (bp_write_tree)
+		((bp_node_common_t *)node)->generation = bp_write_tree->generation;
+}
+
+/**
+ * @brief 释放当前写操作加的所有写锁，已经从树上删除的结点放到等待释放的链表上
+ *
+ * @param sync 读写同步信息
+ */
+static void bp_sync_write_release(bp_sync_t *sync)
+{
+	bp_node_common_t *common;
+	bp_node_common_t *next;
+
+	// 写时复制模式下没有加锁的结点，写操作结束时才发布修改
+	if (sync->cow)
+		return;
+
+	for (common = sync->latched; common; common = next) {
+		next = common->latch_next;
+		if (common->version & BP_VERSION_OBSOLETE) {
+			// 查找还要用版本号判断结点已经删除，删除时的 epoch 记在 generation 上
+			common->generation = sync->epoch;
+			common->latch_next = sync->retired;
+			sync->retired      = common;
+
+			continue;
+		}
+
+		__atomic_store_n(&common->version,
+						 (common->version & ~(BP_VERSION_STEP - 1))
+						 + BP_VERSION_STEP, __ATOMIC_RELEASE);
+	}
+
+	sync->latched = NULL;
+}
+
+static bp_node_t *bp_node_copy(bp_node_t *node);
+static void bp_node_dealloc(bp_node_t *node);
+
+/**
+ * @brief 开始一次写操作，并发模式下等待其它写操作完成，写时复制模式下复制根结点
+ *
+ * @param tree B+树
+ * @return int 成功返回 0 ，复制根结点失败返回 -1
+ */
+static int bp_sync_write_begin(bp_tree_t *tree)
+{
+	bp_node_t *root;
+
+	if (NULL == tree->sync) {
+		bp_write_tree = tree;
+
+		return 0;
+	}
+
+	pthread_mutex_lock(&tree->sync->write_lock);
+	bp_write_sync = tree->sync;
+	bp_write_tree = tree;
+	if (!tree->sync->cow)
+		return 0;
+
+	root = bp_node_copy(tree->head);
+	if (NULL == root) {
+		bp_write_sync = NULL;
+		bp_write_tree = NULL;
+		pthread_mutex_unlock(&tree->sync->write_lock);
+
+		return -1;
+	}
+
+	bp_node_free(tree->head);
+	tree->head = root;
+
+	return 0;
+}
+
+/**
+ * @brief 释放所有读者都已经看不到的结点
+ *
+ * @details
+ *  读者先记下 epoch 再读取根结点，写操作先把结点从树上摘下（写时复制模式下是先发布
+ *  root ）再把 epoch 加一，所以 epoch 比结点删除时的 epoch 大的读者一定访问不到它
+ *
+ * @param sync 读写同步信息
+ */
+static void bp_epoch_reclaim(bp_sync_t *sync)
+{
+	bp_node_common_t  *common;
+	bp_node_common_t **prev;
+	uint64_t           min_epoch;
+	uint64_t           epoch;
+	int                i;
+
+	if (NULL == sync->retired)
+		return;
+
+	min_epoch = UINT64_MAX;
+	for (i = 0; i < BP_EPOCH_SLOT_NUM; i++) {
+		epoch = __atomic_load_n(&sync->slots[i].epoch, __ATOMIC_SEQ_CST);
+		if (epoch && epoch < min_epoch)
+			min_epoch = epoch;
+	}
+
+	prev = &sync->retired;
+	while (*prev) {
+		common = *prev;
+		epoch = sync->cow ? common->version : common->generation;
+		if (epoch >= min_epoch) {
+			prev = &common->latch_next;
+
+			continue;
+		}
+
+		*prev = common->latch_next;
+		bp_node_dealloc((bp_node_t *)common);
+	}
+}
+
+/**
+ * @brief 结束一次写操作，释放所有的写锁，写时复制模式下发布新的根结点
+ *
+ * @param tree B+树
+ */
+static void bp_sync_write_end(bp_tree_t *tree)
+{
+	bp_sync_t *sync;
+
+	bp_write_tree = NULL;
+	sync          = tree->sync;
+	if (NULL == sync)
+		return;
+
+	if (sync->cow)
+		__atomic_store_n(&sync->root, tree->head, __ATOMIC_SEQ_CST);
+	else
+		bp_sync_write_release(sync);
+
+	__atomic_add_fetch(&sync->epoch, 1, __ATOMIC_SEQ_CST);
+	bp_epoch_reclaim(sync);
+
+	bp_write_sync = NULL;
+	pthread_mutex_unlock(&sync->write_lock);
+}
+
+/**
+ * @brief 查找读取结点之前获取结点的版本号
+ *
+ * @param node 结点
+ * @return uint64_t 版本号
+ */
+static inline uint64_t bp_node_read_begin(bp_node_t *node)
+{
+	return __atomic_load_n(&((bp_node_common_t *)node)->version,
+						   __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief 检查查找读取结点期间结点是否被修改过
+ *
+ * @param node 结点
+ * @param version bp_node_read_begin 返回的版本号
+ * @return int 没有被修改过返回 1 ，否则返回 0
+ */
+static inline int bp_node_read_validate(bp_node_t *node, uint64_t version)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return 0 == (version & (BP_VERSION_LOCKED | BP_VERSION_OBSOLETE))
+		&& version == __atomic_load_n(&((bp_node_common_t *)node)->version,
+									  __ATOMIC_RELAXED);
+}
+
+static int bp_compare(unsigned char *a, unsigned char *b, int size)
+{
+	return memcmp(a, b, size);
+}
+
+/**
+ * @brief 比较两个 key 值，没有指定比较函数时直接使用 memcmp ，避免经过函数指针调用
+ *
+ * @param compare 比较 key 值的函数，可以为 NULL
+ * @param a 要比较的 key
+ * @param b 要比较的 key
+ * @param size key 的长度
+ * @return int 同 memcmp
+ */
+static inline int bp_key_compare(
+	bp_compare_f   compare,
+	unsigned char *a,
+	unsigned char *b,
+	int            size)
+{
+	if (NULL == compare)
+		return memcmp(a, b, size);
+
+	return compare(a, b, size);
+}
+
+/**
+ * @brief 根据比较函数和 key 的长度选择结点内查找时比较 key 值的方式
+ *
+ * @param compare 比较 key 值的函数
+ * @param key_size 被索引项的数据长度
+ * @return bp_key_type_e 比较 key 值的方式
+ */
+static bp_key_type_e bp_select_key_type(bp_compare_f compare, int key_size)
+{
+	if (compare)
+		return BP_KEY_TYPE_COMPARE;
+
+	switch (key_size) {
+	case 4:
+		return BP_KEY_TYPE_BE32;
+	case 8:
+		return BP_KEY_TYPE_BE64;
+	case 16:
+		return BP_KEY_TYPE_BE128;
+	default:
+		return BP_KEY_TYPE_COMPARE;
+	}
+}
+
+/**
+ * @brief 16 字节的 key 按大端读取后的值
+ */
+typedef struct bp_be128 {
+	uint64_t high;
+	uint64_t low;
+} bp_be128_t;
+
+static inline uint32_t bp_load_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+		| ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t bp_load_be64(const unsigned char *p)
+{
+	return ((uint64_t)bp_load_be32(p) << 32) | bp_load_be32(p + 4);
+}
+
+static inline bp_be128_t bp_load_be128(const unsigned char *p)
+{
+	bp_be128_t v;
+
+	v.high = bp_load_be64(p);
+	v.low  = bp_load_be64(p + 8);
+
+	return v;
+}
+
+#define bp_lt_scalar(_a, _b) ((_a) < (_b))
+#define bp_le_scalar(_a, _b) ((_a) <= (_b))
+#define bp_lt_be128(_a, _b) \
+	((_a).high < (_b).high || ((_a).high == (_b).high && (_a).low < (_b).low))
+#define bp_le_be128(_a, _b) \
+	((_a).high < (_b).high || ((_a).high == (_b).high && (_a).low <= (_b).low))
+
+/**
+ * @brief 没有 SIMD 实现的 key 类型使用的统计函数， window 为 1 时不会被调用
+ */
+#define bp_count_none(_base, _num, _stride, _key, _or_equal) 0
+
+/**
+ * @brief 4 、 8 字节的 key 在 CPU 支持 SIMD 时二分查找缩小到的数据项个数
+ */
+#define bp_simd_window() (BP_SIMD_NONE == bp_simd_get_level() ? 1 : BP_SIMD_WINDOW)
+
+/**
+ * @brief 生成定长 key 的结点内查找函数
+ *
+ * @details
+ *  生成的函数返回第一个使 _before(item, target) 不成立的数据项的下标，每次循环只根据
+ *  比较结果移动下界，编译器可以生成没有分支的代码。剩下的数据项不超过 _window 个时，
+ *  用 _count 一次统计其中使 _before 成立的数据项的个数
+ */
+#define BP_DEFINE_FIXED_BOUND(_name, _type, _load, _before, _window, _count,  \
+							  _or_equal)                                     \
+static inline int _name(                                                     \
+	unsigned char *content,                                                  \
+	int            item_num,                                                 \
+	int            item_size,                                                \
+	unsigned char *target,                                                   \
+	int            offset)                                                   \
+{                                                                            \
+	_type          key;                                                      \
+	_type          item;                                                     \
+	unsigned char *base;                                                     \
+	int            window;                                                   \
+	int            low;                                                      \
+	int            half;                                                     \
+                                                                             \
+	if (0 == item_num)                                                       \
+		return 0;                                                            \
+                                                                             \
+	key    = _load(target);                                                  \
+	base   = content + offset;                                               \
+	window = _window;                                                        \
+	low    = 0;                                                              \
+	while (item_num > window) {                                              \
+		half      = item_num / 2;                                            \
+		item      = _load(base + (low + half) * item_size);                  \
+		low      += _before(item, key) ? half : 0;                           \
+		item_num -= half;                                                    \
+	}                                                                        \
+                                                                             \
+	if (item_num > 1)                                                        \
+		return low + _count(base + low * item_size, item_num, item_size,     \
+							key, _or_equal);                                 \
+                                                                             \
+	item = _load(base + low * item_size);                                    \
+                                                                             \
+	return low + (_before(item, key) ? 1 : 0);                               \
+}
+
+BP_DEFINE_FIXED_BOUND(bp_lower_bound_be32, uint32_t, bp_load_be32, bp_lt_scalar,
+					  bp_simd_window(), bp_simd_count_be32, 0)
+BP_DEFINE_FIXED_BOUND(bp_upper_bound_be32, uint32_t, bp_load_be32, bp_le_scalar,
+					  bp_simd_window(), bp_simd_count_be32, 1)
+BP_DEFINE_FIXED_BOUND(bp_lower_bound_be64, uint64_t, bp_load_be64, bp_lt_scalar,
+					  bp_simd_window(), bp_simd_count_be64, 0)
+BP_DEFINE_FIXED_BOUND(bp_upper_bound_be64, uint64_t, bp_load_be64, bp_le_scalar,
+					  bp_simd_window(), bp_simd_count_be64, 1)
+BP_DEFINE_FIXED_BOUND(bp_lower_bound_be128, bp_be128_t, bp_load_be128,
+					  bp_lt_be128, 1, bp_count_none, 0)
+BP_DEFINE_FIXED_BOUND(bp_upper_bound_be128, bp_be128_t, bp_load_be128,
+					  bp_le_be128, 1, bp_count_none, 1)
+
+/**
+ * @brief 在 content 的 item 列表中查找第一个大于等于 target 的数据项
+ *
+ * @details
+ *  与 bp_bi_search_first 不同，这里不会对相同的 key 做线性查找，并且定长的 key 会按
+ *  整数比较，没有指定比较函数时也不会经过函数指针调用，用于查找路径
+ *
+ * @param content 结点内容
+ * @param item_num content 中有效数据项的个数
+ * @param item_size content 中一个数据项的长度
+ * @param target 要查找的内容
+ * @param target_size 要查找内容的长度
+ * @param offset 要查找内容在 item 中的偏移量
+ * @param compare 比较 key 值的函数，可以为 NULL
+ * @param key_type 比较 key 值的方式
+ * @return int 第一个大于等于 target 的数据项的下标，都小于 target 时返回 item_num
+ */
+static inline int bp_lower_bound(
+	unsigned char *content,
+	int            item_num,
+	int            item_size,
+	unsigned char *target,
+	int            target_size,
+	int            offset,
+	bp_compare_f   compare,
+	bp_key_type_e  key_type)
+{
+	int low;
+	int high;
+	int mid;
+
+	BP_STAT_ADD(probe_num, 1);
+	switch (key_type) {
+	case BP_KEY_TYPE_BE32:
+		return bp_lower_bound_be32(content, item_num, item_size, target, offset);
+	case BP_KEY_TYPE_BE64:
+		return bp_lower_bound_be64(content, item_num, item_size, target, offset);
+	case BP_KEY_TYPE_BE128:
+		return bp_lower_bound_be128(content, item_num, item_size, target,
+									offset);
+	default:
+		break;
+	}
+
+	low  = 0;
+	high = item_num;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (bp_key_compare(compare, content + mid * item_size + offset,
+						   target, target_size) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/**
+ * @brief 在 content 的 item 列表中查找第一个大于 target 的数据项
+ *
+ * @param content 结点内容
+ * @param item_num content 中有效数据项的个数
+ * @param item_size content 中一个数据项的长度
+ * @param target 要查找的内容
+ * @param target_size 要查找内容的长度
+ * @param offset 要查找内容在 item 中的偏移量
+ * @param compare 比较 key 值的函数，可以为 NULL
+ * @param key_type 比较 key 值的方式
+ * @return int 第一个大于 target 的数据项的下标，都不大于 target 时返回 item_num
+ */
+static inline int bp_upper_bound(
+	unsigned char *content,
+	int            item_num,
+	int            item_size,
+	unsigned char *target,
+	int            target_size,
+	int            offset,
+	bp_compare_f   compare,
+	bp_key_type_e  key_type)
+{
+	int low;
+	int high;
+	int mid;
+
+	BP_STAT_ADD(probe_num, 1);
+	switch (key_type) {
+	case BP_KEY_TYPE_BE32:
+		return bp_upper_bound_be32(content, item_num, item_size, target, offset);
+	case BP_KEY_TYPE_BE64:
+		return bp_upper_bound_be64(content, item_num, item_size, target, offset);
+	case BP_KEY_TYPE_BE128:
+		return bp_upper_bound_be128(content, item_num, item_size, target,
+									offset);
+	default:
+		break;
+	}
+
+	low  = 0;
+	high = item_num;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (bp_key_compare(compare, content + mid * item_size + offset,
+						   target, target_size) <= 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/**
+ * @brief 在 content 的 item 列表中查找最后一个等于 target 的数据项，和
+ *        bp_bi_search_last 的结果相同，用于插入路径
+ *
+ * @param content 结点内容
+ * @param item_num content 中有效数据项的个数
+ * @param item_size content 中一个数据项的长度
+ * @param target 要查找的内容
+ * @param target_size 要查找内容的长度
+ * @param offset 要查找内容在 item 中的偏移量
+ * @param compare 比较 key 值的函数，可以为 NULL
+ * @param key_type 比较 key 值的方式
+ * @param found_idx 如果找到了则返回找到的最后一个数据的位置，否则返回第一个大于
+ *                  target 的数据的位置
+ * @return int 找到返回 1 ，否则返回 0
+ */
+static inline int bp_search_last(
+	unsigned char *content,
+	int            item_num,
+	int            item_size,
+	unsigned char *target,
+	int            target_size,
+	int            offset,
+	bp_compare_f   compare,
+	bp_key_type_e  key_type,
+	int           *found_idx)
+{
+	int idx;
+
+	idx = bp_upper_bound(content, item_num, item_size, target, target_size,
+						 offset, compare, key_type);
+	if (idx > 0 && 0 == bp_key_compare(compare,
+									   content + (idx - 1) * item_size + offset,
+									   target, target_size)) {
+		*found_idx = idx - 1;
+
+		return 1;
+	}
+
+	*found_idx = idx;
+
+	return 0;
+}
+
+/**
+ * @brief Eytzinger 顺序的查找每次预取的 key 在几层之后
+ *
+ * @details
+ *  第 k 个 key 的第 4 层子结点是第 16k 到 16k+15 个 key ，四字节的 key 正好在同一个
+ *  缓存行上，预取的缓存行在四次比较之后用到
+ */
+#define BP_EYTZINGER_PREFETCH 16
+
+/**
+ * @brief 计算 key_num 个 key 的 Eytzinger 顺序上第 k 个位置按中序遍历的下标
+ *
+ * @details
+ *  先按补满最后一层的完全二叉树计算中序下标 r ：深度为 d 的结点是这一层第
+ *  k - 2^d 个，下标为 (2(k - 2^d) + 1) * 2^(h-d) - 1 ，其中 h 为最后一层的深度。
+ *  最后一层实际只有前 last 个位置，中序下标在 r 之前的最后一层的位置有
+ *  ceil(r / 2) 个，其中不存在的要减掉。不需要额外保存每个位置的下标，查找时不会
+ *  多访问一个缓存行
+ *
+ * @param k Eytzinger 位置，为 0 时表示所有的 key 都小于要查找的 key
+ * @param key_num key 的个数
+ * @return int 中序遍历的下标，也就是数据项在结点上的下标， k 为 0 时返回 key_num
+ */
+static inline int bp_eytzinger_rank(int k, int key_num)
+{
+	int height;
+	int depth;
+	int last;
+	int r;
+
+	if (0 == k)
+		return key_num;
+
+	height = 31 - __builtin_clz(key_num);
+	depth  = 31 - __builtin_clz(k);
+	last   = key_num - (1 << height) + 1;
+	r      = ((2 * (k - (1 << depth)) + 1) << (height - depth)) - 1;
+	if ((r + 1) / 2 > last)
+		r -= (r + 1) / 2 - last;
+
+	return r;
+}
+
+/**
+ * @brief 生成定长 key 在 Eytzinger 顺序的 key 上查找第一个大于等于 target 的 key 的
+ *        函数
+ *
+ * @details
+ *  keys 上第 k 个 key 的两个子结点是第 2k 和第 2k+1 个 key ，第 0 个不使用。每次循环
+ *  只根据比较结果选择子结点，没有分支；循环结束时 k 的二进制去掉最后一次向左之后的
+ *  向右就是第一个大于等于 target 的 key ，都小于 target 时为 0
+ */
+#define BP_DEFINE_EYTZINGER_BOUND(_name, _type, _load, _before)               \
+static inline int _name(                                                     \
+	unsigned char *items,                                                    \
+	int            item_num,                                                 \
+	int            item_size,                                                \
+	unsigned char *target)                                                   \
+{                                                                            \
+	_type key;                                                               \
+	int   k;                                                                 \
+                                                                             \
+	key = _load(target);                                                     \
+	k   = 1;                                                                 \
+	while (k <= item_num) {                                                  \
+		bp_prefetch(items + k * BP_EYTZINGER_PREFETCH * item_size);          \
+		k = 2 * k + (_before(_load(items + k * item_size), key) ? 1 : 0);    \
+	}                                                                        \
+                                                                             \
+	return k >> __builtin_ffs(~k);                                           \
+}
+
+BP_DEFINE_EYTZINGER_BOUND(bp_eytzinger_bound_be32, uint32_t, bp_load_be32,
+						  bp_lt_scalar)
+BP_DEFINE_EYTZINGER_BOUND(bp_eytzinger_bound_be64, uint64_t, bp_load_be64,
+						  bp_lt_scalar)
+BP_DEFINE_EYTZINGER_BOUND(bp_eytzinger_bound_be128, bp_be128_t, bp_load_be128,
+						  bp_lt_be128)
+
+/**
+ * @brief 使用比较函数在 Eytzinger 顺序的 key 上查找第一个大于等于 target 的 key
+ *
+ * @return int 第一个大于等于 target 的 key 的 Eytzinger 位置，都小于 target 时为 0
+ */
+static inline int bp_eytzinger_bound(
+	unsigned char *items,
+	int            item_num,
+	int            item_size,
+	unsigned char *target,
+	int            key_size,
+	bp_compare_f   compare)
+{
+	int k;
+
+	k = 1;
+	while (k <= item_num) {
+		bp_prefetch(items + k * BP_EYTZINGER_PREFETCH * item_size);
+		k = 2 * k + (bp_key_compare(compare, items + k * item_size, target,
+									key_size) < 0 ? 1 : 0);
+	}
+
+	return k >> __builtin_ffs(~k);
+}
+
+/**
+ * @brief 在冻结的数据结点的 Eytzinger 顺序的 key 上查找第一个大于等于 key 的数据项
+ *
+ * @param data 冻结的数据结点
+ * @param key 被索引项
+ * @return int 数据项的 Eytzinger 位置，都小于 key 时返回 0
+ */
+static inline int bp_data_node_frozen_bound(bp_data_node_t *data, unsigned char *key)
+{
+	switch (data->common.key_type) {
+	case BP_KEY_TYPE_BE32:
+		return bp_eytzinger_bound_be32(data->frozen, data->common.key_num,
+									   data->key_size, key);
+	case BP_KEY_TYPE_BE64:
+		return bp_eytzinger_bound_be64(data->frozen, data->common.key_num,
+									   data->key_size, key);
+	case BP_KEY_TYPE_BE128:
+		return bp_eytzinger_bound_be128(data->frozen, data->common.key_num,
+										data->key_size, key);
+	default:
+		return bp_eytzinger_bound(data->frozen, data->common.key_num,
+								  data->key_size, key, data->key_size,
+								  data->common.compare);
+	}
+}
+
+/**
+ * @brief 在数据结点上查找第一个大于等于 key 的数据项，冻结的结点在 Eytzinger 顺序的
+ *        key 上查找
+ *
+ * @param data 数据结点
+ * @param key 被索引项
+ * @return int 第一个大于等于 key 的数据项的下标，都小于 key 时返回 key_num
+ */
+static inline int bp_data_node_lower_bound(bp_data_node_t *data, unsigned char *key)
+{
+	if (NULL == data->frozen)
+		return bp_lower_bound(data->content, data->common.key_num,
+							  bp_data_node_key_stride(data), key, data->key_size,
+							  0, data->common.compare, data->common.key_type);
+
+	return bp_eytzinger_rank(bp_data_node_frozen_bound(data, key),
+							 data->common.key_num);
+}
+
+/**
+ * @brief 在节点 content 的 item 列表中查找 target
+ *
+ * @param content 结点内容，可以是内部结点也可以是叶子结点
+ * @param content_len 内容长度，这里需要传入的是实际已经插入的数据的长度，而不是全部长度
+ * @param item_len content 中一个数据项的长度，对于内部结点，数据项内容为 ptr + key，
+ *                 item_len 为 sizeof(ptr) + sizeof(key)，对于叶子结点，数据项内容
+ *                 为 key + value， item_len 为 sizeof(key) + sizeof(value)
+ * @param target 要查找的内容
+ * @param target_size 要查找内容的长度
+ * @param offset 要查找内容在 item 中的偏移量，内部结点的数据格式为 ptr + key，需要传入
+ *               的查找偏移量为 sizeof(ptr)，叶子结点的数据格式为 key + value，需要传
+ *               入的查找偏移量为 0
+ * @param compare 比较 key 值的函数
+ * @param found_idx 如果找到了则返回找到的位置，否则返回比 target 大的第一个值的位置
+ * @return int 找到返回1，否则返回0
+ */
+int bp_bi_search_one(
+	unsigned char *content,
+	int            content_len,
+	int            item_size,
+	unsigned char *target,
+	int            target_size,
+	int            offset,
+	bp_compare_f   compare,
+	int           *found_idx)
+{
+	int            item_num;
+	int            comp_res;
+	int            half_item_num;
+	unsigned char *low;
+	unsigned char *high;
+	unsigned char *mid;
+
+	if (0 == content_len) {
+		*found_idx = 0;
+
+		return 0;
+	}
+
+	compare = compare ? compare : bp_compare;
+	item_num = content_len / item_size;
+	low      = content;
+	high     = low + (item_num - 1) * item_size;
+	while (low <= high) {
+		half_item_num = (item_num) / 2;
+		half_item_num = half_item_num == 0 ? 1 : half_item_num;
+		mid           = low + (half_item_num - 1) * item_size;
+		comp_res      = compare(target, mid + offset, target_size);
+
+		if (0 == comp_res) {
+			*found_idx = (mid - content) / item_size;
+
+			return 1;
+		}
+
+		if (0 < comp_res) {
+			low      = mid + item_size;
+			item_num = item_num - half_item_num;
+		} else {
+			high     = mid - item_size;
+			item_num = half_item_num - 1;
+		}
+	}
+
+	if (comp_res < 0)
+		*found_idx = (mid - content) / item_size;
+	else
+		*found_idx = (low - content) / item_size;
+
+	return 0;
+}
+
+/**
+ * @brief 在节点 content 的 item 列表中查找第一个 target
+ *
+ * @param content 结点内容，可以是内部结点也可以是叶子结点
+ * @param content_len 内容长度，这里需要传入的是实际已经插入的数据的长度，而不是全部长度
+ * @param item_len content 中一个数据项的长度，对于内部结点，数据项内容为 ptr + key，
+ *                 item_len 为 sizeof(ptr) + sizeof(key)，对于叶子结点，数据项内容
+ *                 为 key + value， item_len 为 sizeof(key) + sizeof(value)
+ * @param target 要查找的内容
+ * @param target_size 要查找内容的长度
+ * @param offset 要查找内容在 item 中的偏移量，内部结点的数据格式为 ptr + key，需要传入
+ *               的查找偏移量为 sizeof(ptr)，叶子结点的数据格式为 key + value，需要传
+ *               入的查找偏移量为 0
+ * @param found_idx 如果找到了则返回找到的第一个数据的位置，否则返回第一个大于 target
+ *                  的第一个数据的位置
+ * @param compare 比较 key 值的函数
+ * @return int 找到返回1，否则返回0
+ */
+int bp_bi_search_first(
+	unsigned char *content,
+	int            content_len,
+	int            item_size,
+	unsigned char *target,
+	int            target_size,
+	int            offset,
+	bp_compare_f   compare,
+	int           *found_idx)
+{
+	int found;
+
+	compare = compare ? compare : bp_compare;
+
+	found = bp_bi_search_one(content, content_len, item_size, target,
+							 target_size, offset, compare, found_idx);
+
+	if (0 == found)
+		return 0;
+
+	while (*found_idx > 0)
+		if (0 == compare(content + (*found_idx - 1) * item_size + offset,
+							target, target_size))
+			*found_idx = *found_idx - 1;
+		else
+			break;
+
+	return 1;
+}
+
+/**
+ * @brief 在节点 content 的 item 列表中查找最后一个 target
+ *
+ * @param content 结点内容，可以是内部结点也可以是叶子结点
+ * @param content_len 内容长度，这里需要传入的是实际已经插入的数据的长度，而不是全部长度
+ * @param item_len content 中一个数据项的长度，对于内部结点，数据项内容为 ptr + key，
+ *                 item_len 为 sizeof(ptr) + sizeof(key)，对于叶子结点，数据项内容
+ *                 为 key + value， item_len 为 sizeof(key) + sizeof(value)
+ * @param target 要查找的内容
+ * @param target_size 要查找内容的长度
+ * @param offset 要查找内容在 item 中的偏移量，内部结点的数据格式为 ptr + key，需要传入
+ *               的查找偏移量为 sizeof(ptr)，叶子结点的数据格式为 key + value，需要传
+ *               入的查找偏移量为 0
+ * @param compare 比较 key 值的函数
+ * @param found_idx 如果找到了则返回找到的最后一个数据的位置，否则返回第一个大于 target
+ *                  的第一个数据的位置
+ * @return int 找到返回1，否则返回0
+ */
+int bp_bi_search_last(
+	unsigned char *content,
+	int            content_len,
+	int            item_size,
+	unsigned char *target,
+	int            target_size,
+	int            offset,
+	bp_compare_f   compare,
+	int           *found_idx)
+{
+	int found;
+
+	compare = compare ? compare : bp_compare;
+	found = bp_bi_search_one(content, content_len, item_size, target,
+							 target_size, offset, compare, found_idx);
+
+	if (0 == found)
+		return 0;
+
+	while (*found_idx < content_len / item_size - 1)
+		if (0 == compare(content + (*found_idx + 1) * item_size + offset,
+							target, target_size))
+			*found_idx = *found_idx + 1;
+		else
+			break;
+
+	return 1;
+}
+
+/**
+ * @brief 数据结点是否需要分裂
+ *
+ * @param data 数据结点
+ * @return int 需要分裂返回 1 ，否则返回 0
+ */
+int bp_data_node_need_split(bp_data_node_t *data)
+{
+	return data->common.key_num >= data->common.max_key_num;
+}
+
+/**
+ * @brief 从数据结点的 content 上找到日后的 pnext 的保存位置
+ *
+ * @param data 数据结点
+ * @return data 的 content 上保存 pnext 的地方
+ */
+bp_data_node_t **bp_data_node_get_pnext_save_position(bp_data_node_t *data)
+{
+	return (bp_data_node_t **)(data->content + data->content_len
+		- sizeof(bp_data_node_t *));
+}
+
+/**
+ * @brief 返回 data 结点的 pnext 值
+ *
+ * @param data 数据结点
+ * @return data 结点的 pnext 值
+ */
+bp_data_node_t *bp_data_node_get_pnext(bp_data_node_t *data)
+{
+	return *bp_data_node_get_pnext_save_position(data);
+}
+
+/**
+ * @brief 设置 data 结点的 pnext 值
+ *
+ * @param data 数据结点
+ * @param pnext 要设置的值
+ */
+void bp_data_node_set_pnext(bp_data_node_t *data, bp_data_node_t *pnext)
+{
+	bp_data_node_t **pp_next;
+
+	pp_next = bp_data_node_get_pnext_save_position(data);
 
 	*pp_next = pnext;
 }
 
 /**
- * @brief 数据结点分裂
+ * @brief 数据结点分裂
+ *
+ * @details
+ *  append 为 0 时两个结点各保存一半的数据。 append 不为 0 表示要插入的 key 不小于结点
+ *  上所有的 key ，此时旧结点保留所属的B+树的 split_fill 百分比的数据，单调递增的 key 顺序插入
+ *  时除了最后一个以外的数据结点都是接近满的，而不是只有一半
+ *
+ * @param to_split 要分裂的数据结点
+ * @param append 要插入的 key 是否不小于结点的最大值
+ * @param pp_new 分裂出的新结点
+ * @return int 分裂是否成功
+ */
+int bp_data_node_split(
+	bp_node_t  *to_split,
+	int         append,
+	bp_node_t **pp_new)
+{
+	bp_data_node_t *old;
+	bp_data_node_t *new;
+	int             old_data_num;
+	int             fill;
+
+	old = (bp_data_node_t *)to_split;
+	new = (bp_data_node_t *)bp_alloc_data_node(
+		old->common.allocator, old->common.layout, old->common.max_key_num,
+		old->common.min_key_num, old->key_size, old->value_size,
+		old->common.compare);
+	if (NULL == new) {
+		*pp_new = NULL;
+
+		return -1;
+	}
+
+	// 旧结点保存小的 1/2 数据，新结点保存大的 1/2 数据；在最大值之后追加时旧结点
+	// 最少保存一半，最多保存全部数据
+	fill = bp_write_tree ? bp_write_tree->split_fill : BP_SPLIT_FILL_DEFAULT;
+	old_data_num = old->common.key_num;
+	old->common.key_num = old_data_num / 2;
+	if (append && old_data_num * fill / 100 > old->common.key_num)
+		old->common.key_num = old_data_num * fill / 100;
+	new->common.key_num = old_data_num - old->common.key_num;
+
+	// 复制数据到新的结点
+	bp_node_move_items((bp_node_t *)new, 0, to_split, old->common.key_num,
+					   new->common.key_num);
+
+	// 新结点的 pnext 指向旧结点的 pnext，旧结点的 pnext 指向新结点
+	bp_data_node_set_pnext(new, bp_data_node_get_pnext(old));
+	bp_data_node_set_pnext(old, new);
+
+	if (bp_write_tree)
+		bp_write_tree->data_split_num += 1;
+
+	*pp_new = (bp_node_t *)new;
+
+	return 0;
+}
+
+/**
+ * @brief 插入被索引项和位置信息
+ *
+ * @param data 数据结点
+ * @param key 被索引项
+ * @param position 位置信息
+ * @param pp_new 如果 data 保存满了则进行结点分裂，返回分裂出的新结点
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+int bp_data_node_insert_data(
+	bp_node_t      *node,
+	unsigned char  *key,
+	unsigned char  *position,
+	bp_node_t     **pp_new)
+{
+	bp_data_node_t *data;
+	int             found;
+	int             found_idx;
+	int             cmp_res;
+	unsigned char  *max_key_of_data;
+	unsigned char  *min_key_of_new;
+
+	data    = (bp_data_node_t *)node;
+	*pp_new = NULL;
+
+	// 分裂出的结点在插入完成之前只能通过 pnext 访问到，所以只需要给 node 加锁
+	bp_node_write_lock(node);
+
+	if (bp_data_node_need_split(data)
+		&& -1 == bp_data_node_split(
+			node, 0 <= bp_key_compare(data->common.compare, key,
+									 bp_data_node_key(data, data->common.key_num - 1),
+									 data->key_size),
+			pp_new))
+		return -1;
+
+	// 如果分裂了，需要找出 key 值插入旧结点还是新结点
+	if (*pp_new) {
+		max_key_of_data = bp_data_node_key(data, data->common.key_num - 1);
+		cmp_res = bp_key_compare(data->common.compare, key, max_key_of_data,
+								 data->key_size);
+		if (0 < cmp_res || 0 == ((bp_data_node_t *)*pp_new)->common.key_num) {
+			// key 大于 max_key_of_data 时，或者追加时旧结点保留了全部数据，新 key
+			// 应该插入到分裂出的结点
+			data = (bp_data_node_t *)*pp_new;
+		} else if (0 == cmp_res) {
+			// 如果 data 存在相等的 key 值，且分裂点正好在相等的 key 值中间时
+			// 新 key 应该插入到分裂出的结点
+			min_key_of_new = bp_data_node_key((bp_data_node_t *)*pp_new, 0);
+			if (0 == bp_key_compare(data->common.compare, key, min_key_of_new,
+									data->key_size))
+				data = (bp_data_node_t *)*pp_new;
+		}
+	}
+
+	// 查找合适的位置插入，存在相同 key 值时，要确保 key 值要插入到相同 key 值的后面
+	found = bp_search_last(data->content, data->common.key_num,
+						   bp_data_node_key_stride(data), key, data->key_size, 0,
+						   data->common.compare, data->common.key_type,
+						   &found_idx);
+	if (found)
+		found_idx += 1;
+
+	// 向后移动数据，腾出 key position 的位置
+	bp_node_move_items((bp_node_t *)data, found_idx + 1, (bp_node_t *)data,
+					   found_idx, data->common.key_num - found_idx);
+
+	memcpy(bp_data_node_key(data, found_idx), key, data->key_size);
+	memcpy(bp_data_node_value(data, found_idx), position, data->value_size);
+
+	data->common.key_num += 1;
+
+	return 0;
+}
+
+/**
+ * @brief 返回数据结点中保存的最大 key 值，也就是最后一个 key
+ *
+ * @param node 数据结点
+ * @param key_buf 用于返回 key 值
+ * @param key_buf_len key_buf 的长度
+ * @return 如果数据结点是空的，返回 -1 ，否则返回 key_buf 上实际数据的长度
+ */
+int bp_data_node_max_key(
+	bp_node_t     *node,
+	unsigned char *key_buf,
+	int            key_buf_len)
+{
+	bp_data_node_t *data;
+	int             cp_len;
+
+	data = (bp_data_node_t *)node;
+	if (data->common.key_num <= 0)
+		return -1;
+
+	cp_len = key_buf_len < data->key_size ? key_buf_len : data->key_size;
+	memcpy(key_buf, bp_data_node_key(data, data->common.key_num - 1), cp_len);
+
+	return cp_len;
+}
+
+/**
+ * @brief 为结点分配内存
+ *
+ * @param allocator 分配器， NULL 表示使用 malloc
+ * @param size 结点的大小
+ * @return void* 分配的内存，失败返回 NULL
+ */
+static void *bp_node_alloc(bp_allocator_t *allocator, int size)
+{
+	if (NULL == allocator)
+		return malloc(size);
+
+	return allocator->alloc(allocator->ctx, size);
+}
+
+/**
+ * @brief 返回结点占用的内存大小
+ *
+ * @param node 内部结点或者数据结点
+ * @return int 结点的大小
+ */
+static int bp_node_get_size(bp_node_t *node)
+{
+	if (BP_NODE_TYPE_DATA == node->type)
+		return sizeof(bp_data_node_t) + ((bp_data_node_t *)node)->content_len;
+
+	return sizeof(bp_inner_node_t) + ((bp_inner_node_t *)node)->content_len;
+}
+
+/**
+ * @brief 把结点的内存还给分配结点的分配器
+ *
+ * @param node 要释放的结点
+ */
+void bp_node_free(bp_node_t *node)
+{
+	bp_node_common_t *common;
+
+	// 写时复制模式下旧的快照可能还在访问这个结点，记下当前的 epoch ，等到没有读者
+	// 能看到它时再释放
+	common = (bp_node_common_t *)node;
+	if (bp_write_sync && bp_write_sync->cow) {
+		common->version        = bp_write_sync->epoch;
+		common->latch_next     = bp_write_sync->retired;
+		bp_write_sync->retired = common;
+
+		return;
+	}
+
+	// 并发模式下可能还有查找在访问这个结点，等到没有查找能看到它时再释放
+	if (bp_write_sync) {
+		bp_node_write_lock(node);
+		__atomic_store_n(&common->version, common->version | BP_VERSION_OBSOLETE,
+						 __ATOMIC_RELEASE);
+
+		return;
+	}
+
+	bp_node_dealloc(node);
+}
+
+/**
+ * @brief 把结点的内存直接还给分配器，不检查是否还有查找在访问
+ *
+ * @param node 要释放的结点
+ */
+static void bp_node_dealloc(bp_node_t *node)
+{
+	bp_allocator_t *allocator;
+
+	allocator = ((bp_node_common_t *)node)->allocator;
+	if (NULL == allocator)
+		free(node);
+	else
+		allocator->free(allocator->ctx, node, bp_node_get_size(node));
+}
+
+/**
+ * @brief 写时复制模式下新建的结点记下当前的 epoch ，同一次写操作中不需要再复制
+ *
+ * @return uint64_t 新结点的版本号
+ */
+static inline uint64_t bp_node_birth_version(void)
+{
+	if (bp_write_sync && bp_write_sync->cow)
+		return bp_write_sync->epoch;
+
+	return 0;
+}
+
+/**
+ * @brief 复制一个结点，子结点的指针和原来的结点共用
+ *
+ * @param node 要复制的结点
+ * @return bp_node_t* 复制出来的结点，失败返回 NULL
+ */
+static bp_node_t *bp_node_copy(bp_node_t *node)
+{
+	bp_node_common_t *new;
+	int               size;
+
+	size = bp_node_get_size(node);
+	new  = bp_node_alloc(((bp_node_common_t *)node)->allocator, size);
+	if (NULL == new)
+		return NULL;
+
+	memcpy(new, node, size);
+	new->version    = bp_node_birth_version();
+	new->latch_next = NULL;
+
+	return (bp_node_t *)new;
+}
+
+/**
+ * @brief 用指定的分配器创建一个空的叶子结点
+ *
+ * @param allocator 分配器， NULL 表示使用 malloc
+ * @param layout 数据项的排列方式
+ * @param max_kv_num 叶子结点保存键值对的最大个数
+ * @param min_kv_num 叶子结点保存键值对的最小个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @return bp_node_t* 新建的结点
+ */
+bp_node_t *bp_alloc_data_node(
+	bp_allocator_t *allocator,
+	bp_layout_e     layout,
+	int             max_kv_num,
+	int             min_kv_num,
+	int             key_size,
+	int             value_size,
+	bp_compare_f    compare)
+{
+	bp_data_node_t *new;
+	int             content_len;
+
+	content_len = bp_calc_data_node_content_len(max_kv_num, key_size, value_size);
+	new = bp_node_alloc(allocator, sizeof(*new) + content_len);
+	if (NULL == new)
+		return NULL;
+
+	new->common.type        = BP_NODE_TYPE_DATA;
+	new->common.max_key_num = max_kv_num;
+	new->common.min_key_num = min_kv_num;
+	new->common.key_num     = 0;
+	new->common.insert      = bp_data_node_insert_data;
+	new->common.max_key     = bp_data_node_max_key;
+	new->common.compare     = compare;
+	new->common.allocator   = allocator;
+	new->common.key_type    = bp_select_key_type(compare, key_size);
+	new->common.layout      = layout;
+	new->common.version     = bp_node_birth_version();
+	new->common.latch_next  = NULL;
+	new->common.generation  = bp_write_tree ? bp_write_tree->generation : 0;
+
+	new->key_size    = key_size;
+	new->value_size  = value_size;
+	new->frozen      = NULL;
+	new->content_len = content_len;
+	memset(new->content, 0, new->content_len);
+
+	return (bp_node_t *)new;
+}
+
+/**
+ * @brief 创建一个空的叶子结点
+ *
+ * @param max_kv_num 叶子结点保存键值对的最大个数
+ * @param min_kv_num 叶子结点保存键值对的最小个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @return bp_node_t* 新建的结点
+ */
+bp_node_t *bp_create_data_node(
+	int          max_kv_num,
+	int          min_kv_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare)
+{
+	return bp_alloc_data_node(NULL, BP_LAYOUT_INTERLEAVED, max_kv_num,
+							  min_kv_num, key_size, value_size, compare);
+}
+
+/**
+ * @brief 返回写操作要修改的子结点
+ *
+ * @details
+ *  写时复制模式下子结点还不是当前写操作复制出来的话，先复制子结点并让 inner 指向
+ *  复制出来的结点。 inner 本身是从复制出来的根结点一路复制下来的，修改它不会影响
+ *  已经发布的快照
+ *
+ * @param inner 当前写操作可以修改的内部结点
+ * @param idx 子结点的下标
+ * @return bp_node_t* 可以修改的子结点，复制失败返回 NULL
+ */
+static bp_node_t *bp_inner_node_modify_child(bp_inner_node_t *inner, int idx)
+{
+	bp_node_t *child;
+	bp_node_t *copy;
+
+	child = bp_inner_node_get_child(inner, idx);
+	if (NULL == bp_write_sync || !bp_write_sync->cow
+		|| bp_write_sync->epoch == ((bp_node_common_t *)child)->version)
+		return child;
+
+	copy = bp_node_copy(child);
+	if (NULL == copy)
+		return NULL;
+
+	*bp_inner_node_child_pos(inner, idx) = copy;
+	if (bp_write_sync->tree->data == child)
+		bp_write_sync->tree->data = copy;
+	bp_node_free(child);
+
+	return copy;
+}
+
+/**
+ * @brief 根据二分查找的结果在内部结点上找到插入数据的位置
+ *
+ * @param inner 内部结点
+ * @param found_idx 二分查找返回的下标
+ * @return bp_node_t * inner content 上的位置
+ */
+bp_node_t *bp_inner_node_get_insert_position(
+	bp_inner_node_t *inner,
+	int              found_idx)
+{
+	// 如果 found_idx 落在 content 的有效数据区域内，说明 found_pos 指向的 p-k 对
+	// 中的 k 是第一个大于等于 key 的值，key 应该插入到 p 指向的结点；否则的话说明 key
+	// 大于当前结点的最大值，需要取最后一个 p-k 对中的 p ，在插入完成后更新最后一个 p-k
+	// 对的 k
+	if (found_idx < inner->common.key_num)
+		return bp_inner_node_get_child(inner, found_idx);
+
+	return bp_inner_node_get_child(inner, inner->common.key_num - 1);
+}
+
+/**
+ * @brief 返回结点下所有数据结点保存的被索引项的个数
+ *
+ * @param node 内部结点或者数据结点
+ * @return int 被索引项的个数
+ */
+int bp_node_get_key_total(bp_node_t *node)
+{
+	if (BP_NODE_TYPE_DATA == node->type)
+		return ((bp_data_node_t *)node)->common.key_num;
+
+	return ((bp_inner_node_t *)node)->key_total;
+}
+
+/**
+ * @brief 在内部结点的前 key_num 个 key 中查找第一个大于等于 key 的位置
+ *
+ * @details
+ *  BP_LAYOUT_PREFIX 的结点先和前缀比较，前缀不同时 key 比所有 key 都小或者都大，
+ *  前缀相同时只在后缀上查找
+ *
+ * @param inner 内部结点
+ * @param key_num 查找的 key 的个数
+ * @param key 被索引项
+ * @return int 第一个大于等于 key 的下标，都小于 key 时返回 key_num
+ */
+static inline int bp_inner_node_lower_bound(
+	bp_inner_node_t *inner,
+	int              key_num,
+	unsigned char   *key)
+{
+	int cmp;
+
+	if (BP_LAYOUT_PREFIX != inner->common.layout)
+		return bp_lower_bound(bp_inner_node_key(inner, 0), key_num,
+							  bp_inner_node_key_stride(inner), key,
+							  inner->key_size, 0, inner->common.compare,
+							  inner->common.key_type);
+
+	cmp = memcmp(key, inner->content, inner->prefix_len);
+	if (0 != cmp)
+		return cmp < 0 ? 0 : key_num;
+
+	return bp_lower_bound(bp_inner_node_key(inner, 0), key_num,
+						  bp_inner_node_key_stride(inner),
+						  key + inner->prefix_len, bp_inner_node_key_len(inner),
+						  0, NULL, inner->common.key_type);
+}
+
+/**
+ * @brief 在内部结点上查找第一个大于 key 的位置
+ *
+ * @param inner 内部结点
+ * @param key 被索引项
+ * @return int 第一个大于 key 的下标，都小于等于 key 时返回 key_num
+ */
+static inline int bp_inner_node_upper_bound(bp_inner_node_t *inner, unsigned char *key)
+{
+	int cmp;
+
+	if (BP_LAYOUT_PREFIX != inner->common.layout)
+		return bp_upper_bound(bp_inner_node_key(inner, 0), inner->common.key_num,
+							  bp_inner_node_key_stride(inner), key,
+							  inner->key_size, 0, inner->common.compare,
+							  inner->common.key_type);
+
+	cmp = memcmp(key, inner->content, inner->prefix_len);
+	if (0 != cmp)
+		return cmp < 0 ? 0 : inner->common.key_num;
+
+	return bp_upper_bound(bp_inner_node_key(inner, 0), inner->common.key_num,
+						  bp_inner_node_key_stride(inner),
+						  key + inner->prefix_len, bp_inner_node_key_len(inner),
+						  0, NULL, inner->common.key_type);
+}
+
+/**
+ * @brief 在内部结点上查找最后一个等于 key 的位置，见 bp_search_last
+ *
+ * @param inner 内部结点
+ * @param key 被索引项
+ * @param found_idx 找到时返回最后一个等于 key 的下标，否则返回第一个大于 key 的下标
+ */
+static void bp_inner_node_search_last(
+	bp_inner_node_t *inner,
+	unsigned char   *key,
+	int             *found_idx)
+{
+	int cmp;
+
+	if (BP_LAYOUT_PREFIX != inner->common.layout) {
+		bp_search_last(bp_inner_node_key(inner, 0), inner->common.key_num,
+					   bp_inner_node_key_stride(inner), key, inner->key_size, 0,
+					   inner->common.compare, inner->common.key_type, found_idx);
+
+		return;
+	}
+
+	cmp = memcmp(key, inner->content, inner->prefix_len);
+	if (0 != cmp) {
+		*found_idx = cmp < 0 ? 0 : inner->common.key_num;
+
+		return;
+	}
+
+	bp_search_last(bp_inner_node_key(inner, 0), inner->common.key_num,
+				   bp_inner_node_key_stride(inner), key + inner->prefix_len,
+				   bp_inner_node_key_len(inner), 0, NULL,
+				   inner->common.key_type, found_idx);
+}
+
+/**
+ * @brief 比较内部结点上第 idx 个 key 和 key
+ *
+ * @return int 和 memcmp 相同
+ */
+static int bp_inner_node_compare_key(
+	bp_inner_node_t *inner,
+	int              idx,
+	unsigned char   *key)
+{
+	int cmp;
+
+	if (BP_LAYOUT_PREFIX != inner->common.layout)
+		return bp_key_compare(inner->common.compare,
+							  bp_inner_node_key(inner, idx), key,
+							  inner->key_size);
+
+	cmp = memcmp(inner->content, key, inner->prefix_len);
+	if (0 != cmp)
+		return cmp;
+
+	return memcmp(bp_inner_node_key(inner, idx), key + inner->prefix_len,
+				  bp_inner_node_key_len(inner));
+}
+
+/**
+ * @brief 把 key 保存为内部结点上第 idx 个 key ， BP_LAYOUT_PREFIX 的结点的前缀必须
+ *        也是 key 的前缀
+ *
+ */
+static inline void bp_inner_node_set_key(
+	bp_inner_node_t *inner,
+	int              idx,
+	unsigned char   *key)
+{
+	memcpy(bp_inner_node_key(inner, idx), key + inner->prefix_len,
+		   bp_inner_node_key_len(inner));
+}
+
+/**
+ * @brief 把子结点保存的最大 key 值更新到内部结点上第 idx 个 key ，子结点是空的时候
+ *        保留原来的值
+ *
+ * @param inner 内部结点
+ * @param idx key 的下标
+ * @param child 子结点
+ */
+static void bp_inner_node_update_key(
+	bp_inner_node_t *inner,
+	int              idx,
+	bp_node_t       *child)
+{
+	bp_node_common_t *common;
+	bp_data_node_t   *data;
+
+	common = (bp_node_common_t *)child;
+	if (BP_LAYOUT_PREFIX != inner->common.layout) {
+		common->max_key(child, bp_inner_node_key(inner, idx), inner->key_size);
+
+		return;
+	}
+
+	if (common->key_num <= 0)
+		return;
+
+	if (BP_NODE_TYPE_DATA == child->type) {
+		data = (bp_data_node_t *)child;
+		bp_inner_node_set_key(inner, idx,
+							  bp_data_node_key(data, data->common.key_num - 1));
+
+		return;
+	}
+
+	bp_inner_node_copy_key(inner, idx, (bp_inner_node_t *)child,
+						   common->key_num - 1);
+}
+
+/**
+ * @brief 修改 BP_LAYOUT_PREFIX 的内部结点的前缀长度，所有的 P|S 在结点上原地重新排列
+ *
+ * @details
+ *  前缀变短时新的前缀是原来前缀的一部分；前缀变长时多出来的部分从 key 上复制，
+ *  所有的 key 都必须有这个前缀。前缀变短后结点可能放不下原来的 key ，需要调用方
+ *  先用 bp_inner_node_capacity 检查
+ *
+ * @param inner 内部结点
+ * @param key 前缀变长时提供新的前缀
+ * @param prefix_len 新的前缀的长度
+ */
+static void bp_inner_node_set_prefix(
+	bp_inner_node_t *inner,
+	unsigned char   *key,
+	int              prefix_len)
+{
+	unsigned char *slots;
+	unsigned char *src;
+	unsigned char *dst;
+	int            old_len;
+	int            old_stride;
+	int            new_stride;
+	int            diff;
+	int            i;
+
+	slots      = bp_inner_node_slots(inner);
+	old_len    = inner->prefix_len;
+	old_stride = sizeof(bp_node_t *) + inner->key_size - old_len;
+	new_stride = sizeof(bp_node_t *) + inner->key_size - prefix_len;
+	if (prefix_len < old_len) {
+		// 后缀变长，从后往前移动，每个后缀前面补上原来前缀多出来的部分
+		diff = old_len - prefix_len;
+		for (i = inner->common.key_num - 1; i >= 0; i--) {
+			src = slots + i * old_stride;
+			dst = slots + i * new_stride;
+			memmove(dst + sizeof(bp_node_t *) + diff, src + sizeof(bp_node_t *),
+					inner->key_size - old_len);
+			memcpy(dst + sizeof(bp_node_t *), inner->content + prefix_len, diff);
+			memmove(dst, src, sizeof(bp_node_t *));
+		}
+	} else if (prefix_len > old_len) {
+		// 后缀变短，从前往后移动，去掉每个后缀前面已经成为前缀的部分
+		diff = prefix_len - old_len;
+		for (i = 0; i < inner->common.key_num; i++) {
+			src = slots + i * old_stride;
+			dst = slots + i * new_stride;
+			memmove(dst, src, sizeof(bp_node_t *));
+			memmove(dst + sizeof(bp_node_t *), src + sizeof(bp_node_t *) + diff,
+					inner->key_size - prefix_len);
+		}
+		memcpy(inner->content + old_len, key + old_len, diff);
+	}
+
+	inner->prefix_len         = prefix_len;
+	inner->common.max_key_num = bp_inner_node_capacity(inner, prefix_len);
+	inner->common.key_type    = bp_select_key_type(NULL,
+													 inner->key_size - prefix_len);
+}
+
+/**
+ * @brief 把 BP_LAYOUT_PREFIX 的内部结点的前缀设置为子树里最小的 key 和最大的 key
+ *        共有的前缀，分裂或者新建结点之后调用
+ *
+ * @details
+ *  子树里所有的 key 都在最左侧数据结点的第一个 key 和结点的最后一个 key 之间，
+ *  最左侧的数据结点是空的时候保持原来的前缀
+ *
+ * @param inner 内部结点
+ */
+static void bp_inner_node_fit_prefix(bp_inner_node_t *inner)
+{
+	bp_node_t     *node;
+	unsigned char *first;
+	int            prefix_len;
+
+	if (BP_LAYOUT_PREFIX != inner->common.layout || 0 == inner->common.key_num)
+		return;
+
+	node = (bp_node_t *)inner;
+	while (BP_NODE_TYPE_INNER == node->type)
+		node = bp_inner_node_get_child((bp_inner_node_t *)node, 0);
+	if (0 == ((bp_data_node_t *)node)->common.key_num)
+		return;
+
+	first      = bp_data_node_key((bp_data_node_t *)node, 0);
+	prefix_len = inner->prefix_len + bp_common_prefix_len(
+		first + inner->prefix_len,
+		bp_inner_node_key(inner, inner->common.key_num - 1),
+		bp_inner_node_key_len(inner));
+	bp_inner_node_set_prefix(inner, first, prefix_len);
+}
+
+/**
+ * @brief 内部结点分裂，分裂完后 to_split 保存前半部分数据， pp_new 保存后半部分数据
+ *
+ * @param to_split 要分裂的结点
+ * @param pp_new 用于输出分裂出的结点
+ * @return int 是否分裂成功
+ */
+int bp_inner_node_split(bp_node_t *to_split, bp_node_t **pp_new)
+{
+	bp_inner_node_t *old;
+	bp_inner_node_t *new;
+	int              old_data_num;
+	int              i;
+
+	old = (bp_inner_node_t *)to_split;
+	new = (bp_inner_node_t *)bp_alloc_inner_node(
+		old->common.allocator, old->common.layout,
+		bp_inner_node_nominal_num(old), old->key_size, old->common.compare);
+	if (NULL == new) {
+		*pp_new = NULL;
+
+		return -1;
+	}
+
+	old_data_num = old->common.key_num;
+	old->common.key_num = old_data_num / 2;
+	new->common.key_num = old_data_num - old->common.key_num;
+
+	bp_node_move_items((bp_node_t *)new, 0, to_split, old->common.key_num,
+					   new->common.key_num);
+
+	// 被移动到新结点的子树的被索引项也要从旧结点的 key_total 中移到新结点
+	for (i = 0; i < new->common.key_num; i++)
+		new->key_total += bp_node_get_key_total(
+			bp_inner_node_get_child(new, i));
+	old->key_total -= new->key_total;
+
+	// 两个结点的 key 的范围都变小了，前缀可能变长
+	bp_inner_node_fit_prefix(old);
+	bp_inner_node_fit_prefix(new);
+
+	if (bp_write_tree)
+		bp_write_tree->inner_split_num += 1;
+
+	*pp_new = (bp_node_t *)new;
+
+	return 0;
+}
+
+/**
+ * @brief inner 的子结点 child 分裂后，inner 上 child 的索引和新结点的索引
+ *
+ * @param inner 内部结点
+ * @param child 分裂的子结点
+ * @param split_child 分裂出的新结点
+ * @param child_idx 分裂前 child 在 inner 上的下标
+ * @param split_inner 如果 inner 已经满了，则 inner 也会分裂，用于返回分裂出的结点
+ * @return int 0 成功 -1 失败
+ */
+int bp_inner_node_add_split_child(
+	bp_inner_node_t   *inner,
+	bp_node_common_t  *child,
+	bp_node_common_t  *split_child,
+	int                child_idx,
+	bp_inner_node_t  **split_inner)
+{
+	bp_inner_node_t *inner_contains_child;
+	int              split_total;
+
+	*split_inner = NULL;
+	bp_node_write_lock((bp_node_t *)inner);
+	if (inner->common.key_num == inner->common.max_key_num)
+		if (-1 == bp_inner_node_split((bp_node_t *)inner,
+									  (bp_node_t **)split_inner))
+			return -1;
+
+	inner_contains_child = inner;
+	if (*split_inner) {
+		// 如果 inner 分裂了的话，需要找到 child 应该保存在 inner 还是 *split_inner
+		if (child_idx < inner->common.key_num) {
+			inner_contains_child = inner;
+		} else {
+			inner_contains_child = *split_inner;
+			child_idx -= inner->common.key_num;
+
+			// 分裂时 split_child 还没有加入 inner ，它的被索引项仍然算在 inner 上
+			split_total = bp_node_get_key_total((bp_node_t *)split_child);
+			inner->key_total          -= split_total;
+			(*split_inner)->key_total += split_total;
+		}
+	}
+
+	// child 后面的数据后移，腾出 child_split 的空间
+	bp_node_move_items((bp_node_t *)inner_contains_child, child_idx + 2,
+					   (bp_node_t *)inner_contains_child, child_idx + 1,
+					   inner_contains_child->common.key_num - child_idx - 1);
+
+	// 插入 child_split 。删除会让 child 原来的 key 大于子树实际的最大值，这个值可能
+	// 也是上层结点上的分界，所以 child_split 沿用原来的 key 而不是按结点内容重新计算，
+	// 否则 inner 的最大 key 会比上层结点记录的小，查找会越过 inner 的最后一个子结点
+	*bp_inner_node_child_pos(inner_contains_child, child_idx + 1) =
+		(bp_node_t *)split_child;
+	memcpy(bp_inner_node_key(inner_contains_child, child_idx + 1),
+		   bp_inner_node_key(inner_contains_child, child_idx),
+		   bp_inner_node_key_len(inner_contains_child));
+	inner_contains_child->common.key_num += 1;
+
+	// 更新 child 所在的 P-K 对中的最大 key 值为 child 的最大 key 值
+	bp_inner_node_update_key(inner_contains_child, child_idx, (bp_node_t *)child);
+
+	return 0;
+}
+
+/**
+ * @brief BP_LAYOUT_PREFIX 的内部结点插入不以前缀开头的 key 之前缩短前缀，缩短后放不下
+ *        已有的子结点和一个新分裂出的子结点时先把结点分裂
+ *
+ * @param pinner 输入输出，内部结点，分裂时返回 key 所在的那一半
+ * @param key 要插入的被索引项
+ * @param pp_new 结点分裂时用于输出分裂出的结点
+ * @return int 0 成功 -1 失败
+ */
+static int bp_inner_node_admit(
+	bp_inner_node_t **pinner,
+	unsigned char    *key,
+	bp_node_t       **pp_new)
+{
+	bp_inner_node_t *inner;
+	int              prefix_len;
+	int              found_idx;
+
+	inner = *pinner;
+	if (BP_LAYOUT_PREFIX != inner->common.layout)
+		return 0;
+
+	prefix_len = bp_common_prefix_len(key, inner->content, inner->prefix_len);
+	if (prefix_len == inner->prefix_len)
+		return 0;
+
+	bp_node_write_lock((bp_node_t *)inner);
+	if (inner->common.key_num + 1 > bp_inner_node_capacity(inner, prefix_len)) {
+		bp_inner_node_search_last(inner, key, &found_idx);
+		if (-1 == bp_inner_node_split((bp_node_t *)inner, pp_new))
+			return -1;
+
+		if (found_idx >= inner->common.key_num)
+			inner = (bp_inner_node_t *)*pp_new;
+
+		prefix_len = bp_common_prefix_len(key, inner->content, inner->prefix_len);
+	}
+
+	bp_inner_node_set_prefix(inner, key, prefix_len);
+	*pinner = inner;
+
+	return 0;
+}
+
+/**
+ * @brief 内部结点插入数据
+ *
+ * @param node 内部结点
+ * @param key 要插入的被索引项
+ * @param position 被索引项的位置信息
+ * @param pp_new 如果内部结点发生分裂的话，返回分裂出的结点
+ * @return int 0 成功 -1 失败
+ */
+int bp_inner_node_insert_data(
+	bp_node_t      *node,
+	unsigned char  *key,
+	unsigned char  *position,
+	bp_node_t     **pp_new)
+{
+	bp_inner_node_t  *inner;
+	bp_inner_node_t  *split_inner;
+	bp_node_common_t *child;
+	bp_node_common_t *split_child;
+	int               found_idx;
+
+	inner   = (bp_inner_node_t *)node;
+	*pp_new = NULL;
+
+	// 空B+树插入第一个 key 时，使用第一个 key 作为第一个子结点的最大值
+	if (0 == inner->common.key_num) {
+		bp_node_write_lock(node);
+		if (BP_LAYOUT_PREFIX == inner->common.layout)
+			bp_inner_node_set_prefix(inner, NULL, 0);
+		memcpy(bp_inner_node_key(inner, 0), key, inner->key_size);
+
+		inner->common.key_num = 1;
+	}
+
+	if (-1 == bp_inner_node_admit(&inner, key, pp_new))
+		return -1;
+
+	bp_inner_node_search_last(inner, key, &found_idx);
+	if (found_idx == inner->common.key_num) {
+		// B+树的查找原理可以保证这种情况只会出现在树的最右侧结点，此时更新最右侧
+		// 结点的最大值为新的最大值，并把新值插入最右侧的子树
+		bp_node_write_lock((bp_node_t *)inner);
+		bp_inner_node_set_key(inner, found_idx - 1, key);
+		found_idx -= 1;
+	}
+
+	// 找到子树插入
+	child = (bp_node_common_t *)bp_inner_node_modify_child(inner, found_idx);
+	if (NULL == child)
+		return -1;
+
+	if (-1 == child->insert((bp_node_t *)child, key, position,
+							(bp_node_t **)&split_child))
+		return -1;
+
+	// 先更新 key_total ，如果 inner 分裂了，分裂时会根据子结点重新计算两个结点的
+	// key_total
+	bp_node_touch((bp_node_t *)inner);
+	inner->key_total += 1;
+
+	// bp_inner_node_admit 分裂过的结点一定还能放下一个子结点，不会再次分裂
+	if (split_child
+		&& -1 == bp_inner_node_add_split_child(inner, child, split_child,
+											   found_idx, &split_inner))
+		return -1;
+
+	if (split_child && split_inner)
+		*pp_new = (bp_node_t *)split_inner;
+
+	return 0;
+}
+
+/**
+ * @brief 获取内部结点保存的最大 key 值
+ *
+ * @param node 内部结点
+ * @param key_buf 用于输出最大 key 值
+ * @param key_buf_len 输出缓存的长度
+ * @return int -1 失败 否则为 memcpy 的长度
+ */
+int bp_inner_node_max_key(
+	bp_node_t     *node,
+	unsigned char *key_buf,
+	int            key_buf_len)
+{
+	bp_inner_node_t *inner;
+	int              cp_len;
+
+	inner = (bp_inner_node_t *)node;
+	if (inner->common.key_num <= 0)
+		return -1;
+
+	cp_len = key_buf_len < inner->key_size ? key_buf_len : inner->key_size;
+	if (BP_LAYOUT_PREFIX == inner->common.layout) {
+		// 前缀和后缀拼起来才是完整的 key
+		memcpy(key_buf, inner->content,
+			   cp_len < inner->prefix_len ? cp_len : inner->prefix_len);
+		if (cp_len > inner->prefix_len)
+			memcpy(key_buf + inner->prefix_len,
+				   bp_inner_node_key(inner, inner->common.key_num - 1),
+				   cp_len - inner->prefix_len);
+
+		return cp_len;
+	}
+
+	memcpy(key_buf, bp_inner_node_key(inner, inner->common.key_num - 1), cp_len);
+
+	return cp_len;
+}
+
+/**
+ * @brief 用指定的分配器创建一个空的内部节点
+ *
+ * @param allocator 分配器， NULL 表示使用 malloc
+ * @param layout 数据项的排列方式
+ * @param max_key_num 内部节点可以保存的最大的 key 的个数
+ * @param key_size 被索引项的数据长度
+ * @param compare 比较 key 值的函数
+ * @return bp_node_t* 新建的内部节点
+ */
+bp_node_t *bp_alloc_inner_node(
+	bp_allocator_t *allocator,
+	bp_layout_e     layout,
+	int             max_key_num,
+	int             key_size,
+	bp_compare_f    compare)
+{
+	bp_inner_node_t *new;
+	int              content_len;
+
+	content_len = bp_calc_inner_node_content_len(layout, max_key_num, key_size);
+	new = bp_node_alloc(allocator, sizeof(*new) + content_len);
+	if (NULL == new)
+		return NULL;
+
+	new->common.type        = BP_NODE_TYPE_INNER;
+	new->common.max_key_num = max_key_num;
+	new->common.min_key_num = max_key_num / 2;
+	new->common.key_num     = 0;
+	new->common.insert      = bp_inner_node_insert_data;
+	new->common.compare     = compare;
+	new->common.max_key     = bp_inner_node_max_key;
+	new->common.allocator   = allocator;
+	new->common.key_type    = bp_select_key_type(compare, key_size);
+	new->common.layout      = layout;
+	new->common.version     = bp_node_birth_version();
+	new->common.latch_next  = NULL;
+	new->common.generation  = bp_write_tree ? bp_write_tree->generation : 0;
+
+	new->key_size    = key_size;
+	new->key_total   = 0;
+	new->prefix_len  = 0;
+	new->content_len = content_len;
+	memset(new->content, 0, new->content_len);
+
+	return (bp_node_t *)new;
+}
+
+/**
+ * @brief 创建一个空的内部节点
+ *
+ * @param max_key_num 内部节点可以保存的最大的 key 的个数
+ * @param key_size 被索引项的数据长度
+ * @param compare 比较 key 值的函数
+ * @return bp_node_t* 新建的内部节点
+ */
+bp_node_t *bp_create_inner_node(int max_key_num, int key_size, bp_compare_f compare)
+{
+	return bp_alloc_inner_node(NULL, BP_LAYOUT_INTERLEAVED, max_key_num,
+							   key_size, compare);
+}
+
+/**
+ * @brief 创建B+树设置头结点的第一个指针指向第一个数据结点
+ *
+ * @param inner B+树的头结点
+ * @param first_data B+树的第一个数据结点
+ */
+void bp_inner_node_set_first_ptr(bp_inner_node_t *inner, bp_node_t *first_data)
+{
+	*bp_inner_node_child_pos(inner, 0) = first_data;
+}
+
+/**
+ * @brief 创建一棵B+树
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @param allocator 分配结点内存的分配器， NULL 表示使用 malloc
+ * @param layout 结点上数据项的排列方式
+ * @return bp_tree_t* 创建的B+树
+ */
+static bp_tree_t *bp_alloc_tree(
+	int             max_idx_num,
+	int             max_data_num,
+	int             key_size,
+	int             value_size,
+	bp_compare_f    compare,
+	bp_allocator_t *allocator,
+	bp_layout_e     layout)
+{
+	bp_tree_t     *new;
+
+	// 数据结点分裂的时候，每个新结点至少要有 max_idx_num/2 个数据，所以需要数据
+	// 结点的最大数据个数要大于内部结点的最大数据个数
+	if (max_data_num < max_idx_num)
+		return NULL;
+
+	// 只有按 memcmp 排列的 key 才能保证有相同前缀的 key 是连续的
+	if (BP_LAYOUT_PREFIX == layout && compare)
+		return NULL;
+
+	new = malloc(sizeof(*new));
+	if (NULL == new)
+		return NULL;
+
+	memset(new, 0, sizeof(*new));
+	new->max_idx_num  = max_idx_num;
+	new->max_data_num = max_data_num;
+	new->key_size     = key_size;
+	new->value_size   = value_size;
+	new->allocator    = allocator;
+	new->layout       = layout;
+	new->split_fill   = BP_SPLIT_FILL_DEFAULT;
+	new->generation   = 1;
+
+	new->head = bp_alloc_inner_node(allocator, layout, max_idx_num, key_size,
+									compare);
+	if (NULL == new->head) {
+		free(new);
+
+		return NULL;
+	}
+
+	new->data = bp_alloc_data_node(allocator, layout, max_data_num,
+								   max_idx_num / 2, key_size, value_size,
+								   compare);
+	if (NULL == new->data) {
+		bp_node_free(new->head);
+		free(new);
+
+		return NULL;
+	}
+
+	// 头结点的第一个指针指向第一个数据节点
+	bp_inner_node_set_first_ptr((bp_inner_node_t *)new->head, new->data);
+
+	return new;
+}
+
+/**
+ * @brief 创建一棵使用指定分配器分配结点的B+树
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @param allocator 分配结点内存的分配器， NULL 表示使用 malloc ，在树被释放之前
+ *                  必须一直有效
+ * @return bp_tree_t* 创建的B+树
+ */
+bp_tree_t *bp_create_tree_with_allocator(
+	int             max_idx_num,
+	int             max_data_num,
+	int             key_size,
+	int             value_size,
+	bp_compare_f    compare,
+	bp_allocator_t *allocator)
+{
+	return bp_alloc_tree(max_idx_num, max_data_num, key_size, value_size,
+						 compare, allocator, BP_LAYOUT_INTERLEAVED);
+}
+
+/**
+ * @brief 创建一棵结点上的数据项按 layout 排列的B+树
+ *
+ * @details
+ *  BP_LAYOUT_SPLIT 的结点把 key 连续保存在一起，结点内查找只访问 key 所在的缓存行，
+ *  但是 bp_cursor_next_run 不能返回连续的 K|V 数据项。 BP_LAYOUT_PREFIX 的内部结点
+ *  只保存一次公共前缀，有长公共前缀的 key 可以得到更大的扇出，数据结点和交错保存的
+ *  相同；指定了 compare 时不能使用
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @param layout 结点上数据项的排列方式
+ * @return bp_tree_t* 创建的B+树
+ */
+bp_tree_t *bp_create_tree_with_layout(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare,
+	bp_layout_e  layout)
+{
+	return bp_alloc_tree(max_idx_num, max_data_num, key_size, value_size,
+						 compare, NULL, layout);
+}
+
+/**
+ * @brief 创建一棵带读写同步信息的B+树
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @param cow 是否为写时复制模式
+ * @return bp_tree_t* 创建的B+树
+ */
+static bp_tree_t *bp_create_sync_tree(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare,
+	int          cow)
+{
+	bp_tree_t *new;
+	bp_sync_t *sync;
+
+	sync = malloc(sizeof(*sync));
+	if (NULL == sync)
+		return NULL;
+
+	memset(sync, 0, sizeof(*sync));
+	if (0 != pthread_mutex_init(&sync->write_lock, NULL)) {
+		free(sync);
+
+		return NULL;
+	}
+
+	new = bp_alloc_tree(max_idx_num, max_data_num, key_size, value_size,
+						compare, NULL, BP_LAYOUT_INTERLEAVED);
+	if (NULL == new) {
+		pthread_mutex_destroy(&sync->write_lock);
+		free(sync);
+
+		return NULL;
+	}
+
+	// epoch 从 1 开始，读者的 epoch 为 0 表示没有在访问快照
+	sync->cow   = cow;
+	sync->tree  = new;
+	sync->root  = new->head;
+	sync->epoch = 1;
+	new->sync   = sync;
+
+	return new;
+}
+
+/**
+ * @brief 创建一棵支持多线程并发访问的B+树，查找不加锁，写操作之间互斥
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @return bp_tree_t* 创建的B+树
+ */
+bp_tree_t *bp_create_concurrent_tree(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare)
+{
+	return bp_create_sync_tree(max_idx_num, max_data_num, key_size, value_size,
+							   compare, 0);
+}
+
+/**
+ * @brief 创建一棵写时复制模式的B+树
+ *
+ * @details
+ *  写操作之间互斥，每次写操作复制从根结点到被修改结点路径上的所有结点，完成后整体
+ *  发布新的根结点。查找和游标在打开时的快照上进行，既不加锁也不需要重试，适合在
+ *  持续写入的同时做长时间的范围扫描
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @return bp_tree_t* 创建的B+树
+ */
+bp_tree_t *bp_create_cow_tree(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare)
+{
+	return bp_create_sync_tree(max_idx_num, max_data_num, key_size, value_size,
+							   compare, 1);
+}
+
+/**
+ * @brief 释放已经从树上删除的结点
+ *
+ * @param sync 读写同步信息
+ */
+static void bp_sync_free_retired(bp_sync_t *sync)
+{
+	bp_node_common_t *common;
+	bp_node_common_t *next;
+
+	for (common = sync->retired; common; common = next) {
+		next = common->latch_next;
+		bp_node_dealloc((bp_node_t *)common);
+	}
+
+	sync->retired = NULL;
+}
+
+/**
+ * @brief 释放并发模式的B+树上已经删除的结点
+ *
+ * @details
+ *  每次写操作结束时已经会释放没有读者能看到的结点，这里只释放之后的读者退出后
+ *  才能释放的结点，可以随时调用
+ *
+ * @param tree B+树
+ */
+void bp_tree_reclaim(bp_tree_t *tree)
+{
+	if (NULL == tree->sync)
+		return;
+
+	pthread_mutex_lock(&tree->sync->write_lock);
+	bp_epoch_reclaim(tree->sync);
+	pthread_mutex_unlock(&tree->sync->write_lock);
+}
+
+/**
+ * @brief 当前线程上次找到空闲位置的下标，下次从这里开始找
+ */
+static __thread int bp_epoch_hint = -1;
+
+/**
+ * @brief 在一个空闲位置上记下当前的 epoch ，之后可以访问的结点都不会被释放
+ *
+ * @param sync 读写同步信息
+ * @return int 记录 epoch 的位置
+ */
+static int bp_epoch_enter(bp_sync_t *sync)
+{
+	uint64_t expected;
+	uint64_t epoch;
+	int      slot;
+	int      i;
+
+	// 不同的线程从不同的位置开始找，减少争用同一个缓存行
+	if (bp_epoch_hint < 0)
+		bp_epoch_hint = (int)(((uintptr_t)&bp_epoch_hint >> 6)
+							  % BP_EPOCH_SLOT_NUM);
+
+	slot = -1;
+	while (-1 == slot) {
+		for (i = 0; i < BP_EPOCH_SLOT_NUM; i++) {
+			expected = 0;
+			epoch    = __atomic_load_n(&sync->epoch, __ATOMIC_SEQ_CST);
+			if (__atomic_compare_exchange_n(
+					&sync->slots[(bp_epoch_hint + i) % BP_EPOCH_SLOT_NUM].epoch,
+					&expected, epoch, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+				slot = (bp_epoch_hint + i) % BP_EPOCH_SLOT_NUM;
+				break;
+			}
+		}
+
+		// 所有的位置都有读者在使用，等待其它快照关闭
+		if (-1 == slot)
+			sched_yield();
+	}
+
+	bp_epoch_hint = slot;
+
+	return slot;
+}
+
+/**
+ * @brief 清除读者占用的位置，之后读者访问过的结点随时可能被释放
+ *
+ * @param sync 读写同步信息
+ * @param slot bp_epoch_enter 返回的位置
+ */
+static inline void bp_epoch_exit(bp_sync_t *sync, int slot)
+{
+	__atomic_store_n(&sync->slots[slot].epoch, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief 记下当前的 epoch ，再读取最近一次发布的根结点
+ *
+ * @param sync 写时复制模式的读写同步信息
+ * @param snapshot 用于输出快照
+ */
+static void bp_snapshot_enter(bp_sync_t *sync, bp_snapshot_t *snapshot)
+{
+	snapshot->tree = sync->tree;
+	snapshot->slot = bp_epoch_enter(sync);
+	snapshot->root = __atomic_load_n(&sync->root, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief 清除快照占用的位置，之后快照上的结点随时可能被释放
+ *
+ * @param snapshot 快照
+ */
+static void bp_snapshot_exit(bp_snapshot_t *snapshot)
+{
+	bp_epoch_exit(snapshot->tree->sync, snapshot->slot);
+}
+
+/**
+ * @brief 打开写时复制模式的B+树当前的快照
+ *
+ * @details
+ *  快照打开期间它能看到的结点都不会被释放，长时间不关闭的快照会让被写操作替换的
+ *  结点一直占用内存
+ *
+ * @param tree B+树
+ * @return bp_snapshot_t* 快照，不是写时复制模式或者分配内存失败返回 NULL
+ */
+bp_snapshot_t *bp_snapshot_open(bp_tree_t *tree)
+{
+	bp_snapshot_t *snapshot;
+
+	if (NULL == tree->sync || !tree->sync->cow)
+		return NULL;
+
+	snapshot = malloc(sizeof(*snapshot));
+	if (NULL == snapshot)
+		return NULL;
+
+	bp_snapshot_enter(tree->sync, snapshot);
+
+	return snapshot;
+}
+
+/**
+ * @brief 关闭快照
+ *
+ * @param snapshot 快照
+ */
+void bp_snapshot_close(bp_snapshot_t *snapshot)
+{
+	bp_snapshot_exit(snapshot);
+	free(snapshot);
+}
+
+/**
+ * @brief 创建一棵B+树
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @return bp_tree_t* 创建的B+树
+ */
+bp_tree_t *bp_create_tree(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare)
+{
+	return bp_create_tree_with_allocator(max_idx_num, max_data_num, key_size,
+										 value_size, compare, NULL);
+}
+
+/**
+ * @brief 创建一棵结点都从自己独占的 arena 上分配的B+树，释放树时直接释放整个 arena
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @param slab_size arena 每次向系统申请的内存大小， 0 表示使用默认值
+ * @return bp_tree_t* 创建的B+树
+ */
+bp_tree_t *bp_create_tree_with_arena(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare,
+	int          slab_size)
+{
+	bp_arena_t *arena;
+	bp_tree_t  *new;
+
+	arena = bp_arena_create(slab_size);
+	if (NULL == arena)
+		return NULL;
+
+	new = bp_create_tree_on_arena(max_idx_num, max_data_num, key_size, value_size,
+								  compare, arena);
+	if (NULL == new)
+		bp_arena_destroy(arena);
+
+	return new;
+}
+
+/**
+ * @brief 创建一棵结点都从 arena 上分配的B+树，树创建成功后 arena 归树所有
+ *
+ * @details
+ *  用 bp_arena_create_with_flags 创建的 arena 可以让整棵树的结点使用大页或者位于指定的
+ *  NUMA 结点上
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @param arena 分配结点的 arena ，释放树时一起释放，创建失败时仍归调用者所有
+ * @return bp_tree_t* 创建的B+树
+ */
+bp_tree_t *bp_create_tree_on_arena(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare,
+	bp_arena_t  *arena)
+{
+	bp_tree_t *new;
+
+	new = bp_create_tree_with_allocator(max_idx_num, max_data_num, key_size,
+										value_size, compare,
+										bp_arena_get_allocator(arena));
+	if (NULL == new)
+		return NULL;
+
+	new->arena = arena;
+
+	return new;
+}
+
+/**
+ * @brief 按缓存行计算结点大小时一个缓存行的大小
+ */
+#define BP_CACHE_LINE_SIZE 64
+
+/**
+ * @brief BP_PROFILE_MEMORY 的内部结点和数据结点默认占用的缓存行的个数
+ */
+#define BP_PROFILE_INNER_LINES 8
+#define BP_PROFILE_DATA_LINES  16
+
+/**
+ * @brief BP_PROFILE_MEMORY 的结点至少要能保存的数据项的个数，数据项太大时增加缓存行
+ */
+#define BP_PROFILE_MIN_FANOUT 8
+
+/**
+ * @brief 计算结点大小正好为 node_size 时可以保存的数据项的个数
+ *
+ * @param profile 结点大小的方案
+ * @param header 结点结构体的大小
+ * @param item_size 每个数据项的大小
+ * @param node_size 输入为默认的结点大小，按缓存行计算时输出实际使用的结点大小
+ * @return int 可以保存的数据项的个数
+ */
+static int bp_profile_fanout(
+	bp_profile_e profile,
+	int          header,
+	int          item_size,
+	int         *node_size)
+{
+	int num;
+
+	// 数据区域最后还要保存一个指针
+	num = (*node_size - header - (int)sizeof(bp_node_t *)) / item_size;
+	if (BP_PROFILE_MEMORY != profile || num >= BP_PROFILE_MIN_FANOUT)
+		return num;
+
+	*node_size = header + (int)sizeof(bp_node_t *) + BP_PROFILE_MIN_FANOUT * item_size;
+	*node_size = (*node_size + BP_CACHE_LINE_SIZE - 1) / BP_CACHE_LINE_SIZE
+		* BP_CACHE_LINE_SIZE;
+
+	return (*node_size - header - (int)sizeof(bp_node_t *)) / item_size;
+}
+
+/**
+ * @brief 按结点大小的方案计算内部结点和数据结点可以保存的数据项的个数
+ *
+ * @details
+ *  结点的大小包括结点结构体和数据区域， BP_PROFILE_MEMORY 按整数个缓存行计算，其他
+ *  方案按页的大小计算，数据项的个数取放得下的最大值。数据结点的个数不能比内部结点少，
+ *  数据项很大时内部结点也只能保存同样多的数据项
+ *
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param profile 结点大小的方案
+ * @param max_idx_num 输出内部结点保存的数据项的最大个数
+ * @param max_data_num 输出数据结点保存的数据项的最大个数
+ * @return int 成功返回 0 ，结点放不下足够的数据项时返回 -1
+ */
+int bp_tree_auto_fanout(
+	int           key_size,
+	int           value_size,
+	bp_profile_e  profile,
+	int          *max_idx_num,
+	int          *max_data_num)
+{
+	int inner_size;
+	int data_size;
+	int idx_num;
+	int data_num;
+
+	if (key_size <= 0 || value_size <= 0)
+		return -1;
+
+	switch (profile) {
+	case BP_PROFILE_MEMORY:
+		inner_size = BP_PROFILE_INNER_LINES * BP_CACHE_LINE_SIZE;
+		data_size  = BP_PROFILE_DATA_LINES * BP_CACHE_LINE_SIZE;
+		break;
+	case BP_PROFILE_PAGE_4K:
+		inner_size = data_size = 4096;
+		break;
+	case BP_PROFILE_PAGE_16K:
+		inner_size = data_size = 16384;
+		break;
+	default:
+		return -1;
+	}
+
+	idx_num  = bp_profile_fanout(profile, sizeof(bp_inner_node_t),
+								 key_size + sizeof(bp_node_t *), &inner_size);
+	data_num = bp_profile_fanout(profile, sizeof(bp_data_node_t),
+								 key_size + value_size, &data_size);
+	if (data_num < idx_num)
+		idx_num = data_num;
+
+	// 内部结点分裂后两边都至少要有一个 key
+	if (idx_num < 3)
+		return -1;
+
+	*max_idx_num  = idx_num;
+	*max_data_num = data_num;
+
+	return 0;
+}
+
+/**
+ * @brief 创建一棵按结点大小的方案自动选择结点容量的B+树
+ *
+ * @details
+ *  结点从树独占的 arena 上分配， arena 上的结点按缓存行对齐，所以 BP_PROFILE_MEMORY
+ *  的结点正好占满 bp_tree_auto_fanout 选择的整数个缓存行
+ *
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @param profile 结点大小的方案
+ * @return bp_tree_t* 创建的B+树
+ */
+bp_tree_t *bp_create_tree_auto(
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare,
+	bp_profile_e profile)
+{
+	int max_idx_num;
+	int max_data_num;
+
+	if (-1 == bp_tree_auto_fanout(key_size, value_size, profile, &max_idx_num,
+								  &max_data_num))
+		return NULL;
+
+	return bp_create_tree_with_arena(max_idx_num, max_data_num, key_size,
+									 value_size, compare, 0);
+}
+
+/**
+ * @brief 释放结点及其所有子结点
+ *
+ * @param node 要释放的结点
+ */
+static void bp_node_destroy(bp_node_t *node)
+{
+	bp_inner_node_t *inner;
+	int              i;
+
+	if (BP_NODE_TYPE_INNER == node->type) {
+		inner = (bp_inner_node_t *)node;
+		for (i = 0; i < inner->common.key_num; i++)
+			bp_node_destroy(bp_inner_node_get_child(inner, i));
+	}
+
+	bp_node_free(node);
+}
+
+/**
+ * @brief 释放一棵B+树
+ *
+ * @param tree 要释放的B+树
+ */
+void bp_destroy_tree(bp_tree_t *tree)
+{
+	if (tree->frozen)
+		bp_thaw(tree);
+
+	free(tree->ibuf);
+
+	if (tree->sync) {
+		bp_sync_free_retired(tree->sync);
+		pthread_mutex_destroy(&tree->sync->write_lock);
+		free(tree->sync);
+	}
+
+	// 树独占 arena 时所有结点都在 arena 的 slab 上，不需要逐个释放
+	if (tree->arena) {
+		bp_arena_destroy(tree->arena);
+		free(tree);
+
+		return;
+	}
+
+	// 空树的头结点上没有有效的 P-K 对，第一个数据结点需要单独释放
+	if (0 == ((bp_node_common_t *)tree->head)->key_num)
+		bp_node_free(tree->data);
+
+	bp_node_destroy(tree->head);
+	free(tree);
+}
+
+/**
+ * @brief 统计B+树时遍历结点的状态
+ */
+typedef struct bp_stats_walk {
+	bp_tree_stats_t *stats; /** 输出的统计信息 */
+	int64_t          capacity[BP_STATS_MAX_LEVEL]; /** 每一层最多能保存的数据项个数 */
+	bp_compare_f     compare; /** 比较 key 值的函数 */
+	int              key_size; /** 被索引项的大小 */
+	unsigned char   *prev; /** 上一个数据项的 key ，还没有时为 NULL */
+	int64_t          run; /** prev 所在的相同 key 的连续数据项的个数 */
+} bp_stats_walk_t;
+
+/**
+ * @brief 结束一段相同 key 的连续数据项
+ *
+ * @param walk 遍历的状态
+ */
+static void bp_stats_end_run(bp_stats_walk_t *walk)
+{
+	if (walk->run > 1) {
+		walk->stats->dup_run_num += 1;
+		walk->stats->dup_key_num += walk->run;
+	}
+	if (walk->run > walk->stats->max_dup_run)
+		walk->stats->max_dup_run = walk->run;
+}
+
+/**
+ * @brief 按照从左到右的顺序统计结点及其子树
+ *
+ * @details
+ *  写时复制模式下左边数据结点的 pnext 可能指向旧的结点，所以相同 key 的连续数据项也
+ *  通过内部结点按顺序访问数据结点来统计
+ *
+ * @param walk 遍历的状态
+ * @param node 内部结点或者数据结点
+ * @param level 结点所在的层，根结点为 0
+ * @return int 成功返回 0 ，树的层数超过 BP_STATS_MAX_LEVEL 时返回 -1
+ */
+static int bp_node_stats(bp_stats_walk_t *walk, bp_node_t *node, int level)
+{
+	bp_tree_stats_t  *stats;
+	bp_node_common_t *common;
+	bp_data_node_t   *data;
+	bp_inner_node_t  *inner;
+	unsigned char    *key;
+	int               i;
+
+	if (level >= BP_STATS_MAX_LEVEL)
+		return -1;
+
+	stats  = walk->stats;
+	common = (bp_node_common_t *)node;
+	stats->level_node_num[level] += 1;
+	stats->level_key_num[level]  += common->key_num;
+	walk->capacity[level]        += common->max_key_num;
+	stats->bytes                 += bp_node_get_size(node);
+
+	if (BP_NODE_TYPE_DATA == node->type) {
+		data = (bp_data_node_t *)node;
+		stats->data_node_num += 1;
+		stats->key_num       += common->key_num;
+		if (level + 1 > stats->height)
+			stats->height = level + 1;
+
+		for (i = 0; i < common->key_num; i++) {
+			key = bp_data_node_key(data, i);
+			if (walk->prev && 0 == bp_key_compare(walk->compare, walk->prev, key,
+												  walk->key_size)) {
+				walk->run += 1;
+			} else {
+				bp_stats_end_run(walk);
+				walk->run = 1;
+			}
+			walk->prev = key;
+		}
+
+		return 0;
+	}
+
+	// 空树的根结点上没有 key ，但是第一个指针仍然指向第一个数据结点
+	inner = (bp_inner_node_t *)node;
+	stats->inner_node_num += 1;
+	for (i = 0; i < (common->key_num > 0 ? common->key_num : 1); i++)
+		if (-1 == bp_node_stats(walk, bp_inner_node_get_child(inner, i),
+								level + 1))
+			return -1;
+
+	return 0;
+}
+
+/**
+ * @brief 统计B+树的结构
+ *
+ * @details
+ *  遍历整棵树，耗时和结点个数成正比。并发模式下统计期间会阻塞写操作
+ *
+ * @param tree B+树
+ * @param out 用于输出统计信息
+ * @return int 成功返回 0 ，树的层数超过 BP_STATS_MAX_LEVEL 时返回 -1
+ */
+int bp_tree_stats(bp_tree_t *tree, bp_tree_stats_t *out)
+{
+	bp_stats_walk_t walk;
+	int             ret;
+	int             i;
+
+	memset(out, 0, sizeof(*out));
+	memset(&walk, 0, sizeof(walk));
+	walk.stats    = out;
+	walk.compare  = ((bp_node_common_t *)tree->head)->compare;
+	walk.key_size = tree->key_size;
+
+	if (tree->sync)
+		pthread_mutex_lock(&tree->sync->write_lock);
+
+	ret = bp_node_stats(&walk, tree->head, 0);
+	bp_stats_end_run(&walk);
+	out->data_split_num  = tree->data_split_num;
+	out->inner_split_num = tree->inner_split_num;
+	out->ibuf_num        = tree->ibuf_num;
+
+	if (tree->sync)
+		pthread_mutex_unlock(&tree->sync->write_lock);
+
+	for (i = 0; i < out->height; i++)
+		out->level_fill[i] = walk.capacity[i]
+			? (double)out->level_key_num[i] / walk.capacity[i] : 0;
+
+	return ret;
+}
+
+/**
+ * @brief 返回当前线程的查找和插入计数
+ *
+ * @details
+ *  只有编译时定义了 BP_STATS 才会计数，否则总是返回 0 。计数在线程内累加，不需要同步
+ *
+ * @param out 用于输出计数
+ * @param reset 是否在输出后清零
+ */
+void bp_get_thread_stats(bp_thread_stats_t *out, int reset)
+{
+#ifdef BP_STATS
+	*out = bp_thread_stats;
+	if (reset)
+		memset(&bp_thread_stats, 0, sizeof(bp_thread_stats));
+#else
+	memset(out, 0, sizeof(*out));
+#endif
+}
+
+/**
+ * @brief 根结点分裂后创建新的根结点，新根结点的两个子结点为旧的根结点和分裂出的结点
+ *
+ * @param tree B+树
+ * @param split 根结点分裂出的结点
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_tree_grow(bp_tree_t *tree, bp_node_t *split)
+{
+	bp_inner_node_t *root;
+	bp_node_t       *children[2];
+	int              i;
+
+	root = (bp_inner_node_t *)bp_alloc_inner_node(
+		tree->allocator, tree->layout, tree->max_idx_num, tree->key_size,
+		((bp_node_common_t *)tree->head)->compare);
+	if (NULL == root)
+		return -1;
+
+	children[0] = tree->head;
+	children[1] = split;
+	for (i = 0; i < 2; i++) {
+		*bp_inner_node_child_pos(root, i) = children[i];
+		((bp_node_common_t *)children[i])->max_key(
+			children[i], bp_inner_node_key(root, i), tree->key_size);
+		root->key_total += bp_node_get_key_total(children[i]);
+	}
+	root->common.key_num = 2;
+	bp_inner_node_fit_prefix(root);
+
+	// 新的根结点初始化完成之后才能被并发的查找看到
+	__atomic_store_n(&tree->head, (bp_node_t *)root, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/**
+ * @brief 重新找出从根结点到最右侧数据结点的路径，并检查 key 是否可以直接追加到最右侧
+ *        的数据结点
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @return int 可以追加返回 1 ，否则返回 0
+ */
+static int bp_tree_find_spine(bp_tree_t *tree, unsigned char *key)
+{
+	bp_node_t       *node;
+	bp_inner_node_t *inner;
+	bp_data_node_t  *data;
+	int              depth;
+
+	node = tree->head;
+	for (depth = 0; BP_NODE_TYPE_INNER == node->type; depth++) {
+		inner = (bp_inner_node_t *)node;
+		if (BP_SPINE_MAX_DEPTH == depth || 0 == inner->common.key_num
+			|| 0 < bp_inner_node_compare_key(inner, inner->common.key_num - 1,
+											 key))
+			return 0;
+
+		tree->spine[depth] = node;
+		node = bp_inner_node_get_child(inner, inner->common.key_num - 1);
+	}
+
+	data = (bp_data_node_t *)node;
+	if (data->common.key_num > 0
+		&& 0 < bp_key_compare(data->common.compare,
+							  bp_data_node_key(data, data->common.key_num - 1),
+							  key, data->key_size))
+		return 0;
+
+	tree->spine_depth = depth;
+	tree->last_data   = node;
+
+	return 1;
+}
+
+/**
+ * @brief 把不小于树上所有 key 的被索引项直接追加到最右侧的数据结点
+ *
+ * @details
+ *  不从根结点查找，只沿着缓存的最右侧路径更新每个内部结点的最大值和 key_total 。
+ *  只用于没有读写同步的树，并且 BP_LAYOUT_PREFIX 的内部结点更新最大值时可能需要缩短
+ *  前缀，所以也不使用。最右侧的数据结点满了时返回 0 ，由正常的插入流程分裂
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param position 位置信息
+ * @return int 追加了返回 1 ，否则返回 0
+ */
+static int bp_tree_append(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	unsigned char *position)
+{
+	bp_inner_node_t *inner;
+	bp_data_node_t  *data;
+	int              i;
+
+	if (tree->sync || BP_LAYOUT_PREFIX == tree->layout)
+		return 0;
+
+	// 根结点的最大值就是树上的最大值，随机插入时只需要这一次比较
+	inner = (bp_inner_node_t *)tree->head;
+	if (0 == inner->common.key_num
+		|| 0 < bp_inner_node_compare_key(inner, inner->common.key_num - 1, key))
+		return 0;
+
+	if (0 == tree->spine_depth && !bp_tree_find_spine(tree, key))
+		return 0;
+
+	data = (bp_data_node_t *)tree->last_data;
+	if (bp_data_node_need_split(data))
+		return 0;
+
+	memcpy(bp_data_node_key(data, data->common.key_num), key, data->key_size);
+	memcpy(bp_data_node_value(data, data->common.key_num), position,
+		   data->value_size);
+	data->common.key_num   += 1;
+	data->common.generation = tree->generation;
+
+	for (i = 0; i < tree->spine_depth; i++) {
+		inner = (bp_inner_node_t *)tree->spine[i];
+		bp_inner_node_set_key(inner, inner->common.key_num - 1, key);
+		inner->key_total        += 1;
+		inner->common.generation = tree->generation;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief 插入缓冲尾部没有排序的数据项最多有多少个，超过时归并到前面排好序的部分，
+ *        查找时只需要遍历这么多个数据项
+ */
+#define BP_IBUF_SCAN_MAX 64
+
+static void bp_tree_sort_buffer(bp_tree_t *tree);
+
+/**
+ * @brief 从根结点开始插入一个被索引项及其位置信息
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param position 位置信息
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_tree_insert(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	unsigned char *position)
+{
+	bp_node_t *split;
+	int        ret;
+
+	// 结点可能分裂，缓存的最右侧路径失效
+	tree->spine_depth = 0;
+
+	ret = bp_inner_node_insert_data(tree->head, key, position, &split);
+	if (-1 == ret)
+		return -1;
+
+	// 根结点分裂时树长高一层
+	if (split && -1 == bp_tree_grow(tree, split))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * @brief 设置在数据结点的最大值之后插入导致分裂时旧结点保留的数据项的百分比
+ *
+ * @details
+ *  默认为 BP_SPLIT_FILL_DEFAULT 。 key 单调递增时 100 让除了最后一个以外的数据结点
+ *  都是满的； 50 和在中间插入时一样平均分裂。 bp_bulk_load 和 bp_insert_batch 合并
+ *  数据时不受影响
+ *
+ * @param tree B+树
+ * @param percent 旧结点保留的百分比，取值 50 到 100
+ * @return int 成功返回 0 ，参数错误返回 -1
+ */
+int bp_tree_set_split_fill(bp_tree_t *tree, int percent)
+{
+	if (percent < 50 || percent > 100)
+		return -1;
+
+	tree->split_fill = percent;
+
+	return 0;
+}
+
+/**
+ * @brief 向B+树中插入一个被索引项及其位置信息
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param position 位置信息
+ * @param position_len 位置信息的长度
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+int bp_insert(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *position,
+	int            position_len)
+{
+	unsigned char *item;
+	int            ret;
+
+	if (tree->key_size != key_len)
+		return -1;
+
+	if (tree->value_size != position_len)
+		return -1;
+
+	if (tree->frozen)
+		return -1;
+
+	BP_STAT_ADD(insert_num, 1);
+	if (tree->ibuf) {
+		if (tree->ibuf_num == tree->ibuf_cap && -1 == bp_tree_flush(tree))
+			return -1;
+
+		item = tree->ibuf + tree->ibuf_num * (tree->key_size + tree->value_size);
+		memcpy(item, key, tree->key_size);
+		memcpy(item + tree->key_size, position, tree->value_size);
+		tree->ibuf_num += 1;
+		if (tree->ibuf_num - tree->ibuf_sorted >= BP_IBUF_SCAN_MAX)
+			bp_tree_sort_buffer(tree);
+
+		return 0;
+	}
+
+	if (bp_tree_append(tree, key, position))
+		return 0;
+
+	if (-1 == bp_sync_write_begin(tree))
+		return -1;
+
+	ret = bp_tree_insert(tree, key, position);
+	bp_sync_write_end(tree);
+
+	return ret;
+}
+
+/**
+ * @brief 对按 memcmp 比较的 K|V 数组从 key 的最后一个字节开始逐字节做基数排序
+ *
+ * @details
+ *  每一趟按一个字节稳定地分配到 256 个桶中，所有数据项这个字节都相同时跳过这一趟。
+ *  8 字节以内的 key 最多 8 趟，比归并排序 log2(item_num) 趟的比较和复制少
+ *
+ * @param items 要排序的数组
+ * @param tmp 排序用的临时空间，和 items 一样大
+ * @param item_num 数据项的个数
+ * @param item_size 一个数据项的长度
+ * @param key_size 被索引项的长度
+ * @return unsigned char* 排好序的数组，为 items 或者 tmp
+ */
+static unsigned char *bp_radix_sort_items(
+	unsigned char *items,
+	unsigned char *tmp,
+	int            item_num,
+	int            item_size,
+	int            key_size)
+{
+	unsigned char *src;
+	unsigned char *dst;
+	unsigned char *swap;
+	int            count[256];
+	int            byte;
+	int            sum;
+	int            num;
+	int            i;
+
+	src = items;
+	dst = tmp;
+	for (byte = key_size - 1; byte >= 0; byte--) {
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < item_num; i++)
+			count[src[i * item_size + byte]] += 1;
+
+		if (count[src[byte]] == item_num)
+			continue;
+
+		for (sum = 0, i = 0; i < 256; i++) {
+			num       = count[i];
+			count[i]  = sum;
+			sum      += num;
+		}
+
+		for (i = 0; i < item_num; i++)
+			memcpy(dst + (count[src[i * item_size + byte]]++) * item_size,
+				   src + i * item_size, item_size);
+
+		swap = src;
+		src  = dst;
+		dst  = swap;
+	}
+
+	return src;
+}
+
+/**
+ * @brief 对 K|V 数组按被索引项做稳定的排序，按 memcmp 比较的短 key 用基数排序，
+ *        其它的用归并排序
+ *
+ * @param items 要排序的数组
+ * @param tmp 排序用的临时空间，和 items 一样大
+ * @param item_num 数据项的个数
+ * @param key_size 被索引项的长度
+ * @param value_size 位置信息的长度
+ * @param compare 比较 key 值的函数
+ * @return unsigned char* 排好序的数组，为 items 或者 tmp
+ */
+static unsigned char *bp_sort_items(
+	unsigned char *items,
+	unsigned char *tmp,
+	int            item_num,
+	int            key_size,
+	int            value_size,
+	bp_compare_f   compare)
+{
+	unsigned char *src;
+	unsigned char *dst;
+	unsigned char *swap;
+	int            item_size;
+	int            width;
+	int            low;
+	int            mid;
+	int            high;
+	int            a;
+	int            b;
+	int            i;
+
+	item_size = key_size + value_size;
+	for (i = 1; i < item_num; i++)
+		if (0 < bp_key_compare(compare, items + (i - 1) * item_size,
+							   items + i * item_size, key_size))
+			break;
+
+	// 批量插入的数据通常已经是有序的
+	if (i >= item_num)
+		return items;
+
+	if (NULL == compare && key_size <= 8)
+		return bp_radix_sort_items(items, tmp, item_num, item_size, key_size);
+
+	src = items;
+	dst = tmp;
+	for (width = 1; width < item_num; width *= 2) {
+		for (low = 0; low < item_num; low += 2 * width) {
+			mid  = low + width < item_num ? low + width : item_num;
+			high = low + 2 * width < item_num ? low + 2 * width : item_num;
+			a    = low;
+			b    = mid;
+			for (i = low; i < high; i++) {
+				if (a < mid && (b >= high
+								|| 0 >= bp_key_compare(compare,
+													   src + a * item_size,
+													   src + b * item_size,
+													   key_size)))
+					memcpy(dst + i * item_size, src + (a++) * item_size,
+						   item_size);
+				else
+					memcpy(dst + i * item_size, src + (b++) * item_size,
+						   item_size);
+			}
+		}
+
+		swap = src;
+		src  = dst;
+		dst  = swap;
+	}
+
+	return src;
+}
+
+/**
+ * @brief 把一段有序的数据合并到数据结点中，只移动一遍数据
+ *
+ * @param data 数据结点
+ * @param items 有序的 K|V 数组
+ * @param item_num items 中数据项的个数
+ * @param bound 可以插入 data 的最大的 key 值， NULL 表示不限
+ * @return int 合并的数据项的个数，最多合并到数据结点被填满
+ */
+static int bp_data_node_merge_run(
+	bp_data_node_t *data,
+	unsigned char  *items,
+	int             item_num,
+	unsigned char  *bound)
+{
+	unsigned char *new_item;
+	int            item_size;
+	int            take;
+	int            dst;
+	int            pos;
+	int            a;
+	int            b;
+
+	item_size = bp_data_node_get_item_size(data);
+	take      = data->common.max_key_num - data->common.key_num;
+	take      = take < item_num ? take : item_num;
+	if (bound)
+		take = bp_upper_bound(items, take, item_size, bound, data->key_size, 0,
+							  data->common.compare, data->common.key_type);
+	if (take <= 0)
+		return 0;
+
+	bp_node_write_lock((bp_node_t *)data);
+
+	// 从后往前合并，相同的 key 值新数据放在旧数据的后面。每个新数据用二分查找找到
+	// 旧数据中大于它的部分，一次移动到最终的位置
+	a   = data->common.key_num;
+	b   = take - 1;
+	dst = data->common.key_num + take;
+	while (b >= 0) {
+		new_item = items + b * item_size;
+		pos      = bp_upper_bound(data->content, a, bp_data_node_key_stride(data),
+								  new_item, data->key_size, 0,
+								  data->common.compare, data->common.key_type);
+		dst     -= a - pos;
+		bp_node_move_items((bp_node_t *)data, dst, (bp_node_t *)data, pos,
+						   a - pos);
+		a        = pos;
+		dst     -= 1;
+		bp_data_node_put_items(data, dst, new_item, 1);
+		b       -= 1;
+	}
+
+	data->common.key_num += take;
+
+	return take;
+}
+
+/**
+ * @brief 沿着插入路径把有序的数据依次合并到子树的数据结点中
+ *
+ * @details
+ *  从第一个数据项的插入路径开始，一个子结点合并完之后继续把后面的数据合并到下一个
+ *  子结点，直到超出 bound 或者遇到已经满了的数据结点，一次从根结点向下的遍历可以
+ *  合并连续的多个数据结点。不会在这里做结点分裂，数据结点已经满了的时候停止，由
+ *  调用方走单个插入的流程
+ *
+ * @param inner 内部结点
+ * @param items 有序的 K|V 数组
+ * @param item_num items 中数据项的个数
+ * @param item_size items 中一个数据项的长度
+ * @param bound 可以插入 inner 的最大的 key 值， NULL 表示不限
+ * @param single 为 1 时只合并一个数据结点，并发模式下用来缩短持有写锁的时间
+ * @return int 插入的数据项的个数
+ */
+static int bp_inner_node_insert_run(
+	bp_inner_node_t *inner,
+	unsigned char   *items,
+	int              item_num,
+	int              item_size,
+	unsigned char   *bound,
+	int              single)
+{
+	bp_node_common_t *child;
+	unsigned char    *child_key;
+	unsigned char    *item;
+	int               run_num;
+	int               found_idx;
+	int               beyond;
+	int               total;
+	int               num;
+
+	if (0 == inner->common.key_num)
+		return 0;
+
+	for (total = 0; total < item_num; total += num) {
+		item    = items + total * item_size;
+		run_num = item_num - total;
+		if (bound && total > 0 &&
+			0 < bp_key_compare(inner->common.compare, item, bound,
+							   inner->key_size))
+			break;
+
+		bp_inner_node_search_last(inner, item, &found_idx);
+
+		// 和 bp_inner_node_insert_data 一样，比所有 key 都大时插入到最右侧的子树
+		beyond = found_idx == inner->common.key_num;
+		if (beyond)
+			found_idx -= 1;
+
+		child_key = beyond ? bound : bp_inner_node_key(inner, found_idx);
+		if (BP_LAYOUT_PREFIX == inner->common.layout) {
+			// 结点上只保存了后缀，不能作为上限传给子结点，这里直接截掉不以前缀开头和
+			// 超出子结点范围的数据。第一个数据不以前缀开头时由单个插入的流程缩短前缀
+			if (0 != memcmp(item, inner->content, inner->prefix_len))
+				break;
+
+			run_num = bp_upper_bound(item, run_num, item_size, inner->content,
+									 inner->prefix_len, 0, NULL,
+									 BP_KEY_TYPE_COMPARE);
+			if (!beyond)
+				run_num = bp_upper_bound(item, run_num, item_size, child_key,
+										 bp_inner_node_key_len(inner),
+										 inner->prefix_len, NULL,
+										 inner->common.key_type);
+			child_key = NULL;
+		}
+
+		child = (bp_node_common_t *)bp_inner_node_modify_child(inner, found_idx);
+		if (NULL == child)
+			break;
+
+		if (BP_NODE_TYPE_DATA == child->type)
+			num = bp_data_node_merge_run((bp_data_node_t *)child, item, run_num,
+										 child_key);
+		else
+			num = bp_inner_node_insert_run((bp_inner_node_t *)child, item,
+										   run_num, item_size, child_key,
+										   single);
+
+		if (beyond && num > 0) {
+			bp_node_write_lock((bp_node_t *)inner);
+			bp_inner_node_update_key(inner, found_idx, (bp_node_t *)child);
+		}
+		bp_node_touch((bp_node_t *)inner);
+		inner->key_total += num;
+
+		if (0 == num || single)
+			return total + num;
+	}
+
+	return total;
+}
+
+/**
+ * @brief 把有序的数据合并到B+树中
+ *
+ * @details
+ *  每次从根结点沿着插入路径把数据合并到连续的数据结点中；数据结点满了的时候才按
+ *  单个插入的流程分裂结点，然后继续批量合并剩下的数据
+ *
+ * @param tree B+树
+ * @param items 有序的 K|V 数组
+ * @param item_num items 中数据项的个数
+ * @return int 插入的数据项的个数，小于 item_num 表示失败，此时 items 中前面的数据项
+ *             已经插入到树上
+ */
+static int bp_tree_merge_items(bp_tree_t *tree, unsigned char *items, int item_num)
+{
+	unsigned char *item;
+	int            item_size;
+	int            num;
+	int            i;
+
+	// 并发模式下每合并完一个数据结点就释放写锁，不会让查找等待整个批量插入完成；
+	// 写时复制模式下整个批量插入完成后才发布
+	if (-1 == bp_sync_write_begin(tree))
+		return 0;
+	tree->spine_depth = 0;
+
+	item_size = tree->key_size + tree->value_size;
+	for (i = 0; i < item_num; i += num) {
+		if (tree->sync)
+			bp_sync_write_release(tree->sync);
+
+		item = items + i * item_size;
+		num  = bp_inner_node_insert_run((bp_inner_node_t *)tree->head, item,
+										item_num - i, item_size, NULL,
+										NULL != tree->sync);
+		if (num > 0)
+			continue;
+
+		// 数据结点已经满了，插入一个数据让它分裂，剩下的数据可以继续批量合并
+		if (-1 == bp_tree_insert(tree, item, item + tree->key_size))
+			break;
+		num = 1;
+	}
+	bp_sync_write_end(tree);
+
+	return i;
+}
+
+/**
+ * @brief 向B+树中批量插入被索引项及其位置信息
+ *
+ * @details
+ *  先对数据排序，然后按 bp_tree_merge_items 一次性合并到数据结点中。插入缓冲中的
+ *  数据比这一批早，先合并到树上
+ *
+ * @param tree B+树
+ * @param keys 被索引项，长度为 item_num * tree->key_size
+ * @param positions 位置信息，长度为 item_num * tree->value_size
+ * @param item_num 要插入的数据个数
+ * @return int 成功返回 0 ，否则返回 -1 ，失败时可能已经插入了一部分数据
+ */
+int bp_insert_batch(
+	bp_tree_t     *tree,
+	unsigned char *keys,
+	unsigned char *positions,
+	int            item_num)
+{
+	unsigned char *buf;
+	unsigned char *items;
+	int            item_size;
+	int            i;
+
+	if (item_num <= 0)
+		return 0;
+
+	if (tree->frozen || -1 == bp_tree_flush(tree))
+		return -1;
+
+	BP_STAT_ADD(insert_num, item_num);
+	item_size = tree->key_size + tree->value_size;
+	buf = malloc(2 * item_num * item_size);
+	if (NULL == buf)
+		return -1;
+
+	for (i = 0; i < item_num; i++) {
+		memcpy(buf + i * item_size, keys + i * tree->key_size, tree->key_size);
+		memcpy(buf + i * item_size + tree->key_size,
+			   positions + i * tree->value_size, tree->value_size);
+	}
+
+	items = bp_sort_items(buf, buf + item_num * item_size, item_num,
+						  tree->key_size, tree->value_size,
+						  ((bp_node_common_t *)tree->head)->compare);
+	i = bp_tree_merge_items(tree, items, item_num);
+	free(buf);
+
+	return i == item_num ? 0 : -1;
+}
+
+/**
+ * @brief 设置插入缓冲的大小， 0 表示关闭插入缓冲
+ *
+ * @details
+ *  开启插入缓冲后 bp_insert 只把数据追加到缓冲中，缓冲满了之后按
+ *  bp_tree_merge_items 一次性合并到数据结点，每个数据结点上的数据只移动一遍，随机的
+ *  key 也按顺序访问树上的结点。
+ *
+ *  缓冲的前 ibuf_sorted 个数据项是排好序的，后面追加的数据项超过 BP_IBUF_SCAN_MAX 个
+ *  时归并到前面，所以查找在有序的部分二分查找，再遍历不超过 BP_IBUF_SCAN_MAX 个没有
+ *  排序的数据项。缓冲中的数据都比树上的晚插入，相同的 key 仍然按插入的顺序返回。
+ *  顺序统计和游标先把整个缓冲排好序，再和树上的数据一起按顺序计算，这些操作都不修改
+ *  树。删除、替换、批量插入、保存、并行扫描、导出增量和冻结之前会先合并缓冲中的数据
+ *
+ * @param tree B+树，不能是并发模式或者写时复制模式的树
+ * @param item_num 缓冲中最多保存的数据项的个数
+ * @return int 成功返回 0 ，参数错误或者内存不足返回 -1
+ */
+int bp_tree_set_insert_buffer(bp_tree_t *tree, int item_num)
+{
+	unsigned char *ibuf;
+
+	if (item_num < 0 || tree->sync || tree->frozen)
+		return -1;
+
+	if (-1 == bp_tree_flush(tree))
+		return -1;
+
+	ibuf = NULL;
+	if (item_num > 0) {
+		ibuf = malloc(2 * item_num * (tree->key_size + tree->value_size));
+		if (NULL == ibuf)
+			return -1;
+	}
+
+	free(tree->ibuf);
+	tree->ibuf        = ibuf;
+	tree->ibuf_cap    = item_num;
+	tree->ibuf_sorted = 0;
+
+	return 0;
+}
+
+/**
+ * @brief 把插入缓冲尾部没有排序的数据项归并到前面排好序的部分
+ *
+ * @details
+ *  尾部的数据项先排序到缓冲后一半的临时空间，再从后往前归并，只移动比尾部最小的
+ *  key 大的数据项。相同的 key 尾部的数据插入得晚，放在后面
+ *
+ * @param tree B+树
+ */
+static void bp_tree_sort_buffer(bp_tree_t *tree)
+{
+	unsigned char *tmp;
+	unsigned char *sorted;
+	bp_compare_f   compare;
+	int            item_size;
+	int            i;
+	int            j;
+	int            k;
+
+	if (tree->ibuf_sorted == tree->ibuf_num)
+		return;
+
+	compare   = ((bp_node_common_t *)tree->head)->compare;
+	item_size = tree->key_size + tree->value_size;
+	tmp       = tree->ibuf + tree->ibuf_cap * item_size;
+	j         = tree->ibuf_num - tree->ibuf_sorted;
+	sorted    = bp_sort_items(tree->ibuf + tree->ibuf_sorted * item_size, tmp, j,
+							  tree->key_size, tree->value_size, compare);
+	if (sorted != tmp)
+		memcpy(tmp, sorted, j * item_size);
+
+	i = tree->ibuf_sorted - 1;
+	j = j - 1;
+	k = tree->ibuf_num - 1;
+	for (; j >= 0; k--) {
+		if (i >= 0 && 0 < bp_key_compare(compare, tree->ibuf + i * item_size,
+										 tmp + j * item_size, tree->key_size))
+			memcpy(tree->ibuf + k * item_size, tree->ibuf + (i--) * item_size,
+				   item_size);
+		else
+			memcpy(tree->ibuf + k * item_size, tmp + (j--) * item_size, item_size);
+	}
+
+	tree->ibuf_sorted = tree->ibuf_num;
+}
+
+/**
+ * @brief 返回插入缓冲中小于 key 的数据项个数，调用之前缓冲已经整体排好序
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param or_equal 为 1 时统计小于等于 key 的个数
+ * @return int 数据项的个数
+ */
+static int bp_tree_buffer_rank(bp_tree_t *tree, unsigned char *key, int or_equal)
+{
+	bp_node_common_t *head;
+
+	if (0 == tree->ibuf_num)
+		return 0;
+
+	head = (bp_node_common_t *)tree->head;
+	if (or_equal)
+		return bp_upper_bound(tree->ibuf, tree->ibuf_num,
+							  tree->key_size + tree->value_size, key,
+							  tree->key_size, 0, head->compare, head->key_type);
+
+	return bp_lower_bound(tree->ibuf, tree->ibuf_num,
+						  tree->key_size + tree->value_size, key, tree->key_size,
+						  0, head->compare, head->key_type);
+}
+
+/**
+ * @brief 把插入缓冲中的数据合并到树上
+ *
+ * @param tree B+树
+ * @return int 成功返回 0 ，失败返回 -1 ，此时没有合并的数据仍然留在缓冲中
+ */
+int bp_tree_flush(bp_tree_t *tree)
+{
+	int item_size;
+	int num;
+
+	if (0 == tree->ibuf_num)
+		return 0;
+
+	bp_tree_sort_buffer(tree);
+	item_size = tree->key_size + tree->value_size;
+	num       = bp_tree_merge_items(tree, tree->ibuf, tree->ibuf_num);
+
+	tree->ibuf_num    -= num;
+	tree->ibuf_sorted  = tree->ibuf_num;
+	memmove(tree->ibuf, tree->ibuf + num * item_size, tree->ibuf_num * item_size);
+
+	return tree->ibuf_num > 0 ? -1 : 0;
+}
+
+/**
+ * @brief 在插入缓冲中按插入的顺序查找被索引项的位置信息
+ *
+ * @details
+ *  有序部分的数据项都比没有排序的部分早插入，先在有序部分二分查找，再遍历没有排序的
+ *  部分
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param values_out 用于输出位置信息，长度至少为 max_num * tree->value_size
+ * @param max_num values_out 最多可以保存的位置信息的个数
+ * @return int 输出的位置信息的个数
+ */
+static int bp_tree_search_buffer(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	unsigned char *values_out,
+	int            max_num)
+{
+	bp_node_common_t *head;
+	unsigned char    *item;
+	int               item_size;
+	int               found_num;
+	int               i;
+
+	if (0 == tree->ibuf_num)
+		return 0;
+
+	head      = (bp_node_common_t *)tree->head;
+	item_size = tree->key_size + tree->value_size;
+	found_num = 0;
+	i         = bp_lower_bound(tree->ibuf, tree->ibuf_sorted, item_size, key,
+							   tree->key_size, 0, head->compare, head->key_type);
+	for (; i < tree->ibuf_sorted && found_num < max_num; i++, found_num++) {
+		item = tree->ibuf + i * item_size;
+		if (0 != bp_key_compare(head->compare, item, key, tree->key_size))
+			break;
+
+		memcpy(values_out + found_num * tree->value_size, item + tree->key_size,
+			   tree->value_size);
+	}
+
+	for (i = tree->ibuf_sorted; i < tree->ibuf_num && found_num < max_num; i++) {
+		item = tree->ibuf + i * item_size;
+		if (0 != bp_key_compare(head->compare, item, key, tree->key_size))
+			continue;
+
+		memcpy(values_out + found_num * tree->value_size, item + tree->key_size,
+			   tree->value_size);
+		found_num += 1;
+	}
+
+	return found_num;
+}
+
+/**
+ * @brief 把 total 个数据平均分配到每个最多保存 fill 个数据的结点上
+ *
+ * @param total 数据的个数
+ * @param fill 每个结点最多保存的数据个数
+ * @param node_num 用于输出需要的结点个数
+ * @param base 用于输出每个结点至少保存的数据个数，前 total % node_num 个结点多保存一个
+ */
+static void bp_bulk_divide(int total, int fill, int *node_num, int *base)
+{
+	*node_num = (total + fill - 1) / fill;
+	*base     = total / *node_num;
+}
+
+/**
+ * @brief 批量构建时释放已经创建的结点
+ *
+ * @param level 当前层的结点，前 built 个是新建的上层结点，从 consumed 开始是还没有
+ *              被上层结点引用的结点
+ * @param built 新建的上层结点的个数
+ * @param consumed 已经被上层结点引用的结点的个数
+ * @param num 当前层结点的个数
+ */
+static void bp_bulk_free_level(
+	bp_node_t **level,
+	int         built,
+	int         consumed,
+	int         num)
+{
+	int i;
+
+	for (i = 0; i < built; i++)
+		bp_node_destroy(level[i]);
+	for (i = consumed; i < num; i++)
+		bp_node_destroy(level[i]);
+}
+
+/**
+ * @brief 自底向上构建内部结点，直到只剩下一个根结点
+ *
+ * @param tree B+树
+ * @param level 最底层的数据结点，构建时会被每一层新建的内部结点覆盖
+ * @param num 数据结点的个数
+ * @param fill_factor 结点的填充率，取值为 1 到 100
+ * @return bp_node_t* 根结点，失败返回 NULL ，此时 level 上的所有结点都已经被释放
+ */
+static bp_node_t *bp_bulk_build_inner(
+	bp_tree_t  *tree,
+	bp_node_t **level,
+	int         num,
+	int         fill_factor)
+{
+	bp_inner_node_t *inner;
+	bp_node_t       *child;
+	bp_compare_f     compare;
+	int              fill;
+	int              inner_num;
+	int              base;
+	int              consumed;
+	int              i;
+	int              j;
+
+	// 每个内部结点至少要有两个子结点，才能保证每构建一层结点的个数都会减少
+	fill = tree->max_idx_num * fill_factor / 100;
+	fill = fill < 2 ? 2 : fill;
+
+	compare = ((bp_node_common_t *)tree->head)->compare;
+	do {
+		bp_bulk_divide(num, fill, &inner_num, &base);
+		consumed = 0;
+		for (i = 0; i < inner_num; i++) {
+			inner = (bp_inner_node_t *)bp_alloc_inner_node(
+				tree->allocator, tree->layout, tree->max_idx_num,
+				tree->key_size, compare);
+			if (NULL == inner) {
+				bp_bulk_free_level(level, i, consumed, num);
+
+				return NULL;
+			}
+
+			inner->common.key_num = base + (i < num % inner_num ? 1 : 0);
+			for (j = 0; j < inner->common.key_num; j++) {
+				child = level[consumed + j];
+				*bp_inner_node_child_pos(inner, j) = child;
+				((bp_node_common_t *)child)->max_key(
+					child, bp_inner_node_key(inner, j), tree->key_size);
+				inner->key_total += bp_node_get_key_total(child);
+			}
+
+			bp_inner_node_fit_prefix(inner);
+
+			consumed += inner->common.key_num;
+			level[i]  = (bp_node_t *)inner;
+		}
+
+		num = inner_num;
+	} while (num > 1);
+
+	return level[0];
+}
+
+/**
+ * @brief 并行构建时一个线程负责的一段连续的数据结点
+ *
+ */
+typedef struct bp_bulk_part {
+	bp_tree_t      *tree; /** 正在构建的B+树 */
+	bp_node_t     **level; /** 所有的数据结点 */
+	unsigned char  *items; /** 所有的 K|V 数据项 */
+	int             item_num; /** 数据项的总个数 */
+	int             data_num; /** 数据结点的总个数 */
+	int             base; /** 每个数据结点至少保存的数据个数 */
+	int             first; /** 第一个数据结点的下标 */
+	int             last; /** 最后一个数据结点之后的下标 */
+	int             ret; /** 成功为 0 ，数据不是有序的或者内存不足为 -1 */
+	pthread_t       thread; /** 构建这一段的线程 */
+} bp_bulk_part_t;
+
+/**
+ * @brief 返回第 idx 个数据结点上第一个数据项的下标
+ *
+ * @param part 构建的数据结点
+ * @param idx 数据结点的下标
+ * @return int 数据项的下标
+ */
+static inline int bp_bulk_first_item(bp_bulk_part_t *part, int idx)
+{
+	int extra;
+
+	extra = part->item_num % part->data_num;
+
+	return idx * part->base + (idx < extra ? idx : extra);
+}
+
+/**
+ * @brief 检查一段数据是否有序，创建这一段的数据结点并用 pnext 连接起来
+ *
+ * @details
+ *  第一个数据结点使用创建树时的数据结点，这样 tree->data 始终指向最左侧的数据结点。
+ *  这一段的第一个数据项和上一段的最后一个数据项也要比较，各段连接起来之后仍然有序
+ *
+ * @param arg 构建的数据结点 bp_bulk_part_t
+ * @return void* NULL
+ */
+static void *bp_bulk_build_part(void *arg)
+{
+	bp_bulk_part_t *part;
+	bp_tree_t      *tree;
+	bp_data_node_t *data;
+	bp_data_node_t *prev;
+	bp_compare_f    compare;
+	int             item_size;
+	int             from;
+	int             to;
+	int             i;
+
+	part      = arg;
+	tree      = part->tree;
+	compare   = ((bp_node_common_t *)tree->head)->compare;
+	item_size = tree->key_size + tree->value_size;
+
+	from = bp_bulk_first_item(part, part->first);
+	to   = bp_bulk_first_item(part, part->last);
+	for (i = from > 0 ? from : 1; i < to; i++)
+		if (0 < bp_key_compare(compare, part->items + (i - 1) * item_size,
+							   part->items + i * item_size, tree->key_size)) {
+			part->ret = -1;
+
+			return NULL;
+		}
+
+	prev = NULL;
+	for (i = part->first; i < part->last; i++) {
+		data = i == 0 ? (bp_data_node_t *)tree->data
+			: (bp_data_node_t *)bp_alloc_data_node(
+				tree->allocator, tree->layout, tree->max_data_num,
+				tree->max_idx_num / 2, tree->key_size, tree->value_size,
+				compare);
+		if (NULL == data) {
+			part->ret = -1;
+
+			return NULL;
+		}
+
+		from                 = bp_bulk_first_item(part, i);
+		data->common.key_num = bp_bulk_first_item(part, i + 1) - from;
+		bp_data_node_put_items(data, 0, part->items + from * item_size,
+							   data->common.key_num);
+
+		if (prev)
+			bp_data_node_set_pnext(prev, data);
+		prev           = data;
+		part->level[i] = (bp_node_t *)data;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief 用有序的数据一次性构建一棵B+树
+ *
+ * @details
+ *  同 bp_parallel_bulk_load ，只使用当前线程
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @param items 按被索引项从小到大排列的 K|V 数组
+ * @param item_num items 中数据项的个数
+ * @param fill_factor 结点的填充率，取值为 1 到 100 ，为 100 时每个结点都会被填满
+ * @return bp_tree_t* 创建的B+树，参数错误、 items 不是有序的或内存不足时返回 NULL
+ */
+bp_tree_t *bp_bulk_load(
+	int            max_idx_num,
+	int            max_data_num,
+	int            key_size,
+	int            value_size,
+	bp_compare_f   compare,
+	unsigned char *items,
+	int            item_num,
+	int            fill_factor)
+{
+	return bp_parallel_bulk_load(max_idx_num, max_data_num, key_size, value_size,
+								 compare, items, item_num, fill_factor, 1);
+}
+
+/**
+ * @brief 用有序的数据多线程一次性构建一棵B+树
+ *
+ * @details
+ *  数据按照数据结点的格式保存为连续的 K|V 数组。先按填充率算出每个数据结点保存的
+ *  数据，然后把数据结点平均分成 thread_num 段，每个线程检查一段数据是否有序、复制到
+ *  这一段的数据结点上并用 pnext 连接起来；所有线程完成后把相邻两段的 pnext 连接
+ *  起来，再用每个结点的最大 key 值自底向上构建内部结点。内部结点的个数只有数据结点的
+ *  1 / max_idx_num 左右，在当前线程上构建
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数，会在多个线程上同时调用
+ * @param items 按被索引项从小到大排列的 K|V 数组
+ * @param item_num items 中数据项的个数
+ * @param fill_factor 结点的填充率，取值为 1 到 100 ，为 100 时每个结点都会被填满
+ * @param thread_num 构建数据结点的线程个数，包括当前线程
+ * @return bp_tree_t* 创建的B+树，参数错误、 items 不是有序的或内存不足时返回 NULL
+ */
+bp_tree_t *bp_parallel_bulk_load(
+	int            max_idx_num,
+	int            max_data_num,
+	int            key_size,
+	int            value_size,
+	bp_compare_f   compare,
+	unsigned char *items,
+	int            item_num,
+	int            fill_factor,
+	int            thread_num)
+{
+	bp_bulk_part_t  *parts;
+	bp_tree_t       *tree;
+	bp_node_t      **level;
+	bp_node_t       *root;
+	int              fill;
+	int              data_num;
+	int              base;
+	int              ret;
+	int              i;
+
+	if (fill_factor <= 0 || fill_factor > 100 || thread_num <= 0)
+		return NULL;
+
+	tree = bp_create_tree(max_idx_num, max_data_num, key_size, value_size,
+						  compare);
+	if (NULL == tree || item_num <= 0)
+		return tree;
+
+	fill = max_data_num * fill_factor / 100;
+	fill = fill < 1 ? 1 : fill;
+	bp_bulk_divide(item_num, fill, &data_num, &base);
+	thread_num = thread_num < data_num ? thread_num : data_num;
+
+	level = calloc(data_num, sizeof(bp_node_t *));
+	parts = calloc(thread_num, sizeof(bp_bulk_part_t));
+	if (NULL == level || NULL == parts) {
+		free(level);
+		free(parts);
+		bp_destroy_tree(tree);
+
+		return NULL;
+	}
+
+	for (i = 0; i < thread_num; i++) {
+		parts[i].tree     = tree;
+		parts[i].level    = level;
+		parts[i].items    = items;
+		parts[i].item_num = item_num;
+		parts[i].data_num = data_num;
+		parts[i].base     = base;
+		parts[i].first    = (int64_t)data_num * i / thread_num;
+		parts[i].last     = (int64_t)data_num * (i + 1) / thread_num;
+	}
+
+	// 创建线程失败时在当前线程上构建这一段
+	for (i = 1; i < thread_num; i++)
+		if (0 != pthread_create(&parts[i].thread, NULL, bp_bulk_build_part,
+								&parts[i])) {
+			bp_bulk_build_part(&parts[i]);
+			parts[i].thread = pthread_self();
+		}
+	bp_bulk_build_part(&parts[0]);
+
+	ret = parts[0].ret;
+	for (i = 1; i < thread_num; i++) {
+		if (!pthread_equal(parts[i].thread, pthread_self()))
+			pthread_join(parts[i].thread, NULL);
+		ret |= parts[i].ret;
+	}
+
+	// 把每一段的第一个数据结点连接到上一段的最后一个数据结点之后
+	for (i = 1; 0 == ret && i < thread_num; i++)
+		bp_data_node_set_pnext((bp_data_node_t *)level[parts[i].first - 1],
+							   (bp_data_node_t *)level[parts[i].first]);
+	free(parts);
+
+	// 有一段失败时释放所有已经创建的数据结点，第一个数据结点由 bp_destroy_tree 释放
+	if (0 != ret) {
+		for (i = 1; i < data_num; i++)
+			if (level[i])
+				bp_node_free(level[i]);
+		free(level);
+		bp_data_node_set_pnext((bp_data_node_t *)tree->data, NULL);
+		bp_destroy_tree(tree);
+
+		return NULL;
+	}
+
+	root = bp_bulk_build_inner(tree, level, data_num, fill_factor);
+	free(level);
+	if (NULL == root) {
+		bp_node_free(tree->head);
+		free(tree);
+
+		return NULL;
+	}
+
+	bp_node_free(tree->head);
+	tree->head = root;
+
+	return tree;
+}
+
+/**
+ * @brief 把数据结点上的 key 按 Eytzinger 顺序复制到 frozen 上
+ *
+ * @details
+ *  frozen 上保存第 0 到 key_num 个位置的 key ，第 0 个不使用，按中序遍历的顺序
+ *  依次填入结点上排好序的 key 。 K|V 数据项和 pnext 保持不变，游标和
+ *  bp_cursor_next_run 仍然按原来的顺序访问
+ *
+ * @param data 数据结点
+ * @param k Eytzinger 位置
+ * @param idx 下一个要填入的数据项的下标
+ */
+static void bp_data_node_fill_frozen(bp_data_node_t *data, int k, int *idx)
+{
+	if (k > data->common.key_num)
+		return;
+
+	bp_data_node_fill_frozen(data, 2 * k, idx);
+	memcpy(data->frozen + k * data->key_size, bp_data_node_key(data, *idx),
+		   data->key_size);
+	*idx += 1;
+	bp_data_node_fill_frozen(data, 2 * k + 1, idx);
+}
+
+/**
+ * @brief 为数据结点生成 Eytzinger 顺序的 key
+ *
+ * @param data 数据结点
+ * @return int 成功返回 0 ，分配内存失败返回 -1
+ */
+static int bp_data_node_freeze(bp_data_node_t *data)
+{
+	void *frozen;
+	int   idx;
+
+	if (0 != posix_memalign(&frozen, 64,
+							(data->common.key_num + 1) * data->key_size))
+		return -1;
+
+	data->frozen = frozen;
+
+	idx = 0;
+	bp_data_node_fill_frozen(data, 1, &idx);
+
+	return 0;
+}
+
+/**
+ * @brief 把B+树恢复为可以修改的状态，释放所有数据结点上 Eytzinger 顺序的 key
+ *
+ * @param tree B+树
+ */
+void bp_thaw(bp_tree_t *tree)
+{
+	bp_data_node_t *data;
+
+	for (data = (bp_data_node_t *)tree->data; data;
+		 data = bp_data_node_get_pnext(data)) {
+		free(data->frozen);
+		data->frozen = NULL;
+	}
+
+	tree->frozen = 0;
+}
+
+/**
+ * @brief 冻结B+树，之后只能查找
+ *
+ * @details
+ *  每个数据结点上的 key 按 Eytzinger （广度优先）顺序再保存一份，结点内查找每一层
+ *  只比较一次，没有分支，并且提前预取后面几层所在的缓存行，而不是在排好序的 key 上
+ *  二分查找。 K|V 数据项保持排好序的顺序，所以游标和 pnext 的语义不变。冻结期间插入
+ *  和删除返回 -1 ，需要修改时先调用 bp_thaw 。并发模式的树上查找不加锁，不能安全地
+ *  释放冻结的数据，所以不支持
+ *
+ * @param tree B+树
+ * @return int 成功返回 0 ，并发模式的树或者分配内存失败返回 -1
+ */
+int bp_freeze(bp_tree_t *tree)
+{
+	bp_data_node_t *data;
+
+	if (tree->sync)
+		return -1;
+
+	if (tree->frozen)
+		return 0;
+
+	if (-1 == bp_tree_flush(tree))
+		return -1;
+
+	for (data = (bp_data_node_t *)tree->data; data;
+		 data = bp_data_node_get_pnext(data)) {
+		if (data->common.key_num > 0 && -1 == bp_data_node_freeze(data)) {
+			bp_thaw(tree);
+
+			return -1;
+		}
+	}
+
+	tree->frozen = 1;
+
+	return 0;
+}
+
+/**
+ * @brief 从根结点开始查找 key 所在的第一个数据结点
+ *
+ * @details
+ *  按照结点类型循环向下查找，不经过 bp_node_common_t 上的函数指针。内部结点上每个
+ *  P-K 对中的 K 是 P 指向的子树的最大值，所以第一个大于等于 key 的 K 对应的子树就是
+ *  key 可能出现的最左边的子树
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @return bp_data_node_t* key 可能所在的第一个数据结点，key 比树上所有的数据都大时返回
+ *                         NULL
+ */
+static bp_data_node_t *bp_tree_find_data_node(bp_tree_t *tree, unsigned char *key)
+{
+	bp_node_t       *node;
+	bp_inner_node_t *inner;
+	int              idx;
+
+	node = tree->head;
+	while (BP_NODE_TYPE_INNER == node->type) {
+		inner = (bp_inner_node_t *)node;
+		idx   = bp_inner_node_lower_bound(inner, inner->common.key_num, key);
+		if (idx == inner->common.key_num)
+			return NULL;
+
+		node = bp_inner_node_get_child(inner, idx);
+	}
+
+	return (bp_data_node_t *)node;
+}
+
+/**
+ * @brief 从快照的根结点开始找到 key 所在的第一个数据结点，并记下经过的路径
+ *
+ * @param path 用于输出经过的路径
+ * @param root 快照的根结点
+ * @param key 被索引项， NULL 表示找最左侧的数据结点
+ * @return bp_data_node_t* 数据结点，所有被索引项都比 key 小或者树是空的返回 NULL
+ */
+static bp_data_node_t *bp_path_find(
+	bp_path_t     *path,
+	bp_node_t     *root,
+	unsigned char *key)
+{
+	bp_node_t       *node;
+	bp_inner_node_t *inner;
+	int              idx;
+
+	path->depth = 0;
+	node        = root;
+	while (BP_NODE_TYPE_INNER == node->type) {
+		inner = (bp_inner_node_t *)node;
+		idx   = 0;
+		if (key)
+			idx = bp_inner_node_lower_bound(inner, inner->common.key_num, key);
+		if (idx == inner->common.key_num || BP_MAX_DEPTH == path->depth)
+			return NULL;
+
+		path->nodes[path->depth] = inner;
+		path->idx[path->depth]   = idx;
+		path->depth += 1;
+
+		node = bp_inner_node_get_child(inner, idx);
+	}
+
+	return (bp_data_node_t *)node;
+}
+
+/**
+ * @brief 沿着路径移动到右边相邻的数据结点
+ *
+ * @param path bp_path_find 记下的路径，返回时更新为到下一个数据结点的路径
+ * @return bp_data_node_t* 下一个数据结点，已经是最右侧的数据结点时返回 NULL
+ */
+static bp_data_node_t *bp_path_next(bp_path_t *path)
+{
+	bp_inner_node_t *inner;
+	bp_node_t       *node;
+	int              top;
+
+	while (path->depth > 0) {
+		top   = path->depth - 1;
+		inner = path->nodes[top];
+		if (path->idx[top] + 1 == inner->common.key_num) {
+			path->depth -= 1;
+
+			continue;
+		}
+
+		// 右边的子树里最左侧的数据结点就是下一个数据结点，路径的长度不变
+		path->idx[top] += 1;
+		node = bp_inner_node_get_child(inner, path->idx[top]);
+		while (BP_NODE_TYPE_INNER == node->type) {
+			top += 1;
+			path->nodes[top] = (bp_inner_node_t *)node;
+			path->idx[top]   = 0;
+			node = bp_inner_node_get_child((bp_inner_node_t *)node, 0);
+		}
+		path->depth = top + 1;
+
+		return (bp_data_node_t *)node;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief 在快照上查找被索引项的所有位置信息
+ *
+ * @details
+ *  快照上的结点不会再被修改，查找既不加锁也不需要检查版本号
+ *
+ * @param snapshot 快照
+ * @param key 被索引项
+ * @param values_out 用于输出位置信息，长度至少为 max_num * value_size
+ * @param max_num values_out 最多可以保存的位置信息的个数
+ * @return int 输出的位置信息的个数
+ */
+static int bp_snapshot_find_all(
+	bp_snapshot_t *snapshot,
+	unsigned char *key,
+	unsigned char *values_out,
+	int            max_num)
+{
+	bp_path_t       path;
+	bp_data_node_t *data;
+	int             idx;
+	int             found_num;
+
+	data = bp_path_find(&path, snapshot->root, key);
+	if (NULL == data)
+		return 0;
+
+	idx = bp_data_node_lower_bound(data, key);
+	found_num = 0;
+	while (data && found_num < max_num) {
+		if (idx == data->common.key_num) {
+			data = bp_path_next(&path);
+			idx  = 0;
+
+			continue;
+		}
+
+		if (0 != bp_key_compare(data->common.compare,
+								bp_data_node_key(data, idx), key,
+								data->key_size))
+			break;
+
+		memcpy(values_out + found_num * data->value_size,
+			   bp_data_node_value(data, idx), data->value_size);
+		found_num += 1;
+		idx       += 1;
+	}
+
+	return found_num;
+}
+
+/**
+ * @brief 写时复制模式下在当前的快照上查找被索引项的所有位置信息
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param values_out 用于输出位置信息，长度至少为 max_num * tree->value_size
+ * @param max_num values_out 最多可以保存的位置信息的个数
+ * @return int 输出的位置信息的个数
+ */
+static int bp_cow_search_all(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	unsigned char *values_out,
+	int            max_num)
+{
+	bp_snapshot_t snapshot;
+	int           found_num;
+
+	bp_snapshot_enter(tree->sync, &snapshot);
+	found_num = bp_snapshot_find_all(&snapshot, key, values_out, max_num);
+	bp_snapshot_exit(&snapshot);
+
+	return found_num;
+}
+
+/**
+ * @brief 并发模式下一次查找最多记录版本号的数据结点个数，跨越更多数据结点时加写锁查找
+ */
+#define BP_SYNC_LEAF_NUM 16
+
+/**
+ * @brief 并发模式下查找被索引项的所有位置信息
+ *
+ * @details
+ *  查找过程中不修改任何共享的数据。每个结点在读取之前记下版本号，读取子结点或者
+ *  下一个数据结点的指针之后先检查当前结点的版本号，确认指针有效之后再访问子结点，
+ *  任何一次检查失败都从根结点重新开始查找。
+ *
+ *  相同的被索引项跨越多个数据结点时，写操作可能在读完前一个数据结点之后把数据项在
+ *  两个结点之间移动，所以最后要重新检查经过的所有数据结点，都没有变化才说明读到的是
+ *  同一时刻的数据。
+ *
+ *  结点内容用普通的读取（ memcpy 、二分查找、 SIMD 加载和比较函数）访问，可能和写
+ *  操作同时进行，这是有意的数据竞争：读到的数据只有版本号检查通过之后才会影响返回
+ *  值。调用方已经在 bp_epoch_enter 中记下了 epoch 或者持有写锁，读取期间结点不会被释放
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param values_out 用于输出位置信息，长度至少为 max_num * tree->value_size
+ * @param max_num values_out 最多可以保存的位置信息的个数
+ * @param locked 调用方是否持有写锁，持有写锁时不限制经过的数据结点的个数
+ * @return int 输出的位置信息的个数，没有持有写锁并且经过的数据结点超过
+ *             BP_SYNC_LEAF_NUM 个时返回 -1
+ */
+static int bp_sync_find_all(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	unsigned char *values_out,
+	int            max_num,
+	int            locked)
+{
+	bp_node_t       *node;
+	bp_node_t       *next;
+	bp_inner_node_t *inner;
+	bp_data_node_t  *data;
+	bp_node_t       *leaves[BP_SYNC_LEAF_NUM];
+	uint64_t         leaf_versions[BP_SYNC_LEAF_NUM];
+	uint64_t         version;
+	uint64_t         next_version;
+	int              leaf_num;
+	int              key_num;
+	int              idx;
+	int              found_num;
+	int              i;
+
+	goto start;
+restart:
+	sched_yield();
+start:
+	node    = __atomic_load_n(&tree->head, __ATOMIC_ACQUIRE);
+	version = bp_node_read_begin(node);
+
+	// 读到版本号之前根结点可能已经被替换了
+	if (node != __atomic_load_n(&tree->head, __ATOMIC_ACQUIRE))
+		goto restart;
+
+	while (BP_NODE_TYPE_INNER == node->type) {
+		inner   = (bp_inner_node_t *)node;
+		key_num = inner->common.key_num;
+		idx     = bp_inner_node_lower_bound(inner, key_num, key);
+		next = idx < key_num ? bp_inner_node_get_child(inner, idx) : NULL;
+		if (!bp_node_read_validate(node, version))
+			goto restart;
+
+		if (NULL == next)
+			return 0;
+
+		next_version = bp_node_read_begin(next);
+		if (!bp_node_read_validate(node, version))
+			goto restart;
+
+		node    = next;
+		version = next_version;
+	}
+
+	data      = (bp_data_node_t *)node;
+	key_num   = data->common.key_num;
+	idx       = bp_lower_bound(data->content, key_num,
+							   bp_data_node_key_stride(data), key,
+							   data->key_size, 0, data->common.compare,
+							   data->common.key_type);
+	found_num = 0;
+	leaf_num  = 0;
+	while (found_num < max_num) {
+		if (idx >= key_num) {
+			next = (bp_node_t *)bp_data_node_get_pnext(data);
+			if (!bp_node_read_validate(node, version))
+				goto restart;
+
+			if (NULL == next)
+				break;
+
+			next_version = bp_node_read_begin(next);
+			if (!bp_node_read_validate(node, version))
+				goto restart;
+
+			if (!locked && BP_SYNC_LEAF_NUM == leaf_num)
+				return -1;
+
+			if (leaf_num < BP_SYNC_LEAF_NUM) {
+				leaves[leaf_num]        = node;
+				leaf_versions[leaf_num] = version;
+				leaf_num               += 1;
+			}
+
+			node    = next;
+			version = next_version;
+			data    = (bp_data_node_t *)node;
+			key_num = data->common.key_num;
+			idx     = 0;
+
+			continue;
+		}
+
+		if (0 != bp_key_compare(data->common.compare,
+								bp_data_node_key(data, idx), key,
+								data->key_size))
+			break;
+
+		memcpy(values_out + found_num * data->value_size,
+			   bp_data_node_value(data, idx), data->value_size);
+		found_num += 1;
+		idx       += 1;
+	}
+
+	if (!bp_node_read_validate(node, version))
+		goto restart;
+
+	for (i = 0; i < leaf_num; i++) {
+		if (!bp_node_read_validate(leaves[i], leaf_versions[i]))
+			goto restart;
+	}
+
+	return found_num;
+}
+
+/**
+ * @brief 并发模式下查找被索引项的所有位置信息，见 bp_sync_find_all
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param values_out 用于输出位置信息，长度至少为 max_num * tree->value_size
+ * @param max_num values_out 最多可以保存的位置信息的个数
+ * @return int 输出的位置信息的个数
+ */
+static int bp_sync_search_all(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	unsigned char *values_out,
+	int            max_num)
+{
+	int found_num;
+	int slot;
+
+	slot = bp_epoch_enter(tree->sync);
+	bp_optimistic_read_begin();
+	found_num = bp_sync_find_all(tree, key, values_out, max_num, 0);
+	bp_optimistic_read_end();
+	bp_epoch_exit(tree->sync, slot);
+	if (-1 != found_num)
+		return found_num;
+
+	// 跨越的数据结点太多，乐观读取很难一次成功，加写锁之后结点不会再变化
+	pthread_mutex_lock(&tree->sync->write_lock);
+	found_num = bp_sync_find_all(tree, key, values_out, max_num, 1);
+	pthread_mutex_unlock(&tree->sync->write_lock);
+
+	return found_num;
+}
+
+/**
+ * @brief 在B+树中查找被索引项，存在相同的被索引项时返回第一个的位置信息
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value_out 用于输出位置信息，长度至少为 tree->value_size
+ * @return int 找到返回 1 ，没找到返回 0 ，参数错误返回 -1
+ */
+int bp_search(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value_out)
+{
+	bp_data_node_t *data;
+	int             idx;
+
+	if (tree->key_size != key_len)
+		return -1;
+
+	BP_STAT_ADD(lookup_num, 1);
+	if (tree->sync && tree->sync->cow)
+		return bp_cow_search_all(tree, key, value_out, 1);
+
+	if (tree->sync)
+		return bp_sync_search_all(tree, key, value_out, 1);
+
+	data = bp_tree_find_data_node(tree, key);
+	if (NULL == data)
+		return bp_tree_search_buffer(tree, key, value_out, 1);
+
+	idx = bp_data_node_lower_bound(data, key);
+
+	// 删除数据后没有兄弟结点可以合并的数据结点可能是空的，此时从下一个数据结点继续查找
+	while (idx == data->common.key_num) {
+		data = bp_data_node_get_pnext(data);
+		if (NULL == data)
+			return bp_tree_search_buffer(tree, key, value_out, 1);
+
+		idx = 0;
+	}
+
+	if (0 != bp_key_compare(data->common.compare, bp_data_node_key(data, idx),
+							key, data->key_size))
+		return bp_tree_search_buffer(tree, key, value_out, 1);
+
+	memcpy(value_out, bp_data_node_value(data, idx), data->value_size);
+
+	return 1;
+}
+
+/**
+ * @brief 在B+树中查找被索引项的所有位置信息
+ *
+ * @details
+ *  相同的被索引项可能跨越多个数据结点，找到第一个之后沿着数据结点的 pnext 继续查找
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param values_out 用于输出位置信息，长度至少为 max_num * tree->value_size
+ * @param max_num values_out 最多可以保存的位置信息的个数
+ * @return int 输出的位置信息的个数，参数错误返回 -1
+ */
+int bp_search_all(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *values_out,
+	int            max_num)
+{
+	bp_data_node_t *data;
+	int             idx;
+	int             found_num;
+
+	if (tree->key_size != key_len)
+		return -1;
+
+	BP_STAT_ADD(lookup_num, 1);
+	if (tree->sync && tree->sync->cow)
+		return bp_cow_search_all(tree, key, values_out, max_num);
+
+	if (tree->sync)
+		return bp_sync_search_all(tree, key, values_out, max_num);
+
+	found_num = 0;
+	data      = bp_tree_find_data_node(tree, key);
+	idx       = data ? bp_data_node_lower_bound(data, key) : 0;
+	while (data && found_num < max_num) {
+		if (idx == data->common.key_num) {
+			data = bp_data_node_get_pnext(data);
+			idx  = 0;
+
+			continue;
+		}
+
+		if (0 != bp_key_compare(data->common.compare,
+								bp_data_node_key(data, idx), key,
+								data->key_size))
+			break;
+
+		memcpy(values_out + found_num * data->value_size,
+			   bp_data_node_value(data, idx), data->value_size);
+		found_num += 1;
+		idx       += 1;
+	}
+
+	return found_num + bp_tree_search_buffer(
+		tree, key, values_out + found_num * tree->value_size,
+		max_num - found_num);
+}
+
+/**
+ * @brief 返回内部结点上前 idx 个子树中被索引项的个数
+ *
+ * @details
+ *  先预取所有子结点再读取它们的 key_total ，读取子结点的缓存未命中可以同时进行
+ *
+ * @param inner 内部结点
+ * @param idx 子树的个数
+ * @return int 被索引项的个数
+ */
+static int bp_inner_node_count_before(bp_inner_node_t *inner, int idx)
+{
+	int total;
+	int i;
+
+	for (i = 0; i < idx; i++)
+		bp_prefetch(bp_inner_node_get_child(inner, i));
+
+	total = 0;
+	for (i = 0; i < idx; i++)
+		total += bp_node_get_key_total(bp_inner_node_get_child(inner, i));
+
+	return total;
+}
+
+/**
+ * @brief 统计B+树上小于 key 或者小于等于 key 的被索引项的个数
+ *
+ * @details
+ *  第 i 个子树上的 key 都不大于内部结点上第 i 个 key ，第 i + 1 个子树上的 key 都不
+ *  小于它，所以 key 之前的被索引项是前面所有子树的 key_total 加上进入的子树中 key
+ *  之前的被索引项，每层只进入一个子结点
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param or_equal 为 1 时统计小于等于 key 的个数
+ * @return int 被索引项的个数
+ */
+static int bp_tree_rank(bp_tree_t *tree, unsigned char *key, int or_equal)
+{
+	bp_inner_node_t *inner;
+	bp_data_node_t  *data;
+	bp_node_t       *node;
+	int              total;
+	int              idx;
+
+	total = 0;
+	node  = tree->head;
+	while (BP_NODE_TYPE_INNER == node->type) {
+		inner  = (bp_inner_node_t *)node;
+		idx    = or_equal ? bp_inner_node_upper_bound(inner, key)
+			: bp_inner_node_lower_bound(inner, inner->common.key_num, key);
+		total += bp_inner_node_count_before(inner, idx);
+		if (idx == inner->common.key_num)
+			return total;
+
+		node = bp_inner_node_get_child(inner, idx);
+	}
+
+	data = (bp_data_node_t *)node;
+	if (!or_equal)
+		return total + bp_data_node_lower_bound(data, key);
+
+	return total + bp_upper_bound(data->content, data->common.key_num,
+								  bp_data_node_key_stride(data), key,
+								  data->key_size, 0, data->common.compare,
+								  data->common.key_type);
+}
+
+/**
+ * @brief 顺序统计查询之前把插入缓冲整体排好序，并发模式下持有写锁
+ *
+ * @param tree B+树
+ */
+static void bp_order_begin(bp_tree_t *tree)
+{
+	if (tree->ibuf)
+		bp_tree_sort_buffer(tree);
+
+	if (tree->sync)
+		pthread_mutex_lock(&tree->sync->write_lock);
+}
+
+/**
+ * @brief 结束顺序统计查询
+ *
+ * @param tree B+树
+ */
+static void bp_order_end(bp_tree_t *tree)
+{
+	if (tree->sync)
+		pthread_mutex_unlock(&tree->sync->write_lock);
+}
+
+/**
+ * @brief 返回B+树上小于 key 的被索引项的个数，也就是第一个不小于 key 的被索引项的
+ *        下标，包括插入缓冲中的数据
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @return int 被索引项的个数，参数错误返回 -1
+ */
+int bp_rank(bp_tree_t *tree, unsigned char *key, int key_len)
+{
+	int rank;
+
+	if (tree->key_size != key_len)
+		return -1;
+
+	bp_order_begin(tree);
+	rank = bp_tree_rank(tree, key, 0) + bp_tree_buffer_rank(tree, key, 0);
+	bp_order_end(tree);
+
+	return rank;
+}
+
+/**
+ * @brief 返回B+树上 [lo, hi] 范围内被索引项的个数，包括插入缓冲中的数据
+ *
+ * @param tree B+树
+ * @param lo 范围的下限， NULL 表示不限
+ * @param hi 范围的上限， NULL 表示不限
+ * @return int 被索引项的个数
+ */
+int bp_count_range(bp_tree_t *tree, unsigned char *lo, unsigned char *hi)
+{
+	int low;
+	int high;
+
+	bp_order_begin(tree);
+	low  = lo ? bp_tree_rank(tree, lo, 0) + bp_tree_buffer_rank(tree, lo, 0) : 0;
+	high = hi ? bp_tree_rank(tree, hi, 1) + bp_tree_buffer_rank(tree, hi, 1)
+		: bp_node_get_key_total(tree->head) + tree->ibuf_num;
+	bp_order_end(tree);
+
+	return high > low ? high - low : 0;
+}
+
+/**
+ * @brief 查找B+树上按顺序的第 k 个被索引项，从 0 开始，包括插入缓冲中的数据
+ *
+ * @details
+ *  插入缓冲中第 j 个数据项之前有 j 个缓冲中的数据项和 bp_tree_rank 个树上的数据项
+ *  （相同的 key 树上的数据先插入），这个位置随 j 递增，所以先在缓冲上二分查找第 k
+ *  个被索引项之前有几个缓冲中的数据项，剩下的在树上查找：每层跳过 key_total 之和
+ *  不超过 k 的子树，进入第 k 个被索引项所在的子树
+ *
+ * @param tree B+树
+ * @param k 被索引项的下标
+ * @param key_out 用于输出被索引项，长度至少为 tree->key_size ，可以为 NULL
+ * @param value_out 用于输出位置信息，长度至少为 tree->value_size ，可以为 NULL
+ * @return int 找到返回 1 ， k 超出范围返回 0
+ */
+int bp_select(
+	bp_tree_t     *tree,
+	int            k,
+	unsigned char *key_out,
+	unsigned char *value_out)
+{
+	bp_inner_node_t *inner;
+	bp_data_node_t  *data;
+	bp_node_t       *node;
+	bp_node_t       *child;
+	unsigned char   *item;
+	int              item_size;
+	int              total;
+	int              low;
+	int              high;
+	int              mid;
+	int              i;
+
+	bp_order_begin(tree);
+	if (k < 0 || k >= bp_node_get_key_total(tree->head) + tree->ibuf_num) {
+		bp_order_end(tree);
+
+		return 0;
+	}
+
+	item_size = tree->key_size + tree->value_size;
+	low       = 0;
+	high      = tree->ibuf_num;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (mid + bp_tree_rank(tree, tree->ibuf + mid * item_size, 1) < k)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	item = low < tree->ibuf_num ? tree->ibuf + low * item_size : NULL;
+	if (item && low + bp_tree_rank(tree, item, 1) == k) {
+		if (key_out)
+			memcpy(key_out, item, tree->key_size);
+		if (value_out)
+			memcpy(value_out, item + tree->key_size, tree->value_size);
+		bp_order_end(tree);
+
+		return 1;
+	}
+	k -= low;
+
+	node = tree->head;
+	while (BP_NODE_TYPE_INNER == node->type) {
+		inner = (bp_inner_node_t *)node;
+		for (i = 0; i < inner->common.key_num; i++)
+			bp_prefetch(bp_inner_node_get_child(inner, i));
+
+		for (i = 0; i < inner->common.key_num - 1; i++) {
+			child = bp_inner_node_get_child(inner, i);
+			total = bp_node_get_key_total(child);
+			if (k < total)
+				break;
+
+			k -= total;
+		}
+
+		node = bp_inner_node_get_child(inner, i);
+	}
+
+	data = (bp_data_node_t *)node;
+	if (key_out)
+		memcpy(key_out, bp_data_node_key(data, k), data->key_size);
+	if (value_out)
+		memcpy(value_out, bp_data_node_value(data, k), data->value_size);
+	bp_order_end(tree);
+
+	return 1;
+}
+
+/**
+ * @brief 在快照上查找被索引项的所有位置信息
+ *
+ * @param snapshot 快照
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param values_out 用于输出位置信息，长度至少为 max_num * value_size
+ * @param max_num values_out 最多可以保存的位置信息的个数
+ * @return int 输出的位置信息的个数，参数错误返回 -1
+ */
+int bp_snapshot_search_all(
+	bp_snapshot_t *snapshot,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *values_out,
+	int            max_num)
+{
+	if (snapshot->tree->key_size != key_len)
+		return -1;
+
+	return bp_snapshot_find_all(snapshot, key, values_out, max_num);
+}
+
+/**
+ * @brief 从数据结点中删除一个被索引项
+ *
+ * @param data 数据结点
+ * @param key 被索引项
+ * @param value 位置信息，不为 NULL 时只删除位置信息相同的数据项
+ * @return int 删除了返回 1 ，否则返回 0
+ */
+static int bp_data_node_delete(
+	bp_data_node_t *data,
+	unsigned char  *key,
+	unsigned char  *value)
+{
+	int idx;
+
+	idx = bp_data_node_lower_bound(data, key);
+	for (; idx < data->common.key_num; idx++) {
+		if (0 != bp_key_compare(data->common.compare,
+								bp_data_node_key(data, idx), key,
+								data->key_size))
+			return 0;
+
+		if (NULL == value || 0 == memcmp(bp_data_node_value(data, idx), value,
+										 data->value_size))
+			break;
+	}
+
+	if (idx == data->common.key_num)
+		return 0;
+
+	bp_node_write_lock((bp_node_t *)data);
+	bp_node_move_items((bp_node_t *)data, idx, (bp_node_t *)data, idx + 1,
+					   data->common.key_num - idx - 1);
+	data->common.key_num -= 1;
+
+	return 1;
+}
+
+/**
+ * @brief 把 inner 上 idx 和 idx + 1 两个子结点中右边的子结点合并到左边的子结点
+ *
+ * @details
+ *  总是释放右边的结点，这样 tree->data 始终指向最左侧的数据结点
+ *
+ * @param inner 内部结点
+ * @param idx 左边子结点的下标
+ */
+static void bp_inner_node_merge_child(bp_inner_node_t *inner, int idx)
+{
+	bp_data_node_t  *left_data;
+	bp_data_node_t  *right_data;
+	bp_inner_node_t *left_inner;
+	bp_inner_node_t *right_inner;
+	bp_node_t       *left;
+	bp_node_t       *right;
+
+	left  = bp_inner_node_get_child(inner, idx);
+	right = bp_inner_node_get_child(inner, idx + 1);
+	bp_node_write_lock((bp_node_t *)inner);
+	bp_node_write_lock(left);
+	bp_node_move_items(left, ((bp_node_common_t *)left)->key_num, right, 0,
+					   ((bp_node_common_t *)right)->key_num);
+
+	if (BP_NODE_TYPE_DATA == left->type) {
+		left_data  = (bp_data_node_t *)left;
+		right_data = (bp_data_node_t *)right;
+		left_data->common.key_num += right_data->common.key_num;
+		bp_data_node_set_pnext(left_data, bp_data_node_get_pnext(right_data));
+	} else {
+		left_inner  = (bp_inner_node_t *)left;
+		right_inner = (bp_inner_node_t *)right;
+		left_inner->common.key_num += right_inner->common.key_num;
+		left_inner->key_total      += right_inner->key_total;
+	}
+
+	// 合并后左边子结点的最大值就是右边子结点的最大值，删除右边子结点的 P-K 对
+	memcpy(bp_inner_node_key(inner, idx), bp_inner_node_key(inner, idx + 1),
+		   bp_inner_node_key_len(inner));
+	bp_node_move_items((bp_node_t *)inner, idx + 1, (bp_node_t *)inner, idx + 2,
+					   inner->common.key_num - idx - 2);
+	inner->common.key_num -= 1;
+
+	bp_node_free(right);
+}
+
+/**
+ * @brief 在 inner 上 idx 和 idx + 1 两个相邻的子结点之间移动一个数据项
+ *
+ * @param inner 内部结点
+ * @param idx 左边子结点的下标
+ * @param to_left 为 1 时把右边子结点的第一个数据项移到左边子结点的最后，否则把左边
+ *                子结点的最后一个数据项移到右边子结点的最前面
+ */
+static void bp_inner_node_borrow(bp_inner_node_t *inner, int idx, int to_left)
+{
+	bp_node_common_t *left;
+	bp_node_common_t *right;
+	bp_node_common_t *src;
+	bp_node_common_t *dst;
+	int               moved_idx;
+	int               moved_total;
+
+	left  = (bp_node_common_t *)bp_inner_node_get_child(inner, idx);
+	right = (bp_node_common_t *)bp_inner_node_get_child(inner, idx + 1);
+	src   = to_left ? right : left;
+	dst   = to_left ? left : right;
+	bp_node_write_lock((bp_node_t *)inner);
+	bp_node_write_lock((bp_node_t *)left);
+	bp_node_write_lock((bp_node_t *)right);
+
+	if (to_left) {
+		moved_idx = dst->key_num;
+		bp_node_move_items((bp_node_t *)dst, moved_idx, (bp_node_t *)src, 0, 1);
+		bp_node_move_items((bp_node_t *)src, 0, (bp_node_t *)src, 1,
+						   src->key_num - 1);
+	} else {
+		moved_idx = 0;
+		bp_node_move_items((bp_node_t *)dst, 1, (bp_node_t *)dst, 0,
+						   dst->key_num);
+		bp_node_move_items((bp_node_t *)dst, 0, (bp_node_t *)src,
+						   src->key_num - 1, 1);
+	}
+
+	// 内部结点移动的是一棵子树，需要同时移动子树的被索引项个数
+	if (BP_NODE_TYPE_INNER == left->type) {
+		moved_total = bp_node_get_key_total(
+			bp_inner_node_get_child((bp_inner_node_t *)dst, moved_idx));
+		((bp_inner_node_t *)src)->key_total -= moved_total;
+		((bp_inner_node_t *)dst)->key_total += moved_total;
+	}
+
+	src->key_num -= 1;
+	dst->key_num += 1;
+
+	bp_inner_node_update_key(inner, idx, (bp_node_t *)left);
+}
+
+/**
+ * @brief 检查 dst 能否保存从 src 移入数据项之后的 num 个数据项
+ *
+ * @details
+ *  BP_LAYOUT_PREFIX 的内部结点要先把前缀缩短为两个结点共有的部分，能放下时才修改
+ *
+ * @param dst 移入数据项的结点
+ * @param src 移出数据项的结点
+ * @param num 移入之后 dst 上数据项的个数
+ * @return int 能放下返回 1 ，否则返回 0
+ */
+static int bp_node_make_room(
+	bp_node_common_t *dst,
+	bp_node_common_t *src,
+	int               num)
+{
+	bp_inner_node_t *dst_inner;
+	bp_inner_node_t *src_inner;
+	int              prefix_len;
+
+	if (BP_NODE_TYPE_INNER != dst->type || BP_LAYOUT_PREFIX != dst->layout)
+		return num <= dst->max_key_num;
+
+	dst_inner  = (bp_inner_node_t *)dst;
+	src_inner  = (bp_inner_node_t *)src;
+	prefix_len = bp_common_prefix_len(
+		dst_inner->content, src_inner->content,
+		dst_inner->prefix_len < src_inner->prefix_len
+		? dst_inner->prefix_len : src_inner->prefix_len);
+	if (num > bp_inner_node_capacity(dst_inner, prefix_len))
+		return 0;
+
+	bp_node_write_lock((bp_node_t *)dst);
+	bp_inner_node_set_prefix(dst_inner, NULL, prefix_len);
+
+	return 1;
+}
+
+/**
+ * @brief inner 上下标为 idx 的子结点的数据项个数少于 min_key_num 时，从相邻的兄弟
+ *        结点借一个数据项，兄弟结点也不够的话和兄弟结点合并
+ *
+ * @param inner 内部结点
+ * @param idx 数据项不足的子结点的下标
+ */
+static void bp_inner_node_rebalance(bp_inner_node_t *inner, int idx)
+{
+	bp_node_common_t *child;
+	bp_node_common_t *sibling;
+	int               left_idx;
+	int               total;
+
+	// 只有一个子结点时没有兄弟结点，由上一层的内部结点来处理
+	if (inner->common.key_num < 2)
+		return;
+
+	// 写时复制模式下兄弟结点也会被修改，复制失败时保持子结点数据项不足的状态，
+	// 树仍然是有效的
+	left_idx = idx > 0 ? idx - 1 : idx;
+	child    = (bp_node_common_t *)bp_inner_node_get_child(inner, idx);
+	sibling  = (bp_node_common_t *)bp_inner_node_modify_child(
+		inner, idx > 0 ? idx - 1 : idx + 1);
+	if (NULL == sibling)
+		return;
+
+	// BP_LAYOUT_PREFIX 的结点缩短前缀后可能连一个数据项都放不下，此时保持子结点数据项
+	// 不足的状态
+	total = child->key_num + sibling->key_num;
+	if (bp_node_make_room(idx > 0 ? sibling : child, idx > 0 ? child : sibling,
+						  total))
+		bp_inner_node_merge_child(inner, left_idx);
+	else if (bp_node_make_room(child, sibling, child->key_num + 1))
+		bp_inner_node_borrow(inner, left_idx, idx == left_idx);
+}
+
+/**
+ * @brief 从结点及其子树中删除一个被索引项
+ *
+ * @details
+ *  相同的被索引项可能跨越多个子树，子树的最大值等于 key 时如果在子树中没有找到要删除
+ *  的数据项，需要继续在下一个子树中查找
+ *
+ * @param node 内部结点或者数据结点
+ * @param key 被索引项
+ * @param value 位置信息，不为 NULL 时只删除位置信息相同的数据项
+ * @return int 删除了返回 1 ，没找到返回 0 ，写时复制模式下复制结点失败返回 -1
+ */
+static int bp_node_delete(
+	bp_node_t     *node,
+	unsigned char *key,
+	unsigned char *value)
+{
+	bp_inner_node_t  *inner;
+	bp_node_common_t *child = NULL;
+	int               idx;
+	int               ret;
+
+	if (BP_NODE_TYPE_DATA == node->type)
+		return bp_data_node_delete((bp_data_node_t *)node, key, value);
+
+	inner = (bp_inner_node_t *)node;
+	idx   = bp_inner_node_lower_bound(inner, inner->common.key_num, key);
+	for (; idx < inner->common.key_num; idx++) {
+		child = (bp_node_common_t *)bp_inner_node_modify_child(inner, idx);
+		if (NULL == child)
+			return -1;
+
+		ret = bp_node_delete((bp_node_t *)child, key, value);
+		if (-1 == ret)
+			return -1;
+
+		if (ret)
+			break;
+
+		if (0 != bp_inner_node_compare_key(inner, idx, key))
+			return 0;
+	}
+
+	if (idx == inner->common.key_num)
+		return 0;
+
+	bp_node_touch((bp_node_t *)inner);
+	inner->key_total -= 1;
+
+	// 子结点删除了最大值的话需要更新子结点的最大值，空结点保留原来的值作为分界
+	if (child->key_num > 0) {
+		bp_node_write_lock(node);
+		bp_inner_node_update_key(inner, idx, (bp_node_t *)child);
+	}
+
+	if (child->key_num < child->min_key_num)
+		bp_inner_node_rebalance(inner, idx);
+
+	return 1;
+}
+
+/**
+ * @brief 从B+树中删除一个被索引项
+ *
+ * @details
+ *  删除后数据项个数少于 min_key_num 的结点会从兄弟结点借数据或者和兄弟结点合并，合并
+ *  释放的结点会还给分配器；根结点只剩下一个内部子结点时树的高度减一。删除会使已经
+ *  打开的游标失效
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 位置信息，长度为 tree->value_size ，不为 NULL 时只删除位置信息相同的
+ *              数据项，为 NULL 时删除第一个被索引项
+ * @return int 删除了返回 1 ，没找到返回 0 ，参数错误或者写时复制模式下分配结点失败
+ *             返回 -1
+ */
+int bp_delete(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value)
+{
+	bp_inner_node_t *root;
+	bp_node_t       *child;
+	int              ret;
+
+	if (tree->key_size != key_len || tree->frozen || -1 == bp_tree_flush(tree))
+		return -1;
+
+	if (-1 == bp_sync_write_begin(tree))
+		return -1;
+
+	// 合并结点会释放最右侧路径上的结点
+	tree->spine_depth = 0;
+	ret = bp_node_delete(tree->head, key, value);
+	if (1 != ret) {
+		bp_sync_write_end(tree);
+
+		return ret;
+	}
+
+	root = (bp_inner_node_t *)tree->head;
+	while (1 == root->common.key_num) {
+		child = bp_inner_node_get_child(root, 0);
+		if (BP_NODE_TYPE_DATA == child->type) {
+			// 最后一个数据结点也空了，恢复成空树的状态
+			if (0 == ((bp_data_node_t *)child)->common.key_num) {
+				bp_node_write_lock((bp_node_t *)root);
+				root->common.key_num = 0;
+			}
+
+			break;
+		}
+
+		__atomic_store_n(&tree->head, child, __ATOMIC_RELEASE);
+		bp_node_free((bp_node_t *)root);
+		root = (bp_inner_node_t *)child;
+	}
+	bp_sync_write_end(tree);
+
+	return 1;
+}
+
+/**
+ * @brief 替换结点及其子树中一个数据项的位置信息
+ *
+ * @details
+ *  和 bp_node_delete 一样，相同的被索引项可能跨越多个子树。经过的内部结点内容不变，
+ *  只更新代数
+ *
+ * @param node 内部结点或者数据结点
+ * @param key 被索引项
+ * @param value 位置信息，不为 NULL 时只替换位置信息相同的数据项
+ * @param new_value 新的位置信息
+ * @return int 替换了返回 1 ，没找到返回 0 ，写时复制模式下复制结点失败返回 -1
+ */
+static int bp_node_update(
+	bp_node_t     *node,
+	unsigned char *key,
+	unsigned char *value,
+	unsigned char *new_value)
+{
+	bp_inner_node_t *inner;
+	bp_data_node_t  *data;
+	bp_node_t       *child;
+	int              idx;
+	int              ret;
+
+	if (BP_NODE_TYPE_DATA == node->type) {
+		data = (bp_data_node_t *)node;
+		idx  = bp_data_node_lower_bound(data, key);
+		for (; idx < data->common.key_num; idx++) {
+			if (0 != bp_key_compare(data->common.compare,
+									bp_data_node_key(data, idx), key,
+									data->key_size))
+				return 0;
+
+			if (NULL == value || 0 == memcmp(bp_data_node_value(data, idx),
+											 value, data->value_size))
+				break;
+		}
+
+		if (idx == data->common.key_num)
+			return 0;
+
+		bp_node_write_lock(node);
+		memcpy(bp_data_node_value(data, idx), new_value, data->value_size);
+
+		return 1;
+	}
+
+	inner = (bp_inner_node_t *)node;
+	idx   = bp_inner_node_lower_bound(inner, inner->common.key_num, key);
+	for (; idx < inner->common.key_num; idx++) {
+		child = bp_inner_node_modify_child(inner, idx);
+		if (NULL == child)
+			return -1;
+
+		ret = bp_node_update(child, key, value, new_value);
+		if (0 != ret) {
+			if (1 == ret)
+				bp_node_touch(node);
+
+			return ret;
+		}
+
+		if (0 != bp_inner_node_compare_key(inner, idx, key))
+			return 0;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief 替换B+树中一个被索引项的位置信息
+ *
+ * @details
+ *  和删除再插入相比不会移动数据项，也不会让结点分裂或者合并，已经打开的游标仍然有效。
+ *  修改和删除一样经过写锁，并在结点上记下代数
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 位置信息，长度为 tree->value_size ，不为 NULL 时只替换位置信息相同的
+ *              数据项，为 NULL 时替换第一个被索引项
+ * @param new_value 新的位置信息，长度为 tree->value_size
+ * @return int 替换了返回 1 ，没找到返回 0 ，参数错误或者写时复制模式下分配结点失败
+ *             返回 -1
+ */
+int bp_update(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value,
+	unsigned char *new_value)
+{
+	int ret;
+
+	if (tree->key_size != key_len || tree->frozen || -1 == bp_tree_flush(tree))
+		return -1;
+
+	if (-1 == bp_sync_write_begin(tree))
+		return -1;
+
+	ret = bp_node_update(tree->head, key, value, new_value);
+	bp_sync_write_end(tree);
+
+	return ret;
+}
+
+/**
+ * @brief 游标进入一个数据结点，计算结点上查找范围的结束位置，并预取下一个数据结点
+ *
+ * @param cursor 游标
+ * @param data 要进入的数据结点
+ */
+static void bp_cursor_enter(bp_cursor_t *cursor, bp_data_node_t *data)
+{
+	bp_data_node_t *next;
+	unsigned char  *max_key;
+
+	cursor->data = data;
+	cursor->idx  = 0;
+	cursor->end  = data->common.key_num;
+	cursor->last = 0;
+
+	// 顺序访问时下一个数据结点马上就会用到，提前把它的头部和数据的开始部分取到缓存中；
+	// 快照上的 pnext 可能指向已经被替换的结点，不用它预取
+	next = cursor->snapshot ? NULL : bp_data_node_get_pnext(data);
+	if (next) {
+		bp_prefetch(next);
+		bp_prefetch(next->content);
+		bp_prefetch(next->content + 64);
+	}
+
+	if (!cursor->has_hi || 0 == data->common.key_num)
+		return;
+
+	max_key = bp_data_node_key(data, data->common.key_num - 1);
+	if (bp_key_compare(data->common.compare, max_key, cursor->hi,
+					   cursor->key_size) <= 0)
+		return;
+
+	cursor->end  = bp_upper_bound(data->content, data->common.key_num,
+								  bp_data_node_key_stride(data), cursor->hi,
+								  cursor->key_size, 0, data->common.compare,
+								  data->common.key_type);
+	cursor->last = 1;
+}
+
+/**
+ * @brief 游标移动到下一个还有数据的数据结点
+ *
+ * @param cursor 游标
+ * @return int 还有数据返回 1 ，否则返回 0
+ */
+static int bp_cursor_forward(bp_cursor_t *cursor)
+{
+	bp_data_node_t *next;
+
+	while (cursor->idx >= cursor->end) {
+		if (NULL == cursor->data || cursor->last)
+			return 0;
+
+		if (cursor->snapshot)
+			next = bp_path_next(&cursor->path);
+		else
+			next = bp_data_node_get_pnext(cursor->data);
+		if (NULL == next)
+			return 0;
+
+		bp_cursor_enter(cursor, next);
+	}
+
+	return 1;
+}
+
+/**
+ * @brief 创建一个游标，用于顺序访问 [lo, hi] 范围内的被索引项
+ *
+ * @param tree B+树
+ * @param snapshot 快照，不为 NULL 时在快照上访问
+ * @param lo 查找范围的下限，长度为 tree->key_size ， NULL 表示从最小的被索引项开始
+ * @param hi 查找范围的上限，长度为 tree->key_size ， NULL 表示到最大的被索引项结束
+ * @return bp_cursor_t* 游标，失败返回 NULL
+ */
+static bp_cursor_t *bp_cursor_create(
+	bp_tree_t     *tree,
+	bp_snapshot_t *snapshot,
+	unsigned char *lo,
+	unsigned char *hi)
+{
+	bp_cursor_t    *cursor;
+	bp_data_node_t *data;
+	int             idx;
+
+	cursor = malloc(sizeof(*cursor) + tree->key_size);
+	if (NULL == cursor)
+		return NULL;
+
+	memset(cursor, 0, sizeof(*cursor));
+	cursor->key_size = tree->key_size;
+	cursor->snapshot = snapshot;
+	if (hi) {
+		cursor->has_hi = 1;
+		memcpy(cursor->hi, hi, tree->key_size);
+	}
+
+	// bp_cursor_open 已经把插入缓冲整体排好序，快照上没有插入缓冲
+	if (NULL == snapshot && tree->ibuf_num > 0) {
+		cursor->buf       = tree->ibuf;
+		cursor->item_size = tree->key_size + tree->value_size;
+		cursor->compare   = ((bp_node_common_t *)tree->head)->compare;
+		cursor->key_type  = ((bp_node_common_t *)tree->head)->key_type;
+		cursor->buf_idx   = lo ? bp_tree_buffer_rank(tree, lo, 0) : 0;
+		cursor->buf_end   = hi ? bp_tree_buffer_rank(tree, hi, 1) : tree->ibuf_num;
+	}
+
+	if (snapshot) {
+		data = bp_path_find(&cursor->path, snapshot->root, lo);
+		if (NULL == data)
+			return cursor;
+
+		idx = 0;
+		if (lo)
+			idx = bp_data_node_lower_bound(data, lo);
+	} else if (NULL == lo) {
+		data = (bp_data_node_t *)tree->data;
+		idx  = 0;
+	} else {
+		data = bp_tree_find_data_node(tree, lo);
+		if (NULL == data)
+			return cursor;
+
+		idx = bp_data_node_lower_bound(data, lo);
+	}
+
+	bp_cursor_enter(cursor, data);
+	cursor->idx = idx;
+
+	return cursor;
+}
+
+/**
+ * @brief 打开一个游标，用于顺序访问 [lo, hi] 范围内的被索引项
+ *
+ * @details
+ *  写时复制模式的树上游标打开自己的快照，关闭游标时一起关闭。开启插入缓冲的树上
+ *  先把缓冲整体排好序，缓冲中的数据和树上的数据按顺序合并返回，游标打开期间插入
+ *  数据会使游标失效
+ *
+ * @param tree B+树
+ * @param lo 查找范围的下限，长度为 tree->key_size ， NULL 表示从最小的被索引项开始
+ * @param hi 查找范围的上限，长度为 tree->key_size ， NULL 表示到最大的被索引项结束
+ * @return bp_cursor_t* 游标，失败返回 NULL
+ */
+bp_cursor_t *bp_cursor_open(bp_tree_t *tree, unsigned char *lo, unsigned char *hi)
+{
+	bp_snapshot_t *snapshot;
+	bp_cursor_t   *cursor;
+
+	if (tree->ibuf)
+		bp_tree_sort_buffer(tree);
+
+	if (NULL == tree->sync || !tree->sync->cow)
+		return bp_cursor_create(tree, NULL, lo, hi);
+
+	snapshot = bp_snapshot_open(tree);
+	if (NULL == snapshot)
+		return NULL;
+
+	cursor = bp_cursor_create(tree, snapshot, lo, hi);
+	if (NULL == cursor) {
+		bp_snapshot_close(snapshot);
+
+		return NULL;
+	}
+
+	cursor->own_snapshot = 1;
+
+	return cursor;
+}
+
+/**
+ * @brief 在快照上打开一个游标，用于顺序访问 [lo, hi] 范围内的被索引项
+ *
+ * @param snapshot 快照
+ * @param lo 查找范围的下限， NULL 表示从最小的被索引项开始
+ * @param hi 查找范围的上限， NULL 表示到最大的被索引项结束
+ * @return bp_cursor_t* 游标，失败返回 NULL
+ */
+bp_cursor_t *bp_snapshot_cursor_open(
+	bp_snapshot_t *snapshot,
+	unsigned char *lo,
+	unsigned char *hi)
+{
+	return bp_cursor_create(snapshot->tree, snapshot, lo, hi);
+}
+
+/**
+ * @brief 返回游标指向的被索引项及其位置信息，并把游标移动到下一项
+ *
+ * @param cursor 游标
+ * @param key 用于输出被索引项在数据结点上的位置
+ * @param value 用于输出位置信息在数据结点上的位置
+ * @return int 有数据返回 1 ，已经没有数据返回 0
+ */
+int bp_cursor_next(
+	bp_cursor_t    *cursor,
+	unsigned char **key,
+	unsigned char **value)
+{
+	unsigned char *item;
+	int            has_node;
+
+	has_node = bp_cursor_forward(cursor);
+
+	// 相同的 key 树上的数据先插入，先返回
+	if (cursor->buf_idx < cursor->buf_end) {
+		item = cursor->buf + cursor->buf_idx * cursor->item_size;
+		if (!has_node
+			|| 0 > bp_key_compare(cursor->compare, item,
+								  bp_data_node_key(cursor->data, cursor->idx),
+								  cursor->key_size)) {
+			*key             = item;
+			*value           = item + cursor->key_size;
+			cursor->buf_idx += 1;
+
+			return 1;
+		}
+	}
+
+	if (!has_node)
+		return 0;
+
+	*key   = bp_data_node_key(cursor->data, cursor->idx);
+	*value = bp_data_node_value(cursor->data, cursor->idx);
+	cursor->idx += 1;
+
+	return 1;
+}
+
+/**
+ * @brief 返回当前数据结点上从游标开始的连续的 K|V 数据项，并把游标移动到这些数据项之后
+ *
+ * @param cursor 游标
+ * @param items 用于输出第一个数据项在数据结点上的位置，每个数据项长度为
+ *              key_size + value_size
+ * @return int 数据项的个数，已经没有数据返回 0 ，数据结点上的 K|V 不是交错保存的
+ *             返回 -1
+ */
+int bp_cursor_next_run(bp_cursor_t *cursor, unsigned char **items)
+{
+	bp_data_node_t *data;
+	unsigned char  *item;
+	int             has_node;
+	int             end;
+	int             num;
+
+	has_node = bp_cursor_forward(cursor);
+	data     = cursor->data;
+	if (has_node && BP_LAYOUT_SPLIT == data->common.layout)
+		return -1;
+
+	end = cursor->end;
+	if (cursor->buf_idx < cursor->buf_end) {
+		item = cursor->buf + cursor->buf_idx * cursor->item_size;
+
+		// 插入缓冲中比数据结点上下一个 key 小的数据项组成一段
+		num = cursor->buf_end - cursor->buf_idx;
+		if (has_node)
+			num = bp_lower_bound(item, num, cursor->item_size,
+								 bp_data_node_key(data, cursor->idx),
+								 cursor->key_size, 0, cursor->compare,
+								 cursor->key_type);
+		if (num > 0) {
+			*items           = item;
+			cursor->buf_idx += num;
+
+			return num;
+		}
+
+		// 数据结点上不大于缓冲中下一个 key 的数据项组成一段
+		end = bp_upper_bound(data->content, cursor->end,
+							 bp_data_node_key_stride(data), item,
+							 cursor->key_size, 0, data->common.compare,
+							 data->common.key_type);
+	}
+
+	if (!has_node)
+		return 0;
+
+	*items = data->content + cursor->idx * bp_data_node_get_item_size(data);
+	num = end - cursor->idx;
+	cursor->idx = end;
+
+	return num;
+}
+
+/**
+ * @brief 关闭游标
+ *
+ * @param cursor 游标
+ */
+void bp_cursor_close(bp_cursor_t *cursor)
+{
+	if (cursor->own_snapshot)
+		bp_snapshot_close(cursor->snapshot);
+
+	free(cursor);
+}
+
+/**
+ * @brief 并行扫描时每个线程平均分到的子树个数，子树越多每个线程的数据量越接近
+ */
+#define BP_SCAN_PARTS_PER_THREAD 4
+
+/**
+ * @brief 并行扫描时划分范围用的一棵子树
+ *
+ */
+typedef struct bp_scan_node {
+	bp_node_t       *node; /** 子树的根结点 */
+	bp_inner_node_t *parent; /** 父结点，上面第 idx 个 key 是子树的最大值 */
+	int              idx; /** 子树在父结点上的下标 */
+} bp_scan_node_t;
+
+/**
+ * @brief 并行扫描时一个线程负责的一段连续的数据结点
+ *
+ */
+typedef struct bp_scan_part {
+	bp_tree_t      *tree; /** 扫描的B+树 */
+	unsigned char  *lo; /** 扫描范围的下限， NULL 表示不限 */
+	unsigned char  *hi; /** 扫描范围的上限， NULL 表示不限 */
+	bp_scan_f       fn; /** 处理数据项的函数 */
+	void           *arg; /** 传给 fn 的参数 */
+	int             part; /** 这一段的下标 */
+	bp_data_node_t *first; /** 第一个数据结点 */
+	bp_data_node_t *end; /** 最后一个数据结点的下一个数据结点， NULL 表示到最后 */
+	int             ret; /** fn 都返回 0 时为 0 ，否则为 -1 */
+	pthread_t       thread; /** 扫描这一段的线程 */
+} bp_scan_part_t;
+
+/**
+ * @brief 返回子树最左侧的数据结点
+ *
+ * @param node 子树的根结点
+ * @return bp_data_node_t* 最左侧的数据结点
+ */
+static bp_data_node_t *bp_node_first_data(bp_node_t *node)
+{
+	while (BP_NODE_TYPE_INNER == node->type)
+		node = bp_inner_node_get_child((bp_inner_node_t *)node, 0);
+
+	return (bp_data_node_t *)node;
+}
+
+/**
+ * @brief 扫描一段数据结点上 [lo, hi] 范围内的数据项
+ *
+ * @param arg 扫描的数据结点 bp_scan_part_t
+ * @return void* NULL
+ */
+static void *bp_scan_part(void *arg)
+{
+	bp_scan_part_t *part;
+	bp_data_node_t *data;
+	bp_compare_f    compare;
+	int             num;
+	int             a;
+	int             b;
+
+	part    = arg;
+	compare = ((bp_node_common_t *)part->tree->head)->compare;
+	for (data = part->first; data != part->end; data = bp_data_node_get_pnext(data)) {
+		num = data->common.key_num;
+		if (0 == num)
+			continue;
+
+		// 只有范围两端的数据结点需要查找
+		a = 0;
+		b = num;
+		if (part->lo && 0 > bp_key_compare(compare, bp_data_node_key(data, 0),
+										   part->lo, data->key_size))
+			a = bp_lower_bound(data->content, num, bp_data_node_key_stride(data),
+							   part->lo, data->key_size, 0, compare,
+							   data->common.key_type);
+		if (part->hi && 0 < bp_key_compare(compare, bp_data_node_key(data, num - 1),
+										   part->hi, data->key_size))
+			b = bp_upper_bound(data->content, num, bp_data_node_key_stride(data),
+							   part->hi, data->key_size, 0, compare,
+							   data->common.key_type);
+
+		if (a < b && 0 != part->fn(part->arg, part->part,
+								   bp_data_node_key(data, a), b - a)) {
+			part->ret = -1;
+			break;
+		}
+
+		if (b < num)
+			break;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief 把根结点下的子树一层一层展开，直到子树的个数足够分给每个线程
+ *
+ * @param tree B+树
+ * @param want 至少需要的子树个数
+ * @param out 用于输出同一层的所有子树，需要调用方释放
+ * @return int 子树的个数，内存不足返回 -1
+ */
+static int bp_scan_expand(bp_tree_t *tree, int want, bp_scan_node_t **out)
+{
+	bp_scan_node_t  *nodes;
+	bp_scan_node_t  *next;
+	bp_inner_node_t *inner;
+	int              num;
+	int              next_num;
+	int              i;
+	int              j;
+
+	inner = (bp_inner_node_t *)tree->head;
+	nodes = malloc(inner->common.key_num * sizeof(*nodes));
+	if (NULL == nodes)
+		return -1;
+
+	for (i = 0; i < inner->common.key_num; i++) {
+		nodes[i].node   = bp_inner_node_get_child(inner, i);
+		nodes[i].parent = inner;
+		nodes[i].idx    = i;
+	}
+	num = inner->common.key_num;
+
+	// B+树是平衡的，同一层的子树要么都是内部结点，要么都是数据结点
+	while (num < want && BP_NODE_TYPE_INNER == nodes[0].node->type) {
+		next_num = 0;
+		for (i = 0; i < num; i++)
+			next_num += ((bp_inner_node_t *)nodes[i].node)->common.key_num;
+
+		next = malloc(next_num * sizeof(*next));
+		if (NULL == next) {
+			free(nodes);
+
+			return -1;
+		}
+
+		next_num = 0;
+		for (i = 0; i < num; i++) {
+			inner = (bp_inner_node_t *)nodes[i].node;
+			for (j = 0; j < inner->common.key_num; j++, next_num++) {
+				next[next_num].node   = bp_inner_node_get_child(inner, j);
+				next[next_num].parent = inner;
+				next[next_num].idx    = j;
+			}
+		}
+
+		free(nodes);
+		nodes = next;
+		num   = next_num;
+	}
+
+	*out = nodes;
+
+	return num;
+}
+
+/**
+ * @brief 多线程扫描 [lo, hi] 范围内的数据项
+ *
+ * @details
+ *  从根结点向下展开子树，直到同一层的子树个数达到线程数的 BP_SCAN_PARTS_PER_THREAD
+ *  倍。去掉最大值小于 lo 的子树和第一个最大值大于 hi 的子树之后的子树，按每棵子树的
+ *  key_total 把剩下的连续子树分成 thread_num 段，每段的数据量接近。每个线程从这一段
+ *  最左侧的数据结点开始沿着 pnext 扫描到下一段的第一个数据结点为止，每个数据结点上
+ *  范围内的数据项调用一次 fn 。子树的最大值在删除之后可能大于实际的最大值，只会让
+ *  被去掉的子树变少，不影响结果
+ *
+ * @param tree B+树，扫描期间不能有写操作
+ * @param lo 扫描范围的下限， NULL 表示不限
+ * @param hi 扫描范围的上限， NULL 表示不限
+ * @param fn 处理数据项的函数，会在多个线程上同时调用，返回非 0 时这个线程停止扫描
+ * @param arg 传给 fn 的参数
+ * @param thread_num 扫描的线程个数，包括当前线程
+ * @return int 扫描完成返回 0 ，参数错误、内存不足、 BP_LAYOUT_SPLIT 的树或者 fn
+ *             返回了非 0 时返回 -1
+ */
+int bp_parallel_scan(
+	bp_tree_t     *tree,
+	unsigned char *lo,
+	unsigned char *hi,
+	bp_scan_f      fn,
+	void          *arg,
+	int            thread_num)
+{
+	bp_scan_node_t *nodes;
+	bp_scan_part_t *parts;
+	int64_t         total;
+	int64_t         acc;
+	int             part_num;
+	int             num;
+	int             first;
+	int             last;
+	int             start;
+	int             ret;
+	int             i;
+
+	if (thread_num <= 0 || BP_LAYOUT_SPLIT == tree->layout)
+		return -1;
+
+	if (-1 == bp_tree_flush(tree))
+		return -1;
+
+	if (0 == ((bp_node_common_t *)tree->head)->key_num)
+		return 0;
+
+	num = bp_scan_expand(tree, thread_num * BP_SCAN_PARTS_PER_THREAD, &nodes);
+	if (num < 0)
+		return -1;
+
+	first = 0;
+	while (lo && first < num &&
+		   0 > bp_inner_node_compare_key(nodes[first].parent, nodes[first].idx, lo))
+		first++;
+
+	last = first;
+	while (last < num - 1 &&
+		   (NULL == hi || 0 >= bp_inner_node_compare_key(nodes[last].parent,
+														  nodes[last].idx, hi)))
+		last++;
+
+	if (first == num || (lo && hi && 0 < bp_key_compare(
+							 ((bp_node_common_t *)tree->head)->compare, lo, hi,
+							 tree->key_size))) {
+		free(nodes);
+
+		return 0;
+	}
+
+	parts = calloc(thread_num, sizeof(*parts));
+	if (NULL == parts) {
+		free(nodes);
+
+		return -1;
+	}
+
+	total = 0;
+	for (i = first; i <= last; i++)
+		total += bp_node_get_key_total(nodes[i].node);
+
+	part_num = 0;
+	acc      = 0;
+	start    = first;
+	for (i = first; i <= last; i++) {
+		acc += bp_node_get_key_total(nodes[i].node);
+		if (i < last && (part_num == thread_num - 1
+						 || acc * thread_num < total * (part_num + 1)))
+			continue;
+
+		parts[part_num].tree  = tree;
+		parts[part_num].lo    = lo;
+		parts[part_num].hi    = hi;
+		parts[part_num].fn    = fn;
+		parts[part_num].arg   = arg;
+		parts[part_num].part  = part_num;
+		parts[part_num].first = bp_node_first_data(nodes[start].node);
+		parts[part_num].end   = i + 1 < num ? bp_node_first_data(nodes[i + 1].node)
+			: NULL;
+		part_num += 1;
+		start     = i + 1;
+	}
+	free(nodes);
+
+	// 创建线程失败时在当前线程上扫描这一段
+	for (i = 1; i < part_num; i++)
+		if (0 != pthread_create(&parts[i].thread, NULL, bp_scan_part, &parts[i])) {
+			bp_scan_part(&parts[i]);
+			parts[i].thread = pthread_self();
+		}
+	bp_scan_part(&parts[0]);
+
+	ret = parts[0].ret;
+	for (i = 1; i < part_num; i++) {
+		if (!pthread_equal(parts[i].thread, pthread_self()))
+			pthread_join(parts[i].thread, NULL);
+		ret |= parts[i].ret;
+	}
+	free(parts);
+
+	return ret;
+}
+
+/**
+ * @brief 文件中每个页的大小，页在文件中的下标就是页的偏移除以页的大小
+ */
+#define BP_PAGE_SIZE    4096
+#define BP_PAGE_VERSION 1
+
+static const unsigned char bp_page_magic[8] = {'B', 'P', 'L', 'U', 'S', 'M', 'A', 'P'};
+
+/**
+ * @brief
+ *  文件第 0 页开头的文件头
+ */
+typedef struct bp_file_header {
+	unsigned char magic[8]; /** 文件写完之后才写入的魔数 */
+	uint32_t      version; /** 文件格式的版本 */
+	uint32_t      page_size; /** 页的大小 */
+	uint32_t      key_size; /** 被索引项的大小 */
+	uint32_t      value_size; /** 位置信息的大小 */
+	uint32_t      custom_compare; /** 保存时的树是否使用了自定义的比较函数 */
+	uint32_t      generation; /** 保存时指定的版本号， bp_save_tree 保存的文件为 0 */
+	uint64_t      page_num; /** 文件中页的个数 */
+	uint64_t      root; /** 根结点所在的页，空树为 0 */
+	uint64_t      item_num; /** 被索引项的个数 */
+} bp_file_header_t;
+
+/**
+ * @brief
+ *  文件中的一个结点，占用一整页
+ *
+ * @details
+ *  内部结点的 content 上是交错保存的 P|K ， P 是 8 字节的页下标， next 是结点所在的
+ *  层，数据结点的父结点为第 1 层；数据结点的 content 上是交错保存的 K|V ， next 是
+ *  下一个数据结点的页下标，最后一个数据结点为 0
+ */
+typedef struct bp_page {
+	uint32_t      type; /** bp_node_type_e */
+	uint32_t      key_num; /** 保存的数据项的个数 */
+	uint64_t      next; /** 下一个数据结点所在的页或者内部结点所在的层 */
+	unsigned char content[0];
+} bp_page_t;
+
+#define bp_page_inner_item_size(_key_size) ((int)sizeof(uint64_t) + (_key_size))
+
+/**
+ * @brief 通过缓冲池访问时内部结点和数据结点的 CLOCK 访问计数
+ */
+#define BP_POOL_INNER_WEIGHT 8
+#define BP_POOL_DATA_WEIGHT  1
+
+/**
+ * @brief 游标每次预读的数据结点个数
+ */
+#define BP_READAHEAD_PAGES 32
+
+/**
+ * @brief bp_load_tree 构建的树上结点的填充率，留出空间给之后的插入
+ */
+#define BP_LOAD_FILL_FACTOR 75
+
+/**
+ * @brief
+ *  直接访问 bp_save_tree 保存的文件的只读B+树
+ */
+struct bp_mmap_tree {
+	bp_pool_t     *pool; /** 缓冲池，为 NULL 时通过 mmap 访问 */
+	unsigned char *base; /** 映射的开始位置 */
+	size_t         size; /** 映射的长度 */
+	uint64_t       page_num; /** 文件中页的个数 */
+	uint64_t       root; /** 根结点所在的页 */
+	int            key_size; /** 被索引项的大小 */
+	int            value_size; /** 位置信息的大小 */
+	int            data_cap; /** 数据结点最多保存的数据项个数 */
+	int            inner_cap; /** 内部结点最多保存的子结点个数 */
+	bp_compare_f   compare; /** 比较 key 值的函数 */
+	bp_key_type_e  key_type; /** 结点内查找时比较 key 值的方式 */
+};
+
+/**
+ * @brief
+ *  只读B+树上的游标
+ */
+struct bp_mmap_cursor {
+	bp_mmap_tree_t *tree; /** 只读的B+树 */
+	bp_page_t      *page; /** 当前的数据结点，通过缓冲池访问时一直被 pin 住 */
+	int             idx; /** 下一个数据项在当前数据结点上的下标 */
+	uint64_t        readahead; /** 已经预读到的页下标，不包括这一页 */
+	int             has_hi; /** 是否有查找范围的上限 */
+	unsigned char   hi[0]; /** 查找范围的上限 */
+};
+
+/**
+ * @brief 把一页写到文件的当前位置
+ *
+ * @param file 文件
+ * @param page 页，写完之后清零
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_save_page(FILE *file, bp_page_t *page)
+{
+	if (1 != fwrite(page, BP_PAGE_SIZE, 1, file))
+		return -1;
+
+	memset(page, 0, BP_PAGE_SIZE);
+
+	return 0;
+}
+
+/**
+ * @brief 记下一个已经写入文件的结点，用于构建上一层的内部结点
+ *
+ * @param level 当前层结点的数组，每项是 8 字节的页下标和结点的最大值，空间不够时扩大
+ * @param level_cap level 可以保存的项数
+ * @param level_num level 中有效的项数
+ * @param page_idx 结点所在的页
+ * @param max_key 结点的最大值
+ * @param key_size 被索引项的大小
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_save_level_add(
+	unsigned char **level,
+	int            *level_cap,
+	int            *level_num,
+	uint64_t        page_idx,
+	unsigned char  *max_key,
+	int             key_size)
+{
+	unsigned char *new_level;
+	int            item_size;
+
+	item_size = bp_page_inner_item_size(key_size);
+	if (*level_num == *level_cap) {
+		new_level = realloc(*level, 2 * (*level_cap + 16) * item_size);
+		if (NULL == new_level)
+			return -1;
+
+		*level     = new_level;
+		*level_cap = 2 * (*level_cap + 16);
+	}
+
+	memcpy(*level + *level_num * item_size, &page_idx, sizeof(page_idx));
+	memcpy(*level + *level_num * item_size + sizeof(page_idx), max_key, key_size);
+	*level_num += 1;
+
+	return 0;
+}
+
+/**
+ * @brief 依次写入所有的数据结点，所有的被索引项重新紧密排列
+ *
+ * @param tree B+树
+ * @param file 文件，当前位置是第 1 页
+ * @param page 一页大小的缓冲区，内容为 0
+ * @param level 用于输出每个数据结点的页下标和最大值
+ * @param level_cap level 可以保存的项数
+ * @param level_num 用于输出数据结点的个数
+ * @param item_num 用于输出被索引项的个数
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_save_data_pages(
+	bp_tree_t      *tree,
+	FILE           *file,
+	bp_page_t      *page,
+	unsigned char **level,
+	int            *level_cap,
+	int            *level_num,
+	uint64_t       *item_num)
+{
+	bp_cursor_t   *cursor;
+	unsigned char *key;
+	unsigned char *value;
+	unsigned char *last;
+	uint64_t       page_idx;
+	int            item_size;
+	int            cap;
+
+	item_size = tree->key_size + tree->value_size;
+	cap       = (BP_PAGE_SIZE - sizeof(bp_page_t)) / item_size;
+	cursor    = bp_cursor_open(tree, NULL, NULL);
+	if (NULL == cursor)
+		return -1;
+
+	// 读到下一个数据项时才知道当前页是不是最后一个数据结点
+	page_idx  = 1;
+	*item_num = 0;
+	page->type = BP_NODE_TYPE_DATA;
+	while (bp_cursor_next(cursor, &key, &value)) {
+		if ((int)page->key_num == cap) {
+			last       = page->content + (cap - 1) * item_size;
+			page->next = page_idx + 1;
+			if (-1 == bp_save_level_add(level, level_cap, level_num, page_idx,
+										last, tree->key_size)
+				|| -1 == bp_save_page(file, page)) {
+				bp_cursor_close(cursor);
+
+				return -1;
+			}
+
+			page_idx  += 1;
+			page->type = BP_NODE_TYPE_DATA;
+		}
+
+		memcpy(page->content + page->key_num * item_size, key, tree->key_size);
+		memcpy(page->content + page->key_num * item_size + tree->key_size, value,
+			   tree->value_size);
+		page->key_num += 1;
+		*item_num     += 1;
+	}
+	bp_cursor_close(cursor);
+
+	if (0 == page->key_num)
+		return 0;
+
+	last = page->content + (page->key_num - 1) * item_size;
+	if (-1 == bp_save_level_add(level, level_cap, level_num, page_idx, last,
+								tree->key_size))
+		return -1;
+
+	return bp_save_page(file, page);
+}
+
+/**
+ * @brief 把B+树保存成可以用 bp_open_mmap 直接访问的文件
+ *
+ * @details
+ *  文件由 BP_PAGE_SIZE 大小的页组成，第 0 页是文件头，之后依次是所有的数据结点，再
+ *  自底向上是每一层的内部结点，最后写入的一页是根结点。结点之间用页下标代替指针，
+ *  所以文件映射到任意地址都可以直接使用。文件头最后才写入，写到一半失败的文件没有
+ *  有效的魔数，不会被 bp_open_mmap 打开。
+ *
+ *  保存时游标需要访问整棵树，并发模式的树上不能同时有写操作；写时复制模式的树上游标
+ *  保存的是打开时的快照
+ *
+ * @param tree B+树
+ * @param path 文件路径，已经存在的文件会被覆盖
+ * @param generation 写入文件头的版本号，用于判断文件和其它文件的先后关系
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+int bp_save_tree_with_generation(
+	bp_tree_t  *tree,
+	const char *path,
+	uint32_t    generation)
+{
+	bp_file_header_t *header;
+	bp_page_t        *page;
+	FILE             *file;
+	unsigned char    *level;
+	uint64_t          page_idx;
+	uint64_t          item_num;
+	uint64_t          height;
+	int               item_size;
+	int               level_cap;
+	int               level_num;
+	int               node_num;
+	int               base;
+	int               child_num;
+	int               consumed;
+	int               i;
+	int               j;
+
+	item_size = bp_page_inner_item_size(tree->key_size);
+	if ((int)sizeof(bp_page_t) + tree->key_size + tree->value_size > BP_PAGE_SIZE
+		|| (int)sizeof(bp_page_t) + 2 * item_size > BP_PAGE_SIZE)
+		return -1;
+
+	if (-1 == bp_tree_flush(tree))
+		return -1;
+
+	page = malloc(BP_PAGE_SIZE);
+	if (NULL == page)
+		return -1;
+
+	file = fopen(path, "wb");
+	if (NULL == file) {
+		free(page);
+
+		return -1;
+	}
+
+	level     = NULL;
+	level_cap = 0;
+	level_num = 0;
+	memset(page, 0, BP_PAGE_SIZE);
+	if (-1 == bp_save_page(file, page)
+		|| -1 == bp_save_data_pages(tree, file, page, &level, &level_cap,
+									&level_num, &item_num))
+		goto fail;
+
+	// 和批量构建一样把子结点平均分配到每个内部结点上，新的一层覆盖 level 的开头
+	page_idx = 1 + level_num;
+	height   = 0;
+	while (level_num > 1) {
+		height += 1;
+		bp_bulk_divide(level_num, (BP_PAGE_SIZE - sizeof(bp_page_t)) / item_size,
+					   &node_num, &base);
+		consumed = 0;
+		for (i = 0; i < node_num; i++) {
+			child_num     = base + (i < level_num % node_num ? 1 : 0);
+			page->type    = BP_NODE_TYPE_INNER;
+			page->key_num = child_num;
+			page->next    = height;
+			memcpy(page->content, level + consumed * item_size,
+				   child_num * item_size);
+			consumed += child_num;
+
+			j = consumed - 1;
+			memcpy(level + i * item_size, &page_idx, sizeof(page_idx));
+			memmove(level + i * item_size + sizeof(page_idx),
+					level + j * item_size + sizeof(page_idx), tree->key_size);
+			if (-1 == bp_save_page(file, page))
+				goto fail;
+
+			page_idx += 1;
+		}
+		level_num = node_num;
+	}
+
+	header = (bp_file_header_t *)page;
+	memcpy(header->magic, bp_page_magic, sizeof(bp_page_magic));
+	header->version        = BP_PAGE_VERSION;
+	header->page_size      = BP_PAGE_SIZE;
+	header->key_size       = tree->key_size;
+	header->value_size     = tree->value_size;
+	header->custom_compare = NULL != ((bp_node_common_t *)tree->head)->compare;
+	header->page_num       = page_idx;
+	header->root           = page_idx - 1;
+	header->item_num       = item_num;
+	header->generation     = generation;
+	if (0 == item_num)
+		header->root = 0;
+
+	if (0 != fseek(file, 0, SEEK_SET) || -1 == bp_save_page(file, page))
+		goto fail;
+
+	free(level);
+	free(page);
+
+	return 0 == fclose(file) ? 0 : -1;
+
+fail:
+	free(level);
+	free(page);
+	fclose(file);
+
+	return -1;
+}
+
+/**
+ * @brief 把B+树保存成可以用 bp_open_mmap 直接访问的文件，文件头的版本号为 0
+ *
+ * @param tree B+树
+ * @param path 文件路径，已经存在的文件会被覆盖
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+int bp_save_tree(bp_tree_t *tree, const char *path)
+{
+	return bp_save_tree_with_generation(tree, path, 0);
+}
+
+/**
+ * @brief 根据文件头初始化只读B+树
+ *
+ * @param tree 只读的B+树
+ * @param header 文件头
+ * @param file_size 文件的大小
+ * @param compare 比较 key 值的函数，必须和保存时的树使用的函数相同
+ * @return int 文件头有效返回 0 ，否则返回 -1
+ */
+static int bp_mmap_tree_init(
+	bp_mmap_tree_t   *tree,
+	bp_file_header_t *header,
+	uint64_t          file_size,
+	bp_compare_f      compare)
+{
+	if (0 != memcmp(header->magic, bp_page_magic, sizeof(bp_page_magic))
+		|| BP_PAGE_VERSION != header->version
+		|| BP_PAGE_SIZE != header->page_size
+		|| header->page_num > file_size / BP_PAGE_SIZE
+		|| header->root >= header->page_num
+		|| (NULL != compare) != (0 != header->custom_compare))
+		return -1;
+
+	tree->page_num   = header->page_num;
+	tree->root       = header->root;
+	tree->key_size   = header->key_size;
+	tree->value_size = header->value_size;
+	tree->data_cap   = (BP_PAGE_SIZE - sizeof(bp_page_t))
+		/ (header->key_size + header->value_size);
+	tree->inner_cap  = (BP_PAGE_SIZE - sizeof(bp_page_t))
+		/ bp_page_inner_item_size(header->key_size);
+	tree->compare    = compare;
+	tree->key_type   = bp_select_key_type(compare, header->key_size);
+
+	return 0;
+}
+
+/**
+ * @brief 通过 mmap 打开 bp_save_tree 保存的文件
+ *
+ * @details
+ *  只检查文件头，不读取任何结点，打开的时间和文件大小无关。结点在第一次被查找访问时
+ *  才由操作系统从文件中读入
+ *
+ * @param path 文件路径
+ * @param compare 比较 key 值的函数，必须和保存时的树使用的函数相同
+ * @return bp_mmap_tree_t* 只读的B+树，文件无效或者打开失败返回 NULL
+ */
+bp_mmap_tree_t *bp_open_mmap(const char *path, bp_compare_f compare)
+{
+	bp_mmap_tree_t *new;
+	struct stat     st;
+	void           *base;
+	int             fd;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd)
+		return NULL;
+
+	if (0 != fstat(fd, &st) || st.st_size < BP_PAGE_SIZE) {
+		close(fd);
+
+		return NULL;
+	}
+
+	// 映射建立之后不再需要文件描述符
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == base)
+		return NULL;
+
+	new = malloc(sizeof(*new));
+	if (NULL == new
+		|| -1 == bp_mmap_tree_init(new, (bp_file_header_t *)base, st.st_size,
+								   compare)) {
+		free(new);
+		munmap(base, st.st_size);
+
+		return NULL;
+	}
+
+	new->pool = NULL;
+	new->base = base;
+	new->size = st.st_size;
+
+	return new;
+}
+
+/**
+ * @brief 打开 bp_save_tree 保存的文件，页通过缓冲池按需读入
+ *
+ * @details
+ *  缓冲池只占用 frame_num 页的内存，适用于文件比内存大的情况。内部结点的访问计数比
+ *  数据结点大，帧的个数比内部结点多时内部结点会一直留在缓冲池中，查找通常只需要从
+ *  文件读入一个数据结点
+ *
+ * @param path 文件路径
+ * @param compare 比较 key 值的函数，必须和保存时的树使用的函数相同
+ * @param frame_num 缓冲池中帧的个数，同时进行的每个查找或者游标最多 pin 住两页
+ * @return bp_mmap_tree_t* 只读的B+树，文件无效或者打开失败返回 NULL
+ */
+bp_mmap_tree_t *bp_open_pooled(
+	const char   *path,
+	bp_compare_f  compare,
+	int           frame_num)
+{
+	bp_file_header_t  header;
+	bp_mmap_tree_t   *new;
+	unsigned char    *data;
+	struct stat       st;
+
+	if (0 != stat(path, &st))
+		return NULL;
+
+	new = malloc(sizeof(*new));
+	if (NULL == new)
+		return NULL;
+
+	new->pool = bp_pool_open(path, BP_PAGE_SIZE, frame_num, 0);
+	if (NULL == new->pool) {
+		free(new);
+
+		return NULL;
+	}
+
+	// 文件头只在打开时读取一次，之后第 0 页可以被淘汰
+	data = bp_pool_pin(new->pool, 0, 0);
+	if (NULL != data) {
+		memcpy(&header, data, sizeof(header));
+		bp_pool_unpin(new->pool, data, 0);
+	}
+
+	if (NULL == data
+		|| -1 == bp_mmap_tree_init(new, &header, st.st_size, compare)) {
+		bp_pool_close(new->pool);
+		free(new);
+
+		return NULL;
+	}
+
+	new->base = NULL;
+	new->size = 0;
+
+	return new;
+}
+
+/**
+ * @brief 取得一页，通过缓冲池访问时 pin 住这一页
  *
- * @param to_split 要分裂的数据结点
- * @param pp_new 分裂出的新结点
- * @return int 分裂是否成功
+ * @param tree 只读的B+树
+ * @param page_idx 页下标
+ * @param weight 通过缓冲池访问时页的访问计数
+ * @return bp_page_t* 页，页下标或者页上的数据项个数无效、读取失败时返回 NULL
  */
-int bp_data_node_split(
-	bp_node_t  *to_split,
-	bp_node_t **pp_new)
+static bp_page_t *bp_mmap_page_get(
+	bp_mmap_tree_t *tree,
+	uint64_t        page_idx,
+	int             weight)
 {
-	bp_data_node_t *old;
-	bp_data_node_t *new;
-	int             old_data_num;
-	int             offset;
-	int             copy_len;
+	bp_page_t *page;
 
-	old = (bp_data_node_t *)to_split;
-	new = (bp_data_node_t *)bp_create_data_node(
-		old->common.max_key_num, old->common.min_key_num,
-		old->key_size, old->value_size, old->common.compare);
-	if (NULL == new) {
-		*pp_new = NULL;
+	if (0 == page_idx || page_idx >= tree->page_num)
+		return NULL;
 
-		return -1;
+	if (tree->pool)
+		page = (bp_page_t *)bp_pool_pin(tree->pool, page_idx, weight);
+	else
+		page = (bp_page_t *)(tree->base + page_idx * BP_PAGE_SIZE);
+	if (NULL == page)
+		return NULL;
+
+	if ((int)page->key_num > (BP_NODE_TYPE_DATA == page->type
+							  ? tree->data_cap : tree->inner_cap)) {
+		if (tree->pool)
+			bp_pool_unpin(tree->pool, (unsigned char *)page, 0);
+
+		return NULL;
 	}
 
-	// 旧结点保存小的 1/2 数据，新结点保存大的 1/2 数据
-	old_data_num = old->common.key_num;
-	old->common.key_num = old_data_num / 2;
-	new->common.key_num = old_data_num - old->common.key_num;
+	return page;
+}
 
-	// 复制数据到新的结点
-	offset   = old->common.key_num * (old->key_size + old->value_size);
-	copy_len = new->common.key_num * (new->key_size + new->value_size);
-	memcpy(new->content, old->content + offset, copy_len);
+/**
+ * @brief 用完 bp_mmap_page_get 取得的页
+ *
+ * @param tree 只读的B+树
+ * @param page 页
+ */
+static inline void bp_mmap_page_put(bp_mmap_tree_t *tree, bp_page_t *page)
+{
+	if (tree->pool)
+		bp_pool_unpin(tree->pool, (unsigned char *)page, 0);
+}
 
-	// 新结点的 pnext 指向旧结点的 pnext，旧结点的 pnext 指向新结点
-	bp_data_node_set_pnext(new, bp_data_node_get_pnext(old));
-	bp_data_node_set_pnext(old, new);
+/**
+ * @brief 从根结点开始找到 key 所在的第一个数据结点
+ *
+ * @param tree 只读的B+树
+ * @param key 被索引项， NULL 表示找最左侧的数据结点
+ * @param idx 用于输出第一个大于等于 key 的数据项的下标
+ * @return bp_page_t* 数据结点，用完之后需要 bp_mmap_page_put ，没有找到返回 NULL
+ */
+static bp_page_t *bp_mmap_find_data_page(
+	bp_mmap_tree_t *tree,
+	unsigned char  *key,
+	int            *idx)
+{
+	bp_page_t *page;
+	bp_page_t *child;
+	uint64_t   child_idx;
+	int        item_size;
 
-	*pp_new = (bp_node_t *)new;
+	item_size = bp_page_inner_item_size(tree->key_size);
+	page      = bp_mmap_page_get(tree, tree->root, BP_POOL_INNER_WEIGHT);
+	while (page && BP_NODE_TYPE_INNER == page->type) {
+		*idx = 0;
+		if (key)
+			*idx = bp_lower_bound(page->content + sizeof(uint64_t),
+								  page->key_num, item_size, key, tree->key_size,
+								  0, tree->compare, tree->key_type);
+		if (*idx == (int)page->key_num) {
+			bp_mmap_page_put(tree, page);
 
-	return 0;
+			return NULL;
+		}
+
+		// 内部结点的 next 是它所在的层，第 1 层的子结点是数据结点
+		memcpy(&child_idx, page->content + *idx * item_size, sizeof(child_idx));
+		child = bp_mmap_page_get(tree, child_idx, page->next > 1
+								 ? BP_POOL_INNER_WEIGHT : BP_POOL_DATA_WEIGHT);
+		bp_mmap_page_put(tree, page);
+		page = child;
+	}
+
+	if (NULL == page)
+		return NULL;
+
+	*idx = 0;
+	if (key)
+		*idx = bp_lower_bound(page->content, page->key_num,
+							  tree->key_size + tree->value_size, key,
+							  tree->key_size, 0, tree->compare, tree->key_type);
+
+	return page;
 }
 
 /**
- * @brief 插入被索引项和位置信息
+ * @brief 在只读的B+树中查找被索引项的所有位置信息
  *
- * @param data 数据结点
+ * @param tree 只读的B+树
  * @param key 被索引项
- * @param position 位置信息
- * @param pp_new 如果 data 保存满了则进行结点分裂，返回分裂出的新结点
- * @return int 成功返回 0 ，否则返回 -1
+ * @param key_len 被索引项的长度
+ * @param values_out 用于输出位置信息，长度至少为 max_num * value_size
+ * @param max_num values_out 最多可以保存的位置信息的个数
+ * @return int 输出的位置信息的个数，参数错误返回 -1
  */
-int bp_data_node_insert_data(
-	bp_node_t      *node,
+int bp_mmap_search_all(
+	bp_mmap_tree_t *tree,
 	unsigned char  *key,
-	unsigned char  *position,
-	bp_node_t     **pp_new)
+	int             key_len,
+	unsigned char  *values_out,
+	int             max_num)
 {
-	bp_data_node_t *data;
-	int             valid_data_len;
-	int             item_size;
-	int             found;
-	int             found_idx;
-	int             cmp_res;
-	unsigned char  *dst;
-	unsigned char  *tmp;
-	unsigned char  *max_key_of_data;
-	unsigned char  *min_key_of_new;
-
-	data    = (bp_data_node_t *)node;
-	*pp_new = NULL;
+	bp_page_t *page;
+	bp_page_t *next;
+	int        item_size;
+	int        found_num;
+	int        idx;
 
-	if (bp_data_node_need_split(data)
-		&& -1 == bp_data_node_split(node, pp_new))
+	if (tree->key_size != key_len)
 		return -1;
 
-	// 如果分裂了，需要找出 key 值插入旧结点还是新结点
-	if (*pp_new) {
-		max_key_of_data = data->content + (data->common.key_num - 1) *
-			(data->key_size + data->value_size);
-		cmp_res = memcmp(key, max_key_of_data, data->key_size);
-		if (0 < cmp_res) {
-			// key 大于 max_key_of_data 时，新 key 应该插入到分裂出的结点
-			data = (bp_data_node_t *)*pp_new;
-		} else if (0 == cmp_res) {
-			// 如果 data 存在相等的 key 值，且分裂点正好在相等的 key 值中间时
-			// 新 key 应该插入到分裂出的结点
-			min_key_of_new = ((bp_data_node_t *)(*pp_new))->content;
-			if (0 == memcpy(key, min_key_of_new, data->key_size))
-				data = (bp_data_node_t *)*pp_new;
+	page = bp_mmap_find_data_page(tree, key, &idx);
+	item_size = tree->key_size + tree->value_size;
+	found_num = 0;
+	while (page && found_num < max_num) {
+		if (idx == (int)page->key_num) {
+			next = bp_mmap_page_get(tree, page->next, BP_POOL_DATA_WEIGHT);
+			bp_mmap_page_put(tree, page);
+			page = next;
+			idx  = 0;
+
+			continue;
 		}
+
+		if (0 != bp_key_compare(tree->compare, page->content + idx * item_size,
+								key, tree->key_size))
+			break;
+
+		memcpy(values_out + found_num * tree->value_size,
+			   page->content + idx * item_size + tree->key_size,
+			   tree->value_size);
+		found_num += 1;
+		idx       += 1;
 	}
 
-	// 查找合适的位置插入，存在相同 key 值时，要确保 key 值要插入到相同 key 值的后面
-	item_size      = bp_data_node_get_item_size(data);
-	valid_data_len = bp_data_node_get_valid_data_len(data, item_size);
-	found = bp_bi_search_last(data->content, valid_data_len, item_size, key,
-							  data->key_size, 0, data->common.compare, &found_idx);
-	dst = data->content + found_idx * item_size;
-	if (found)
-		dst += item_size;
+	if (page)
+		bp_mmap_page_put(tree, page);
 
-	// 向后移动数据，腾出 key position 的位置
-	if (dst < data->content + valid_data_len)
-		for (tmp = data->content + valid_data_len + item_size;
-			 tmp > dst;
-			 tmp -= item_size)
-			memcpy(tmp, tmp - item_size, item_size);
+	return found_num;
+}
 
-	memcpy(dst, key, data->key_size);
-	memcpy(dst + data->key_size, position, data->value_size);
+/**
+ * @brief 在只读的B+树中查找被索引项，存在相同的被索引项时返回第一个的位置信息
+ *
+ * @param tree 只读的B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value_out 用于输出位置信息，长度至少为 value_size
+ * @return int 找到返回 1 ，没找到返回 0 ，参数错误返回 -1
+ */
+int bp_mmap_search(
+	bp_mmap_tree_t *tree,
+	unsigned char  *key,
+	int             key_len,
+	unsigned char  *value_out)
+{
+	return bp_mmap_search_all(tree, key, key_len, value_out, 1);
+}
 
-	data->common.key_num += 1;
+/**
+ * @brief 游标进入一个数据结点时预读后面的数据结点
+ *
+ * @details
+ *  bp_save_tree 按顺序连续写入数据结点，后面的数据结点就是文件中后面的页。每次预读
+ *  BP_READAHEAD_PAGES 页，游标走到预读范围的末尾时才发起下一次预读
+ *
+ * @param cursor 游标
+ * @param page_idx 下一个数据结点所在的页
+ */
+static void bp_mmap_readahead(bp_mmap_cursor_t *cursor, uint64_t page_idx)
+{
+	bp_mmap_tree_t *tree;
+	uint64_t        num;
 
-	return 0;
+	tree = cursor->tree;
+	if (0 == page_idx || page_idx < cursor->readahead)
+		return;
+
+	num = tree->page_num - page_idx;
+	if (num > BP_READAHEAD_PAGES)
+		num = BP_READAHEAD_PAGES;
+
+	if (tree->pool)
+		bp_pool_readahead(tree->pool, page_idx, num);
+	else
+		madvise(tree->base + page_idx * BP_PAGE_SIZE, num * BP_PAGE_SIZE,
+				MADV_WILLNEED);
+
+	cursor->readahead = page_idx + num;
 }
 
 /**
- * @brief 返回数据结点中保存的最大 key 值，也就是最后一个 key
+ * @brief 打开访问只读B+树上 [lo, hi] 范围内被索引项的游标
  *
- * @param node 数据结点
- * @param key_buf 用于返回 key 值
- * @param key_buf_len key_buf 的长度
- * @return 如果数据结点是空的，返回 -1 ，否则返回 key_buf 上实际数据的长度
+ * @param tree 只读的B+树
+ * @param lo 查找范围的下限， NULL 表示从最小的被索引项开始
+ * @param hi 查找范围的上限， NULL 表示到最大的被索引项结束
+ * @return bp_mmap_cursor_t* 游标，失败返回 NULL
  */
-int bp_data_node_max_key(
-	bp_node_t     *node,
-	unsigned char *key_buf,
-	int            key_buf_len)
+bp_mmap_cursor_t *bp_mmap_cursor_open(
+	bp_mmap_tree_t *tree,
+	unsigned char  *lo,
+	unsigned char  *hi)
 {
-	bp_data_node_t *data;
-	int             cp_len;
+	bp_mmap_cursor_t *cursor;
 
-	data = (bp_data_node_t *)node;
-	if (data->common.key_num <= 0)
-		return -1;
+	cursor = malloc(sizeof(*cursor) + tree->key_size);
+	if (NULL == cursor)
+		return NULL;
 
-	cp_len = key_buf_len < data->key_size ? key_buf_len : data->key_size;
-	memcpy(key_buf, data->content + (data->common.key_num - 1)
-		* (data->key_size + data->value_size), cp_len);
+	memset(cursor, 0, sizeof(*cursor));
+	cursor->tree = tree;
+	if (hi) {
+		cursor->has_hi = 1;
+		memcpy(cursor->hi, hi, tree->key_size);
+	}
 
-	return cp_len;
+	cursor->page = bp_mmap_find_data_page(tree, lo, &cursor->idx);
+	if (cursor->page)
+		bp_mmap_readahead(cursor, cursor->page->next);
+
+	return cursor;
 }
 
 /**
- * @brief 创建一个空的叶子结点
+ * @brief 返回游标指向的被索引项及其位置信息，并把游标移动到下一项
  *
- * @param max_kv_num 叶子结点保存键值对的最大个数
- * @param min_kv_num 叶子结点保存键值对的最小个数
- * @param key_size 被索引项的数据长度
- * @param value_size 位置信息的数据长度
- * @param compare 比较 key 值的函数
- * @return bp_node_t* 新建的结点
+ * @param cursor 游标
+ * @param key 用于输出被索引项，在下一次调用之前有效
+ * @param value 用于输出位置信息，在下一次调用之前有效
+ * @return int 有数据返回 1 ，已经没有数据返回 0 ，读取数据结点失败返回 -1
  */
-bp_node_t *bp_create_data_node(
-	int          max_kv_num,
-	int          min_kv_num,
-	int          key_size,
-	int          value_size,
-	bp_compare_f compare)
+int bp_mmap_cursor_next(
+	bp_mmap_cursor_t *cursor,
+	unsigned char   **key,
+	unsigned char   **value)
 {
-	bp_data_node_t *new;
-	int             content_len;
+	bp_mmap_tree_t *tree;
+	uint64_t        next;
+	int             item_size;
 
-	content_len = bp_calc_data_node_content_len(max_kv_num, key_size, value_size);
-	new = malloc(sizeof(*new) + content_len);
-	if (NULL == new)
+	tree = cursor->tree;
+	while (cursor->page && cursor->idx == (int)cursor->page->key_num) {
+		next = cursor->page->next;
+		bp_mmap_page_put(tree, cursor->page);
+		cursor->page = NULL;
+		cursor->idx  = 0;
+		if (0 == next)
+			return 0;
+
+		cursor->page = bp_mmap_page_get(tree, next, BP_POOL_DATA_WEIGHT);
+		if (NULL == cursor->page)
+			return -1;
+
+		bp_mmap_readahead(cursor, cursor->page->next);
+	}
+
+	if (NULL == cursor->page)
+		return 0;
+
+	item_size = tree->key_size + tree->value_size;
+	*key      = cursor->page->content + cursor->idx * item_size;
+	if (cursor->has_hi
+		&& 0 < bp_key_compare(tree->compare, *key, cursor->hi, tree->key_size))
+		return 0;
+
+	*value = *key + tree->key_size;
+	cursor->idx += 1;
+
+	return 1;
+}
+
+/**
+ * @brief 关闭只读B+树的游标
+ *
+ * @param cursor 游标
+ */
+void bp_mmap_cursor_close(bp_mmap_cursor_t *cursor)
+{
+	if (cursor->page)
+		bp_mmap_page_put(cursor->tree, cursor->page);
+
+	free(cursor);
+}
+
+/**
+ * @brief 把 bp_save_tree 保存的文件读回到一棵新的B+树中
+ *
+ * @details
+ *  文件中的数据结点本来就是有序的，用游标按顺序读出所有数据项后批量构建，不需要逐个
+ *  插入
+ *
+ * @param path 文件路径
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度，必须和保存时的树相同
+ * @param value_size 位置信息的数据长度，必须和保存时的树相同
+ * @param compare 比较 key 值的函数，必须和保存时的树使用的函数相同
+ * @param generation 不为 NULL 时用于输出文件头的版本号
+ * @return bp_tree_t* 新的B+树，文件无效、参数和文件不一致或者内存不足时返回 NULL
+ */
+bp_tree_t *bp_load_tree(
+	const char   *path,
+	int           max_idx_num,
+	int           max_data_num,
+	int           key_size,
+	int           value_size,
+	bp_compare_f  compare,
+	uint32_t     *generation)
+{
+	bp_mmap_tree_t   *file_tree;
+	bp_mmap_cursor_t *cursor;
+	bp_tree_t        *new;
+	unsigned char    *items;
+	unsigned char    *key;
+	unsigned char    *value;
+	uint64_t          item_num;
+	int               item_size;
+	int               ret;
+	int               i;
+
+	file_tree = bp_open_mmap(path, compare);
+	if (NULL == file_tree)
 		return NULL;
 
-	new->common.type        = BP_NODE_TYPE_DATA;
-	new->common.max_key_num = max_kv_num;
-	new->common.min_key_num = min_kv_num;
-	new->common.key_num     = 0;
-	new->common.insert      = bp_data_node_insert_data;
-	new->common.max_key     = bp_data_node_max_key;
-	new->common.compare     = compare;
+	item_num  = ((bp_file_header_t *)file_tree->base)->item_num;
+	item_size = key_size + value_size;
+	if (key_size != file_tree->key_size || value_size != file_tree->value_size
+		|| item_num > (uint64_t)(INT_MAX / item_size)) {
+		bp_close_mmap(file_tree);
 
-	new->key_size    = key_size;
-	new->value_size  = value_size;
-	new->content_len = content_len;
-	memset(new->content, 0, new->content_len);
+		return NULL;
+	}
+
+	if (generation)
+		*generation = ((bp_file_header_t *)file_tree->base)->generation;
+
+	items  = malloc(item_num * item_size + 1);
+	cursor = bp_mmap_cursor_open(file_tree, NULL, NULL);
+	ret    = NULL == items || NULL == cursor ? -1 : 0;
+	for (i = 0; 0 == ret && i < (int)item_num; i++) {
+		ret = bp_mmap_cursor_next(cursor, &key, &value);
+		ret = 1 == ret ? 0 : -1;
+		if (0 == ret)
+			memcpy(items + i * item_size, key, item_size);
+	}
+
+	new = NULL;
+	if (0 == ret)
+		new = bp_bulk_load(max_idx_num, max_data_num, key_size, value_size,
+						   compare, items, (int)item_num, BP_LOAD_FILL_FACTOR);
+
+	if (cursor)
+		bp_mmap_cursor_close(cursor);
+	bp_close_mmap(file_tree);
+	free(items);
+
+	return new;
+}
+
+/**
+ * @brief 关闭 bp_open_mmap 或者 bp_open_pooled 打开的B+树
+ *
+ * @param tree 只读的B+树
+ */
+void bp_close_mmap(bp_mmap_tree_t *tree)
+{
+	if (tree->pool)
+		bp_pool_close(tree->pool);
+	else
+		munmap(tree->base, tree->size);
+
+	free(tree);
+}
+
+/**
+ * @brief 增量数据流的格式版本
+ */
+#define BP_DELTA_VERSION 1
+
+/**
+ * @brief 导出增量数据时每次 writev 最多提交的 iovec 个数
+ */
+#define BP_DELTA_IOV_NUM 256
+
+/**
+ * @brief 应用增量数据时每次从游标上取出再删除的数据项个数
+ */
+#define BP_DELTA_DELETE_BATCH 256
+
+/**
+ * @brief 增量数据中一段范围的标记
+ */
+#define BP_DELTA_HAS_LO 1u /** 范围有下限，否则从最小的被索引项开始 */
+#define BP_DELTA_HAS_HI 2u /** 范围有上限，否则到最大的被索引项结束 */
+#define BP_DELTA_END    4u /** 数据流结束 */
+
+static const unsigned char bp_delta_magic[8] = {'B', 'P', 'L', 'U', 'S', 'D', 'L', 'T'};
+
+/**
+ * @brief
+ *  增量数据流开头的头部
+ */
+typedef struct bp_delta_header {
+	unsigned char magic[8]; /** bp_delta_magic */
+	uint32_t      version; /** 数据流格式的版本 */
+	uint32_t      key_size; /** 被索引项的大小 */
+	uint32_t      value_size; /** 位置信息的大小 */
+	uint32_t      reserved;
+	uint64_t      since_gen; /** 导出的是从这个代数开始的修改， 0 表示整棵树 */
+	uint64_t      next_gen; /** 下一次导出时使用的 since_gen */
+} bp_delta_header_t;
+
+/**
+ * @brief
+ *  增量数据中的一段范围
+ *
+ * @details
+ *  头部之后依次是 flags 包含 BP_DELTA_HAS_LO 时的下限 key ， flags 包含
+ *  BP_DELTA_HAS_HI 时的上限 key ，和 item_num 个按顺序排列的 K|V 。应用时先删除
+ *  [lo, hi] 范围内原有的所有数据项，再插入这些数据项
+ */
+typedef struct bp_delta_range {
+	uint32_t flags; /** BP_DELTA_HAS_LO 、 BP_DELTA_HAS_HI 和 BP_DELTA_END 的组合 */
+	uint32_t item_num; /** 范围内数据项的个数 */
+} bp_delta_range_t;
+
+/**
+ * @brief
+ *  导出增量数据的状态
+ *
+ * @details
+ *  按顺序访问所有的数据结点，修改过的连续的数据结点合成一段范围，下限是前一个没有
+ *  修改过的数据结点的最大值，上限是后一个没有修改过的数据结点的最小值。这两个结点
+ *  没有变化，所以修改过程中删除的数据项也一定在这个范围内。没有修改过的子树整个
+ *  跳过，只在需要范围的上下限时沿着最左或者最右的路径走到数据结点
+ */
+typedef struct bp_delta_writer {
+	bp_tree_t        *tree; /** 导出的B+树 */
+	int               fd; /** 输出的文件描述符 */
+	uint64_t          since_gen; /** 代数不小于这个值的结点就是修改过的 */
+	int               ret; /** 已经出错时为 -1 */
+	int               open; /** 是否有还没有输出的一段范围 */
+	bp_node_t        *clean; /** 最近一个没有修改过的子树，没有时为 NULL */
+	unsigned char    *lo; /** 范围的下限 */
+	unsigned char    *hi; /** 范围的上限 */
+	bp_delta_range_t  range; /** 正在输出的范围的头部 */
+	int               iov_num; /** iov 中有效数据的个数 */
+	struct iovec      iov[BP_DELTA_IOV_NUM];
+} bp_delta_writer_t;
+
+/**
+ * @brief 写出所有缓存的 iovec ，处理只写出了一部分的情况
+ *
+ * @param writer 导出状态
+ */
+static void bp_delta_flush(bp_delta_writer_t *writer)
+{
+	struct iovec *iov;
+	ssize_t       len;
+	int           num;
+
+	iov = writer->iov;
+	num = writer->iov_num;
+	while (0 == writer->ret && num > 0) {
+		len = writev(writer->fd, iov, num);
+		if (len < 0) {
+			if (EINTR != errno)
+				writer->ret = -1;
+
+			continue;
+		}
 
-	return (bp_node_t *)new;
+		for (; num > 0 && (size_t)len >= iov->iov_len; iov++, num--)
+			len -= iov->iov_len;
+		if (num > 0) {
+			iov->iov_base  = (unsigned char *)iov->iov_base + len;
+			iov->iov_len  -= len;
+		}
+	}
+
+	writer->iov_num = 0;
 }
 
 /**
- * @brief 根据二分查找的结果在内部结点上找到插入数据的位置
+ * @brief 缓存一段要写出的数据，数据在 bp_delta_flush 之前必须保持不变
  *
- * @param inner 内部结点
- * @param found_idx 二分查找返回的下标
- * @return bp_node_t * inner content 上的位置
+ * @param writer 导出状态
+ * @param data 要写出的数据
+ * @param len 数据的长度
  */
-bp_node_t *bp_inner_node_get_insert_position(
-	bp_inner_node_t *inner,
-	int              found_idx)
+static void bp_delta_push(bp_delta_writer_t *writer, void *data, size_t len)
 {
-	// 如果 found_idx 落在 content 的有效数据区域内，说明 found_pos 指向的 p-k 对
-	// 中的 k 是第一个大于等于 key 的值，key 应该插入到 p 指向的结点；否则的话说明 key
-	// 大于当前结点的最大值，需要取最后一个 p-k 对中的 p ，在插入完成后更新最后一个 p-k
-	// 对的 k
-	if (found_idx < inner->common.key_num)
-		return *((bp_node_t **)(inner->content
-			+ found_idx * (sizeof(bp_node_t *) + inner->key_size)));
+	if (writer->iov_num == BP_DELTA_IOV_NUM)
+		bp_delta_flush(writer);
 
-	return *((bp_node_t **)(inner->content
-		+ (inner->common.key_num - 1)
-		* (sizeof(bp_node_t *) + inner->key_size)));
+	writer->iov[writer->iov_num].iov_base = data;
+	writer->iov[writer->iov_num].iov_len  = len;
+	writer->iov_num += 1;
 }
 
 /**
- * @brief 内部结点分裂，分裂完后 to_split 保存前半部分数据， pp_new 保存后半部分数据
+ * @brief 沿着最左或者最右的路径找到子树上的最小值或者最大值
  *
- * @param to_split 要分裂的结点
- * @param pp_new 用于输出分裂出的结点
- * @return int 是否分裂成功
+ * @details
+ *  删除后数据结点可能是空的，边上的数据结点是空的时候继续找相邻的数据结点
+ *
+ * @param node 子树的根结点
+ * @param last 为 1 时找最大值
+ * @return unsigned char* 数据结点上的 key ，子树上没有数据时返回 NULL
  */
-int bp_inner_node_split(bp_node_t *to_split, bp_node_t **pp_new)
+static unsigned char *bp_delta_edge_key(bp_node_t *node, int last)
 {
-	bp_inner_node_t *old;
-	bp_inner_node_t *new;
-	int              old_data_num;
-	int              offset;
-	int              copy_len;
+	bp_inner_node_t *inner;
+	bp_data_node_t  *data;
+	unsigned char   *key;
+	int              i;
 
-	old = (bp_inner_node_t *)to_split;
-	new = (bp_inner_node_t *)bp_create_inner_node(
-		old->common.max_key_num, old->key_size, old->common.compare);
-	if (NULL == new) {
-		*pp_new = NULL;
+	if (BP_NODE_TYPE_DATA == node->type) {
+		data = (bp_data_node_t *)node;
+		if (0 == data->common.key_num)
+			return NULL;
 
-		return -1;
+		return bp_data_node_key(data, last ? data->common.key_num - 1 : 0);
 	}
 
-	old_data_num = old->common.key_num;
-	old->common.key_num = old_data_num / 2;
-	new->common.key_num = old_data_num - old->common.key_num;
-
-	offset   = old->common.key_num * (sizeof(bp_node_t *) + old->key_size);
-	copy_len = new->common.key_num * (sizeof(bp_node_t *) + new->key_size);
-
-	memcpy(new->content, old->content + offset, copy_len);
-
-	*pp_new = (bp_node_t *)new;
+	inner = (bp_inner_node_t *)node;
+	for (i = 0; i < inner->common.key_num; i++) {
+		key = bp_delta_edge_key(
+			bp_inner_node_get_child(inner, last ? inner->common.key_num - 1 - i : i),
+			last);
+		if (key)
+			return key;
+	}
 
-	return 0;
+	return NULL;
 }
 
 /**
- * @brief inner 的子结点 child 分裂后，inner 上 child 的索引和新结点的索引
+ * @brief 输出 [lo, hi] 范围内的所有数据项，数据项直接从数据结点上写出
  *
- * @param inner 内部结点
- * @param child 分裂的子结点
- * @param split_child 分裂出的新结点
- * @param child_idx 分裂前 child 在 inner 上的下标
- * @param split_inner 如果 inner 已经满了，则 inner 也会分裂，用于返回分裂出的结点
- * @return int 0 成功 -1 失败
+ * @param writer 导出状态
+ * @param has_hi 范围是否有上限
  */
-int bp_inner_node_add_split_child(
-	bp_inner_node_t   *inner,
-	bp_node_common_t  *child,
-	bp_node_common_t  *split_child,
-	int                child_idx,
-	bp_inner_node_t  **split_inner)
+static void bp_delta_emit(bp_delta_writer_t *writer, int has_hi)
 {
-	int              item_size;
-	int              valid_data_len;
-	unsigned char   *child_position;
-	unsigned char   *tmp;
-	bp_inner_node_t *inner_contains_child;
+	bp_tree_t     *tree;
+	bp_cursor_t   *cursor;
+	unsigned char *lo;
+	unsigned char *hi;
+	unsigned char *items;
+	unsigned char *key;
+	unsigned char *value;
+	int            item_size;
+	int            num;
+	int64_t        total;
 
-	*split_inner = NULL;
-	if (inner->common.key_num == inner->common.max_key_num)
-		if (-1 == bp_inner_node_split((bp_node_t *)inner,
-									  (bp_node_t **)split_inner))
-			return -1;
+	tree      = writer->tree;
+	item_size = tree->key_size + tree->value_size;
+	lo        = writer->clean ? writer->lo : NULL;
+	hi        = has_hi ? writer->hi : NULL;
 
-	inner_contains_child = inner;
-	if (*split_inner) {
-		// 如果 inner 分裂了的话，需要找到 child 应该保存在 inner 还是 *split_inner
-		if (child_idx < inner->common.key_num) {
-			inner_contains_child = inner;
-		} else {
-			inner_contains_child = *split_inner;
-			child_idx -= inner->common.key_num;
-		}
+	num = hi ? bp_tree_rank(tree, hi, 1) : bp_node_get_key_total(tree->head);
+	writer->range.flags    = (lo ? BP_DELTA_HAS_LO : 0) | (hi ? BP_DELTA_HAS_HI : 0);
+	writer->range.item_num = num - (lo ? bp_tree_rank(tree, lo, 0) : 0);
+
+	bp_delta_push(writer, &writer->range, sizeof(writer->range));
+	if (lo)
+		bp_delta_push(writer, lo, tree->key_size);
+	if (hi)
+		bp_delta_push(writer, hi, tree->key_size);
+
+	cursor = bp_cursor_open(tree, lo, hi);
+	if (NULL == cursor) {
+		writer->ret = -1;
+
+		return;
 	}
 
-	item_size      = sizeof(bp_node_t *) + inner->key_size;
-	valid_data_len = inner->common.key_num * item_size;
-	// 更新 child 所在的 child_position 中的最大 key 值为 child 的最大 key 值
-	child_position = inner_contains_child->content + child_idx * item_size;
-	child->max_key((bp_node_t *)child, child_position + sizeof(bp_node_t *),
-		inner->key_size);
+	// BP_LAYOUT_SPLIT 的 K 和 V 不连续，分别写出
+	total = 0;
+	if (BP_LAYOUT_SPLIT == tree->layout) {
+		while (bp_cursor_next(cursor, &key, &value)) {
+			bp_delta_push(writer, key, tree->key_size);
+			bp_delta_push(writer, value, tree->value_size);
+			total++;
+		}
+	} else {
+		while ((num = bp_cursor_next_run(cursor, &items)) > 0) {
+			bp_delta_push(writer, items, (size_t)num * item_size);
+			total += num;
+		}
+	}
+	bp_cursor_close(cursor);
 
-	// child 后面的数据后移，腾出 child_split 的空间
-	for (tmp = inner_contains_child->content + valid_data_len - item_size;
-		 tmp > child_position;
-		 tmp -= item_size)
-		memcpy(tmp + item_size, tmp, item_size);
-
-	// 插入 child_split
-	tmp = child_position + item_size;
-	memcpy(tmp, &split_child, sizeof(split_child));
-	split_child->max_key((bp_node_t *)split_child, tmp + sizeof(bp_node_t *),
-		inner_contains_child->key_size);
-	inner_contains_child->common.key_num += 1;
+	if (total != writer->range.item_num)
+		writer->ret = -1;
 
-	return 0;
+	// 范围的头部和上下限在下一段范围中会被覆盖
+	bp_delta_flush(writer);
+	writer->open = 0;
 }
 
 /**
- * @brief 内部结点插入数据
+ * @brief 遇到一个没有修改过的子树，结束正在合并的范围
  *
- * @param node 内部结点
- * @param key 要插入的被索引项
- * @param position 被索引项的位置信息
- * @param pp_new 如果内部结点发生分裂的话，返回分裂出的结点
- * @return int 0 成功 -1 失败
+ * @param writer 导出状态
+ * @param node 没有修改过的子树
  */
-int bp_inner_node_insert_data(
-	bp_node_t      *node,
-	unsigned char  *key,
-	unsigned char  *position,
-	bp_node_t     **pp_new)
+static void bp_delta_clean(bp_delta_writer_t *writer, bp_node_t *node)
 {
-	bp_inner_node_t  *inner;
-	bp_node_common_t *child;
-	bp_node_common_t *split_child;
-	int               item_size;
-	int               valid_data_len;
-	int               found_idx;
-
-	inner   = (bp_inner_node_t *)node;
-	*pp_new = NULL;
-
-	// 空B+树插入第一个 key 时，使用第一个 key 作为第一个子结点的最大值
-	if (0 == inner->common.key_num) {
-		memcpy(inner->content + sizeof(bp_node_t *), key, inner->key_size);
+	unsigned char *key;
 
-		inner->common.key_num = 1;
-	}
+	// 没有数据的子树提供不了上下限，修改前也没有数据，当作范围的一部分跳过
+	key = bp_delta_edge_key(node, 0);
+	if (NULL == key)
+		return;
 
-	item_size      = sizeof(bp_node_t *) + inner->key_size;
-	valid_data_len = inner->common.key_num * item_size;
-	bp_bi_search_last(inner->content, valid_data_len, item_size, key,
-					  inner->key_size, sizeof(bp_node_t *),
-					  inner->common.compare, &found_idx);
-	if (found_idx == inner->common.key_num) {
-		// B+树的查找原理可以保证这种情况只会出现在树的最右侧结点，此时更新最右侧
-		// 结点的最大值为新的最大值，并把新值插入最右侧的子树
-		memcpy(inner->content + (found_idx - 1) * item_size + sizeof(bp_node_t *),
-			   key, inner->key_size);
+	if (writer->open) {
+		memcpy(writer->hi, key, writer->tree->key_size);
+		bp_delta_emit(writer, 1);
 	}
 
-	// 找到子树插入
-	child = (bp_node_common_t *)bp_inner_node_get_insert_position(
-		inner, found_idx);
-	if (-1 == child->insert((bp_node_t *)child, key, position,
-							(bp_node_t **)&split_child))
-		return -1;
-
-	if (split_child)
-		bp_inner_node_add_split_child(inner, child, split_child, found_idx,
-									  (bp_inner_node_t **)pp_new);
+	writer->clean = node;
+}
 
-	inner->key_total += 1;
+/**
+ * @brief 遇到一个修改过的数据结点，开始一段新的范围
+ *
+ * @param writer 导出状态
+ */
+static void bp_delta_dirty(bp_delta_writer_t *writer)
+{
+	if (writer->open)
+		return;
 
-	return 0;
+	writer->open = 1;
+	if (writer->clean)
+		memcpy(writer->lo, bp_delta_edge_key(writer->clean, 1), writer->tree->key_size);
 }
 
 /**
- * @brief 获取内部结点保存的最大 key 值
+ * @brief 按顺序访问子树，跳过没有修改过的子树
  *
- * @param node 内部结点
- * @param key_buf 用于输出最大 key 值
- * @param key_buf_len 输出缓存的长度
- * @return int -1 失败 否则为 memcpy 的长度
+ * @param writer 导出状态
+ * @param node 修改过的子树
  */
-int bp_inner_node_max_key(
-	bp_node_t     *node,
-	unsigned char *key_buf,
-	int            key_buf_len)
+static void bp_delta_walk(bp_delta_writer_t *writer, bp_node_t *node)
 {
 	bp_inner_node_t *inner;
-	int              cp_len;
+	bp_node_t       *child;
+	int              i;
 
-	inner = (bp_inner_node_t *)node;
-	if (inner->common.key_num <= 0)
-		return -1;
+	if (BP_NODE_TYPE_DATA == node->type) {
+		bp_delta_dirty(writer);
 
-	cp_len = key_buf_len < inner->key_size ? key_buf_len : inner->key_size;
-	memcpy(key_buf, inner->content + (inner->common.key_num - 1)
-		* (sizeof(bp_node_t *) + inner->key_size) + sizeof(bp_node_t *),
-		cp_len);
+		return;
+	}
 
-	return cp_len;
+	inner = (bp_inner_node_t *)node;
+	for (i = 0; 0 == writer->ret && i < inner->common.key_num; i++) {
+		child = bp_inner_node_get_child(inner, i);
+		if (((bp_node_common_t *)child)->generation < writer->since_gen)
+			bp_delta_clean(writer, child);
+		else
+			bp_delta_walk(writer, child);
+	}
 }
 
 /**
- * @brief 创建一个空的内部节点
+ * @brief 把 since_gen 之后修改过的数据结点导出到 fd
  *
- * @param max_key_num 内部节点可以保存的最大的 key 的个数
- * @param key_size 被索引项的数据长度
- * @param compare 比较 key 值的函数
- * @return bp_node_t* 新建的内部节点
+ * @details
+ *  写操作修改结点时会在结点上记下树当前的代数，导出时只访问代数不小于 since_gen 的
+ *  子树，每一段修改过的数据结点输出为一段 [lo, hi] 范围和范围内现在所有的数据项，
+ *  用 writev 直接从数据结点上写出，不复制数据。 since_gen 为 0 时导出整棵树。导出
+ *  完成后树的代数加一，之后的修改都会被下一次从 next_gen 开始的导出包含。
+ *
+ *  副本先应用一次 since_gen 为 0 的导出，之后每次应用从上一次的 next_gen 开始的
+ *  导出，副本上的数据就和导出时的树相同。并发模式下导出期间持有写锁
+ *
+ * @param tree B+树
+ * @param since_gen 只导出这个代数之后的修改， 0 表示导出整棵树
+ * @param fd 输出的文件描述符，可以是文件、管道或者 socket
+ * @param next_gen 不为 NULL 时输出下一次导出使用的 since_gen
+ * @return int 成功返回 0 ，否则返回 -1
  */
-bp_node_t *bp_create_inner_node(int max_key_num, int key_size, bp_compare_f compare)
+int bp_export_delta(
+	bp_tree_t *tree,
+	uint64_t   since_gen,
+	int        fd,
+	uint64_t  *next_gen)
 {
-	bp_inner_node_t *new;
-	int              content_len;
+	bp_delta_writer_t *writer;
+	bp_delta_header_t  header;
+	bp_delta_range_t   end;
+	int                ret;
 
-	content_len = bp_calc_inner_node_content_len(max_key_num, key_size);
-	new = malloc(sizeof(*new) + content_len);
-	if (NULL == new)
-		return NULL;
+	writer = malloc(sizeof(*writer) + 2 * tree->key_size);
+	if (NULL == writer)
+		return -1;
 
-	new->common.type        = BP_NODE_TYPE_INNER;
-	new->common.max_key_num = max_key_num;
-	new->common.min_key_num = max_key_num / 2;
-	new->common.key_num     = 0;
-	new->common.insert      = bp_inner_node_insert_data;
-	new->common.compare     = compare;
-	new->common.max_key     = NULL;
+	// 导出的是树上结点的代数，插入缓冲中的数据要先合并到树上
+	if (-1 == bp_tree_flush(tree)) {
+		free(writer);
 
-	new->key_size    = key_size;
-	new->key_total   = 0;
-	new->content_len = content_len;
-	memset(new->content, 0, new->content_len);
+		return -1;
+	}
+	bp_order_begin(tree);
 
-	return (bp_node_t *)new;
+	memset(writer, 0, sizeof(*writer));
+	writer->tree      = tree;
+	writer->fd        = fd;
+	writer->since_gen = since_gen;
+	writer->lo        = (unsigned char *)(writer + 1);
+	writer->hi        = writer->lo + tree->key_size;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, bp_delta_magic, sizeof(header.magic));
+	header.version    = BP_DELTA_VERSION;
+	header.key_size   = tree->key_size;
+	header.value_size = tree->value_size;
+	header.since_gen  = since_gen;
+	header.next_gen   = tree->generation + 1;
+	bp_delta_push(writer, &header, sizeof(header));
+
+	// 空树只有一个没有数据的根结点，删除了所有数据之后根结点会被修改
+	if (0 == ((bp_node_common_t *)tree->head)->key_num) {
+		if (((bp_node_common_t *)tree->head)->generation >= since_gen)
+			bp_delta_emit(writer, 0);
+	} else if (((bp_node_common_t *)tree->head)->generation >= since_gen) {
+		bp_delta_walk(writer, tree->head);
+		if (0 == writer->ret && writer->open)
+			bp_delta_emit(writer, 0);
+	}
+
+	end.flags    = BP_DELTA_END;
+	end.item_num = 0;
+	bp_delta_push(writer, &end, sizeof(end));
+	bp_delta_flush(writer);
+
+	ret = writer->ret;
+	if (0 == ret) {
+		tree->generation += 1;
+		if (next_gen)
+			*next_gen = tree->generation;
+	}
+
+	bp_order_end(tree);
+	free(writer);
+
+	return ret;
 }
 
 /**
- * @brief 创建B+树设置头结点的第一个指针指向第一个数据结点
+ * @brief 从 fd 读取 len 字节
  *
- * @param inner B+树的头结点
- * @param first_data B+树的第一个数据结点
+ * @return int 成功返回 0 ，出错或者数据不完整时返回 -1
  */
-void bp_inner_node_set_first_ptr(bp_inner_node_t *inner, bp_node_t *first_data)
+static int bp_delta_read(int fd, void *buf, size_t len)
 {
-	memcpy(inner->content, &first_data, sizeof(bp_node_t *));
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = read(fd, buf, len);
+		if (ret < 0 && EINTR == errno)
+			continue;
+		if (ret <= 0)
+			return -1;
+
+		buf  = (unsigned char *)buf + ret;
+		len -= ret;
+	}
+
+	return 0;
 }
 
 /**
- * @brief 创建一棵B+树
+ * @brief 删除 [lo, hi] 范围内的所有数据项
  *
- * @param max_idx_num 内部结点的包含的被索引项的最大个数
- * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
- * @param key_size 被索引项的数据长度
- * @param value_size 位置信息的数据长度
- * @return bp_tree_t* 创建的B+树
+ * @param tree B+树
+ * @param lo 范围的下限， NULL 表示不限
+ * @param hi 范围的上限， NULL 表示不限
+ * @return int 成功返回 0 ，否则返回 -1
  */
-bp_tree_t *bp_create_tree(
-	int          max_idx_num,
-	int          max_data_num,
-	int          key_size,
-	int          value_size,
-	bp_compare_f compare)
+static int bp_delta_delete_range(bp_tree_t *tree, unsigned char *lo, unsigned char *hi)
 {
-	bp_tree_t     *new;
-
-	// 数据结点分裂的时候，每个新结点至少要有 max_idx_num/2 个数据，所以需要数据
-	// 结点的最大数据个数要大于内部结点的最大数据个数
-	if (max_data_num < max_idx_num)
-		return NULL;
-
-	new = malloc(sizeof(*new));
-	if (NULL == new)
-		return NULL;
+	bp_cursor_t   *cursor;
+	unsigned char *items;
+	unsigned char *key;
+	unsigned char *value;
+	int            item_size;
+	int            num;
+	int            i;
 
-	memset(new, 0, sizeof(*new));
-	new->max_idx_num  = max_idx_num;
-	new->max_data_num = max_data_num;
-	new->key_size     = key_size;
-	new->value_size   = value_size;
-
-	new->head = bp_create_inner_node(max_idx_num, key_size, compare);
-	if (NULL == new->head) {
-		free(new);
+	item_size = tree->key_size + tree->value_size;
+	items     = malloc(BP_DELTA_DELETE_BATCH * item_size);
+	if (NULL == items)
+		return -1;
 
-		return NULL;
-	}
+	do {
+		cursor = bp_cursor_open(tree, lo, hi);
+		if (NULL == cursor)
+			break;
 
-	new->data = bp_create_data_node(max_data_num, max_idx_num / 2,
-									key_size, value_size, compare);
-	if (NULL == new->data) {
-		free(new->head);
-		free(new);
+		for (num = 0; num < BP_DELTA_DELETE_BATCH
+				 && bp_cursor_next(cursor, &key, &value); num++) {
+			memcpy(items + num * item_size, key, tree->key_size);
+			memcpy(items + num * item_size + tree->key_size, value, tree->value_size);
+		}
+		bp_cursor_close(cursor);
 
-		return NULL;
-	}
+		for (i = 0; i < num; i++)
+			if (1 != bp_delete(tree, items + i * item_size, tree->key_size,
+							   items + i * item_size + tree->key_size))
+				break;
+		if (i < num)
+			break;
+	} while (BP_DELTA_DELETE_BATCH == num);
 
-	// 头结点的第一个指针指向第一个数据节点
-	bp_inner_node_set_first_ptr((bp_inner_node_t *)new->head, new->data);
+	free(items);
 
-	return new;
+	return cursor && i == num ? 0 : -1;
 }
 
 /**
- * @brief 向B+树中插入一个被索引项及其位置信息
+ * @brief 把 bp_export_delta 导出的增量数据应用到副本上
  *
- * @param tree B+树
- * @param key 被索引项
- * @param key_len 被索引项的长度
- * @param position 位置信息
- * @param position_len 位置信息的长度
- * @return int 成功返回 0 ，否则返回 -1
+ * @details
+ *  对数据流中的每一段范围，先删除副本上范围内原有的数据项，再批量插入导出的数据项。
+ *  副本的 key_size 、 value_size 和比较函数必须和导出的树相同，应用期间不能有其它的
+ *  写操作
+ *
+ * @param tree 副本
+ * @param fd 输入的文件描述符
+ * @param next_gen 不为 NULL 时输出数据流头部记录的下一次导出使用的 since_gen
+ * @return int 成功返回 0 ，数据流无效、和副本不一致或者内存不足时返回 -1 ，此时副本
+ *             可能只应用了一部分
  */
-int bp_insert(
-	bp_tree_t     *tree,
-	unsigned char *key,
-	int            key_len,
-	unsigned char *position,
-	int            position_len)
+int bp_apply_delta(bp_tree_t *tree, int fd, uint64_t *next_gen)
 {
-	if (tree->key_size != key_len)
+	bp_delta_header_t  header;
+	bp_delta_range_t   range;
+	unsigned char     *keys;
+	unsigned char     *items;
+	int                item_size;
+	int                ret;
+
+	if (tree->frozen || -1 == bp_tree_flush(tree)
+		|| -1 == bp_delta_read(fd, &header, sizeof(header))
+		|| 0 != memcmp(header.magic, bp_delta_magic, sizeof(header.magic))
+		|| BP_DELTA_VERSION != header.version
+		|| (uint32_t)tree->key_size != header.key_size
+		|| (uint32_t)tree->value_size != header.value_size)
 		return -1;
 
-	if (tree->value_size != position_len)
+	keys = malloc(2 * tree->key_size);
+	if (NULL == keys)
 		return -1;
 
-	return 0;
+	item_size = tree->key_size + tree->value_size;
+	ret       = 0;
+	while (0 == ret) {
+		ret = bp_delta_read(fd, &range, sizeof(range));
+		if (0 != ret || (range.flags & BP_DELTA_END))
+			break;
+
+		if (range.item_num > (uint32_t)(INT_MAX / item_size)
+			|| ((range.flags & BP_DELTA_HAS_LO)
+				&& -1 == bp_delta_read(fd, keys, tree->key_size))
+			|| ((range.flags & BP_DELTA_HAS_HI)
+				&& -1 == bp_delta_read(fd, keys + tree->key_size, tree->key_size))) {
+			ret = -1;
+			break;
+		}
+
+		items = malloc((size_t)range.item_num * item_size + 1);
+		if (NULL == items
+			|| -1 == bp_delta_read(fd, items, (size_t)range.item_num * item_size)
+			|| -1 == bp_delta_delete_range(
+				tree, (range.flags & BP_DELTA_HAS_LO) ? keys : NULL,
+				(range.flags & BP_DELTA_HAS_HI) ? keys + tree->key_size : NULL)
+			|| (int)range.item_num != bp_tree_merge_items(tree, items, range.item_num))
+			ret = -1;
+		free(items);
+	}
+
+	free(keys);
+	if (0 == ret && next_gen)
+		*next_gen = header.next_gen;
+
+	return ret;
 }
 
 int bp_node_get_key_num(bp_node_t *node)
@@ -0,0 +1,442 @@
+/**
+ * @file bppool.c
+ * @brief 按页缓存文件内容的缓冲池
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * 缓冲池有固定个数的帧（ frame ），每个帧缓存文件中的一页。访问一页之前先 pin ，
+ * 用完之后 unpin ， pin 住的帧不会被淘汰。没有空闲的帧时用 CLOCK 算法淘汰：
+ *
+ *        hand
+ *         |
+ *         V
+ * +-------+-------+-------+-------+-------+
+ * |usage 2|usage 0|pinned |usage 1|usage 0|
+ * +-------+-------+-------+-------+-------+
+ *
+ * 指针依次扫过每个帧，没有 pin 住并且 usage 为 0 的帧被淘汰，否则 usage 减一。每次
+ * 访问时 usage 被设置为调用方指定的权重，权重越大的页在缓冲池中停留得越久，B+树用它
+ * 让内部结点一直留在内存中。被修改过的帧在淘汰或者 flush 时写回文件。
+ *
+ * 读写文件时不持有 lock ，正在读入或者写回的帧标记为 io ，其它线程 pin 这一页时在
+ * io_done 上等待，淘汰时跳过这些帧，这样一个线程等待磁盘时其它线程仍然可以访问缓冲池
+ * 中的其它页。
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "libbplus.h"
+
+#define BP_POOL_NO_PAGE UINT64_MAX
+
+/**
+ * @brief 缓存一页的帧
+ *
+ */
+typedef struct bp_pool_frame {
+	uint64_t page_idx; /** 缓存的页下标， BP_POOL_NO_PAGE 表示空闲 */
+	int      pin_count; /** pin 的次数 */
+	int      usage; /** CLOCK 算法的访问计数 */
+	int      dirty; /** 是否被修改过 */
+	int      io; /** 是否正在从文件读入或者写回文件 */
+	int      hash_next; /** 同一个哈希桶中下一个帧的下标， -1 表示没有 */
+} bp_pool_frame_t;
+
+struct bp_pool {
+	pthread_mutex_t  lock; /** 保护帧的状态和哈希表 */
+	pthread_cond_t   io_done; /** 有帧读入或者写回完成 */
+	int              io_num; /** 正在读入或者写回的帧的个数 */
+	int              fd; /** 文件描述符 */
+	int              page_size; /** 页的大小 */
+	int              frame_num; /** 帧的个数 */
+	int              hand; /** CLOCK 算法的指针 */
+	int              bucket_mask; /** 哈希桶个数减一 */
+	int             *buckets; /** 每个哈希桶中第一个帧的下标 */
+	bp_pool_frame_t *frames; /** 所有的帧 */
+	unsigned char   *data; /** 所有帧的数据，按页的大小对齐 */
+};
+
+/**
+ * @brief 计算页下标所在的哈希桶
+ *
+ * @param pool 缓冲池
+ * @param page_idx 页下标
+ * @return int 哈希桶的下标
+ */
+static inline int bp_pool_bucket(bp_pool_t *pool, uint64_t page_idx)
+{
+	return (int)((page_idx * 0x9e3779b97f4a7c15ull) >> 32) & pool->bucket_mask;
+}
+
+/**
+ * @brief 打开文件并创建缓冲池
+ *
+ * @param path 文件路径
+ * @param page_size 页的大小
+ * @param frame_num 帧的个数
+ * @param writable 为 1 时可以修改页并写回文件，文件不存在时会被创建
+ * @return bp_pool_t* 缓冲池，失败返回 NULL
+ */
+bp_pool_t *bp_pool_open(
+	const char *path,
+	int         page_size,
+	int         frame_num,
+	int         writable)
+{
+	bp_pool_t *new;
+	int        bucket_num;
+	int        i;
+
+	if (page_size <= 0 || frame_num <= 0)
+		return NULL;
+
+	new = malloc(sizeof(*new));
+	if (NULL == new)
+		return NULL;
+
+	memset(new, 0, sizeof(*new));
+	for (bucket_num = 1; bucket_num < 2 * frame_num; bucket_num *= 2)
+		;
+
+	new->page_size   = page_size;
+	new->frame_num   = frame_num;
+	new->bucket_mask = bucket_num - 1;
+	new->buckets     = malloc(bucket_num * sizeof(int));
+	new->frames      = malloc(frame_num * sizeof(bp_pool_frame_t));
+	if (NULL == new->buckets || NULL == new->frames
+		|| 0 != posix_memalign((void **)&new->data, page_size,
+							   (size_t)frame_num * page_size)) {
+		free(new->buckets);
+		free(new->frames);
+		free(new);
+
+		return NULL;
+	}
+
+	new->fd = writable ? open(path, O_RDWR | O_CREAT, 0644)
+		: open(path, O_RDONLY);
+	if (-1 == new->fd || 0 != pthread_mutex_init(&new->lock, NULL)) {
+		if (-1 != new->fd)
+			close(new->fd);
+		free(new->buckets);
+		free(new->frames);
+		free(new->data);
+		free(new);
+
+		return NULL;
+	}
+
+	if (0 != pthread_cond_init(&new->io_done, NULL)) {
+		pthread_mutex_destroy(&new->lock);
+		close(new->fd);
+		free(new->buckets);
+		free(new->frames);
+		free(new->data);
+		free(new);
+
+		return NULL;
+	}
+
+	for (i = 0; i < bucket_num; i++)
+		new->buckets[i] = -1;
+	for (i = 0; i < frame_num; i++) {
+		new->frames[i].page_idx  = BP_POOL_NO_PAGE;
+		new->frames[i].pin_count = 0;
+		new->frames[i].usage     = 0;
+		new->frames[i].dirty     = 0;
+		new->frames[i].io        = 0;
+		new->frames[i].hash_next = -1;
+	}
+
+	return new;
+}
+
+/**
+ * @brief 把修改过的帧写回文件
+ *
+ * @details
+ *  调用时持有 pool->lock ，写文件期间释放。写之前先清除 dirty ，写的过程中 unpin
+ *  重新设置的 dirty 不会丢失
+ *
+ * @param pool 缓冲池
+ * @param idx 帧的下标，不能正在读入或者写回
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_pool_write_back(bp_pool_t *pool, int idx)
+{
+	bp_pool_frame_t *frame;
+	unsigned char   *data;
+	uint64_t         page_idx;
+	int              ret;
+
+	frame = &pool->frames[idx];
+	if (!frame->dirty)
+		return 0;
+
+	data          = pool->data + (size_t)idx * pool->page_size;
+	page_idx      = frame->page_idx;
+	frame->dirty  = 0;
+	frame->io     = 1;
+	pool->io_num += 1;
+	pthread_mutex_unlock(&pool->lock);
+
+	ret = pool->page_size == pwrite(pool->fd, data, pool->page_size,
+									(off_t)page_idx * pool->page_size) ? 0 : -1;
+
+	pthread_mutex_lock(&pool->lock);
+	frame->io     = 0;
+	pool->io_num -= 1;
+	if (-1 == ret)
+		frame->dirty = 1;
+	pthread_cond_broadcast(&pool->io_done);
+
+	return ret;
+}
+
+/**
+ * @brief 把帧从哈希表中删除
+ *
+ * @param pool 缓冲池
+ * @param idx 帧的下标
+ */
+static void bp_pool_unlink(bp_pool_t *pool, int idx)
+{
+	int *pos;
+
+	pos = &pool->buckets[bp_pool_bucket(pool, pool->frames[idx].page_idx)];
+	while (*pos != idx)
+		pos = &pool->frames[*pos].hash_next;
+
+	*pos = pool->frames[idx].hash_next;
+	pool->frames[idx].page_idx = BP_POOL_NO_PAGE;
+}
+
+/**
+ * @brief 用 CLOCK 算法找到一个可以使用的帧
+ *
+ * @details
+ *  每扫过一圈所有没有 pin 住的帧的 usage 至少减一，所以最多扫 max_usage + 2 圈。
+ *  找到的帧可能还没有写回，由调用方在释放锁之后写回
+ *
+ * @param pool 缓冲池
+ * @return int 帧的下标，所有的帧都被 pin 住或者正在读写时返回 -1
+ */
+static int bp_pool_evict(bp_pool_t *pool)
+{
+	bp_pool_frame_t *frame;
+	int              max_usage;
+	int              round;
+	int              i;
+
+	max_usage = 0;
+	for (i = 0; i < pool->frame_num; i++)
+		if (pool->frames[i].usage > max_usage)
+			max_usage = pool->frames[i].usage;
+
+	for (round = 0; round < (max_usage + 2) * pool->frame_num; round++) {
+		i          = pool->hand;
+		frame      = &pool->frames[i];
+		pool->hand = (pool->hand + 1) % pool->frame_num;
+		if (BP_POOL_NO_PAGE == frame->page_idx)
+			return i;
+
+		if (frame->pin_count > 0 || frame->io)
+			continue;
+
+		if (frame->usage > 0) {
+			frame->usage -= 1;
+
+			continue;
+		}
+
+		return i;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief pin 住一页，不在缓冲池中时从文件读入
+ *
+ * @param pool 缓冲池
+ * @param page_idx 页下标
+ * @param weight 这次访问后页的 CLOCK 访问计数，越大越不容易被淘汰
+ * @return unsigned char* 页的数据，失败返回 NULL
+ */
+unsigned char *bp_pool_pin(bp_pool_t *pool, uint64_t page_idx, int weight)
+{
+	bp_pool_frame_t *frame;
+	unsigned char   *data;
+	ssize_t          len;
+	int              bucket;
+	int              idx;
+
+	pthread_mutex_lock(&pool->lock);
+retry:
+	bucket = bp_pool_bucket(pool, page_idx);
+	idx    = pool->buckets[bucket];
+	while (-1 != idx && pool->frames[idx].page_idx != page_idx)
+		idx = pool->frames[idx].hash_next;
+
+	if (-1 != idx) {
+		// 其它线程正在读入或者写回这一页，完成之后重新查找，读入失败时帧已经被释放
+		frame = &pool->frames[idx];
+		if (frame->io) {
+			pthread_cond_wait(&pool->io_done, &pool->lock);
+			goto retry;
+		}
+
+		frame->pin_count += 1;
+		if (frame->usage < weight)
+			frame->usage = weight;
+		pthread_mutex_unlock(&pool->lock);
+
+		return pool->data + (size_t)idx * pool->page_size;
+	}
+
+	idx = bp_pool_evict(pool);
+	if (-1 == idx && pool->io_num > 0) {
+		pthread_cond_wait(&pool->io_done, &pool->lock);
+		goto retry;
+	}
+	if (-1 == idx) {
+		pthread_mutex_unlock(&pool->lock);
+
+		return NULL;
+	}
+
+	// 写回期间其它线程可能已经读入了这一页，写回之后重新查找
+	frame = &pool->frames[idx];
+	if (frame->dirty) {
+		if (-1 == bp_pool_write_back(pool, idx)) {
+			pthread_mutex_unlock(&pool->lock);
+
+			return NULL;
+		}
+
+		goto retry;
+	}
+
+	if (BP_POOL_NO_PAGE != frame->page_idx)
+		bp_pool_unlink(pool, idx);
+
+	frame->page_idx       = page_idx;
+	frame->pin_count      = 1;
+	frame->usage          = weight;
+	frame->io             = 1;
+	frame->hash_next      = pool->buckets[bucket];
+	pool->buckets[bucket] = idx;
+	pool->io_num         += 1;
+	pthread_mutex_unlock(&pool->lock);
+
+	// 读到文件末尾之后的页按全 0 处理，可写的缓冲池写回时会扩展文件
+	data = pool->data + (size_t)idx * pool->page_size;
+	len  = pread(pool->fd, data, pool->page_size,
+				 (off_t)page_idx * pool->page_size);
+	if (len >= 0)
+		memset(data + len, 0, pool->page_size - len);
+
+	pthread_mutex_lock(&pool->lock);
+	frame->io     = 0;
+	pool->io_num -= 1;
+	if (len < 0) {
+		bp_pool_unlink(pool, idx);
+		frame->pin_count = 0;
+		frame->usage     = 0;
+		data             = NULL;
+	}
+	pthread_cond_broadcast(&pool->io_done);
+	pthread_mutex_unlock(&pool->lock);
+
+	return data;
+}
+
+/**
+ * @brief unpin 一页
+ *
+ * @param pool 缓冲池
+ * @param data bp_pool_pin 返回的数据
+ * @param dirty 为 1 时表示页被修改过，淘汰或者 flush 时写回文件
+ */
+void bp_pool_unpin(bp_pool_t *pool, unsigned char *data, int dirty)
+{
+	bp_pool_frame_t *frame;
+
+	pthread_mutex_lock(&pool->lock);
+	frame = &pool->frames[(data - pool->data) / pool->page_size];
+	frame->pin_count -= 1;
+	frame->dirty     |= dirty;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief 提示操作系统预读从 page_idx 开始的 page_num 页
+ *
+ * @details
+ *  预读的页进入操作系统的页缓存，之后 pin 时的读文件不需要等待磁盘。顺序扫描数据
+ *  结点时用它提前读入后面的数据结点
+ *
+ * @param pool 缓冲池
+ * @param page_idx 第一页的下标
+ * @param page_num 页的个数
+ */
+void bp_pool_readahead(bp_pool_t *pool, uint64_t page_idx, int page_num)
+{
+	posix_fadvise(pool->fd, (off_t)page_idx * pool->page_size,
+				  (off_t)page_num * pool->page_size, POSIX_FADV_WILLNEED);
+}
+
+/**
+ * @brief 把所有修改过的帧写回文件
+ *
+ * @param pool 缓冲池
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+int bp_pool_flush(bp_pool_t *pool)
+{
+	int ret;
+	int i;
+
+	ret = 0;
+	pthread_mutex_lock(&pool->lock);
+	for (i = 0; i < pool->frame_num; i++) {
+		// 正在写回的帧由写回的线程负责，正在读入的帧还没有被修改
+		if (BP_POOL_NO_PAGE == pool->frames[i].page_idx || pool->frames[i].io)
+			continue;
+
+		if (-1 == bp_pool_write_back(pool, i))
+			ret = -1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return ret;
+}
+
+/**
+ * @brief 写回所有修改过的帧并释放缓冲池
+ *
+ * @param pool 缓冲池
+ * @return int 写回成功返回 0 ，否则返回 -1
+ */
+int bp_pool_close(bp_pool_t *pool)
+{
+	int ret;
+
+	ret = bp_pool_flush(pool);
+	if (0 != close(pool->fd))
+		ret = -1;
+
+	pthread_cond_destroy(&pool->io_done);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->buckets);
+	free(pool->frames);
+	free(pool->data);
+	free(pool);
+
+	return ret;
+}
@@ -0,0 +1,799 @@
+/**
+ * @file bppost.c
+ * @brief 每个不同的 key 只保存一次并带有排好序的位置信息列表的B+树
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * 普通的B+树上每个重复的 key 都占用一个完整的 K|V 数据项，同一个 key 的大量位置信息
+ * 会分布在很多数据结点上，查找最后一个位置要线性地走过所有重复项。倒排列表树上每个
+ * 不同的 key 在B+树上只有一个数据项，位置信息按大端无符号整数排好序保存在这个 key
+ * 的倒排列表中：
+ *
+ *   B+树数据项: | key | tag | 位置信息或者倒排列表的指针 |
+ *                             |
+ *                             v
+ *   倒排列表:   blocks[0]          blocks[1]               blocks[n - 1]
+ *              +----------------+ +----------------+     +----------------+
+ *              | first .. last  | | first .. last  | ... | first .. last  |
+ *              | varint(delta)  | | varint(delta)  |     | varint(delta)  |
+ *              +----------------+ +----------------+     +----------------+
+ *
+ * 只有一个位置信息的 key 直接把位置信息保存在数据项中，不分配倒排列表。倒排列表由
+ * 按 first 排好序的块组成，块内除 first 以外的位置信息保存为和前一个位置信息的差值，
+ * 按 varint 编码。 first 和 last 不需要解码就可以得到，查找位置信息所在的块是在块的
+ * first 上二分查找，修改时只重新编码一个块。
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "libbplus.h"
+
+/**
+ * @brief 一个块中位置信息的最大个数
+ */
+#define BP_POSTING_BLOCK_NUM 128
+
+/**
+ * @brief 一个位置信息按 varint 编码后的最大长度
+ */
+#define BP_VARINT_MAX 10
+
+/**
+ * @brief 数据项中保存的内容
+ *
+ */
+typedef enum bp_posting_tag {
+	BP_POSTING_INLINE = 0, /** 唯一的位置信息 */
+	BP_POSTING_LIST   = 1, /** 倒排列表的指针 */
+} bp_posting_tag_e;
+
+/**
+ * @brief 倒排列表中的一个块
+ *
+ */
+typedef struct bp_posting_block {
+	uint64_t      first; /** 块内最小的位置信息 */
+	uint64_t      last; /** 块内最大的位置信息 */
+	int           count; /** 块内位置信息的个数 */
+	int           len; /** data 的长度 */
+	unsigned char data[0]; /** 第 2 到 count 个位置信息和前一个的差值，按 varint 编码 */
+} bp_posting_block_t;
+
+/**
+ * @brief 一个 key 的倒排列表
+ *
+ */
+typedef struct bp_posting {
+	uint64_t             count; /** 位置信息的总个数 */
+	int                  block_num; /** 块的个数 */
+	int                  block_cap; /** blocks 的容量 */
+	bp_posting_block_t **blocks; /** 按 first 排好序的块 */
+} bp_posting_t;
+
+/**
+ * @brief B+树上数据项中位置信息的最大长度： tag 加上位置信息或者倒排列表的指针
+ */
+#define BP_POSTING_SLOT_MAX (1 + 8 + sizeof(bp_posting_t *))
+
+struct bp_posting_tree {
+	bp_tree_t *tree; /** 每个不同的 key 只有一个数据项的B+树 */
+	int        key_size; /** 被索引项的大小 */
+	int        value_size; /** 位置信息的大小，最多 8 个字节 */
+	int        slot_size; /** B+树上数据项中位置信息的大小 */
+};
+
+/**
+ * @brief 按大端读取位置信息
+ *
+ * @param value 位置信息
+ * @param size 位置信息的长度
+ * @return uint64_t 位置信息对应的无符号整数
+ */
+static inline uint64_t bp_posting_load(unsigned char *value, int size)
+{
+	uint64_t pos;
+	int      i;
+
+	pos = 0;
+	for (i = 0; i < size; i++)
+		pos = (pos << 8) | value[i];
+
+	return pos;
+}
+
+/**
+ * @brief 按大端写入位置信息
+ *
+ * @param value 写入的位置
+ * @param size 位置信息的长度
+ * @param pos 位置信息对应的无符号整数
+ */
+static inline void bp_posting_store(unsigned char *value, int size, uint64_t pos)
+{
+	int i;
+
+	for (i = size - 1; i >= 0; i--) {
+		value[i]   = pos & 0xff;
+		pos      >>= 8;
+	}
+}
+
+/**
+ * @brief 从 B+树的数据项中取出倒排列表
+ *
+ * @param slot 数据项中的位置信息
+ * @return bp_posting_t* 倒排列表，只有一个位置信息时返回 NULL
+ */
+static inline bp_posting_t *bp_posting_get(unsigned char *slot)
+{
+	bp_posting_t *posting;
+
+	if (BP_POSTING_LIST != slot[0])
+		return NULL;
+
+	memcpy(&posting, slot + 1, sizeof(posting));
+
+	return posting;
+}
+
+/**
+ * @brief 把位置信息编码成一个块
+ *
+ * @param positions 排好序的位置信息
+ * @param num 位置信息的个数，必须大于 0
+ * @return bp_posting_block_t* 新的块，内存不足时返回 NULL
+ */
+static bp_posting_block_t *bp_posting_block_build(uint64_t *positions, int num)
+{
+	unsigned char       buf[BP_POSTING_BLOCK_NUM * BP_VARINT_MAX];
+	bp_posting_block_t *new;
+	uint64_t            delta;
+	int                 len;
+	int                 i;
+
+	len = 0;
+	for (i = 1; i < num; i++) {
+		delta = positions[i] - positions[i - 1];
+		while (delta >= 0x80) {
+			buf[len++]   = (delta & 0x7f) | 0x80;
+			delta      >>= 7;
+		}
+		buf[len++] = delta;
+	}
+
+	new = malloc(sizeof(*new) + len);
+	if (NULL == new)
+		return NULL;
+
+	new->first = positions[0];
+	new->last  = positions[num - 1];
+	new->count = num;
+	new->len   = len;
+	memcpy(new->data, buf, len);
+
+	return new;
+}
+
+/**
+ * @brief 把块解码成位置信息
+ *
+ * @param block 块
+ * @param positions 输出的位置信息，至少能保存 block->count 个
+ */
+static void bp_posting_block_decode(bp_posting_block_t *block, uint64_t *positions)
+{
+	unsigned char *p;
+	uint64_t       delta;
+	int            shift;
+	int            i;
+
+	p            = block->data;
+	positions[0] = block->first;
+	for (i = 1; i < block->count; i++) {
+		delta = 0;
+		shift = 0;
+		do {
+			delta |= (uint64_t)(*p & 0x7f) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+
+		positions[i] = positions[i - 1] + delta;
+	}
+}
+
+/**
+ * @brief 查找位置信息所在的块
+ *
+ * @details
+ *  返回最后一个 first 小于等于 pos 的块。这个块之后的块 first 都大于 pos ，之前的块
+ *  last 都不大于它的 first ，所以只要倒排列表中有 pos ，这个块中就一定有 pos
+ *
+ * @param posting 倒排列表
+ * @param pos 位置信息
+ * @return int 块的下标，所有块的 first 都大于 pos 时返回 0
+ */
+static int bp_posting_find_block(bp_posting_t *posting, uint64_t pos)
+{
+	int low;
+	int high;
+	int mid;
+
+	low  = 0;
+	high = posting->block_num;
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (posting->blocks[mid]->first <= pos)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low > 0 ? low - 1 : 0;
+}
+
+/**
+ * @brief 在倒排列表的 idx 位置插入块
+ *
+ * @param posting 倒排列表
+ * @param idx 插入的位置
+ * @param block 插入的块
+ * @return int 成功返回 0 ，内存不足返回 -1
+ */
+static int bp_posting_add_block(
+	bp_posting_t       *posting,
+	int                 idx,
+	bp_posting_block_t *block)
+{
+	bp_posting_block_t **blocks;
+	int                  cap;
+
+	if (posting->block_num == posting->block_cap) {
+		cap    = posting->block_cap ? posting->block_cap * 2 : 4;
+		blocks = realloc(posting->blocks, cap * sizeof(*blocks));
+		if (NULL == blocks)
+			return -1;
+
+		posting->blocks    = blocks;
+		posting->block_cap = cap;
+	}
+
+	memmove(posting->blocks + idx + 1, posting->blocks + idx,
+			(posting->block_num - idx) * sizeof(*blocks));
+	posting->blocks[idx]  = block;
+	posting->block_num   += 1;
+
+	return 0;
+}
+
+/**
+ * @brief 释放倒排列表
+ *
+ * @param posting 倒排列表
+ */
+static void bp_posting_free(bp_posting_t *posting)
+{
+	int i;
+
+	for (i = 0; i < posting->block_num; i++)
+		free(posting->blocks[i]);
+
+	free(posting->blocks);
+	free(posting);
+}
+
+/**
+ * @brief 创建有两个位置信息的倒排列表
+ *
+ * @param a 位置信息
+ * @param b 位置信息
+ * @return bp_posting_t* 新的倒排列表，内存不足时返回 NULL
+ */
+static bp_posting_t *bp_posting_create(uint64_t a, uint64_t b)
+{
+	bp_posting_block_t *block;
+	bp_posting_t       *new;
+	uint64_t            positions[2];
+
+	positions[0] = a < b ? a : b;
+	positions[1] = a < b ? b : a;
+
+	new = malloc(sizeof(*new));
+	if (NULL == new)
+		return NULL;
+
+	memset(new, 0, sizeof(*new));
+	block = bp_posting_block_build(positions, 2);
+	if (NULL == block || 0 != bp_posting_add_block(new, 0, block)) {
+		free(block);
+		bp_posting_free(new);
+
+		return NULL;
+	}
+
+	new->count = 2;
+
+	return new;
+}
+
+/**
+ * @brief 向倒排列表中插入位置信息
+ *
+ * @details
+ *  块满了之后分裂成两个。在最后一个块的最大值之后追加时，旧块保持满的状态，新块
+ *  只保存新的位置信息，按顺序追加的倒排列表不会留下半满的块
+ *
+ * @param posting 倒排列表
+ * @param pos 位置信息
+ * @return int 成功返回 0 ，内存不足返回 -1
+ */
+static int bp_posting_insert(bp_posting_t *posting, uint64_t pos)
+{
+	bp_posting_block_t *block;
+	bp_posting_block_t *right;
+	uint64_t            positions[BP_POSTING_BLOCK_NUM + 1];
+	int                 idx;
+	int                 num;
+	int                 split;
+	int                 i;
+
+	idx   = bp_posting_find_block(posting, pos);
+	block = posting->blocks[idx];
+	num   = block->count;
+	bp_posting_block_decode(block, positions);
+
+	for (i = num; i > 0 && positions[i - 1] > pos; i--)
+		positions[i] = positions[i - 1];
+	positions[i]  = pos;
+	num          += 1;
+
+	if (num <= BP_POSTING_BLOCK_NUM) {
+		block = bp_posting_block_build(positions, num);
+		if (NULL == block)
+			return -1;
+
+		free(posting->blocks[idx]);
+		posting->blocks[idx]  = block;
+		posting->count       += 1;
+
+		return 0;
+	}
+
+	if (idx == posting->block_num - 1 && i == num - 1)
+		split = num - 1;
+	else
+		split = num / 2;
+
+	block = bp_posting_block_build(positions, split);
+	right = bp_posting_block_build(positions + split, num - split);
+	if (NULL == block || NULL == right ||
+		0 != bp_posting_add_block(posting, idx + 1, right)) {
+		free(block);
+		free(right);
+
+		return -1;
+	}
+
+	free(posting->blocks[idx]);
+	posting->blocks[idx]  = block;
+	posting->count       += 1;
+
+	return 0;
+}
+
+/**
+ * @brief 从倒排列表中删除一个位置信息
+ *
+ * @param posting 倒排列表
+ * @param pos 位置信息
+ * @return int 删除了返回 1 ，没找到返回 0 ，内存不足返回 -1
+ */
+static int bp_posting_remove(bp_posting_t *posting, uint64_t pos)
+{
+	bp_posting_block_t *block;
+	uint64_t            positions[BP_POSTING_BLOCK_NUM];
+	int                 idx;
+	int                 i;
+
+	idx   = bp_posting_find_block(posting, pos);
+	block = posting->blocks[idx];
+	if (pos < block->first || pos > block->last)
+		return 0;
+
+	bp_posting_block_decode(block, positions);
+	for (i = 0; i < block->count && positions[i] != pos; i++)
+		;
+
+	if (i == block->count)
+		return 0;
+
+	if (1 == block->count) {
+		free(block);
+		memmove(posting->blocks + idx, posting->blocks + idx + 1,
+				(posting->block_num - idx - 1) * sizeof(block));
+		posting->block_num -= 1;
+		posting->count     -= 1;
+
+		return 1;
+	}
+
+	memmove(positions + i, positions + i + 1,
+			(block->count - i - 1) * sizeof(positions[0]));
+	block = bp_posting_block_build(positions, block->count - 1);
+	if (NULL == block)
+		return -1;
+
+	free(posting->blocks[idx]);
+	posting->blocks[idx]  = block;
+	posting->count       -= 1;
+
+	return 1;
+}
+
+/**
+ * @brief 查找 key 在B+树上的数据项
+ *
+ * @details
+ *  只复制出数据项中的位置信息，修改数据项要通过 bp_update ，这样B+树上的写锁和
+ *  代数都和普通的写操作一样
+ *
+ * @param tree 倒排列表树
+ * @param key 被索引项
+ * @param slot_out 用于输出数据项中的位置信息，长度至少为 BP_POSTING_SLOT_MAX
+ * @return int 找到返回 1 ，没找到返回 0
+ */
+static inline int bp_posting_find_slot(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	unsigned char     *slot_out)
+{
+	return 1 == bp_search(tree->tree, key, tree->key_size, slot_out);
+}
+
+/**
+ * @brief 创建倒排列表树
+ *
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含不同的被索引项的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度，最多 8 个字节，按大端无符号整数排序
+ * @param compare 比较 key 值的函数
+ * @return bp_posting_tree_t* 创建的倒排列表树，参数错误或者内存不足时返回 NULL
+ */
+bp_posting_tree_t *bp_create_posting_tree(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare)
+{
+	bp_posting_tree_t *new;
+
+	if (value_size <= 0 || value_size > 8)
+		return NULL;
+
+	new = malloc(sizeof(*new));
+	if (NULL == new)
+		return NULL;
+
+	new->key_size   = key_size;
+	new->value_size = value_size;
+	new->slot_size  = 1 + (value_size > (int)sizeof(bp_posting_t *) ?
+						   value_size : (int)sizeof(bp_posting_t *));
+	new->tree       = bp_create_tree(max_idx_num, max_data_num, key_size,
+									 new->slot_size, compare);
+	if (NULL == new->tree) {
+		free(new);
+
+		return NULL;
+	}
+
+	return new;
+}
+
+/**
+ * @brief 释放倒排列表树和所有的倒排列表
+ *
+ * @param tree 倒排列表树
+ */
+void bp_destroy_posting_tree(bp_posting_tree_t *tree)
+{
+	bp_posting_t  *posting;
+	bp_cursor_t   *cursor;
+	unsigned char *key;
+	unsigned char *slot;
+
+	cursor = bp_cursor_open(tree->tree, NULL, NULL);
+	if (cursor) {
+		while (1 == bp_cursor_next(cursor, &key, &slot)) {
+			posting = bp_posting_get(slot);
+			if (posting)
+				bp_posting_free(posting);
+		}
+
+		bp_cursor_close(cursor);
+	}
+
+	bp_destroy_tree(tree->tree);
+	free(tree);
+}
+
+/**
+ * @brief 插入一个被索引项及其位置信息
+ *
+ * @param tree 倒排列表树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param position 位置信息
+ * @param position_len 位置信息的长度
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+int bp_posting_tree_insert(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *position,
+	int                position_len)
+{
+	bp_posting_t  *posting;
+	unsigned char  slot[BP_POSTING_SLOT_MAX];
+	unsigned char  new_slot[BP_POSTING_SLOT_MAX];
+	uint64_t       pos;
+
+	if (tree->key_size != key_len || tree->value_size != position_len)
+		return -1;
+
+	pos = bp_posting_load(position, position_len);
+	memset(new_slot, 0, tree->slot_size);
+	if (!bp_posting_find_slot(tree, key, slot)) {
+		new_slot[0] = BP_POSTING_INLINE;
+		memcpy(new_slot + 1, position, position_len);
+
+		return bp_insert(tree->tree, key, key_len, new_slot, tree->slot_size);
+	}
+
+	posting = bp_posting_get(slot);
+	if (posting)
+		return bp_posting_insert(posting, pos);
+
+	// 第二个位置信息，把数据项中的位置信息换成倒排列表
+	posting = bp_posting_create(bp_posting_load(slot + 1, tree->value_size), pos);
+	if (NULL == posting)
+		return -1;
+
+	new_slot[0] = BP_POSTING_LIST;
+	memcpy(new_slot + 1, &posting, sizeof(posting));
+	if (1 != bp_update(tree->tree, key, key_len, NULL, new_slot)) {
+		bp_posting_free(posting);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief 删除一个被索引项
+ *
+ * @param tree 倒排列表树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 位置信息，不为 NULL 时只删除一个相同的位置信息，为 NULL 时删除最小的
+ *              位置信息
+ * @return int 删除了返回 1 ，没找到返回 0 ，参数错误或者内存不足返回 -1
+ */
+int bp_posting_tree_delete(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value)
+{
+	bp_posting_t  *posting;
+	unsigned char  slot[BP_POSTING_SLOT_MAX];
+	uint64_t       pos;
+	int            ret;
+
+	if (tree->key_size != key_len)
+		return -1;
+
+	if (!bp_posting_find_slot(tree, key, slot))
+		return 0;
+
+	posting = bp_posting_get(slot);
+	if (NULL == posting) {
+		if (value && 0 != memcmp(slot + 1, value, tree->value_size))
+			return 0;
+
+		return bp_delete(tree->tree, key, key_len, NULL) > 0 ? 1 : -1;
+	}
+
+	// 和 bp_delete 一样， value 为 NULL 时只删除第一个也就是最小的位置信息
+	pos = value ? bp_posting_load(value, tree->value_size) : posting->blocks[0]->first;
+	ret = bp_posting_remove(posting, pos);
+	if (1 != ret || posting->count > 1)
+		return ret;
+
+	// 只剩一个位置信息时重新保存在数据项中，替换失败时保留只有一个位置信息的倒排列表
+	pos     = posting->blocks[0]->first;
+	slot[0] = BP_POSTING_INLINE;
+	memset(slot + 1, 0, tree->slot_size - 1);
+	bp_posting_store(slot + 1, tree->value_size, pos);
+	if (1 == bp_update(tree->tree, key, key_len, NULL, slot))
+		bp_posting_free(posting);
+
+	return 1;
+}
+
+/**
+ * @brief 查找被索引项最小或者最大的位置信息
+ *
+ * @param tree 倒排列表树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value_out 输出的位置信息
+ * @param last 为 1 时查找最大的位置信息
+ * @return int 找到返回 1 ，没找到返回 0 ，参数错误返回 -1
+ */
+static int bp_posting_tree_search_end(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value_out,
+	int                last)
+{
+	bp_posting_t  *posting;
+	unsigned char  slot[BP_POSTING_SLOT_MAX];
+
+	if (tree->key_size != key_len)
+		return -1;
+
+	if (!bp_posting_find_slot(tree, key, slot))
+		return 0;
+
+	posting = bp_posting_get(slot);
+	if (NULL == posting)
+		memcpy(value_out, slot + 1, tree->value_size);
+	else if (last)
+		bp_posting_store(value_out, tree->value_size,
+						 posting->blocks[posting->block_num - 1]->last);
+	else
+		bp_posting_store(value_out, tree->value_size, posting->blocks[0]->first);
+
+	return 1;
+}
+
+/**
+ * @brief 查找被索引项最小的位置信息
+ *
+ * @param tree 倒排列表树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value_out 输出的位置信息
+ * @return int 找到返回 1 ，没找到返回 0 ，参数错误返回 -1
+ */
+int bp_posting_tree_search(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value_out)
+{
+	return bp_posting_tree_search_end(tree, key, key_len, value_out, 0);
+}
+
+/**
+ * @brief 查找被索引项最大的位置信息
+ *
+ * @param tree 倒排列表树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value_out 输出的位置信息
+ * @return int 找到返回 1 ，没找到返回 0 ，参数错误返回 -1
+ */
+int bp_posting_tree_search_last(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value_out)
+{
+	return bp_posting_tree_search_end(tree, key, key_len, value_out, 1);
+}
+
+/**
+ * @brief 按从小到大的顺序查找被索引项的位置信息
+ *
+ * @param tree 倒排列表树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param offset 跳过前 offset 个位置信息
+ * @param values_out 输出的位置信息
+ * @param max_num 最多输出的位置信息个数
+ * @return int 输出的位置信息个数，参数错误返回 -1
+ */
+int bp_posting_tree_search_all(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	uint64_t           offset,
+	unsigned char     *values_out,
+	int                max_num)
+{
+	bp_posting_block_t *block;
+	bp_posting_t       *posting;
+	unsigned char       slot[BP_POSTING_SLOT_MAX];
+	uint64_t            positions[BP_POSTING_BLOCK_NUM];
+	int                 num;
+	int                 i;
+	int                 j;
+
+	if (tree->key_size != key_len || max_num < 0)
+		return -1;
+
+	if (0 == max_num || !bp_posting_find_slot(tree, key, slot))
+		return 0;
+
+	posting = bp_posting_get(slot);
+	if (NULL == posting) {
+		if (offset > 0)
+			return 0;
+
+		memcpy(values_out, slot + 1, tree->value_size);
+
+		return 1;
+	}
+
+	num = 0;
+	for (i = 0; i < posting->block_num && num < max_num; i++) {
+		block = posting->blocks[i];
+		if (offset >= (uint64_t)block->count) {
+			offset -= block->count;
+			continue;
+		}
+
+		bp_posting_block_decode(block, positions);
+		for (j = offset; j < block->count && num < max_num; j++, num++)
+			bp_posting_store(values_out + num * tree->value_size,
+							 tree->value_size, positions[j]);
+		offset = 0;
+	}
+
+	return num;
+}
+
+/**
+ * @brief 返回被索引项的位置信息个数
+ *
+ * @param tree 倒排列表树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @return int64_t 位置信息的个数，参数错误返回 -1
+ */
+int64_t bp_posting_tree_count(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len)
+{
+	bp_posting_t  *posting;
+	unsigned char  slot[BP_POSTING_SLOT_MAX];
+
+	if (tree->key_size != key_len)
+		return -1;
+
+	if (!bp_posting_find_slot(tree, key, slot))
+		return 0;
+
+	posting = bp_posting_get(slot);
+
+	return posting ? (int64_t)posting->count : 1;
+}
+
+/**
+ * @brief 返回保存被索引项的B+树，只能用来查看统计信息或者按顺序访问不同的 key
+ *
+ * @param tree 倒排列表树
+ * @return bp_tree_t* 内部的B+树
+ */
+bp_tree_t *bp_posting_tree_get_tree(bp_posting_tree_t *tree)
+{
+	return tree->tree;
+}
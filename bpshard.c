@@ -0,0 +1,475 @@
+/**
+ * @file bpshard.c
+ * @brief 按 key 的范围分片的B+树
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * 分片树把 key 的空间按范围划分成 shard_num 段，每段是一棵独立的B+树，所以写入不同
+ * 分片的线程之间没有任何共享的结点，根结点分裂也只发生在各自的分片上。分界 key 在
+ * 创建后不再修改，查找分片时不需要加锁。
+ *
+ *           bounds[0]      bounds[1]            bounds[n - 2]
+ *               |              |                      |
+ * +-------------+--------------+-------- ... ---------+-------------+
+ * |  shards[0]  |  shards[1]   |                      | shards[n-1] |
+ * +-------------+--------------+-------- ... ---------+-------------+
+ *
+ * 分片之间的 key 范围不重叠并且按顺序排列，范围查找时依次访问每个分片就是有序的。
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "libbplus.h"
+
+struct bp_sharded_tree {
+	int            shard_num; /** 分片的个数 */
+	int            key_size; /** 被索引项的大小 */
+	int            value_size; /** 位置信息的大小 */
+	bp_compare_f   compare; /** 比较 key 值的函数， NULL 表示使用 memcmp */
+	unsigned char *bounds; /** shard_num - 1 个分界 key ， NULL 表示按第一个字节划分 */
+	bp_tree_t     *shards[0]; /** 所有的分片 */
+};
+
+struct bp_sharded_cursor {
+	bp_sharded_tree_t *tree; /** 所属的分片树 */
+	bp_cursor_t       *cursor; /** 当前分片上的游标 */
+	int                shard; /** 当前分片的下标 */
+	int                last_shard; /** 查找范围内最后一个分片的下标 */
+	unsigned char     *lo; /** 查找范围的下限， NULL 表示不限 */
+	unsigned char     *hi; /** 查找范围的上限， NULL 表示不限 */
+	unsigned char      keys[0]; /** lo 和 hi 的存储空间 */
+};
+
+/**
+ * @brief 比较两个 key 值
+ *
+ * @param tree 分片树
+ * @param a 要比较的 key
+ * @param b 要比较的 key
+ * @return int 同 memcmp
+ */
+static inline int bp_shard_compare(
+	bp_sharded_tree_t *tree,
+	unsigned char     *a,
+	unsigned char     *b)
+{
+	if (NULL == tree->compare)
+		return memcmp(a, b, tree->key_size);
+
+	return tree->compare(a, b, tree->key_size);
+}
+
+/**
+ * @brief 创建结点从独占的 arena 上分配的分片，比如让每个分片的结点都位于处理这个分片
+ *        的线程所在的 NUMA 结点上
+ *
+ * @param config 分片的参数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @return bp_tree_t* 创建的分片，并发模式的分片不支持自定义分配器，返回 NULL
+ */
+static bp_tree_t *bp_shard_create_on_arena(
+	bp_shard_config_t *config,
+	int                key_size,
+	int                value_size,
+	bp_compare_f       compare)
+{
+	bp_arena_t *arena;
+	bp_tree_t  *tree;
+
+	if (config->concurrent)
+		return NULL;
+
+	arena = bp_arena_create_with_flags(0, config->arena_flags, config->numa_node);
+	if (NULL == arena)
+		return NULL;
+
+	tree = bp_create_tree_on_arena(config->max_idx_num, config->max_data_num,
+								   key_size, value_size, compare, arena);
+	if (NULL == tree)
+		bp_arena_destroy(arena);
+
+	return tree;
+}
+
+/**
+ * @brief 创建分片树
+ *
+ * @param shard_num 分片的个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数
+ * @param bounds shard_num - 1 个递增的分界 key ，每个分界 key 是下一个分片的最小值；
+ *               为 NULL 时按 key 的第一个字节平均划分，比如 ipv4 地址按 /8 前缀划分
+ * @param configs shard_num 个分片各自的参数
+ * @return bp_sharded_tree_t* 创建的分片树，参数错误或者内存不足时返回 NULL
+ */
+bp_sharded_tree_t *bp_create_sharded_tree(
+	int                shard_num,
+	int                key_size,
+	int                value_size,
+	bp_compare_f       compare,
+	unsigned char     *bounds,
+	bp_shard_config_t *configs)
+{
+	bp_sharded_tree_t *new;
+	int                i;
+
+	if (shard_num <= 0 || key_size <= 0)
+		return NULL;
+
+	// 按第一个字节划分只对 memcmp 的顺序有效，最多划分成 256 段
+	if (NULL == bounds && (compare || shard_num > 256))
+		return NULL;
+
+	new = malloc(sizeof(*new) + shard_num * sizeof(bp_tree_t *));
+	if (NULL == new)
+		return NULL;
+
+	memset(new, 0, sizeof(*new) + shard_num * sizeof(bp_tree_t *));
+	new->shard_num  = shard_num;
+	new->key_size   = key_size;
+	new->value_size = value_size;
+	new->compare    = compare;
+
+	if (bounds && shard_num > 1) {
+		new->bounds = malloc((shard_num - 1) * key_size);
+		if (NULL == new->bounds) {
+			free(new);
+
+			return NULL;
+		}
+
+		memcpy(new->bounds, bounds, (shard_num - 1) * key_size);
+		for (i = 1; i < shard_num - 1; i++)
+			if (bp_shard_compare(new, new->bounds + (i - 1) * key_size,
+								 new->bounds + i * key_size) >= 0) {
+				bp_destroy_sharded_tree(new);
+
+				return NULL;
+			}
+	}
+
+	for (i = 0; i < shard_num; i++) {
+		if (configs[i].arena_flags)
+			new->shards[i] = bp_shard_create_on_arena(&configs[i], key_size,
+													   value_size, compare);
+		else if (configs[i].concurrent)
+			new->shards[i] = bp_create_concurrent_tree(
+				configs[i].max_idx_num, configs[i].max_data_num, key_size,
+				value_size, compare);
+		else
+			new->shards[i] = bp_create_tree(
+				configs[i].max_idx_num, configs[i].max_data_num, key_size,
+				value_size, compare);
+
+		if (NULL == new->shards[i]) {
+			bp_destroy_sharded_tree(new);
+
+			return NULL;
+		}
+	}
+
+	return new;
+}
+
+/**
+ * @brief 释放分片树和所有的分片
+ *
+ * @param tree 分片树
+ */
+void bp_destroy_sharded_tree(bp_sharded_tree_t *tree)
+{
+	int i;
+
+	for (i = 0; i < tree->shard_num; i++)
+		if (tree->shards[i])
+			bp_destroy_tree(tree->shards[i]);
+
+	free(tree->bounds);
+	free(tree);
+}
+
+/**
+ * @brief 返回 key 所在分片的下标
+ *
+ * @details
+ *  分界 key 是下一个分片的最小值，所以 key 所在的分片就是小于等于 key 的分界 key 的
+ *  个数。相同的 key 永远在同一个分片上
+ *
+ * @param tree 分片树
+ * @param key 被索引项
+ * @return int 分片的下标
+ */
+int bp_sharded_tree_route(bp_sharded_tree_t *tree, unsigned char *key)
+{
+	int low;
+	int high;
+	int mid;
+
+	if (NULL == tree->bounds)
+		return key[0] * tree->shard_num / 256;
+
+	low  = 0;
+	high = tree->shard_num - 1;
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (bp_shard_compare(tree, tree->bounds + mid * tree->key_size, key) <= 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/**
+ * @brief 返回下标为 idx 的分片
+ *
+ * @param tree 分片树
+ * @param idx 分片的下标
+ * @return bp_tree_t* 分片，下标超出范围返回 NULL
+ */
+bp_tree_t *bp_sharded_tree_get_shard(bp_sharded_tree_t *tree, int idx)
+{
+	if (idx < 0 || idx >= tree->shard_num)
+		return NULL;
+
+	return tree->shards[idx];
+}
+
+/**
+ * @brief 把被索引项及其位置信息插入到所在的分片
+ *
+ * @param tree 分片树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param position 位置信息
+ * @param position_len 位置信息的长度
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+int bp_sharded_insert(
+	bp_sharded_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *position,
+	int                position_len)
+{
+	if (tree->key_size != key_len)
+		return -1;
+
+	return bp_insert(tree->shards[bp_sharded_tree_route(tree, key)], key,
+					 key_len, position, position_len);
+}
+
+/**
+ * @brief 把数据按分片拆分后，分别批量插入到每个分片
+ *
+ * @param tree 分片树
+ * @param keys 被索引项，长度为 item_num * key_size
+ * @param positions 位置信息，长度为 item_num * value_size
+ * @param item_num 要插入的数据个数
+ * @return int 成功返回 0 ，否则返回 -1 ，失败时可能已经插入了一部分数据
+ */
+int bp_sharded_insert_batch(
+	bp_sharded_tree_t *tree,
+	unsigned char     *keys,
+	unsigned char     *positions,
+	int                item_num)
+{
+	unsigned char *key_buf;
+	unsigned char *position_buf;
+	int           *offsets;
+	int           *routes;
+	int            shard;
+	int            ret;
+	int            i;
+
+	if (item_num <= 0)
+		return 0;
+
+	key_buf      = malloc(item_num * tree->key_size);
+	position_buf = malloc(item_num * tree->value_size);
+	offsets      = malloc((tree->shard_num + 1) * sizeof(int));
+	routes       = malloc(item_num * sizeof(int));
+	if (NULL == key_buf || NULL == position_buf || NULL == offsets
+		|| NULL == routes) {
+		free(key_buf);
+		free(position_buf);
+		free(offsets);
+		free(routes);
+
+		return -1;
+	}
+
+	// 计数排序，把同一个分片的数据放到一起
+	memset(offsets, 0, (tree->shard_num + 1) * sizeof(int));
+	for (i = 0; i < item_num; i++) {
+		routes[i] = bp_sharded_tree_route(tree, keys + i * tree->key_size);
+		offsets[routes[i] + 1] += 1;
+	}
+	for (shard = 0; shard < tree->shard_num; shard++)
+		offsets[shard + 1] += offsets[shard];
+
+	for (i = 0; i < item_num; i++) {
+		memcpy(key_buf + offsets[routes[i]] * tree->key_size,
+			   keys + i * tree->key_size, tree->key_size);
+		memcpy(position_buf + offsets[routes[i]] * tree->value_size,
+			   positions + i * tree->value_size, tree->value_size);
+		offsets[routes[i]] += 1;
+	}
+
+	// 上面的循环之后 offsets[shard] 是下一个分片的开始位置
+	ret = 0;
+	for (shard = 0; shard < tree->shard_num && 0 == ret; shard++) {
+		i = shard == 0 ? 0 : offsets[shard - 1];
+		ret = bp_insert_batch(tree->shards[shard], key_buf + i * tree->key_size,
+							  position_buf + i * tree->value_size,
+							  offsets[shard] - i);
+	}
+
+	free(key_buf);
+	free(position_buf);
+	free(offsets);
+	free(routes);
+
+	return ret;
+}
+
+/**
+ * @brief 在所在的分片上查找被索引项的第一个位置信息
+ *
+ * @param tree 分片树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value_out 用于输出位置信息，长度至少为 value_size
+ * @return int 找到返回 1 ，没找到返回 0 ，参数错误返回 -1
+ */
+int bp_sharded_search(
+	bp_sharded_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value_out)
+{
+	if (tree->key_size != key_len)
+		return -1;
+
+	return bp_search(tree->shards[bp_sharded_tree_route(tree, key)], key,
+					 key_len, value_out);
+}
+
+/**
+ * @brief 从所在的分片上删除一个被索引项
+ *
+ * @param tree 分片树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 位置信息，不为 NULL 时只删除位置信息相同的数据项
+ * @return int 删除了返回 1 ，没找到返回 0 ，参数错误返回 -1
+ */
+int bp_sharded_delete(
+	bp_sharded_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value)
+{
+	if (tree->key_size != key_len)
+		return -1;
+
+	return bp_delete(tree->shards[bp_sharded_tree_route(tree, key)], key,
+					 key_len, value);
+}
+
+/**
+ * @brief 打开按顺序访问所有分片上 [lo, hi] 范围内被索引项的游标
+ *
+ * @details
+ *  只访问 lo 所在的分片到 hi 所在的分片，每个分片上都用 [lo, hi] 打开游标，中间的
+ *  分片上 lo 和 hi 都不起作用
+ *
+ * @param tree 分片树
+ * @param lo 查找范围的下限， NULL 表示从最小的被索引项开始
+ * @param hi 查找范围的上限， NULL 表示到最大的被索引项结束
+ * @return bp_sharded_cursor_t* 游标，失败返回 NULL
+ */
+bp_sharded_cursor_t *bp_sharded_cursor_open(
+	bp_sharded_tree_t *tree,
+	unsigned char     *lo,
+	unsigned char     *hi)
+{
+	bp_sharded_cursor_t *cursor;
+
+	cursor = malloc(sizeof(*cursor) + 2 * tree->key_size);
+	if (NULL == cursor)
+		return NULL;
+
+	memset(cursor, 0, sizeof(*cursor));
+	cursor->tree       = tree;
+	cursor->last_shard = tree->shard_num - 1;
+	if (lo) {
+		cursor->lo    = cursor->keys;
+		cursor->shard = bp_sharded_tree_route(tree, lo);
+		memcpy(cursor->lo, lo, tree->key_size);
+	}
+	if (hi) {
+		cursor->hi         = cursor->keys + tree->key_size;
+		cursor->last_shard = bp_sharded_tree_route(tree, hi);
+		memcpy(cursor->hi, hi, tree->key_size);
+	}
+
+	cursor->cursor = bp_cursor_open(tree->shards[cursor->shard], cursor->lo,
+									cursor->hi);
+	if (NULL == cursor->cursor) {
+		free(cursor);
+
+		return NULL;
+	}
+
+	return cursor;
+}
+
+/**
+ * @brief 返回游标指向的被索引项及其位置信息，并把游标移动到下一项
+ *
+ * @param cursor 游标
+ * @param key 用于输出被索引项在数据结点上的位置
+ * @param value 用于输出位置信息在数据结点上的位置
+ * @return int 有数据返回 1 ，已经没有数据返回 0 ，打开下一个分片的游标失败返回 -1
+ */
+int bp_sharded_cursor_next(
+	bp_sharded_cursor_t *cursor,
+	unsigned char      **key,
+	unsigned char      **value)
+{
+	if (NULL == cursor->cursor)
+		return -1;
+
+	while (!bp_cursor_next(cursor->cursor, key, value)) {
+		if (cursor->shard >= cursor->last_shard)
+			return 0;
+
+		bp_cursor_close(cursor->cursor);
+		cursor->shard  += 1;
+		cursor->cursor  = bp_cursor_open(cursor->tree->shards[cursor->shard],
+										 cursor->lo, cursor->hi);
+		if (NULL == cursor->cursor)
+			return -1;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief 关闭分片树的游标
+ *
+ * @param cursor 游标
+ */
+void bp_sharded_cursor_close(bp_sharded_cursor_t *cursor)
+{
+	if (cursor->cursor)
+		bp_cursor_close(cursor->cursor);
+
+	free(cursor);
+}
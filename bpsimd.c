@@ -0,0 +1,468 @@
+/**
+ * @file bpsimd.c
+ * @brief 结点内查找使用的 SIMD 函数
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * 结点内的 key 是有序的，所以在一段数据项中小于 target 的 key 的个数就是 target 在这段
+ * 数据项中的插入位置。这里把一段数据项中的 key 一次加载到向量寄存器中和 target 比较，
+ * 用 movemask/popcount 统计比较的结果，不需要根据每次比较的结果做分支。
+ *
+ * key 按大端保存，加载后先转换为本机字节序，再把最高位取反，这样就可以用有符号整数的
+ * 比较指令比较无符号整数。 key 连续保存时（ stride 等于 key 的长度）直接加载，否则逐个
+ * 加载后组成向量。
+ *
+ * x86 上加载库时根据 CPUID 选择 AVX2 或者 SSE4.2 ， aarch64 上总是使用 NEON 。
+ */
+
+#include <string.h>
+
+#include "bpsimd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BP_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define BP_SIMD_ARM
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief 当前使用的 SIMD 指令集，取值为 bp_simd_level_e ，库外通过 bp_simd_get_level
+ *        和 bp_simd_set_level 访问
+ */
+#if defined(BP_SIMD_ARM)
+static int bp_simd_level = BP_SIMD_NEON;
+#else
+static int bp_simd_level = BP_SIMD_NONE;
+#endif
+
+/**
+ * @brief 返回当前使用的 SIMD 指令集
+ *
+ * @return int bp_simd_level_e
+ */
+int bp_simd_get_level(void)
+{
+	return bp_simd_level;
+}
+
+/**
+ * @brief 修改使用的 SIMD 指令集，用于测试
+ *
+ * @param level bp_simd_level_e ，不能高于 CPU 支持的指令集
+ */
+void bp_simd_set_level(int level)
+{
+	bp_simd_level = level;
+}
+
+static inline uint32_t bp_simd_load_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+		| ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t bp_simd_load_be64(const unsigned char *p)
+{
+	return ((uint64_t)bp_simd_load_be32(p) << 32) | bp_simd_load_be32(p + 4);
+}
+
+/**
+ * @brief 逐个比较统计 key 的个数，用于向量长度之外剩下的数据项
+ *
+ */
+static int bp_count_be32_scalar(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint32_t             key,
+	int                  or_equal)
+{
+	uint32_t item;
+	int      count;
+	int      i;
+
+	count = 0;
+	for (i = 0; i < num; i++) {
+		item   = bp_simd_load_be32(base + i * stride);
+		count += or_equal ? item <= key : item < key;
+	}
+
+	return count;
+}
+
+static int bp_count_be64_scalar(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint64_t             key,
+	int                  or_equal)
+{
+	uint64_t item;
+	int      count;
+	int      i;
+
+	count = 0;
+	for (i = 0; i < num; i++) {
+		item   = bp_simd_load_be64(base + i * stride);
+		count += or_equal ? item <= key : item < key;
+	}
+
+	return count;
+}
+
+#if defined(BP_SIMD_X86)
+
+/**
+ * @brief AVX2 一次比较 8 个 key ，只用于 key 连续保存的情况
+ *
+ * @details
+ *  数据项交错保存时 gather 指令比逐个加载还慢，所以交错保存的 key 使用 SSE4.2 的函数
+ */
+__attribute__((target("avx2")))
+static int bp_count_be32_avx2(
+	const unsigned char *base,
+	int                  num,
+	uint32_t             key,
+	int                  or_equal)
+{
+	__m256i shuffle;
+	__m256i sign;
+	__m256i target;
+	__m256i item;
+	__m256i mask;
+	int     bits;
+	int     count;
+	int     i;
+
+	shuffle = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8,
+							   15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4,
+							   11, 10, 9, 8, 15, 14, 13, 12);
+	sign    = _mm256_set1_epi32((int)0x80000000u);
+	target  = _mm256_set1_epi32((int)(key ^ 0x80000000u));
+
+	count = 0;
+	for (i = 0; i + 8 <= num; i += 8) {
+		item = _mm256_loadu_si256((const __m256i *)(base + i * 4));
+		item = _mm256_xor_si256(_mm256_shuffle_epi8(item, shuffle), sign);
+
+		// 小于等于 target 的个数为 8 减去大于 target 的个数
+		if (or_equal) {
+			mask   = _mm256_cmpgt_epi32(item, target);
+			bits   = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+			count += 8 - __builtin_popcount(bits);
+		} else {
+			mask   = _mm256_cmpgt_epi32(target, item);
+			bits   = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+			count += __builtin_popcount(bits);
+		}
+	}
+
+	return count + bp_count_be32_scalar(base + i * 4, num - i, 4, key,
+										or_equal);
+}
+
+__attribute__((target("avx2")))
+static int bp_count_be64_avx2(
+	const unsigned char *base,
+	int                  num,
+	uint64_t             key,
+	int                  or_equal)
+{
+	__m256i shuffle;
+	__m256i sign;
+	__m256i target;
+	__m256i item;
+	__m256i mask;
+	int     bits;
+	int     count;
+	int     i;
+
+	shuffle = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12,
+							   11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+							   15, 14, 13, 12, 11, 10, 9, 8);
+	sign    = _mm256_set1_epi64x((long long)0x8000000000000000ull);
+	target  = _mm256_set1_epi64x((long long)(key ^ 0x8000000000000000ull));
+
+	count = 0;
+	for (i = 0; i + 4 <= num; i += 4) {
+		item = _mm256_loadu_si256((const __m256i *)(base + i * 8));
+		item = _mm256_xor_si256(_mm256_shuffle_epi8(item, shuffle), sign);
+
+		if (or_equal) {
+			mask   = _mm256_cmpgt_epi64(item, target);
+			bits   = _mm256_movemask_pd(_mm256_castsi256_pd(mask));
+			count += 4 - __builtin_popcount(bits);
+		} else {
+			mask   = _mm256_cmpgt_epi64(target, item);
+			bits   = _mm256_movemask_pd(_mm256_castsi256_pd(mask));
+			count += __builtin_popcount(bits);
+		}
+	}
+
+	return count + bp_count_be64_scalar(base + i * 8, num - i, 8, key,
+										or_equal);
+}
+
+__attribute__((target("sse4.2")))
+static int bp_count_be32_sse42(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint32_t             key,
+	int                  or_equal)
+{
+	__m128i shuffle;
+	__m128i sign;
+	__m128i target;
+	__m128i item;
+	__m128i mask;
+	int     bits;
+	int     count;
+	int     i;
+
+	shuffle = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8,
+							15, 14, 13, 12);
+	sign    = _mm_set1_epi32((int)0x80000000u);
+	target  = _mm_set1_epi32((int)(key ^ 0x80000000u));
+
+	count = 0;
+	for (i = 0; i + 4 <= num; i += 4) {
+		if (4 == stride)
+			item = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(base + i * 4)), shuffle);
+		else
+			item = _mm_setr_epi32(
+				(int)bp_simd_load_be32(base + i * stride),
+				(int)bp_simd_load_be32(base + (i + 1) * stride),
+				(int)bp_simd_load_be32(base + (i + 2) * stride),
+				(int)bp_simd_load_be32(base + (i + 3) * stride));
+		item = _mm_xor_si128(item, sign);
+
+		if (or_equal) {
+			mask   = _mm_cmpgt_epi32(item, target);
+			bits   = _mm_movemask_ps(_mm_castsi128_ps(mask));
+			count += 4 - __builtin_popcount(bits);
+		} else {
+			mask   = _mm_cmpgt_epi32(target, item);
+			bits   = _mm_movemask_ps(_mm_castsi128_ps(mask));
+			count += __builtin_popcount(bits);
+		}
+	}
+
+	return count + bp_count_be32_scalar(base + i * stride, num - i, stride,
+										key, or_equal);
+}
+
+__attribute__((target("sse4.2")))
+static int bp_count_be64_sse42(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint64_t             key,
+	int                  or_equal)
+{
+	__m128i shuffle;
+	__m128i sign;
+	__m128i target;
+	__m128i item;
+	__m128i mask;
+	int     bits;
+	int     count;
+	int     i;
+
+	shuffle = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12,
+							11, 10, 9, 8);
+	sign    = _mm_set1_epi64x((long long)0x8000000000000000ull);
+	target  = _mm_set1_epi64x((long long)(key ^ 0x8000000000000000ull));
+
+	count = 0;
+	for (i = 0; i + 2 <= num; i += 2) {
+		if (8 == stride)
+			item = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(base + i * 8)), shuffle);
+		else
+			item = _mm_set_epi64x(
+				(long long)bp_simd_load_be64(base + (i + 1) * stride),
+				(long long)bp_simd_load_be64(base + i * stride));
+		item = _mm_xor_si128(item, sign);
+
+		if (or_equal) {
+			mask   = _mm_cmpgt_epi64(item, target);
+			bits   = _mm_movemask_pd(_mm_castsi128_pd(mask));
+			count += 2 - __builtin_popcount(bits);
+		} else {
+			mask   = _mm_cmpgt_epi64(target, item);
+			bits   = _mm_movemask_pd(_mm_castsi128_pd(mask));
+			count += __builtin_popcount(bits);
+		}
+	}
+
+	return count + bp_count_be64_scalar(base + i * stride, num - i, stride,
+										key, or_equal);
+}
+
+/**
+ * @brief 加载库时根据 CPU 支持的指令集选择 SIMD 函数
+ *
+ */
+__attribute__((constructor))
+static void bp_simd_init(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		bp_simd_level = BP_SIMD_AVX2;
+	else if (__builtin_cpu_supports("sse4.2"))
+		bp_simd_level = BP_SIMD_SSE42;
+}
+
+#endif /* BP_SIMD_X86 */
+
+#if defined(BP_SIMD_ARM)
+
+static int bp_count_be32_neon(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint32_t             key,
+	int                  or_equal)
+{
+	uint32x4_t target;
+	uint32x4_t item;
+	uint32x4_t mask;
+	uint32_t   buf[4];
+	int        count;
+	int        i;
+
+	target = vdupq_n_u32(key);
+
+	count = 0;
+	for (i = 0; i + 4 <= num; i += 4) {
+		if (4 == stride) {
+			item = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(base + i * 4)));
+		} else {
+			buf[0] = bp_simd_load_be32(base + i * stride);
+			buf[1] = bp_simd_load_be32(base + (i + 1) * stride);
+			buf[2] = bp_simd_load_be32(base + (i + 2) * stride);
+			buf[3] = bp_simd_load_be32(base + (i + 3) * stride);
+			item   = vld1q_u32(buf);
+		}
+
+		mask   = or_equal ? vcleq_u32(item, target) : vcltq_u32(item, target);
+		count += vaddvq_u32(vshrq_n_u32(mask, 31));
+	}
+
+	return count + bp_count_be32_scalar(base + i * stride, num - i, stride,
+										key, or_equal);
+}
+
+static int bp_count_be64_neon(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint64_t             key,
+	int                  or_equal)
+{
+	uint64x2_t target;
+	uint64x2_t item;
+	uint64x2_t mask;
+	uint64_t   buf[2];
+	int        count;
+	int        i;
+
+	target = vdupq_n_u64(key);
+
+	count = 0;
+	for (i = 0; i + 2 <= num; i += 2) {
+		if (8 == stride) {
+			item = vreinterpretq_u64_u8(vrev64q_u8(vld1q_u8(base + i * 8)));
+		} else {
+			buf[0] = bp_simd_load_be64(base + i * stride);
+			buf[1] = bp_simd_load_be64(base + (i + 1) * stride);
+			item   = vld1q_u64(buf);
+		}
+
+		mask   = or_equal ? vcleq_u64(item, target) : vcltq_u64(item, target);
+		count += (int)vaddvq_u64(vshrq_n_u64(mask, 63));
+	}
+
+	return count + bp_count_be64_scalar(base + i * stride, num - i, stride,
+										key, or_equal);
+}
+
+#endif /* BP_SIMD_ARM */
+
+/**
+ * @brief 统计 num 个间隔为 stride 的 4 字节大端整数中小于（ or_equal 时为小于等于）
+ *        key 的个数
+ *
+ * @param base 第一个 key 的位置
+ * @param num key 的个数
+ * @param stride 相邻两个 key 的间隔
+ * @param key 要比较的值
+ * @param or_equal 为 1 时统计小于等于 key 的个数
+ * @return int key 的个数
+ */
+int bp_simd_count_be32(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint32_t             key,
+	int                  or_equal)
+{
+	switch (bp_simd_level) {
+#if defined(BP_SIMD_X86)
+	case BP_SIMD_AVX2:
+		if (4 == stride)
+			return bp_count_be32_avx2(base, num, key, or_equal);
+		return bp_count_be32_sse42(base, num, stride, key, or_equal);
+	case BP_SIMD_SSE42:
+		return bp_count_be32_sse42(base, num, stride, key, or_equal);
+#endif
+#if defined(BP_SIMD_ARM)
+	case BP_SIMD_NEON:
+		return bp_count_be32_neon(base, num, stride, key, or_equal);
+#endif
+	default:
+		return bp_count_be32_scalar(base, num, stride, key, or_equal);
+	}
+}
+
+/**
+ * @brief 统计 num 个间隔为 stride 的 8 字节大端整数中小于（ or_equal 时为小于等于）
+ *        key 的个数
+ *
+ * @param base 第一个 key 的位置
+ * @param num key 的个数
+ * @param stride 相邻两个 key 的间隔
+ * @param key 要比较的值
+ * @param or_equal 为 1 时统计小于等于 key 的个数
+ * @return int key 的个数
+ */
+int bp_simd_count_be64(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint64_t             key,
+	int                  or_equal)
+{
+	switch (bp_simd_level) {
+#if defined(BP_SIMD_X86)
+	case BP_SIMD_AVX2:
+		if (8 == stride)
+			return bp_count_be64_avx2(base, num, key, or_equal);
+		return bp_count_be64_sse42(base, num, stride, key, or_equal);
+	case BP_SIMD_SSE42:
+		return bp_count_be64_sse42(base, num, stride, key, or_equal);
+#endif
+#if defined(BP_SIMD_ARM)
+	case BP_SIMD_NEON:
+		return bp_count_be64_neon(base, num, stride, key, or_equal);
+#endif
+	default:
+		return bp_count_be64_scalar(base, num, stride, key, or_equal);
+	}
+}
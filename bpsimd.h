@@ -0,0 +1,72 @@
+/**
+ * @file bpsimd.h
+ * @brief 结点内查找使用的 SIMD 函数
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * 只在 libbplus 内部使用
+ */
+
+#ifndef _BPSIMD_H_
+#define _BPSIMD_H_
+
+#include <stdint.h>
+
+/**
+ * @brief 当前 CPU 支持的 SIMD 指令集
+ *
+ */
+typedef enum bp_simd_level {
+	BP_SIMD_NONE, /** 不使用 SIMD */
+	BP_SIMD_SSE42, /** x86 SSE4.2 */
+	BP_SIMD_AVX2, /** x86 AVX2 */
+	BP_SIMD_NEON, /** ARM NEON */
+} bp_simd_level_e;
+
+/**
+ * @brief 结点内查找时先用二分查找把范围缩小到 BP_SIMD_WINDOW 个数据项以内，再用 SIMD
+ *        一次比较多个 key
+ *
+ * @details
+ *  顺序扫描 64 个数据项时硬件预取很有效，并且没有二分查找中前后依赖的加载，实测比
+ *  二分查找到 16 个数据项以内再扫描更快
+ */
+#define BP_SIMD_WINDOW 64
+
+/**
+ * @brief 返回加载库时根据 CPU 选择的 SIMD 指令集，取值为 bp_simd_level_e
+ *
+ */
+int bp_simd_get_level(void);
+
+/**
+ * @brief 修改使用的 SIMD 指令集，只能设置为不高于 CPU 支持的指令集，用于测试
+ *
+ */
+void bp_simd_set_level(int level);
+
+/**
+ * @brief 统计 num 个间隔为 stride 的 4 字节大端整数中小于（ or_equal 时为小于等于）
+ *        key 的个数
+ *
+ */
+int bp_simd_count_be32(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint32_t             key,
+	int                  or_equal);
+
+/**
+ * @brief 统计 num 个间隔为 stride 的 8 字节大端整数中小于（ or_equal 时为小于等于）
+ *        key 的个数
+ *
+ */
+int bp_simd_count_be64(
+	const unsigned char *base,
+	int                  num,
+	int                  stride,
+	uint64_t             key,
+	int                  or_equal);
+
+#endif /* _BPSIMD_H_ */
@@ -0,0 +1,1005 @@
+/**
+ * @file bpvar.c
+ * @brief 被索引项和位置信息都是变长数据的B+树
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * 每个结点是一个固定大小的页，前面是按 key 排列的偏移数组，数据项从页的末尾向前
+ * 保存在堆上：
+ *
+ * +--------------------------------------------------------------------+
+ * |header|slot_1 slot_2 ... slot_n|      free      |item_n ... item_2 item_1|
+ * +--------------------------------------------------------------------+
+ *
+ * slot 记录数据项的偏移和 key 、 value 的长度，数据项就是连续保存的 key 和 value 。
+ * 内部结点的 value 是子结点的指针， key 和定长的树一样是子树的最大值。插入和删除只
+ * 移动 slot ，删除或者覆盖的数据项留在堆上，空间不够时才整理堆。结点按使用的字节数
+ * 分裂和合并，而不是按数据项的个数。
+ *
+ * 插入时从上往下经过的内部结点如果放不下子结点分裂产生的修改就先分裂，所以子结点
+ * 分裂后父结点一定放得下新的数据项。删除后子结点的最大值变长而父结点放不下时保留原来
+ * 的值，它仍然是子树的上限，查找和删除都只要求它不小于子树里所有的 key 。
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "libbplus.h"
+
+#define BP_VAR_MIN_PAGE_SIZE 256
+#define BP_VAR_MAX_PAGE_SIZE 65536
+
+/**
+ * @brief
+ *  结点上的一个偏移数组项
+ */
+typedef struct bp_var_slot {
+	uint16_t offset; /** 数据项在结点上的偏移 */
+	uint16_t key_len; /** key 的长度 */
+	uint16_t value_len; /** value 的长度 */
+} bp_var_slot_t;
+
+/**
+ * @brief
+ *  变长数据的B+树的结点，内部结点和数据结点的格式相同
+ */
+typedef struct bp_var_node {
+	bp_node_type_e      type; /** 结点的类型 */
+	int                 key_num; /** 保存的数据项的个数 */
+	int                 heap; /** 堆的起始偏移，堆从结点的末尾向前增长 */
+	int                 garbage; /** 堆上已经删除或者被覆盖的字节数 */
+	struct bp_var_node *next; /** 数据结点的下一个数据结点 */
+	bp_var_slot_t       slots[0]; /** 按 key 排列的偏移数组 */
+} bp_var_node_t;
+
+struct bp_var_tree {
+	bp_var_node_t    *root; /** 根结点，只有一个数据结点时就是这个数据结点 */
+	bp_var_node_t    *data; /** 最左侧的数据结点 */
+	bp_var_node_t    *scratch; /** 整理和分裂结点时使用的临时结点 */
+	bp_var_node_t    *spare; /** 根结点分裂时使用的新根结点，插入之前先分配好，这样
+								 根结点分裂之后不会因为内存不足丢掉分裂出的结点 */
+	bp_var_compare_f  compare; /** 比较 key 值的函数， NULL 表示按字节序 */
+	int               page_size; /** 结点的大小 */
+	int               max_item; /** 一个数据项的 key 和 value 的最大总长度 */
+	int               reserve; /** 插入经过内部结点时至少要有的空闲字节数 */
+};
+
+struct bp_var_cursor {
+	bp_var_tree_t *tree; /** 所属的B+树 */
+	bp_var_node_t *data; /** 当前所在的数据结点， NULL 表示已经结束 */
+	int            idx; /** 下一个要返回的数据项在 data 上的下标 */
+	int            has_hi; /** 是否有查找范围的上限 */
+	int            hi_len; /** 查找范围上限的长度 */
+	unsigned char  hi[0]; /** 查找范围的上限 */
+};
+
+#define bp_var_node_key(_node, _idx) \
+	((unsigned char *)(_node) + (_node)->slots[(_idx)].offset)
+#define bp_var_node_value(_node, _idx) \
+	(bp_var_node_key((_node), (_idx)) + (_node)->slots[(_idx)].key_len)
+#define bp_var_node_item_len(_node, _idx) \
+	((_node)->slots[(_idx)].key_len + (_node)->slots[(_idx)].value_len)
+
+/**
+ * @brief 按字节序比较两个变长的 key ，前面相同时短的 key 更小
+ *
+ */
+static int bp_var_bytes_compare(
+	unsigned char *a,
+	int            a_len,
+	unsigned char *b,
+	int            b_len)
+{
+	int res;
+
+	res = memcmp(a, b, a_len < b_len ? a_len : b_len);
+	if (0 != res)
+		return res;
+
+	return a_len - b_len;
+}
+
+/**
+ * @brief 比较结点上第 idx 个 key 和 key
+ *
+ */
+static inline int bp_var_compare(
+	bp_var_tree_t *tree,
+	bp_var_node_t *node,
+	int            idx,
+	unsigned char *key,
+	int            key_len)
+{
+	if (NULL == tree->compare)
+		return bp_var_bytes_compare(bp_var_node_key(node, idx),
+									node->slots[idx].key_len, key, key_len);
+
+	return tree->compare(bp_var_node_key(node, idx), node->slots[idx].key_len,
+						 key, key_len);
+}
+
+/**
+ * @brief 在结点上查找第一个大于等于 key （ upper 为 1 时为大于 key ）的数据项
+ *
+ * @return int 数据项的下标，都小于 key 时返回 key_num
+ */
+static int bp_var_node_bound(
+	bp_var_tree_t *tree,
+	bp_var_node_t *node,
+	unsigned char *key,
+	int            key_len,
+	int            upper)
+{
+	int low;
+	int high;
+	int mid;
+	int res;
+
+	low  = 0;
+	high = node->key_num;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		res = bp_var_compare(tree, node, mid, key, key_len);
+		if (res < 0 || (upper && 0 == res))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/**
+ * @brief 返回内部结点上第 idx 个子结点
+ *
+ */
+static inline bp_var_node_t *bp_var_node_child(bp_var_node_t *node, int idx)
+{
+	bp_var_node_t *child;
+
+	memcpy(&child, bp_var_node_value(node, idx), sizeof(child));
+
+	return child;
+}
+
+/**
+ * @brief 返回结点上 slot 和堆之间连续的空闲字节数
+ *
+ */
+static inline int bp_var_node_free_len(bp_var_node_t *node)
+{
+	return node->heap - (int)sizeof(*node)
+		- node->key_num * (int)sizeof(bp_var_slot_t);
+}
+
+/**
+ * @brief 返回结点实际使用的字节数，不包括堆上已经删除的部分
+ *
+ */
+static inline int bp_var_node_used_len(bp_var_tree_t *tree, bp_var_node_t *node)
+{
+	return tree->page_size - bp_var_node_free_len(node) - node->garbage;
+}
+
+/**
+ * @brief 创建一个空结点
+ *
+ * @param tree B+树
+ * @param type 结点的类型
+ * @return bp_var_node_t* 新建的结点，失败返回 NULL
+ */
+static bp_var_node_t *bp_var_node_alloc(bp_var_tree_t *tree, bp_node_type_e type)
+{
+	bp_var_node_t *new;
+
+	new = malloc(tree->page_size);
+	if (NULL == new)
+		return NULL;
+
+	new->type    = type;
+	new->key_num = 0;
+	new->heap    = tree->page_size;
+	new->garbage = 0;
+	new->next    = NULL;
+
+	return new;
+}
+
+/**
+ * @brief 在结点上第 idx 个位置放入一个数据项，调用方保证连续的空闲空间足够
+ *
+ * @param node 结点
+ * @param idx 数据项的下标
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 位置信息
+ * @param value_len 位置信息的长度
+ */
+static void bp_var_node_put(
+	bp_var_node_t *node,
+	int            idx,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value,
+	int            value_len)
+{
+	node->heap -= key_len + value_len;
+	memcpy((unsigned char *)node + node->heap, key, key_len);
+	memcpy((unsigned char *)node + node->heap + key_len, value, value_len);
+
+	memmove(&node->slots[idx + 1], &node->slots[idx],
+			(node->key_num - idx) * sizeof(bp_var_slot_t));
+	node->slots[idx].offset    = node->heap;
+	node->slots[idx].key_len   = key_len;
+	node->slots[idx].value_len = value_len;
+	node->key_num += 1;
+}
+
+/**
+ * @brief 删除结点上第 idx 个数据项，堆上的数据留到整理时回收
+ *
+ */
+static void bp_var_node_remove(bp_var_node_t *node, int idx)
+{
+	node->garbage += bp_var_node_item_len(node, idx);
+	memmove(&node->slots[idx], &node->slots[idx + 1],
+			(node->key_num - idx - 1) * sizeof(bp_var_slot_t));
+	node->key_num -= 1;
+
+	if (0 == node->key_num) {
+		node->heap    = node->heap + node->garbage;
+		node->garbage = 0;
+	}
+}
+
+/**
+ * @brief 把 src 上从 from 开始的 num 个数据项依次追加到 dst 的最后
+ *
+ */
+static void bp_var_node_append(
+	bp_var_node_t *dst,
+	bp_var_node_t *src,
+	int            from,
+	int            num)
+{
+	int i;
+
+	for (i = from; i < from + num; i++)
+		bp_var_node_put(dst, dst->key_num, bp_var_node_key(src, i),
+						src->slots[i].key_len, bp_var_node_value(src, i),
+						src->slots[i].value_len);
+}
+
+/**
+ * @brief 用 node 上的前 num 个数据项重建 node ，回收堆上已经删除的空间
+ *
+ */
+static void bp_var_node_rebuild(bp_var_tree_t *tree, bp_var_node_t *node, int num)
+{
+	bp_var_node_t *scratch;
+
+	scratch          = tree->scratch;
+	scratch->type    = node->type;
+	scratch->key_num = 0;
+	scratch->heap    = tree->page_size;
+	scratch->garbage = 0;
+	scratch->next    = node->next;
+	bp_var_node_append(scratch, node, 0, num);
+
+	memcpy(node, scratch, tree->page_size);
+}
+
+/**
+ * @brief 保证结点上至少有 len 字节连续的空闲空间，必要时整理堆
+ *
+ * @return int 空间足够返回 1 ，否则返回 0
+ */
+static int bp_var_node_make_room(
+	bp_var_tree_t *tree,
+	bp_var_node_t *node,
+	int            len)
+{
+	if (bp_var_node_free_len(node) >= len)
+		return 1;
+
+	if (bp_var_node_free_len(node) + node->garbage < len)
+		return 0;
+
+	bp_var_node_rebuild(tree, node, node->key_num);
+
+	return 1;
+}
+
+/**
+ * @brief 把内部结点上第 idx 个 key 改为 key ，子结点不变
+ *
+ * @details
+ *  key 不能指向 node 上的数据，整理堆时它会被移动
+ *
+ * @return int 成功返回 0 ，结点上放不下时返回 -1 ，此时结点不变
+ */
+static int bp_var_node_set_key(
+	bp_var_tree_t *tree,
+	bp_var_node_t *node,
+	int            idx,
+	unsigned char *key,
+	int            key_len)
+{
+	bp_var_node_t *child;
+	unsigned char *item;
+	int            old_len;
+
+	child   = bp_var_node_child(node, idx);
+	old_len = bp_var_node_item_len(node, idx);
+	if (key_len <= node->slots[idx].key_len) {
+		// 新的 key 不更长时直接覆盖，多出来的部分算作堆上删除的空间
+		item = bp_var_node_key(node, idx);
+		memmove(item, key, key_len);
+		memcpy(item + key_len, &child, sizeof(child));
+		node->garbage           += node->slots[idx].key_len - key_len;
+		node->slots[idx].key_len = key_len;
+
+		return 0;
+	}
+
+	if (bp_var_node_free_len(node) + node->garbage + old_len
+		< key_len + (int)sizeof(child))
+		return -1;
+
+	// 原来的数据项变成堆上删除的空间，空间不够时整理堆，整理后它的长度为 0
+	node->garbage             += old_len;
+	node->slots[idx].key_len   = 0;
+	node->slots[idx].value_len = 0;
+	if (bp_var_node_free_len(node) < key_len + (int)sizeof(child))
+		bp_var_node_rebuild(tree, node, node->key_num);
+
+	node->heap -= key_len + sizeof(child);
+	item = (unsigned char *)node + node->heap;
+	memcpy(item, key, key_len);
+	memcpy(item + key_len, &child, sizeof(child));
+	node->slots[idx].offset    = node->heap;
+	node->slots[idx].key_len   = key_len;
+	node->slots[idx].value_len = sizeof(child);
+
+	return 0;
+}
+
+/**
+ * @brief 按使用的字节数把结点分成两半，分裂完后 node 保存前半部分， pp_new 保存
+ *        后半部分
+ *
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_var_node_split(
+	bp_var_tree_t  *tree,
+	bp_var_node_t  *node,
+	bp_var_node_t **pp_new)
+{
+	bp_var_node_t *new;
+	int            total;
+	int            half;
+	int            i;
+
+	new = bp_var_node_alloc(tree, node->type);
+	if (NULL == new)
+		return -1;
+
+	total = 0;
+	for (i = 0; i < node->key_num; i++)
+		total += bp_var_node_item_len(node, i) + sizeof(bp_var_slot_t);
+
+	// 两边都至少保留一个数据项
+	half = 0;
+	for (i = 0; i < node->key_num - 1; i++) {
+		half += bp_var_node_item_len(node, i) + sizeof(bp_var_slot_t);
+		if (2 * half >= total)
+			break;
+	}
+	i = i + 1 < node->key_num ? i + 1 : node->key_num - 1;
+	i = i > 0 ? i : 1;
+
+	bp_var_node_append(new, node, i, node->key_num - i);
+	new->next  = node->next;
+	node->next = new;
+	bp_var_node_rebuild(tree, node, i);
+
+	*pp_new = new;
+
+	return 0;
+}
+
+/**
+ * @brief 结点分裂后选择 key 应该插入的那一半，和单个结点时的插入位置一致：插入到
+ *        第一个大于 key 的数据项的位置
+ *
+ */
+static bp_var_node_t *bp_var_node_pick(
+	bp_var_tree_t *tree,
+	bp_var_node_t *left,
+	bp_var_node_t *right,
+	unsigned char *key,
+	int            key_len)
+{
+	if (bp_var_compare(tree, left, left->key_num - 1, key, key_len) <= 0)
+		return right;
+
+	return left;
+}
+
+static int bp_var_node_insert(
+	bp_var_tree_t  *tree,
+	bp_var_node_t  *node,
+	unsigned char  *key,
+	int             key_len,
+	unsigned char  *value,
+	int             value_len,
+	bp_var_node_t **pp_new);
+
+/**
+ * @brief 内部结点插入数据
+ *
+ * @details
+ *  子树插入失败时子结点可能已经分裂，分裂出的结点仍然要链接到这个结点上，否则
+ *  它上面的数据就丢了
+ *
+ * @param tree B+树
+ * @param node 内部结点
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 位置信息
+ * @param value_len 位置信息的长度
+ * @param pp_new 内部结点分裂时用于输出分裂出的结点，失败时也可能不为 NULL
+ * @return int 0 成功 -1 失败
+ */
+static int bp_var_inner_insert(
+	bp_var_tree_t  *tree,
+	bp_var_node_t  *node,
+	unsigned char  *key,
+	int             key_len,
+	unsigned char  *value,
+	int             value_len,
+	bp_var_node_t **pp_new)
+{
+	bp_var_node_t *child;
+	bp_var_node_t *split;
+	int            idx;
+	int            ret;
+
+	// 先保证子结点分裂时这个结点上放得下修改，再往下插入
+	if (!bp_var_node_make_room(tree, node, tree->reserve)) {
+		if (-1 == bp_var_node_split(tree, node, pp_new))
+			return -1;
+
+		node = bp_var_node_pick(tree, node, *pp_new, key, key_len);
+		bp_var_node_make_room(tree, node, tree->reserve);
+	}
+
+	// 相同的 key 值新数据放在旧数据的后面，所以插入到第一个最大值大于 key 的子树。
+	// 比所有 key 都大时插入最右侧的子树并更新它的最大值
+	idx = bp_var_node_bound(tree, node, key, key_len, 1);
+	if (idx == node->key_num) {
+		idx -= 1;
+		if (bp_var_compare(tree, node, idx, key, key_len) < 0)
+			bp_var_node_set_key(tree, node, idx, key, key_len);
+	}
+
+	child = bp_var_node_child(node, idx);
+	ret   = bp_var_node_insert(tree, child, key, key_len, value, value_len,
+							   &split);
+	if (NULL == split)
+		return ret;
+
+	bp_var_node_set_key(tree, node, idx,
+						bp_var_node_key(child, child->key_num - 1),
+						child->slots[child->key_num - 1].key_len);
+	bp_var_node_put(node, idx + 1, bp_var_node_key(split, split->key_num - 1),
+					split->slots[split->key_num - 1].key_len,
+					(unsigned char *)&split, sizeof(split));
+
+	return ret;
+}
+
+/**
+ * @brief 向结点及其子树插入数据
+ *
+ * @param tree B+树
+ * @param node 内部结点或者数据结点
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 位置信息
+ * @param value_len 位置信息的长度
+ * @param pp_new 结点分裂时用于输出分裂出的结点，失败时也可能不为 NULL ，调用方
+ *               都要把它链接到树上
+ * @return int 0 成功 -1 失败
+ */
+static int bp_var_node_insert(
+	bp_var_tree_t  *tree,
+	bp_var_node_t  *node,
+	unsigned char  *key,
+	int             key_len,
+	unsigned char  *value,
+	int             value_len,
+	bp_var_node_t **pp_new)
+{
+	int len;
+	int idx;
+
+	*pp_new = NULL;
+	if (BP_NODE_TYPE_INNER == node->type)
+		return bp_var_inner_insert(tree, node, key, key_len, value, value_len,
+								   pp_new);
+
+	len = key_len + value_len + sizeof(bp_var_slot_t);
+	if (!bp_var_node_make_room(tree, node, len)) {
+		if (-1 == bp_var_node_split(tree, node, pp_new))
+			return -1;
+
+		node = bp_var_node_pick(tree, node, *pp_new, key, key_len);
+		bp_var_node_make_room(tree, node, len);
+	}
+
+	// 相同的 key 值新数据放在旧数据的后面
+	idx = bp_var_node_bound(tree, node, key, key_len, 1);
+	bp_var_node_put(node, idx, key, key_len, value, value_len);
+
+	return 0;
+}
+
+/**
+ * @brief 创建一棵变长数据的B+树
+ *
+ * @details
+ *  一个数据项的 key 和 value 总长度最多约为 page_size 的八分之一，这样分裂后的每个
+ *  结点都还放得下几个最长的数据项
+ *
+ * @param page_size 结点的大小，取值为 256 到 65536
+ * @param compare 比较 key 值的函数， NULL 表示按字节序比较，前面相同时短的 key 更小
+ * @return bp_var_tree_t* 创建的B+树，参数错误或者内存不足时返回 NULL
+ */
+bp_var_tree_t *bp_create_var_tree(int page_size, bp_var_compare_f compare)
+{
+	bp_var_tree_t *new;
+	int            entry_len;
+
+	if (page_size < BP_VAR_MIN_PAGE_SIZE || page_size > BP_VAR_MAX_PAGE_SIZE)
+		return NULL;
+
+	new = malloc(sizeof(*new));
+	if (NULL == new)
+		return NULL;
+
+	memset(new, 0, sizeof(*new));
+	new->page_size = page_size;
+	new->compare   = compare;
+
+	// 内部结点上一个数据项还要保存子结点的指针和 slot ，经过内部结点的插入最多
+	// 修改两个 key 并增加一个数据项
+	entry_len     = (page_size - (int)sizeof(bp_var_node_t)) / 8;
+	new->max_item = entry_len - sizeof(bp_var_node_t *) - sizeof(bp_var_slot_t);
+	new->reserve  = 3 * entry_len;
+
+	new->scratch = bp_var_node_alloc(new, BP_NODE_TYPE_DATA);
+	new->data    = bp_var_node_alloc(new, BP_NODE_TYPE_DATA);
+	if (NULL == new->scratch || NULL == new->data) {
+		free(new->scratch);
+		free(new->data);
+		free(new);
+
+		return NULL;
+	}
+	new->root = new->data;
+
+	return new;
+}
+
+/**
+ * @brief 释放结点及其子树
+ *
+ */
+static void bp_var_node_destroy(bp_var_node_t *node)
+{
+	int i;
+
+	if (BP_NODE_TYPE_INNER == node->type)
+		for (i = 0; i < node->key_num; i++)
+			bp_var_node_destroy(bp_var_node_child(node, i));
+
+	free(node);
+}
+
+/**
+ * @brief 释放变长数据的B+树
+ *
+ * @param tree B+树
+ */
+void bp_destroy_var_tree(bp_var_tree_t *tree)
+{
+	bp_var_node_destroy(tree->root);
+	free(tree->scratch);
+	free(tree->spare);
+	free(tree);
+}
+
+/**
+ * @brief 向变长数据的B+树中插入一个被索引项及其位置信息
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 位置信息
+ * @param value_len 位置信息的长度
+ * @return int 成功返回 0 ，长度超过限制或者内存不足时返回 -1
+ */
+int bp_var_insert(
+	bp_var_tree_t *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value,
+	int            value_len)
+{
+	bp_var_node_t *root;
+	bp_var_node_t *split;
+	bp_var_node_t *children[2];
+	int            ret;
+	int            i;
+
+	if (key_len < 0 || value_len < 0 || key_len + value_len > tree->max_item)
+		return -1;
+
+	if (NULL == tree->spare) {
+		tree->spare = bp_var_node_alloc(tree, BP_NODE_TYPE_INNER);
+		if (NULL == tree->spare)
+			return -1;
+	}
+
+	ret = bp_var_node_insert(tree, tree->root, key, key_len, value, value_len,
+							 &split);
+	if (NULL == split)
+		return ret;
+
+	// 根结点分裂时树长高一层，新的根结点保存两个子结点的最大值
+	root        = tree->spare;
+	tree->spare = NULL;
+
+	children[0] = tree->root;
+	children[1] = split;
+	for (i = 0; i < 2; i++)
+		bp_var_node_put(root, i,
+						bp_var_node_key(children[i], children[i]->key_num - 1),
+						children[i]->slots[children[i]->key_num - 1].key_len,
+						(unsigned char *)&children[i], sizeof(children[i]));
+	tree->root = root;
+
+	return ret;
+}
+
+/**
+ * @brief 查找被索引项可能所在的第一个数据结点
+ *
+ * @return bp_var_node_t* 数据结点， key 比树上所有的数据都大时返回 NULL
+ */
+static bp_var_node_t *bp_var_find_data_node(
+	bp_var_tree_t *tree,
+	unsigned char *key,
+	int            key_len)
+{
+	bp_var_node_t *node;
+	int            idx;
+
+	node = tree->root;
+	while (BP_NODE_TYPE_INNER == node->type) {
+		idx = bp_var_node_bound(tree, node, key, key_len, 0);
+		if (idx == node->key_num)
+			return NULL;
+
+		node = bp_var_node_child(node, idx);
+	}
+
+	return node;
+}
+
+/**
+ * @brief 在结点及其子树中查找被索引项的第一个数据项
+ *
+ * @details
+ *  子树的最大值等于 key 时，后面插入的相同 key 可能在下一个子树中
+ *
+ * @param tree B+树
+ * @param node 内部结点或者数据结点
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param found_idx 找到时用于输出数据项在数据结点上的下标
+ * @return bp_var_node_t* 数据项所在的数据结点，没找到返回 NULL
+ */
+static bp_var_node_t *bp_var_node_find(
+	bp_var_tree_t *tree,
+	bp_var_node_t *node,
+	unsigned char *key,
+	int            key_len,
+	int           *found_idx)
+{
+	bp_var_node_t *data;
+	int            idx;
+
+	idx = bp_var_node_bound(tree, node, key, key_len, 0);
+	if (BP_NODE_TYPE_DATA == node->type) {
+		if (idx == node->key_num
+			|| 0 != bp_var_compare(tree, node, idx, key, key_len))
+			return NULL;
+
+		*found_idx = idx;
+
+		return node;
+	}
+
+	for (; idx < node->key_num; idx++) {
+		data = bp_var_node_find(tree, bp_var_node_child(node, idx), key, key_len,
+								found_idx);
+		if (data)
+			return data;
+
+		if (0 != bp_var_compare(tree, node, idx, key, key_len))
+			return NULL;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief 查找被索引项的第一个位置信息
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value_out 用于输出位置信息，最多输出 value_buf_len 字节
+ * @param value_buf_len value_out 的长度
+ * @param value_len 用于输出位置信息实际的长度，可以为 NULL
+ * @return int 找到返回 1 ，否则返回 0
+ */
+int bp_var_search(
+	bp_var_tree_t *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value_out,
+	int            value_buf_len,
+	int           *value_len)
+{
+	bp_var_node_t *data;
+	int            idx;
+	int            len;
+
+	data = bp_var_node_find(tree, tree->root, key, key_len, &idx);
+	if (NULL == data)
+		return 0;
+
+	len = data->slots[idx].value_len;
+	memcpy(value_out, bp_var_node_value(data, idx),
+		   len < value_buf_len ? len : value_buf_len);
+	if (value_len)
+		*value_len = len;
+
+	return 1;
+}
+
+/**
+ * @brief 合并 node 上 idx 和 idx + 1 两个相邻的子结点，释放右边的子结点
+ *
+ * @details
+ *  合并后左边子结点的最大值就是右边子结点的最大值，删除左边子结点的数据项并让右边
+ *  子结点的数据项指向左边子结点，这样不需要修改变长的 key
+ */
+static void bp_var_node_merge_child(
+	bp_var_tree_t *tree,
+	bp_var_node_t *node,
+	int            idx)
+{
+	bp_var_node_t *left;
+	bp_var_node_t *right;
+
+	left  = bp_var_node_child(node, idx);
+	right = bp_var_node_child(node, idx + 1);
+	bp_var_node_make_room(tree, left, bp_var_node_used_len(tree, right)
+						  - (int)sizeof(bp_var_node_t));
+	bp_var_node_append(left, right, 0, right->key_num);
+	left->next = right->next;
+
+	memcpy(bp_var_node_value(node, idx + 1), &left, sizeof(left));
+	bp_var_node_remove(node, idx);
+
+	free(right);
+}
+
+/**
+ * @brief 从结点及其子树中删除一个被索引项
+ *
+ * @details
+ *  和定长的树一样，相同的被索引项可能跨越多个子树。子结点使用的字节数少于结点的
+ *  四分之一时，如果和相邻的兄弟结点放得下就合并
+ *
+ * @param tree B+树
+ * @param node 内部结点或者数据结点
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @return int 删除了返回 1 ，没找到返回 0
+ */
+static int bp_var_node_delete(
+	bp_var_tree_t *tree,
+	bp_var_node_t *node,
+	unsigned char *key,
+	int            key_len)
+{
+	bp_var_node_t *child;
+	bp_var_node_t *sibling;
+	int            left_idx;
+	int            idx;
+
+	child = NULL;
+	idx   = bp_var_node_bound(tree, node, key, key_len, 0);
+	if (BP_NODE_TYPE_DATA == node->type) {
+		if (idx == node->key_num
+			|| 0 != bp_var_compare(tree, node, idx, key, key_len))
+			return 0;
+
+		bp_var_node_remove(node, idx);
+
+		return 1;
+	}
+
+	for (; idx < node->key_num; idx++) {
+		child = bp_var_node_child(node, idx);
+		if (bp_var_node_delete(tree, child, key, key_len))
+			break;
+
+		if (0 != bp_var_compare(tree, node, idx, key, key_len))
+			return 0;
+	}
+
+	if (idx == node->key_num)
+		return 0;
+
+	// 放不下更长的最大值时保留原来的值作为子树的上限，空结点同样保留原来的值
+	if (child->key_num > 0)
+		bp_var_node_set_key(tree, node, idx,
+							bp_var_node_key(child, child->key_num - 1),
+							child->slots[child->key_num - 1].key_len);
+
+	if (node->key_num < 2
+		|| 4 * bp_var_node_used_len(tree, child) >= tree->page_size)
+		return 1;
+
+	left_idx = idx > 0 ? idx - 1 : idx;
+	sibling  = bp_var_node_child(node, idx > 0 ? idx - 1 : idx + 1);
+	if (bp_var_node_used_len(tree, child) + bp_var_node_used_len(tree, sibling)
+		- (int)sizeof(bp_var_node_t) <= tree->page_size)
+		bp_var_node_merge_child(tree, node, left_idx);
+
+	return 1;
+}
+
+/**
+ * @brief 从变长数据的B+树中删除被索引项的第一个数据项
+ *
+ * @param tree B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @return int 删除了返回 1 ，没找到返回 0
+ */
+int bp_var_delete(
+	bp_var_tree_t *tree,
+	unsigned char *key,
+	int            key_len)
+{
+	bp_var_node_t *root;
+
+	if (0 == bp_var_node_delete(tree, tree->root, key, key_len))
+		return 0;
+
+	// 根结点只剩下一个子结点时树的高度减一
+	root = tree->root;
+	while (BP_NODE_TYPE_INNER == root->type && 1 == root->key_num) {
+		tree->root = bp_var_node_child(root, 0);
+		free(root);
+		root = tree->root;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief 打开一个按顺序访问 [lo, hi] 范围内数据项的游标
+ *
+ * @details
+ *  游标返回的 key 和 value 指向结点内部，插入和删除会使已经打开的游标失效
+ *
+ * @param tree B+树
+ * @param lo 查找范围的下限， NULL 表示从最小的数据开始
+ * @param lo_len 下限的长度
+ * @param hi 查找范围的上限， NULL 表示一直到最大的数据
+ * @param hi_len 上限的长度
+ * @return bp_var_cursor_t* 游标，内存不足时返回 NULL
+ */
+bp_var_cursor_t *bp_var_cursor_open(
+	bp_var_tree_t *tree,
+	unsigned char *lo,
+	int            lo_len,
+	unsigned char *hi,
+	int            hi_len)
+{
+	bp_var_cursor_t *new;
+
+	new = malloc(sizeof(*new) + (hi ? hi_len : 0));
+	if (NULL == new)
+		return NULL;
+
+	new->tree   = tree;
+	new->data   = tree->data;
+	new->idx    = 0;
+	new->has_hi = NULL != hi;
+	new->hi_len = hi ? hi_len : 0;
+	if (hi)
+		memcpy(new->hi, hi, hi_len);
+
+	if (lo) {
+		new->data = bp_var_find_data_node(tree, lo, lo_len);
+		if (new->data)
+			new->idx = bp_var_node_bound(tree, new->data, lo, lo_len, 0);
+	}
+
+	return new;
+}
+
+/**
+ * @brief 返回游标指向的数据项并移动到下一个数据项
+ *
+ * @param cursor 游标
+ * @param key 用于输出被索引项
+ * @param key_len 用于输出被索引项的长度
+ * @param value 用于输出位置信息
+ * @param value_len 用于输出位置信息的长度
+ * @return int 有数据返回 1 ，已经没有数据返回 0
+ */
+int bp_var_cursor_next(
+	bp_var_cursor_t  *cursor,
+	unsigned char   **key,
+	int              *key_len,
+	unsigned char   **value,
+	int              *value_len)
+{
+	bp_var_node_t *data;
+
+	while (cursor->data && cursor->idx == cursor->data->key_num) {
+		cursor->data = cursor->data->next;
+		cursor->idx  = 0;
+	}
+
+	data = cursor->data;
+	if (NULL == data)
+		return 0;
+
+	if (cursor->has_hi
+		&& 0 < bp_var_compare(cursor->tree, data, cursor->idx, cursor->hi,
+							  cursor->hi_len)) {
+		cursor->data = NULL;
+
+		return 0;
+	}
+
+	*key       = bp_var_node_key(data, cursor->idx);
+	*key_len   = data->slots[cursor->idx].key_len;
+	*value     = bp_var_node_value(data, cursor->idx);
+	*value_len = data->slots[cursor->idx].value_len;
+	cursor->idx += 1;
+
+	return 1;
+}
+
+/**
+ * @brief 关闭游标
+ *
+ * @param cursor 游标
+ */
+void bp_var_cursor_close(bp_var_cursor_t *cursor)
+{
+	free(cursor);
+}
@@ -0,0 +1,848 @@
+/**
+ * @file bpwal.c
+ * @brief 修改先写入日志的持久化B+树
+ * @version 0.1
+ * @date 2026-10-14
+ *
+ * 数据保存在两个文件中： checkpoint 文件是 bp_save_tree 保存的整棵树，日志文件按顺序
+ * 记录 checkpoint 之后的每个插入和删除。打开时先读入 checkpoint ，再重放日志。
+ *
+ * 写操作在锁内修改树并把日志追加到缓冲区，然后等待日志持久化。第一个等待的线程成为
+ * leader ，在锁外把缓冲区中所有线程的日志一次写入文件并 fdatasync ，期间其它线程的
+ * 日志追加到另一个缓冲区，等 leader 完成之后由其中一个线程把它们一起写入：
+ *
+ *   A: append -- write [A] + fdatasync ----------------------> 返回
+ *   B:    append -- wait ---------- write [B C D] + fdatasync -> 返回
+ *   C:       append -- wait --------------------------------> 返回
+ *   D:          append -- wait -----------------------------> 返回
+ *
+ * 一次 fdatasync 的代价由同时写入的所有线程分摊。
+ *
+ * checkpoint 文件和日志文件头都记录了版本号，日志只有在版本号和 checkpoint 相同时才
+ * 会被重放。 checkpoint 先写入新版本号的 checkpoint 文件，再换成新版本号的空日志，
+ * 两步之间崩溃时旧的日志因为版本号不同被丢弃，它的内容已经在新的 checkpoint 中了。
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "libbplus.h"
+
+#define BP_WAL_VERSION 1
+
+/**
+ * @brief 重放日志时一次读入的日志条数
+ */
+#define BP_WAL_REPLAY_NUM 256
+
+static const unsigned char bp_wal_magic[8] = {'B', 'P', 'L', 'U', 'S', 'W', 'A', 'L'};
+
+/**
+ * @brief 日志记录的操作
+ *
+ */
+typedef enum bp_wal_op {
+	BP_WAL_INSERT       = 1, /** 插入 */
+	BP_WAL_DELETE       = 2, /** 删除位置信息相同的数据项 */
+	BP_WAL_DELETE_FIRST = 3, /** 删除被索引项的第一个数据项，即 value 为 NULL 的 bp_delete */
+} bp_wal_op_e;
+
+/**
+ * @brief
+ *  日志文件开头的文件头
+ */
+typedef struct bp_wal_header {
+	unsigned char magic[8]; /** 魔数 */
+	uint32_t      version; /** 日志格式的版本 */
+	uint32_t      generation; /** 日志所基于的 checkpoint 的版本号 */
+	uint32_t      key_size; /** 被索引项的大小 */
+	uint32_t      value_size; /** 位置信息的大小 */
+} bp_wal_header_t;
+
+/**
+ * @brief
+ *  一条日志，所有日志的大小相同，数据按 4 字节补齐
+ *
+ * @details
+ *  校验和覆盖 op 和之后的数据，并且混入了日志的版本号。崩溃时写到一半的日志校验失败，
+ *  重放到这里为止
+ */
+typedef struct bp_wal_record {
+	uint32_t      checksum; /** 校验和 */
+	uint32_t      op; /** bp_wal_op_e */
+	unsigned char data[0]; /** 被索引项和位置信息，删除所有数据项时位置信息为 0 */
+} bp_wal_record_t;
+
+struct bp_durable_tree {
+	pthread_mutex_t  lock; /** 保护树、日志缓冲区和提交状态 */
+	pthread_cond_t   cond; /** 一次写入完成后广播 */
+	bp_tree_t       *tree; /** 内存中的B+树 */
+	char            *path; /** checkpoint 文件路径 */
+	char            *wal_path; /** 日志文件路径 */
+	char            *tmp_path; /** 写入 checkpoint 和新日志时使用的临时文件路径 */
+	int              fd; /** 日志文件描述符 */
+	int              record_size; /** 一条日志的大小 */
+	uint32_t         generation; /** 当前 checkpoint 的版本号 */
+	unsigned char   *buffer; /** 正在追加的日志 */
+	int              buffer_len; /** buffer 中日志的长度 */
+	int              buffer_cap; /** buffer 的容量 */
+	unsigned char   *spare; /** leader 正在写入文件的日志 */
+	int              spare_cap; /** spare 的容量 */
+	uint64_t         appended; /** 已经追加的日志条数 */
+	uint64_t         durable; /** 已经持久化的日志条数 */
+	int              flushing; /** 是否有 leader 正在写入 */
+	int              failed; /** 写入失败之后不再接受写操作 */
+	uint64_t         wal_size; /** 日志文件的大小 */
+	uint64_t         wal_limit; /** 自动 checkpoint 的日志大小， 0 表示不自动 */
+};
+
+/**
+ * @brief 计算日志的校验和
+ *
+ * @param generation 日志的版本号
+ * @param data 数据
+ * @param len 数据长度
+ * @return uint32_t 校验和
+ */
+static uint32_t bp_wal_checksum(uint32_t generation, unsigned char *data, int len)
+{
+	uint32_t hash;
+	int      i;
+
+	// FNV-1a
+	hash = 2166136261u ^ generation;
+	for (i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief 在 path 后面加上后缀
+ *
+ * @param path 文件路径
+ * @param suffix 后缀
+ * @return char* 新的路径，内存不足返回 NULL
+ */
+static char *bp_wal_path(const char *path, const char *suffix)
+{
+	char *new;
+
+	new = malloc(strlen(path) + strlen(suffix) + 1);
+	if (NULL == new)
+		return NULL;
+
+	strcpy(new, path);
+	strcat(new, suffix);
+
+	return new;
+}
+
+/**
+ * @brief 把文件的内容刷到磁盘
+ *
+ * @param path 文件路径
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_wal_sync_file(const char *path)
+{
+	int ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd)
+		return -1;
+
+	ret = 0 == fsync(fd) ? 0 : -1;
+	close(fd);
+
+	return ret;
+}
+
+/**
+ * @brief 把文件所在的目录刷到磁盘，使 rename 和新建文件持久化
+ *
+ * @param path 文件路径
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_wal_sync_dir(const char *path)
+{
+	char *dir;
+	char *slash;
+	int   ret;
+
+	dir = bp_wal_path(path, "");
+	if (NULL == dir)
+		return -1;
+
+	slash = strrchr(dir, '/');
+	if (NULL == slash)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		dir[1] = '\0';
+	else
+		*slash = '\0';
+
+	ret = bp_wal_sync_file(dir);
+	free(dir);
+
+	return ret;
+}
+
+/**
+ * @brief 把数据全部写入文件
+ *
+ * @param fd 文件描述符
+ * @param data 数据
+ * @param len 数据长度
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_wal_write(int fd, unsigned char *data, int len)
+{
+	ssize_t num;
+
+	while (len > 0) {
+		num = write(fd, data, len);
+		if (num < 0 && EINTR == errno)
+			continue;
+
+		if (num <= 0)
+			return -1;
+
+		data += num;
+		len  -= num;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief 创建只有文件头的日志文件，替换已经存在的日志文件
+ *
+ * @details
+ *  新日志先写到临时文件再 rename ，日志文件路径上总是一个完整的日志
+ *
+ * @param tree 持久化B+树
+ * @param generation 日志的版本号
+ * @return int 新日志的文件描述符，失败返回 -1
+ */
+static int bp_wal_create(bp_durable_tree_t *tree, uint32_t generation)
+{
+	bp_wal_header_t header;
+	int             fd;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, bp_wal_magic, sizeof(bp_wal_magic));
+	header.version    = BP_WAL_VERSION;
+	header.generation = generation;
+	header.key_size   = tree->tree->key_size;
+	header.value_size = tree->tree->value_size;
+
+	fd = open(tree->tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (-1 == fd)
+		return -1;
+
+	if (-1 == bp_wal_write(fd, (unsigned char *)&header, sizeof(header))
+		|| 0 != fdatasync(fd)
+		|| 0 != rename(tree->tmp_path, tree->wal_path)
+		|| -1 == bp_wal_sync_dir(tree->wal_path)) {
+		close(fd);
+		unlink(tree->tmp_path);
+
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * @brief 把一条日志应用到树上
+ *
+ * @param tree 持久化B+树
+ * @param record 日志
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_wal_apply(bp_durable_tree_t *tree, bp_wal_record_t *record)
+{
+	bp_tree_t *bp_tree;
+
+	bp_tree = tree->tree;
+	switch (record->op) {
+	case BP_WAL_INSERT:
+		return bp_insert(bp_tree, record->data, bp_tree->key_size,
+						 record->data + bp_tree->key_size, bp_tree->value_size);
+	case BP_WAL_DELETE:
+		return -1 == bp_delete(bp_tree, record->data, bp_tree->key_size,
+							   record->data + bp_tree->key_size) ? -1 : 0;
+	case BP_WAL_DELETE_FIRST:
+		return -1 == bp_delete(bp_tree, record->data, bp_tree->key_size, NULL)
+			? -1 : 0;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * @brief 重放日志文件中的日志，截掉末尾不完整的日志
+ *
+ * @param tree 持久化B+树
+ * @param fd 日志文件描述符
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_wal_replay(bp_durable_tree_t *tree, int fd)
+{
+	bp_wal_record_t *record;
+	unsigned char   *buf;
+	ssize_t          len;
+	off_t            offset;
+	int              valid;
+	int              num;
+	int              i;
+
+	buf = malloc(BP_WAL_REPLAY_NUM * tree->record_size);
+	if (NULL == buf)
+		return -1;
+
+	offset = sizeof(bp_wal_header_t);
+	valid  = 1;
+	while (valid) {
+		len = pread(fd, buf, BP_WAL_REPLAY_NUM * tree->record_size, offset);
+		if (len < 0) {
+			free(buf);
+
+			return -1;
+		}
+
+		num = len / tree->record_size;
+		for (i = 0; valid && i < num; i++) {
+			record = (bp_wal_record_t *)(buf + i * tree->record_size);
+			valid  = record->checksum == bp_wal_checksum(
+				tree->generation, (unsigned char *)&record->op,
+				tree->record_size - sizeof(record->checksum));
+			if (!valid)
+				break;
+
+			if (-1 == bp_wal_apply(tree, record)) {
+				free(buf);
+
+				return -1;
+			}
+			offset += tree->record_size;
+		}
+
+		if (num < BP_WAL_REPLAY_NUM)
+			valid = 0;
+	}
+	free(buf);
+
+	// 之后的日志追加在最后一条完整的日志后面
+	if (0 != ftruncate(fd, offset) || 0 != fdatasync(fd))
+		return -1;
+
+	tree->wal_size = offset;
+
+	return 0;
+}
+
+/**
+ * @brief 打开日志文件并重放，日志文件不存在或者已经过期时创建新的日志文件
+ *
+ * @param tree 持久化B+树， checkpoint 已经读入
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_wal_recover(bp_durable_tree_t *tree)
+{
+	bp_wal_header_t header;
+	int             fd;
+
+	fd = open(tree->wal_path, O_RDWR | O_APPEND);
+	if (-1 == fd && ENOENT != errno)
+		return -1;
+
+	if (-1 != fd) {
+		if (sizeof(header) != pread(fd, &header, sizeof(header), 0)
+			|| 0 != memcmp(header.magic, bp_wal_magic, sizeof(bp_wal_magic))
+			|| BP_WAL_VERSION != header.version
+			|| (uint32_t)tree->tree->key_size != header.key_size
+			|| (uint32_t)tree->tree->value_size != header.value_size
+			|| header.generation > tree->generation) {
+			close(fd);
+
+			return -1;
+		}
+
+		if (header.generation == tree->generation) {
+			tree->fd = fd;
+
+			return bp_wal_replay(tree, fd);
+		}
+
+		// checkpoint 完成之后没来得及换掉的日志，内容已经在 checkpoint 中了
+		close(fd);
+	}
+
+	tree->fd = bp_wal_create(tree, tree->generation);
+	if (-1 == tree->fd)
+		return -1;
+
+	tree->wal_size = sizeof(header);
+
+	return 0;
+}
+
+/**
+ * @brief 打开持久化B+树，读入 checkpoint 后重放日志
+ *
+ * @param path checkpoint 文件路径，日志文件为 path.wal
+ * @param max_idx_num 内部结点的包含的被索引项的最大个数
+ * @param max_data_num 叶子结点中包含被索引项及其位置信息的最大个数
+ * @param key_size 被索引项的数据长度
+ * @param value_size 位置信息的数据长度
+ * @param compare 比较 key 值的函数， NULL 表示使用 memcmp
+ * @param wal_limit 日志文件超过这个大小时自动 checkpoint ， 0 表示只手动 checkpoint
+ * @return bp_durable_tree_t* 持久化B+树，文件无效或者打开失败返回 NULL
+ */
+bp_durable_tree_t *bp_open_durable(
+	const char   *path,
+	int           max_idx_num,
+	int           max_data_num,
+	int           key_size,
+	int           value_size,
+	bp_compare_f  compare,
+	uint64_t      wal_limit)
+{
+	bp_durable_tree_t *new;
+
+	new = malloc(sizeof(*new));
+	if (NULL == new)
+		return NULL;
+
+	memset(new, 0, sizeof(*new));
+	new->fd          = -1;
+	new->wal_limit   = wal_limit;
+	new->record_size = sizeof(bp_wal_record_t)
+		+ ((key_size + value_size + 3) & ~3);
+	new->path        = bp_wal_path(path, "");
+	new->wal_path    = bp_wal_path(path, ".wal");
+	new->tmp_path    = bp_wal_path(path, ".tmp");
+	if (NULL == new->path || NULL == new->wal_path || NULL == new->tmp_path)
+		goto fail;
+
+	if (0 == access(path, F_OK))
+		new->tree = bp_load_tree(path, max_idx_num, max_data_num, key_size,
+								 value_size, compare, &new->generation);
+	else if (ENOENT == errno)
+		new->tree = bp_create_tree(max_idx_num, max_data_num, key_size,
+								   value_size, compare);
+	if (NULL == new->tree || -1 == bp_wal_recover(new))
+		goto fail;
+
+	pthread_mutex_init(&new->lock, NULL);
+	pthread_cond_init(&new->cond, NULL);
+
+	return new;
+
+fail:
+	if (-1 != new->fd)
+		close(new->fd);
+	if (new->tree)
+		bp_destroy_tree(new->tree);
+	free(new->path);
+	free(new->wal_path);
+	free(new->tmp_path);
+	free(new);
+
+	return NULL;
+}
+
+/**
+ * @brief 保证日志缓冲区还能追加 num 条日志，调用时持有锁
+ *
+ * @details
+ *  在修改树之前调用，修改树之后追加日志不会再失败
+ *
+ * @param tree 持久化B+树
+ * @param num 日志条数
+ * @return int 成功返回 0 ，写入已经失败或者内存不足返回 -1
+ */
+static int bp_wal_reserve(bp_durable_tree_t *tree, int num)
+{
+	unsigned char *buffer;
+	int            cap;
+
+	if (tree->failed)
+		return -1;
+
+	if (tree->buffer_len + num * tree->record_size <= tree->buffer_cap)
+		return 0;
+
+	for (cap = tree->buffer_cap ? tree->buffer_cap : 64 * tree->record_size;
+		 cap < tree->buffer_len + num * tree->record_size; cap *= 2)
+		;
+
+	buffer = realloc(tree->buffer, cap);
+	if (NULL == buffer)
+		return -1;
+
+	tree->buffer     = buffer;
+	tree->buffer_cap = cap;
+
+	return 0;
+}
+
+/**
+ * @brief 追加一条日志，调用时持有锁并且已经 bp_wal_reserve
+ *
+ * @param tree 持久化B+树
+ * @param op 操作
+ * @param key 被索引项
+ * @param value 位置信息， NULL 表示全为 0
+ */
+static void bp_wal_append(
+	bp_durable_tree_t *tree,
+	bp_wal_op_e        op,
+	unsigned char     *key,
+	unsigned char     *value)
+{
+	bp_wal_record_t *record;
+	int              key_size;
+	int              value_size;
+
+	key_size   = tree->tree->key_size;
+	value_size = tree->tree->value_size;
+	record     = (bp_wal_record_t *)(tree->buffer + tree->buffer_len);
+	record->op = op;
+	memset(record->data, 0, tree->record_size - sizeof(*record));
+	memcpy(record->data, key, key_size);
+	if (value)
+		memcpy(record->data + key_size, value, value_size);
+
+	record->checksum = bp_wal_checksum(tree->generation,
+									   (unsigned char *)&record->op,
+									   tree->record_size
+									   - sizeof(record->checksum));
+	tree->buffer_len += tree->record_size;
+	tree->appended   += 1;
+}
+
+/**
+ * @brief 等待前 lsn 条日志持久化，调用时持有锁
+ *
+ * @details
+ *  没有 leader 时当前线程成为 leader ，交换两个缓冲区后在锁外写入文件，写入期间其它
+ *  线程可以继续追加日志
+ *
+ * @param tree 持久化B+树
+ * @param lsn 日志条数
+ * @return int 成功返回 0 ，写入失败返回 -1
+ */
+static int bp_wal_commit(bp_durable_tree_t *tree, uint64_t lsn)
+{
+	unsigned char *data;
+	uint64_t       upto;
+	int            len;
+	int            cap;
+	int            ret;
+
+	while (!tree->failed && tree->durable < lsn) {
+		if (tree->flushing) {
+			pthread_cond_wait(&tree->cond, &tree->lock);
+
+			continue;
+		}
+
+		data = tree->buffer;
+		len  = tree->buffer_len;
+		cap  = tree->buffer_cap;
+		upto = tree->appended;
+		tree->buffer     = tree->spare;
+		tree->buffer_cap = tree->spare_cap;
+		tree->buffer_len = 0;
+		tree->spare      = data;
+		tree->spare_cap  = cap;
+		tree->flushing   = 1;
+		pthread_mutex_unlock(&tree->lock);
+
+		ret = bp_wal_write(tree->fd, data, len);
+		if (0 == ret && 0 != fdatasync(tree->fd))
+			ret = -1;
+
+		pthread_mutex_lock(&tree->lock);
+		tree->flushing = 0;
+		if (0 == ret) {
+			tree->durable   = upto;
+			tree->wal_size += len;
+		} else {
+			tree->failed = 1;
+		}
+		pthread_cond_broadcast(&tree->cond);
+	}
+
+	return tree->durable >= lsn ? 0 : -1;
+}
+
+/**
+ * @brief 保存新的 checkpoint 并换成新的空日志，调用时持有锁
+ *
+ * @param tree 持久化B+树
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+static int bp_wal_checkpoint(bp_durable_tree_t *tree)
+{
+	uint32_t generation;
+	int      fd;
+
+	// 等待 leader 写完，之后一直持有锁，日志文件不会再被写入
+	while (tree->flushing)
+		pthread_cond_wait(&tree->cond, &tree->lock);
+
+	if (tree->failed)
+		return -1;
+
+	generation = tree->generation + 1;
+	if (-1 == bp_save_tree_with_generation(tree->tree, tree->tmp_path,
+										   generation)
+		|| -1 == bp_wal_sync_file(tree->tmp_path)
+		|| 0 != rename(tree->tmp_path, tree->path)) {
+		unlink(tree->tmp_path);
+
+		return -1;
+	}
+
+	// 新的 checkpoint 可能已经替换了旧的，之后的日志再用旧的版本号会在恢复时被丢弃
+	if (-1 == bp_wal_sync_dir(tree->path)) {
+		tree->failed = 1;
+		pthread_cond_broadcast(&tree->cond);
+
+		return -1;
+	}
+
+	// 新的 checkpoint 已经包含了缓冲区中还没有写入的日志
+	tree->durable    = tree->appended;
+	tree->buffer_len = 0;
+	pthread_cond_broadcast(&tree->cond);
+
+	fd = bp_wal_create(tree, generation);
+	if (-1 == fd) {
+		tree->failed = 1;
+
+		return -1;
+	}
+
+	close(tree->fd);
+	tree->fd         = fd;
+	tree->generation = generation;
+	tree->wal_size   = sizeof(bp_wal_header_t);
+
+	return 0;
+}
+
+/**
+ * @brief 等待日志持久化，日志超过 wal_limit 时自动 checkpoint ，调用时持有锁
+ *
+ * @param tree 持久化B+树
+ * @param lsn 日志条数
+ * @return int 日志持久化返回 0 ，否则返回 -1 ，自动 checkpoint 失败不影响返回值
+ */
+static int bp_wal_finish(bp_durable_tree_t *tree, uint64_t lsn)
+{
+	if (-1 == bp_wal_commit(tree, lsn))
+		return -1;
+
+	if (tree->wal_limit > 0 && tree->wal_size >= tree->wal_limit)
+		bp_wal_checkpoint(tree);
+
+	return 0;
+}
+
+/**
+ * @brief 插入一个被索引项及其位置信息，日志持久化之后才返回
+ *
+ * @param tree 持久化B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 位置信息
+ * @param value_len 位置信息的长度
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+int bp_durable_insert(
+	bp_durable_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value,
+	int                value_len)
+{
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+	ret = bp_wal_reserve(tree, 1);
+	if (0 == ret)
+		ret = bp_insert(tree->tree, key, key_len, value, value_len);
+
+	if (0 == ret) {
+		bp_wal_append(tree, BP_WAL_INSERT, key, value);
+		ret = bp_wal_finish(tree, tree->appended);
+	}
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * @brief 插入多个被索引项及其位置信息，所有日志一起持久化之后才返回
+ *
+ * @param tree 持久化B+树
+ * @param keys 被索引项，长度为 item_num * key_size
+ * @param positions 位置信息，长度为 item_num * value_size
+ * @param item_num 要插入的数据个数
+ * @return int 成功返回 0 ，否则返回 -1 ，失败时已经插入的数据同样会持久化
+ */
+int bp_durable_insert_batch(
+	bp_durable_tree_t *tree,
+	unsigned char     *keys,
+	unsigned char     *positions,
+	int                item_num)
+{
+	unsigned char *key;
+	unsigned char *value;
+	int            ret;
+	int            i;
+
+	if (item_num <= 0)
+		return 0;
+
+	pthread_mutex_lock(&tree->lock);
+	ret = bp_wal_reserve(tree, item_num);
+	for (i = 0; 0 == ret && i < item_num; i++) {
+		key   = keys + i * tree->tree->key_size;
+		value = positions + i * tree->tree->value_size;
+		ret   = bp_insert(tree->tree, key, tree->tree->key_size, value,
+						  tree->tree->value_size);
+		if (0 == ret)
+			bp_wal_append(tree, BP_WAL_INSERT, key, value);
+	}
+
+	if (i > 0 && -1 == bp_wal_finish(tree, tree->appended))
+		ret = -1;
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * @brief 删除被索引项，删除了数据项时日志持久化之后才返回
+ *
+ * @param tree 持久化B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value 不为 NULL 时只删除位置信息相同的数据项
+ * @return int 删除了返回 1 ，没找到返回 0 ，参数错误或者写日志失败返回 -1
+ */
+int bp_durable_delete(
+	bp_durable_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value)
+{
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+	ret = bp_wal_reserve(tree, 1);
+	if (0 == ret)
+		ret = bp_delete(tree->tree, key, key_len, value);
+
+	if (1 == ret) {
+		bp_wal_append(tree, value ? BP_WAL_DELETE : BP_WAL_DELETE_FIRST, key,
+					  value);
+		if (-1 == bp_wal_finish(tree, tree->appended))
+			ret = -1;
+	}
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * @brief 查找被索引项的第一个位置信息
+ *
+ * @details
+ *  可以看到其它线程还在等待持久化的修改
+ *
+ * @param tree 持久化B+树
+ * @param key 被索引项
+ * @param key_len 被索引项的长度
+ * @param value_out 用于输出位置信息
+ * @return int 找到返回 1 ，没找到返回 0 ，参数错误返回 -1
+ */
+int bp_durable_search(
+	bp_durable_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value_out)
+{
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+	ret = bp_search(tree->tree, key, key_len, value_out);
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * @brief 把整棵树保存成新的 checkpoint 并清空日志
+ *
+ * @details
+ *  保存期间持有锁，其它线程的读写都会等待
+ *
+ * @param tree 持久化B+树
+ * @return int 成功返回 0 ，否则返回 -1
+ */
+int bp_durable_checkpoint(bp_durable_tree_t *tree)
+{
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+	ret = bp_wal_checkpoint(tree);
+	pthread_mutex_unlock(&tree->lock);
+
+	return ret;
+}
+
+/**
+ * @brief 等待所有日志持久化后关闭持久化B+树，调用时不能有其它线程在访问
+ *
+ * @param tree 持久化B+树
+ * @return int 所有日志都已经持久化返回 0 ，否则返回 -1
+ */
+int bp_close_durable(bp_durable_tree_t *tree)
+{
+	int ret;
+
+	pthread_mutex_lock(&tree->lock);
+	ret = bp_wal_commit(tree, tree->appended);
+	pthread_mutex_unlock(&tree->lock);
+
+	if (0 != close(tree->fd))
+		ret = -1;
+
+	pthread_cond_destroy(&tree->cond);
+	pthread_mutex_destroy(&tree->lock);
+	bp_destroy_tree(tree->tree);
+	free(tree->buffer);
+	free(tree->spare);
+	free(tree->path);
+	free(tree->wal_path);
+	free(tree->tmp_path);
+	free(tree);
+
+	return ret;
+}
@@ -1,6 +1,8 @@
 #ifndef _LIBBPLUS_H_
 #define _LIBBPLUS_H_
 
+#include <stdint.h>
+
 #ifndef NULL
 #define NULL ((void*)0)
 #endif
@@ -24,6 +26,67 @@ typedef struct bp_node {
 	bp_node_type_e type; /** B+树结点的类型 */
 } bp_node_t;
 
+/**
+ * @brief 分配B+树结点内存的分配器
+ *
+ */
+typedef struct bp_allocator {
+	void *(* alloc)(void *ctx, int size); /** 分配 size 大小的结点内存 */
+	void  (* free)(void *ctx, void *ptr, int size); /** 释放 alloc 分配的结点内存 */
+	void   *ctx; /** 传给 alloc 和 free 的参数 */
+} bp_allocator_t;
+
+/**
+ * @brief 结点上数据项的排列方式
+ *
+ */
+typedef enum bp_layout {
+	BP_LAYOUT_INTERLEAVED, /** K|V 或者 P|K 交错保存 */
+	BP_LAYOUT_SPLIT, /** 先连续保存所有的 K ，再连续保存所有的 V ；内部结点先保存所有的 P */
+	BP_LAYOUT_PREFIX, /** 和 BP_LAYOUT_INTERLEAVED 相同，但是内部结点上所有 key 的公共前缀
+						  只保存一次，只能用于按 memcmp 比较的 key */
+} bp_layout_e;
+
+/**
+ * @brief bp_create_tree_auto 选择结点大小的方案
+ *
+ */
+typedef enum bp_profile {
+	BP_PROFILE_MEMORY, /** 常驻内存的树，结点正好占满整数个缓存行 */
+	BP_PROFILE_PAGE_4K, /** 结点正好占满一个 4K 的页，适合换出到磁盘或者 mmap 的树 */
+	BP_PROFILE_PAGE_16K, /** 结点正好占满一个 16K 的页 */
+} bp_profile_e;
+
+/**
+ * @brief 按 64 字节对齐从大块内存上切分结点的 arena
+ *
+ */
+typedef struct bp_arena bp_arena_t;
+
+/**
+ * @brief 并发模式的B+树上用于读写同步的信息
+ *
+ */
+typedef struct bp_sync bp_sync_t;
+
+/**
+ * @brief 写时复制模式的B+树上某一时刻的只读快照
+ *
+ */
+typedef struct bp_snapshot bp_snapshot_t;
+
+/**
+ * @brief 在数据结点的最大值之后插入导致分裂时，旧结点默认保留的数据项的百分比
+ *
+ */
+#define BP_SPLIT_FILL_DEFAULT 90
+
+/**
+ * @brief 顺序追加时缓存的最右侧路径上内部结点的最大个数
+ *
+ */
+#define BP_SPINE_MAX_DEPTH 16
+
 /**
  * @brief 表示一棵B+树
  *
@@ -35,8 +98,1047 @@ typedef struct bp_tree {
 	int        value_size;   /** 位置信息的数据长度 */
 	bp_node_t *head;
 	bp_node_t *data;
+
+	bp_allocator_t *allocator; /** 分配结点内存的分配器， NULL 表示使用 malloc */
+	bp_arena_t     *arena; /** 树独占的 arena ，释放树时直接释放整个 arena */
+	bp_layout_e     layout; /** 结点上数据项的排列方式 */
+	bp_sync_t      *sync; /** 并发模式下的读写同步信息， NULL 表示不支持并发访问 */
+
+	int        split_fill; /** 在数据结点的最大值之后插入导致分裂时旧结点保留的百分比 */
+	int        spine_depth; /** spine 上有效的内部结点个数， 0 表示需要重新查找 */
+	bp_node_t *spine[BP_SPINE_MAX_DEPTH]; /** 从根结点到最右侧数据结点经过的内部结点 */
+	bp_node_t *last_data; /** 最右侧的数据结点，顺序追加时不需要从根结点查找 */
+
+	uint64_t data_split_num; /** 数据结点分裂的次数 */
+	uint64_t inner_split_num; /** 内部结点分裂的次数 */
+
+	int frozen; /** 是否已经被 bp_freeze 冻结，冻结期间只能查找 */
+
+	unsigned char *ibuf; /** 还没有合并到数据结点的 K|V ，后一半是排序用的临时空间，
+							 NULL 表示没有开启插入缓冲 */
+	int            ibuf_cap; /** 插入缓冲最多保存的数据项个数 */
+	int            ibuf_num; /** 插入缓冲中数据项的个数 */
+	int            ibuf_sorted; /** 插入缓冲中前 ibuf_sorted 个数据项已经按被索引项排好序，
+								   相同的被索引项按插入的顺序排列 */
+
+	uint64_t generation; /** 写操作修改结点时记到结点上的代数，每次 bp_export_delta 后加一 */
 } bp_tree_t;
 
 typedef int (* bp_compare_f)(unsigned char *a, unsigned char *b, int size);
 
+/**
+ * @brief 顺序访问B+树上被索引项的游标
+ *
+ */
+typedef struct bp_cursor bp_cursor_t;
+
+/**
+ * @brief 创建一棵B+树
+ *
+ */
+bp_tree_t *bp_create_tree(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare);
+
+/**
+ * @brief 创建一棵使用指定分配器分配结点的B+树
+ *
+ */
+bp_tree_t *bp_create_tree_with_allocator(
+	int             max_idx_num,
+	int             max_data_num,
+	int             key_size,
+	int             value_size,
+	bp_compare_f    compare,
+	bp_allocator_t *allocator);
+
+/**
+ * @brief 创建一棵结点上的数据项按 layout 排列的B+树
+ *
+ */
+bp_tree_t *bp_create_tree_with_layout(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare,
+	bp_layout_e  layout);
+
+/**
+ * @brief 创建一棵支持多线程并发访问的B+树，查找不加锁，写操作之间互斥
+ *
+ */
+bp_tree_t *bp_create_concurrent_tree(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare);
+
+/**
+ * @brief 释放并发模式的B+树上已经删除、没有读者能看到的结点。每次写操作结束时已经
+ *        会自动释放，只有读者退出之后没有新的写操作时才需要调用
+ *
+ */
+void bp_tree_reclaim(bp_tree_t *tree);
+
+/**
+ * @brief 创建一棵写时复制模式的B+树，写操作复制要修改的结点后整体发布新的根结点，
+ *        查找和游标都在快照上进行，不会被写操作阻塞
+ *
+ */
+bp_tree_t *bp_create_cow_tree(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare);
+
+/**
+ * @brief 打开写时复制模式的B+树当前的快照，其它模式的树返回 NULL
+ *
+ */
+bp_snapshot_t *bp_snapshot_open(bp_tree_t *tree);
+
+/**
+ * @brief 在快照上查找被索引项的所有位置信息，返回输出的位置信息个数，参数错误返回 -1
+ *
+ */
+int bp_snapshot_search_all(
+	bp_snapshot_t *snapshot,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *values_out,
+	int            max_num);
+
+/**
+ * @brief 关闭快照，快照上打开的游标需要先关闭
+ *
+ */
+void bp_snapshot_close(bp_snapshot_t *snapshot);
+
+/**
+ * @brief 创建一棵结点都从自己独占的 arena 上分配的B+树， slab_size 为 0 时使用默认值
+ *
+ */
+bp_tree_t *bp_create_tree_with_arena(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare,
+	int          slab_size);
+
+/**
+ * @brief 按结点大小的方案计算内部结点和数据结点保存的数据项的最大个数，结点放不下
+ *        足够的数据项时返回 -1 ，成功返回 0
+ *
+ */
+int bp_tree_auto_fanout(
+	int           key_size,
+	int           value_size,
+	bp_profile_e  profile,
+	int          *max_idx_num,
+	int          *max_data_num);
+
+/**
+ * @brief 创建一棵按 bp_tree_auto_fanout 选择结点容量的B+树，结点从树独占的 arena 上
+ *        按缓存行对齐分配
+ *
+ */
+bp_tree_t *bp_create_tree_auto(
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare,
+	bp_profile_e profile);
+
+/**
+ * @brief 创建一棵结点都从 arena 上分配的B+树，创建成功后 arena 归树所有，释放树时
+ *        一起释放
+ *
+ */
+bp_tree_t *bp_create_tree_on_arena(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare,
+	bp_arena_t  *arena);
+
+/**
+ * @brief 用按被索引项排好序的 K|V 数组一次性构建一棵B+树， fill_factor 为结点填充率
+ *        （1 到 100）
+ *
+ */
+bp_tree_t *bp_bulk_load(
+	int            max_idx_num,
+	int            max_data_num,
+	int            key_size,
+	int            value_size,
+	bp_compare_f   compare,
+	unsigned char *items,
+	int            item_num,
+	int            fill_factor);
+
+/**
+ * @brief 同 bp_bulk_load ，用 thread_num 个线程（包括当前线程）分段构建数据结点
+ *
+ */
+bp_tree_t *bp_parallel_bulk_load(
+	int            max_idx_num,
+	int            max_data_num,
+	int            key_size,
+	int            value_size,
+	bp_compare_f   compare,
+	unsigned char *items,
+	int            item_num,
+	int            fill_factor,
+	int            thread_num);
+
+/**
+ * @brief 释放一棵B+树
+ *
+ */
+void bp_destroy_tree(bp_tree_t *tree);
+
+/**
+ * @brief 冻结B+树，数据结点内按 Eytzinger 顺序查找，之后插入和删除返回 -1 ，成功返回
+ *        0 ，否则返回 -1
+ *
+ */
+int bp_freeze(bp_tree_t *tree);
+
+/**
+ * @brief 解除冻结，释放 Eytzinger 顺序的 key
+ *
+ */
+void bp_thaw(bp_tree_t *tree);
+
+/**
+ * @brief bp_tree_stats 最多统计的层数
+ *
+ */
+#define BP_STATS_MAX_LEVEL 32
+
+/**
+ * @brief B+树的结构统计信息
+ *
+ */
+typedef struct bp_tree_stats {
+	int      height; /** 树的层数，包括数据结点这一层 */
+	int64_t  inner_node_num; /** 内部结点的个数 */
+	int64_t  data_node_num; /** 数据结点的个数 */
+	int64_t  key_num; /** 数据项的个数 */
+	int64_t  bytes; /** 所有结点占用的内存 */
+	int64_t  level_node_num[BP_STATS_MAX_LEVEL]; /** 每一层的结点个数，下标 0 为根结点 */
+	int64_t  level_key_num[BP_STATS_MAX_LEVEL]; /** 每一层的结点上保存的 key 的个数 */
+	double   level_fill[BP_STATS_MAX_LEVEL]; /** 每一层保存的 key 占最多能保存的比例 */
+	uint64_t data_split_num; /** 数据结点分裂的次数 */
+	uint64_t inner_split_num; /** 内部结点分裂的次数 */
+	int64_t  dup_run_num; /** 相同 key 的连续数据项超过一个的段数 */
+	int64_t  dup_key_num; /** 这些段里的数据项个数 */
+	int64_t  max_dup_run; /** 最长的一段相同 key 的数据项个数 */
+	int64_t  ibuf_num; /** 插入缓冲中还没有合并到树上的数据项个数，不计入 key_num */
+} bp_tree_stats_t;
+
+/**
+ * @brief 当前线程的查找和插入计数，编译时定义 BP_STATS 才会计数
+ *
+ */
+typedef struct bp_thread_stats {
+	uint64_t lookup_num; /** bp_search 和 bp_search_all 的次数 */
+	uint64_t probe_num; /** 结点内查找的次数 */
+	uint64_t insert_num; /** 插入的数据项个数 */
+	uint64_t move_bytes; /** 在结点内和结点之间移动数据项的字节数 */
+} bp_thread_stats_t;
+
+/**
+ * @brief 统计B+树的层数、结点个数、每一层的填充率、分裂次数和相同 key 的段，成功返回
+ *        0 ，否则返回 -1
+ *
+ */
+int bp_tree_stats(bp_tree_t *tree, bp_tree_stats_t *out);
+
+/**
+ * @brief 输出当前线程的查找和插入计数， reset 不为 0 时输出后清零
+ *
+ */
+void bp_get_thread_stats(bp_thread_stats_t *out, int reset);
+
+/**
+ * @brief 向B+树中插入一个被索引项及其位置信息，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_insert(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *position,
+	int            position_len);
+
+/**
+ * @brief 设置在数据结点的最大值之后插入导致分裂时旧结点保留的数据项的百分比，取值
+ *        50 到 100 ，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_tree_set_split_fill(bp_tree_t *tree, int percent);
+
+/**
+ * @brief 设置插入缓冲最多保存的数据项个数， 0 表示关闭，开启后 bp_insert 先追加到缓冲中，
+ *        缓冲满了再批量合并到树上。查找、顺序统计和游标直接访问缓冲中的数据，不会触发
+ *        合并。只能用于普通模式的树，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_tree_set_insert_buffer(bp_tree_t *tree, int item_num);
+
+/**
+ * @brief 把插入缓冲中的数据合并到树上，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_tree_flush(bp_tree_t *tree);
+
+/**
+ * @brief 批量插入 item_num 个被索引项及其位置信息，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_insert_batch(
+	bp_tree_t     *tree,
+	unsigned char *keys,
+	unsigned char *positions,
+	int            item_num);
+
+/**
+ * @brief 删除一个被索引项， value 不为 NULL 时只删除位置信息相同的数据项，删除了返回
+ *        1 ，没找到返回 0 ，参数错误返回 -1
+ *
+ */
+int bp_delete(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value);
+
+/**
+ * @brief 替换一个被索引项的位置信息， value 不为 NULL 时只替换位置信息相同的数据项，
+ *        为 NULL 时替换第一个；替换了返回 1 ，没找到返回 0
+ *
+ */
+int bp_update(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value,
+	unsigned char *new_value);
+
+/**
+ * @brief 查找被索引项的第一个位置信息，找到返回 1 ，没找到返回 0 ，参数错误返回 -1
+ *
+ */
+int bp_search(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value_out);
+
+/**
+ * @brief 查找被索引项的所有位置信息，返回输出的位置信息个数，参数错误返回 -1
+ *
+ */
+int bp_search_all(
+	bp_tree_t     *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *values_out,
+	int            max_num);
+
+/**
+ * @brief 返回小于 key 的被索引项的个数，参数错误返回 -1
+ *
+ */
+int bp_rank(bp_tree_t *tree, unsigned char *key, int key_len);
+
+/**
+ * @brief 返回 [lo, hi] 范围内被索引项的个数， lo 或 hi 为 NULL 表示不限，失败返回 -1
+ *
+ */
+int bp_count_range(bp_tree_t *tree, unsigned char *lo, unsigned char *hi);
+
+/**
+ * @brief 输出按顺序的第 k 个（从 0 开始）被索引项及其位置信息， key_out 和 value_out
+ *        可以为 NULL ，找到返回 1 ， k 超出范围返回 0 ，失败返回 -1
+ *
+ */
+int bp_select(
+	bp_tree_t     *tree,
+	int            k,
+	unsigned char *key_out,
+	unsigned char *value_out);
+
+/**
+ * @brief 打开访问 [lo, hi] 范围内被索引项的游标， lo 或 hi 为 NULL 表示不限，并发模式
+ *        的树上使用游标时不能同时有写操作，写时复制模式的树上游标会打开自己的快照
+ *
+ */
+bp_cursor_t *bp_cursor_open(bp_tree_t *tree, unsigned char *lo, unsigned char *hi);
+
+/**
+ * @brief 在快照上打开访问 [lo, hi] 范围内被索引项的游标，游标看到的数据不受之后的
+ *        写操作影响
+ *
+ */
+bp_cursor_t *bp_snapshot_cursor_open(
+	bp_snapshot_t *snapshot,
+	unsigned char *lo,
+	unsigned char *hi);
+
+/**
+ * @brief 返回游标指向的被索引项及其位置信息，有数据返回 1 ，否则返回 0
+ *
+ */
+int bp_cursor_next(
+	bp_cursor_t    *cursor,
+	unsigned char **key,
+	unsigned char **value);
+
+/**
+ * @brief 返回当前数据结点上连续的 K|V 数据项，返回数据项的个数， BP_LAYOUT_SPLIT 的树
+ *        返回 -1
+ *
+ */
+int bp_cursor_next_run(bp_cursor_t *cursor, unsigned char **items);
+
+/**
+ * @brief 关闭游标
+ *
+ */
+void bp_cursor_close(bp_cursor_t *cursor);
+
+/**
+ * @brief 并行扫描时处理一个数据结点上连续的 K|V 数据项， part 为扫描这一段的下标，
+ *        小于 thread_num ，返回非 0 时停止扫描这一段
+ *
+ */
+typedef int (* bp_scan_f)(void *arg, int part, unsigned char *items, int item_num);
+
+/**
+ * @brief 用 thread_num 个线程（包括当前线程）扫描 [lo, hi] 范围内的被索引项， lo 或 hi
+ *        为 NULL 表示不限，扫描期间不能有写操作， BP_LAYOUT_SPLIT 的树不支持，完成返回
+ *        0 ，否则返回 -1
+ *
+ */
+int bp_parallel_scan(
+	bp_tree_t     *tree,
+	unsigned char *lo,
+	unsigned char *hi,
+	bp_scan_f      fn,
+	void          *arg,
+	int            thread_num);
+
+/**
+ * @brief 通过 mmap 直接访问 bp_save_tree 保存的文件的只读B+树
+ *
+ */
+typedef struct bp_mmap_tree bp_mmap_tree_t;
+
+/**
+ * @brief 把B+树保存成按页排列的文件，结点之间用页下标代替指针，成功返回 0 ，失败
+ *        返回 -1
+ *
+ */
+int bp_save_tree(bp_tree_t *tree, const char *path);
+
+/**
+ * @brief 同 bp_save_tree ，在文件头中记录调用方指定的版本号 generation
+ *
+ */
+int bp_save_tree_with_generation(
+	bp_tree_t  *tree,
+	const char *path,
+	uint32_t    generation);
+
+/**
+ * @brief 把 bp_save_tree 保存的文件读回到一棵新的B+树中， generation 不为 NULL 时输出
+ *        文件头的版本号，失败返回 NULL
+ *
+ */
+bp_tree_t *bp_load_tree(
+	const char   *path,
+	int           max_idx_num,
+	int           max_data_num,
+	int           key_size,
+	int           value_size,
+	bp_compare_f  compare,
+	uint32_t     *generation);
+
+/**
+ * @brief 把代数 since_gen 之后修改过的数据结点用 writev 导出到 fd ， since_gen 为 0 时
+ *        导出整棵树， next_gen 不为 NULL 时输出下一次导出使用的 since_gen ，成功返回 0 ，
+ *        否则返回 -1
+ *
+ */
+int bp_export_delta(
+	bp_tree_t *tree,
+	uint64_t   since_gen,
+	int        fd,
+	uint64_t  *next_gen);
+
+/**
+ * @brief 把 bp_export_delta 导出的数据从 fd 读出并应用到副本上， next_gen 不为 NULL 时
+ *        输出导出时的 next_gen ，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_apply_delta(bp_tree_t *tree, int fd, uint64_t *next_gen);
+
+/**
+ * @brief 通过 mmap 打开 bp_save_tree 保存的文件，不需要反序列化， compare 必须和保存时
+ *        的树相同，失败返回 NULL
+ *
+ */
+bp_mmap_tree_t *bp_open_mmap(const char *path, bp_compare_f compare);
+
+/**
+ * @brief 在只读的B+树中查找被索引项的第一个位置信息，同 bp_search
+ *
+ */
+int bp_mmap_search(
+	bp_mmap_tree_t *tree,
+	unsigned char  *key,
+	int             key_len,
+	unsigned char  *value_out);
+
+/**
+ * @brief 在只读的B+树中查找被索引项的所有位置信息，同 bp_search_all
+ *
+ */
+int bp_mmap_search_all(
+	bp_mmap_tree_t *tree,
+	unsigned char  *key,
+	int             key_len,
+	unsigned char  *values_out,
+	int             max_num);
+
+/**
+ * @brief 关闭 bp_open_mmap 打开的B+树
+ *
+ */
+void bp_close_mmap(bp_mmap_tree_t *tree);
+
+/**
+ * @brief 打开 bp_save_tree 保存的文件，结点通过有 frame_num 个帧的缓冲池按需读入，
+ *        适用于文件比内存大的情况，失败返回 NULL
+ *
+ */
+bp_mmap_tree_t *bp_open_pooled(
+	const char   *path,
+	bp_compare_f  compare,
+	int           frame_num);
+
+/**
+ * @brief 顺序访问只读B+树上被索引项的游标
+ *
+ */
+typedef struct bp_mmap_cursor bp_mmap_cursor_t;
+
+/**
+ * @brief 打开访问只读B+树上 [lo, hi] 范围内被索引项的游标，顺序访问时预读后面的
+ *        数据结点
+ *
+ */
+bp_mmap_cursor_t *bp_mmap_cursor_open(
+	bp_mmap_tree_t *tree,
+	unsigned char  *lo,
+	unsigned char  *hi);
+
+/**
+ * @brief 返回游标指向的被索引项及其位置信息，返回的数据在下一次调用前有效，有数据
+ *        返回 1 ，没有数据返回 0 ，读取结点失败返回 -1
+ *
+ */
+int bp_mmap_cursor_next(
+	bp_mmap_cursor_t *cursor,
+	unsigned char   **key,
+	unsigned char   **value);
+
+/**
+ * @brief 关闭只读B+树的游标
+ *
+ */
+void bp_mmap_cursor_close(bp_mmap_cursor_t *cursor);
+
+/**
+ * @brief 按页缓存文件内容的缓冲池
+ *
+ */
+typedef struct bp_pool bp_pool_t;
+
+/**
+ * @brief 创建有 frame_num 个 page_size 大小的帧的缓冲池， writable 为 1 时可以写回
+ *        修改过的页
+ *
+ */
+bp_pool_t *bp_pool_open(
+	const char *path,
+	int         page_size,
+	int         frame_num,
+	int         writable);
+
+/**
+ * @brief pin 住一页并返回页的数据， weight 越大越不容易被淘汰，所有的帧都被 pin 住
+ *        或者读文件失败时返回 NULL
+ *
+ */
+unsigned char *bp_pool_pin(bp_pool_t *pool, uint64_t page_idx, int weight);
+
+/**
+ * @brief unpin bp_pool_pin 返回的页， dirty 为 1 时淘汰或者 flush 时写回文件
+ *
+ */
+void bp_pool_unpin(bp_pool_t *pool, unsigned char *data, int dirty);
+
+/**
+ * @brief 提示操作系统预读从 page_idx 开始的 page_num 页
+ *
+ */
+void bp_pool_readahead(bp_pool_t *pool, uint64_t page_idx, int page_num);
+
+/**
+ * @brief 把所有修改过的页写回文件，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_pool_flush(bp_pool_t *pool);
+
+/**
+ * @brief 写回修改过的页并释放缓冲池，写回成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_pool_close(bp_pool_t *pool);
+
+/**
+ * @brief 修改先写入日志的持久化B+树
+ *
+ */
+typedef struct bp_durable_tree bp_durable_tree_t;
+
+/**
+ * @brief 打开 path 上的持久化B+树，从 checkpoint 文件 path 和日志文件 path.wal 恢复
+ *        数据，日志超过 wal_limit 字节时自动 checkpoint ， 0 表示只手动 checkpoint
+ *
+ */
+bp_durable_tree_t *bp_open_durable(
+	const char   *path,
+	int           max_idx_num,
+	int           max_data_num,
+	int           key_size,
+	int           value_size,
+	bp_compare_f  compare,
+	uint64_t      wal_limit);
+
+/**
+ * @brief 插入一个被索引项及其位置信息，日志持久化之后才返回，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_durable_insert(
+	bp_durable_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value,
+	int                value_len);
+
+/**
+ * @brief 插入 item_num 个被索引项及其位置信息，所有日志一起持久化，同 bp_insert_batch
+ *
+ */
+int bp_durable_insert_batch(
+	bp_durable_tree_t *tree,
+	unsigned char     *keys,
+	unsigned char     *positions,
+	int                item_num);
+
+/**
+ * @brief 删除被索引项，日志持久化之后才返回，同 bp_delete
+ *
+ */
+int bp_durable_delete(
+	bp_durable_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value);
+
+/**
+ * @brief 查找被索引项的第一个位置信息，同 bp_search
+ *
+ */
+int bp_durable_search(
+	bp_durable_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value_out);
+
+/**
+ * @brief 把整棵树保存成新的 checkpoint 并清空日志，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_durable_checkpoint(bp_durable_tree_t *tree);
+
+/**
+ * @brief 等待所有日志持久化后关闭持久化B+树，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_close_durable(bp_durable_tree_t *tree);
+
+/**
+ * @brief 按 key 的范围划分成多棵独立B+树的分片树
+ *
+ */
+typedef struct bp_sharded_tree bp_sharded_tree_t;
+
+/**
+ * @brief 按顺序跨越所有分片访问被索引项的游标
+ *
+ */
+typedef struct bp_sharded_cursor bp_sharded_cursor_t;
+
+/**
+ * @brief 创建一个分片的参数
+ *
+ */
+typedef struct bp_shard_config {
+	int max_idx_num; /** 内部结点的包含的被索引项的最大个数 */
+	int max_data_num; /** 叶子结点中包含被索引项及其位置信息的最大个数 */
+	int concurrent; /** 为 1 时创建并发模式的树，多个线程会写同一个分片时使用 */
+	int arena_flags; /** 不为 0 时分片的结点从独占的 arena 上分配，见
+						 bp_arena_create_with_flags ，不能和 concurrent 同时使用；
+						 分片的 arena 使用默认的 slab 大小，不能使用 BP_ARENA_HUGE_1G */
+	int numa_node; /** arena_flags 包含 BP_ARENA_NUMA 时分片的结点所在的 NUMA 结点 */
+} bp_shard_config_t;
+
+/**
+ * @brief 创建 shard_num 个分片的分片树， bounds 为 shard_num - 1 个递增的分界 key ，
+ *        第 i 个分界 key 是第 i + 1 个分片的最小值； bounds 为 NULL 时按 key 的第一个
+ *        字节平均划分，此时 compare 必须为 NULL
+ *
+ */
+bp_sharded_tree_t *bp_create_sharded_tree(
+	int                shard_num,
+	int                key_size,
+	int                value_size,
+	bp_compare_f       compare,
+	unsigned char     *bounds,
+	bp_shard_config_t *configs);
+
+/**
+ * @brief 释放分片树和所有的分片
+ *
+ */
+void bp_destroy_sharded_tree(bp_sharded_tree_t *tree);
+
+/**
+ * @brief 返回 key 所在分片的下标，只读取创建后不再修改的分界，不需要加锁
+ *
+ */
+int bp_sharded_tree_route(bp_sharded_tree_t *tree, unsigned char *key);
+
+/**
+ * @brief 返回下标为 idx 的分片，拥有分片的线程可以直接在上面插入 route 到它的数据
+ *
+ */
+bp_tree_t *bp_sharded_tree_get_shard(bp_sharded_tree_t *tree, int idx);
+
+/**
+ * @brief 把被索引项插入到所在的分片，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_sharded_insert(
+	bp_sharded_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *position,
+	int                position_len);
+
+/**
+ * @brief 按分片拆分后批量插入，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_sharded_insert_batch(
+	bp_sharded_tree_t *tree,
+	unsigned char     *keys,
+	unsigned char     *positions,
+	int                item_num);
+
+/**
+ * @brief 在所在的分片上查找被索引项的第一个位置信息，同 bp_search
+ *
+ */
+int bp_sharded_search(
+	bp_sharded_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value_out);
+
+/**
+ * @brief 从所在的分片上删除一个被索引项，同 bp_delete
+ *
+ */
+int bp_sharded_delete(
+	bp_sharded_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value);
+
+/**
+ * @brief 打开按顺序访问所有分片上 [lo, hi] 范围内被索引项的游标
+ *
+ */
+bp_sharded_cursor_t *bp_sharded_cursor_open(
+	bp_sharded_tree_t *tree,
+	unsigned char     *lo,
+	unsigned char     *hi);
+
+/**
+ * @brief 返回游标指向的被索引项及其位置信息，有数据返回 1 ，没有数据返回 0 ，打开下一个
+ *        分片的游标失败返回 -1
+ *
+ */
+int bp_sharded_cursor_next(
+	bp_sharded_cursor_t *cursor,
+	unsigned char      **key,
+	unsigned char      **value);
+
+/**
+ * @brief 关闭分片树的游标
+ *
+ */
+void bp_sharded_cursor_close(bp_sharded_cursor_t *cursor);
+
+/**
+ * @brief 每个不同的 key 只保存一次，位置信息按大端无符号整数排好序压缩保存在倒排列表
+ *        中的B+树
+ *
+ */
+typedef struct bp_posting_tree bp_posting_tree_t;
+
+/**
+ * @brief 创建倒排列表树， value_size 最多 8 个字节
+ *
+ */
+bp_posting_tree_t *bp_create_posting_tree(
+	int          max_idx_num,
+	int          max_data_num,
+	int          key_size,
+	int          value_size,
+	bp_compare_f compare);
+
+/**
+ * @brief 释放倒排列表树和所有的倒排列表
+ *
+ */
+void bp_destroy_posting_tree(bp_posting_tree_t *tree);
+
+/**
+ * @brief 插入一个被索引项及其位置信息，成功返回 0 ，否则返回 -1
+ *
+ */
+int bp_posting_tree_insert(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *position,
+	int                position_len);
+
+/**
+ * @brief 删除一个被索引项， value 不为 NULL 时只删除一个相同的位置信息，为 NULL 时删除
+ *        最小的位置信息，同 bp_delete
+ *
+ */
+int bp_posting_tree_delete(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value);
+
+/**
+ * @brief 查找被索引项最小的位置信息，同 bp_search
+ *
+ */
+int bp_posting_tree_search(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value_out);
+
+/**
+ * @brief 查找被索引项最大的位置信息，同 bp_search
+ *
+ */
+int bp_posting_tree_search_last(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	unsigned char     *value_out);
+
+/**
+ * @brief 跳过前 offset 个位置信息，按从小到大的顺序输出最多 max_num 个，返回输出的
+ *        个数，参数错误返回 -1
+ *
+ */
+int bp_posting_tree_search_all(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len,
+	uint64_t           offset,
+	unsigned char     *values_out,
+	int                max_num);
+
+/**
+ * @brief 返回被索引项的位置信息个数，参数错误返回 -1
+ *
+ */
+int64_t bp_posting_tree_count(
+	bp_posting_tree_t *tree,
+	unsigned char     *key,
+	int                key_len);
+
+/**
+ * @brief 返回保存不同 key 的B+树，只能用来查看统计信息或者按顺序访问 key
+ *
+ */
+bp_tree_t *bp_posting_tree_get_tree(bp_posting_tree_t *tree);
+
+/**
+ * @brief 比较两个变长的被索引项，返回值和 memcmp 相同
+ *
+ */
+typedef int (* bp_var_compare_f)(
+	unsigned char *a,
+	int            a_len,
+	unsigned char *b,
+	int            b_len);
+
+/**
+ * @brief 被索引项和位置信息都是变长数据的B+树
+ *
+ */
+typedef struct bp_var_tree bp_var_tree_t;
+
+/**
+ * @brief 顺序访问变长数据的B+树的游标
+ *
+ */
+typedef struct bp_var_cursor bp_var_cursor_t;
+
+/**
+ * @brief 创建一棵结点大小为 page_size 字节的变长数据的B+树， compare 为 NULL 时按
+ *        字节序比较
+ *
+ */
+bp_var_tree_t *bp_create_var_tree(int page_size, bp_var_compare_f compare);
+
+/**
+ * @brief 释放变长数据的B+树
+ *
+ */
+void bp_destroy_var_tree(bp_var_tree_t *tree);
+
+/**
+ * @brief 插入一个被索引项及其位置信息，成功返回 0 ，长度超过限制或者失败返回 -1
+ *
+ */
+int bp_var_insert(
+	bp_var_tree_t *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value,
+	int            value_len);
+
+/**
+ * @brief 查找被索引项的第一个位置信息，最多复制 value_buf_len 字节，找到返回 1 ，
+ *        否则返回 0
+ *
+ */
+int bp_var_search(
+	bp_var_tree_t *tree,
+	unsigned char *key,
+	int            key_len,
+	unsigned char *value_out,
+	int            value_buf_len,
+	int           *value_len);
+
+/**
+ * @brief 删除被索引项的第一个数据项，删除了返回 1 ，没找到返回 0
+ *
+ */
+int bp_var_delete(
+	bp_var_tree_t *tree,
+	unsigned char *key,
+	int            key_len);
+
+/**
+ * @brief 打开顺序访问 [lo, hi] 范围内数据项的游标， NULL 表示不限
+ *
+ */
+bp_var_cursor_t *bp_var_cursor_open(
+	bp_var_tree_t *tree,
+	unsigned char *lo,
+	int            lo_len,
+	unsigned char *hi,
+	int            hi_len);
+
+/**
+ * @brief 返回游标指向的数据项，有数据返回 1 ，没有数据返回 0
+ *
+ */
+int bp_var_cursor_next(
+	bp_var_cursor_t  *cursor,
+	unsigned char   **key,
+	int              *key_len,
+	unsigned char   **value,
+	int              *value_len);
+
+/**
+ * @brief 关闭游标
+ *
+ */
+void bp_var_cursor_close(bp_var_cursor_t *cursor);
+
+/**
+ * @brief 创建一个 arena ，每次向系统申请 slab_size 大小的内存， 0 表示使用默认值
+ *
+ */
+bp_arena_t *bp_arena_create(int slab_size);
+
+/**
+ * @brief bp_arena_create_with_flags 的选项， BP_ARENA_HUGE_THP 把 slab 按 2M 对齐并
+ *        建议内核使用透明大页， BP_ARENA_HUGE_2M/1G 使用预留的大页，系统没有预留时
+ *        退回到透明大页， BP_ARENA_NUMA 把 slab 绑定到指定的 NUMA 结点
+ *
+ */
+#define BP_ARENA_HUGE_THP  1
+#define BP_ARENA_HUGE_2M   2
+#define BP_ARENA_HUGE_1G   4
+#define BP_ARENA_HUGE_MASK (BP_ARENA_HUGE_THP | BP_ARENA_HUGE_2M | BP_ARENA_HUGE_1G)
+#define BP_ARENA_NUMA      8
+
+/**
+ * @brief 创建一个 slab 使用大页或者绑定到 NUMA 结点的 arena ， flags 为 0 时同
+ *        bp_arena_create ，使用大页时 slab_size 取整到大页的整数倍。使用
+ *        BP_ARENA_HUGE_1G 时 slab_size 不能小于 1G ，否则返回 NULL
+ *
+ */
+bp_arena_t *bp_arena_create_with_flags(int slab_size, int flags, int numa_node);
+
+/**
+ * @brief 释放 arena 申请的所有内存
+ *
+ */
+void bp_arena_destroy(bp_arena_t *arena);
+
+/**
+ * @brief 返回从 arena 上分配结点的分配器，可以被多棵树共用
+ *
+ */
+bp_allocator_t *bp_arena_get_allocator(bp_arena_t *arena);
+
 #endif /* _LIBBPLUS_H_ */
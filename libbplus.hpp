@@ -0,0 +1,445 @@
+#ifndef _LIBBPLUS_HPP_
+#define _LIBBPLUS_HPP_
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+	#include "libbplus.h"
+}
+
+namespace bplus {
+
+/**
+ * @brief 默认按这个大小计算结点上数据项的个数，让结点的内容正好占满一个内存页
+ *
+ */
+constexpr int node_bytes = 4096;
+
+/**
+ * @brief key 在C核心里的编码方式，整数 key 按大端保存并翻转符号位，这样 memcmp 的
+ *        顺序就是数值的顺序，C核心可以使用 4/8/16 字节定长 key 的查找函数
+ *
+ */
+template <typename Key, typename Compare>
+struct key_codec {
+	static_assert(std::is_trivially_copyable<Key>::value,
+				  "bplus::tree key must be trivially copyable");
+	static_assert(!std::is_same<typename std::remove_cv<Key>::type, bool>::value,
+				  "bplus::tree key must not be bool, make_unsigned<bool> is ill-formed");
+
+	/** 是否按大端整数编码，否则原样保存并通过 compare 回调比较 */
+	static constexpr bool ordered = std::is_integral<Key>::value
+		&& std::is_same<Compare, std::less<Key>>::value;
+
+	static void encode(const Key &key, unsigned char *out)
+	{
+		encode_impl(key, out, std::integral_constant<bool, ordered>());
+	}
+
+	static Key decode(const unsigned char *in)
+	{
+		return decode_impl(in, std::integral_constant<bool, ordered>());
+	}
+
+	static int compare(unsigned char *a, unsigned char *b, int)
+	{
+		Compare less;
+		Key     x;
+		Key     y;
+
+		std::memcpy(&x, a, sizeof(Key));
+		std::memcpy(&y, b, sizeof(Key));
+		if (less(x, y))
+			return -1;
+
+		return less(y, x) ? 1 : 0;
+	}
+
+	static bp_compare_f comparator()
+	{
+		return ordered ? nullptr : compare;
+	}
+
+private:
+	typedef typename std::conditional<std::is_integral<Key>::value
+									  && !std::is_same<Key, bool>::value,
+									  std::make_unsigned<Key>,
+									  std::enable_if<true, Key>>::type::type bits_t;
+
+	static constexpr bits_t sign_bit()
+	{
+		return std::is_signed<Key>::value ? (bits_t)((bits_t)1 << (8 * sizeof(Key) - 1)) : 0;
+	}
+
+	static void encode_impl(const Key &key, unsigned char *out, std::true_type)
+	{
+		bits_t bits;
+		int    i;
+
+		bits = (bits_t)key ^ sign_bit();
+		for (i = (int)sizeof(Key) - 1; i >= 0; i--) {
+			out[i] = (unsigned char)bits;
+			bits   = (bits_t)(bits >> 8);
+		}
+	}
+
+	static void encode_impl(const Key &key, unsigned char *out, std::false_type)
+	{
+		std::memcpy(out, &key, sizeof(Key));
+	}
+
+	static Key decode_impl(const unsigned char *in, std::true_type)
+	{
+		bits_t bits;
+		int    i;
+
+		bits = 0;
+		for (i = 0; i < (int)sizeof(Key); i++)
+			bits = (bits_t)((bits << 8) | in[i]);
+
+		return (Key)(bits ^ sign_bit());
+	}
+
+	static Key decode_impl(const unsigned char *in, std::false_type)
+	{
+		Key key;
+
+		std::memcpy(&key, in, sizeof(Key));
+
+		return key;
+	}
+};
+
+/**
+ * @brief value 在C核心里的保存方式，可以按字节复制的 value 直接保存在数据结点上，
+ *        其他类型移动到单独分配的对象里，数据结点上只保存指针
+ *
+ */
+template <typename Value>
+struct value_codec {
+	static constexpr bool boxed = !std::is_trivially_copyable<Value>::value;
+	static constexpr int  size  = boxed ? (int)sizeof(Value *) : (int)sizeof(Value);
+};
+
+template <typename Key, typename Value>
+constexpr int default_inner_fanout()
+{
+	return node_bytes / (int)(sizeof(void *) + sizeof(Key));
+}
+
+template <typename Key, typename Value>
+constexpr int default_leaf_fanout()
+{
+	// 数据结点的容量不能小于内部结点
+	return node_bytes / (int)(sizeof(Key) + value_codec<Value>::size)
+		> default_inner_fanout<Key, Value>()
+		? node_bytes / (int)(sizeof(Key) + value_codec<Value>::size)
+		: default_inner_fanout<Key, Value>();
+}
+
+/**
+ * @brief 按编译期确定的 key/value 类型和结点大小封装的B+树，树的结构和查找都在C核心里，
+ *        允许重复的 key
+ *
+ */
+template <typename Key,
+		  typename Value,
+		  int InnerFanout  = default_inner_fanout<Key, Value>(),
+		  int LeafFanout   = default_leaf_fanout<Key, Value>(),
+		  typename Compare = std::less<Key>>
+class tree {
+	typedef key_codec<Key, Compare> keys;
+	typedef value_codec<Value>      values;
+
+	static_assert(InnerFanout >= 3, "bplus::tree inner fanout is too small");
+	static_assert(LeafFanout >= InnerFanout,
+				  "bplus::tree leaf fanout must not be smaller than inner fanout");
+
+	static constexpr int key_size   = (int)sizeof(Key);
+	static constexpr int value_size = values::size;
+
+public:
+	static constexpr int inner_fanout = InnerFanout;
+	static constexpr int leaf_fanout  = LeafFanout;
+
+	tree()
+	{
+		tree_ = bp_create_tree(InnerFanout, LeafFanout, key_size, value_size,
+							   keys::comparator());
+		if (nullptr == tree_)
+			throw std::bad_alloc();
+	}
+
+	~tree()
+	{
+		clear_boxes(std::integral_constant<bool, values::boxed>());
+		if (tree_)
+			bp_destroy_tree(tree_);
+	}
+
+	tree(const tree &) = delete;
+	tree &operator=(const tree &) = delete;
+
+	tree(tree &&other) noexcept : tree_(other.tree_)
+	{
+		other.tree_ = nullptr;
+	}
+
+	tree &operator=(tree &&other) noexcept
+	{
+		std::swap(tree_, other.tree_);
+
+		return *this;
+	}
+
+	/**
+	 * @brief 插入 key 和 value ， value 被移动进树里，成功返回 true
+	 *
+	 */
+	bool insert(const Key &key, Value value)
+	{
+		unsigned char k[key_size];
+
+		keys::encode(key, k);
+
+		return insert_impl(k, std::move(value),
+						   std::integral_constant<bool, values::boxed>());
+	}
+
+	/**
+	 * @brief 查找 key 的第一个 value ，复制到 out ，找到返回 true
+	 *
+	 */
+	bool find(const Key &key, Value &out) const
+	{
+		unsigned char k[key_size];
+		unsigned char v[value_size];
+
+		keys::encode(key, k);
+		if (1 != bp_search(tree_, k, key_size, v))
+			return false;
+
+		out = load(v);
+
+		return true;
+	}
+
+	bool contains(const Key &key) const
+	{
+		unsigned char k[key_size];
+		unsigned char v[value_size];
+
+		keys::encode(key, k);
+
+		return 1 == bp_search(tree_, k, key_size, v);
+	}
+
+	/**
+	 * @brief 返回 key 对应的 value 的个数
+	 *
+	 */
+	std::size_t count(const Key &key) const
+	{
+		unsigned char k[key_size];
+		int           num;
+
+		keys::encode(key, k);
+		num = bp_count_range(tree_, k, k);
+
+		return num > 0 ? (std::size_t)num : 0;
+	}
+
+	/**
+	 * @brief 删除 key 对应的所有 value ，返回删除的个数
+	 *
+	 */
+	std::size_t erase(const Key &key)
+	{
+		unsigned char k[key_size];
+		unsigned char v[value_size];
+		std::size_t   num;
+
+		keys::encode(key, k);
+		for (num = 0; 1 == bp_search(tree_, k, key_size, v); num++) {
+			if (1 != bp_delete(tree_, k, key_size, v))
+				break;
+			drop(v, std::integral_constant<bool, values::boxed>());
+		}
+
+		return num;
+	}
+
+	std::size_t size() const
+	{
+		int num;
+
+		num = bp_count_range(tree_, nullptr, nullptr);
+
+		return num > 0 ? (std::size_t)num : 0;
+	}
+
+	bool empty() const
+	{
+		return 0 == size();
+	}
+
+	/**
+	 * @brief 按 key 的顺序对 [lo, hi] 范围内的每一项调用 fn(key, value)
+	 *
+	 */
+	template <typename F>
+	void for_each(const Key &lo, const Key &hi, F fn) const
+	{
+		unsigned char l[key_size];
+		unsigned char h[key_size];
+
+		keys::encode(lo, l);
+		keys::encode(hi, h);
+		walk(l, h, fn);
+	}
+
+	/**
+	 * @brief 按 key 的顺序对每一项调用 fn(key, value)
+	 *
+	 */
+	template <typename F>
+	void for_each(F fn) const
+	{
+		walk(nullptr, nullptr, fn);
+	}
+
+	/**
+	 * @brief 返回C核心的树，可以直接使用 libbplus.h 里的其他接口
+	 *
+	 */
+	bp_tree_t *native_handle() const
+	{
+		return tree_;
+	}
+
+private:
+	bp_tree_t *tree_;
+
+	static Value load(const unsigned char *v)
+	{
+		return load_impl(v, std::integral_constant<bool, values::boxed>());
+	}
+
+	static Value load_impl(const unsigned char *v, std::false_type)
+	{
+		Value value;
+
+		std::memcpy(&value, v, sizeof(Value));
+
+		return value;
+	}
+
+	static Value load_impl(const unsigned char *v, std::true_type)
+	{
+		return *unbox(v);
+	}
+
+	static Value *unbox(const unsigned char *v)
+	{
+		Value *box;
+
+		std::memcpy(&box, v, sizeof(box));
+
+		return box;
+	}
+
+	bool insert_impl(unsigned char *k, Value &&value, std::false_type)
+	{
+		unsigned char v[value_size];
+
+		std::memcpy(v, &value, sizeof(Value));
+
+		return 0 == bp_insert(tree_, k, key_size, v, value_size);
+	}
+
+	bool insert_impl(unsigned char *k, Value &&value, std::true_type)
+	{
+		unsigned char v[value_size];
+		Value        *box;
+
+		box = new Value(std::move(value));
+		std::memcpy(v, &box, sizeof(box));
+		if (0 != bp_insert(tree_, k, key_size, v, value_size)) {
+			value = std::move(*box);
+			delete box;
+
+			return false;
+		}
+
+		return true;
+	}
+
+	static void drop(unsigned char *, std::false_type)
+	{
+	}
+
+	static void drop(unsigned char *v, std::true_type)
+	{
+		delete unbox(v);
+	}
+
+	void clear_boxes(std::false_type)
+	{
+	}
+
+	void clear_boxes(std::true_type)
+	{
+		bp_cursor_t   *cursor;
+		unsigned char *k;
+		unsigned char *v;
+
+		if (nullptr == tree_)
+			return;
+
+		cursor = bp_cursor_open(tree_, nullptr, nullptr);
+		if (nullptr == cursor)
+			return;
+		while (1 == bp_cursor_next(cursor, &k, &v))
+			delete unbox(v);
+		bp_cursor_close(cursor);
+	}
+
+	template <typename F>
+	void walk(unsigned char *lo, unsigned char *hi, F &fn) const
+	{
+		bp_cursor_t   *cursor;
+		unsigned char *k;
+		unsigned char *v;
+
+		cursor = bp_cursor_open(tree_, lo, hi);
+		if (nullptr == cursor)
+			throw std::bad_alloc();
+		while (1 == bp_cursor_next(cursor, &k, &v))
+			fn(keys::decode(k), static_cast<const Value &>(ref(v)));
+		bp_cursor_close(cursor);
+	}
+
+	// 装箱的 value 直接引用原对象，否则复制到临时变量里
+	template <typename V = Value>
+	static typename std::enable_if<value_codec<V>::boxed, const V &>::type
+	ref(const unsigned char *v)
+	{
+		return *unbox(v);
+	}
+
+	template <typename V = Value>
+	static typename std::enable_if<!value_codec<V>::boxed, V>::type
+	ref(const unsigned char *v)
+	{
+		return load(v);
+	}
+};
+
+}
+
+#endif
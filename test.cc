@@ -1,4 +1,14 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
 
 extern "C" {
 	#include "libbplus.h"
@@ -55,8 +65,11 @@ extern "C" {
 
 	extern int bp_data_node_split(
 		bp_node_t  *old,
+		int         append,
 		bp_node_t **p_new);
 
+	extern bp_node_t *bp_data_node_get_pnext(bp_node_t *data);
+
 	extern int bp_inner_node_insert_data(
 		bp_node_t      *node,
 		unsigned char  *key,
@@ -64,9 +77,27 @@ extern "C" {
 		bp_node_t     **pp_new);
 
 	extern int bp_node_get_key_num(bp_node_t *node);
+	extern int bp_node_get_key_total(bp_node_t *node);
 	extern unsigned char *bp_node_get_content(bp_node_t *node);
+
+	extern int bp_simd_get_level(void);
+	extern void bp_simd_set_level(int level);
+	extern int bp_simd_count_be32(
+		const unsigned char *base,
+		int                  num,
+		int                  stride,
+		uint32_t             key,
+		int                  or_equal);
+	extern int bp_simd_count_be64(
+		const unsigned char *base,
+		int                  num,
+		int                  stride,
+		uint64_t             key,
+		int                  or_equal);
 }
 
+#include "libbplus.hpp"
+
 TEST(BiSearch, FindOne)
 {
 	unsigned char  content[] = "112233445566778899";
@@ -390,3 +421,2734 @@ TEST(InnerNode, Insert)
 	EXPECT_EQ(0, strncmp((char *)split_content, "333355558888", 12));
 	EXPECT_TRUE(split_head == NULL);
 }
+
+static void put_be32(unsigned char *buf, unsigned int v)
+{
+	buf[0] = (v >> 24) & 0xff;
+	buf[1] = (v >> 16) & 0xff;
+	buf[2] = (v >> 8) & 0xff;
+	buf[3] = v & 0xff;
+}
+
+static unsigned int get_be32(unsigned char *buf)
+{
+	return ((unsigned int)buf[0] << 24) | ((unsigned int)buf[1] << 16)
+		| ((unsigned int)buf[2] << 8) | buf[3];
+}
+
+TEST(Tree, Search)
+{
+	bp_tree_t     *tree;
+	unsigned char  k[4];
+	unsigned int   p;
+	unsigned int   out[8];
+	unsigned int   i;
+
+	tree = bp_create_tree(4, 8, sizeof(k), sizeof(p), NULL);
+	ASSERT_TRUE(tree != NULL);
+
+	put_be32(k, 7);
+	EXPECT_EQ(0, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+	EXPECT_EQ(-1, bp_search(tree, k, 2, (unsigned char *)&p));
+
+	for (i = 0; i < 16; i++) {
+		p = (i * 7) % 16;
+		put_be32(k, p * 10);
+		EXPECT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&p,
+							   sizeof(p)));
+	}
+
+	for (i = 0; i < 16; i++) {
+		put_be32(k, i * 10);
+		EXPECT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+		EXPECT_EQ(i, p);
+
+		put_be32(k, i * 10 + 5);
+		EXPECT_EQ(0, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+	}
+
+	// 相同的被索引项跨越多个数据结点
+	put_be32(k, 55);
+	for (i = 0; i < 6; i++) {
+		p = 100 + i;
+		EXPECT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&p,
+							   sizeof(p)));
+	}
+	EXPECT_EQ(6, bp_search_all(tree, k, sizeof(k), (unsigned char *)out, 8));
+	for (i = 0; i < 6; i++)
+		EXPECT_EQ(100 + i, out[i]);
+	EXPECT_EQ(3, bp_search_all(tree, k, sizeof(k), (unsigned char *)out, 3));
+	EXPECT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+	EXPECT_EQ(100u, p);
+
+	put_be32(k, 1000);
+	EXPECT_EQ(0, bp_search_all(tree, k, sizeof(k), (unsigned char *)out, 8));
+
+	bp_destroy_tree(tree);
+}
+
+TEST(Tree, Cursor)
+{
+	bp_tree_t     *tree;
+	bp_cursor_t   *cursor;
+	unsigned char  lo[4];
+	unsigned char  hi[4];
+	unsigned char  k[4];
+	unsigned char *key;
+	unsigned char *value;
+	unsigned char *items;
+	unsigned int   p;
+	unsigned int   i;
+	int            num;
+	int            total;
+
+	tree = bp_create_tree(4, 8, sizeof(k), sizeof(p), NULL);
+	ASSERT_TRUE(tree != NULL);
+
+	for (i = 0; i < 20; i++) {
+		p = ((i * 7) % 20) * 2;
+		put_be32(k, p);
+		EXPECT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&p,
+							   sizeof(p)));
+	}
+
+	put_be32(lo, 5);
+	put_be32(hi, 21);
+	cursor = bp_cursor_open(tree, lo, hi);
+	ASSERT_TRUE(cursor != NULL);
+	for (i = 6; i <= 20; i += 2) {
+		ASSERT_EQ(1, bp_cursor_next(cursor, &key, &value));
+		put_be32(k, i);
+		EXPECT_EQ(0, memcmp(k, key, sizeof(k)));
+		EXPECT_EQ(i, *(unsigned int *)value);
+	}
+	EXPECT_EQ(0, bp_cursor_next(cursor, &key, &value));
+	bp_cursor_close(cursor);
+
+	cursor = bp_cursor_open(tree, NULL, NULL);
+	total  = 0;
+	while ((num = bp_cursor_next_run(cursor, &items)) > 0) {
+		for (i = 0; i < (unsigned int)num; i++)
+			EXPECT_EQ((unsigned int)(total + i) * 2,
+					  *(unsigned int *)(items + i * 8 + 4));
+		total += num;
+	}
+	EXPECT_EQ(20, total);
+	bp_cursor_close(cursor);
+
+	put_be32(lo, 30);
+	put_be32(hi, 10);
+	cursor = bp_cursor_open(tree, lo, hi);
+	EXPECT_EQ(0, bp_cursor_next(cursor, &key, &value));
+	bp_cursor_close(cursor);
+
+	put_be32(lo, 100);
+	cursor = bp_cursor_open(tree, lo, NULL);
+	EXPECT_EQ(0, bp_cursor_next(cursor, &key, &value));
+	bp_cursor_close(cursor);
+
+	bp_destroy_tree(tree);
+}
+
+TEST(Tree, Grow)
+{
+	bp_tree_t     *tree;
+	bp_cursor_t   *cursor;
+	unsigned char  k[4];
+	unsigned char *key;
+	unsigned char *value;
+	unsigned int   p;
+	unsigned int   i;
+	unsigned int   n;
+
+	n    = 20000;
+	tree = bp_create_tree(4, 6, sizeof(k), sizeof(p), NULL);
+	ASSERT_TRUE(tree != NULL);
+
+	for (i = 0; i < n; i++) {
+		p = (i * 7919) % n;
+		put_be32(k, p);
+		ASSERT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&p,
+							   sizeof(p)));
+	}
+	EXPECT_EQ((int)n, bp_node_get_key_total(tree->head));
+
+	for (i = 0; i < n; i++) {
+		put_be32(k, i);
+		ASSERT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+		EXPECT_EQ(i, p);
+	}
+
+	cursor = bp_cursor_open(tree, NULL, NULL);
+	for (i = 0; bp_cursor_next(cursor, &key, &value); i++)
+		EXPECT_EQ(i, *(unsigned int *)value);
+	EXPECT_EQ(n, i);
+	bp_cursor_close(cursor);
+
+	bp_destroy_tree(tree);
+}
+
+static int count_data_nodes(bp_tree_t *tree)
+{
+	bp_node_t *data;
+	int        num;
+
+	num = 0;
+	for (data = tree->data; data; data = bp_data_node_get_pnext(data))
+		num++;
+
+	return num;
+}
+
+TEST(Tree, SequentialInsert)
+{
+	bp_tree_t     *tree;
+	bp_cursor_t   *cursor;
+	unsigned char  k[4];
+	unsigned char *key;
+	unsigned char *value;
+	unsigned int   p;
+	unsigned int   i;
+	unsigned int   n;
+	int            fill;
+
+	n = 10000;
+	for (fill = 90; fill <= 100; fill += 10) {
+		tree = bp_create_tree(4, 10, sizeof(k), sizeof(p), NULL);
+		ASSERT_TRUE(tree != NULL);
+		EXPECT_EQ(-1, bp_tree_set_split_fill(tree, 49));
+		EXPECT_EQ(-1, bp_tree_set_split_fill(tree, 101));
+		ASSERT_EQ(0, bp_tree_set_split_fill(tree, fill));
+
+		// 顺序追加时除了最后一个以外的数据结点都保存 fill% 的数据，最后一个最多是满的
+		for (i = 0; i < n; i++) {
+			put_be32(k, i);
+			ASSERT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&i,
+								   sizeof(i)));
+		}
+		EXPECT_EQ((int)((n - 10 + fill / 10 - 1) / (fill / 10) + 1),
+				  count_data_nodes(tree));
+		EXPECT_EQ((int)n, bp_node_get_key_total(tree->head));
+		EXPECT_GT(tree->spine_depth, 0);
+
+		// 中间插入和删除之后再追加，缓存的最右侧路径要重新查找
+		put_be32(k, n / 2);
+		p = n;
+		ASSERT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&p, sizeof(p)));
+		EXPECT_EQ(0, tree->spine_depth);
+		for (i = n - 100; i < n; i++) {
+			put_be32(k, i);
+			ASSERT_EQ(1, bp_delete(tree, k, sizeof(k), NULL));
+		}
+		for (i = n - 100; i < n + 100; i++) {
+			put_be32(k, i);
+			ASSERT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&i,
+								   sizeof(i)));
+		}
+		EXPECT_EQ((int)(n + 101), bp_node_get_key_total(tree->head));
+
+		for (i = 0; i < n + 100; i++) {
+			put_be32(k, i);
+			ASSERT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+			EXPECT_EQ(i, p);
+		}
+
+		cursor = bp_cursor_open(tree, NULL, NULL);
+		for (i = 0; bp_cursor_next(cursor, &key, &value); i++) {
+			if (i <= n / 2) {
+				EXPECT_EQ(i, *(unsigned int *)value);
+			} else {
+				EXPECT_EQ(i == n / 2 + 1 ? n : i - 1, *(unsigned int *)value);
+			}
+		}
+		EXPECT_EQ(n + 101, i);
+		bp_cursor_close(cursor);
+
+		bp_destroy_tree(tree);
+	}
+}
+
+TEST(Tree, Stats)
+{
+	bp_tree_t         *tree;
+	bp_tree_stats_t    stats;
+	bp_thread_stats_t  thread_stats;
+	unsigned char      k[4];
+	unsigned int       p;
+	unsigned int       i;
+	unsigned int       n;
+	int64_t            node_num;
+	int                level;
+
+	n    = 1000;
+	tree = bp_create_tree(4, 8, sizeof(k), sizeof(p), NULL);
+	ASSERT_TRUE(tree != NULL);
+
+	ASSERT_EQ(0, bp_tree_stats(tree, &stats));
+	EXPECT_EQ(2, stats.height);
+	EXPECT_EQ(1, stats.inner_node_num);
+	EXPECT_EQ(1, stats.data_node_num);
+	EXPECT_EQ(0, stats.key_num);
+
+	// 每个 key 插入两次，最后再插入 20 个相同的 key
+	for (i = 0; i < 2 * n + 20; i++) {
+		p = i;
+		put_be32(k, i < 2 * n ? (i * 7919) % n : 5 * n);
+		ASSERT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&p, sizeof(p)));
+	}
+	bp_get_thread_stats(&thread_stats, 1);
+
+	ASSERT_EQ(0, bp_tree_stats(tree, &stats));
+	EXPECT_EQ(2 * n + 20, stats.key_num);
+	EXPECT_EQ(1, stats.level_node_num[0]);
+	EXPECT_EQ(stats.data_node_num, stats.level_node_num[stats.height - 1]);
+	EXPECT_EQ(stats.key_num, stats.level_key_num[stats.height - 1]);
+	EXPECT_GT(stats.bytes, 0);
+
+	// 根结点以外的结点都是分裂出来的，根结点分裂时还会创建新的根结点
+	EXPECT_EQ(stats.data_node_num - 1, (int64_t)stats.data_split_num);
+	EXPECT_EQ(stats.inner_node_num, (int64_t)stats.inner_split_num + stats.height - 1);
+
+	node_num = 0;
+	for (level = 0; level < stats.height; level++) {
+		EXPECT_GT(stats.level_fill[level], 0);
+		EXPECT_LE(stats.level_fill[level], 1);
+		if (level > 0) {
+			EXPECT_EQ(stats.level_node_num[level], stats.level_key_num[level - 1]);
+		}
+		node_num += stats.level_node_num[level];
+	}
+	EXPECT_EQ(stats.inner_node_num + stats.data_node_num, node_num);
+
+	EXPECT_EQ(n + 1, stats.dup_run_num);
+	EXPECT_EQ(2 * n + 20, stats.dup_key_num);
+	EXPECT_EQ(20, stats.max_dup_run);
+
+	bp_destroy_tree(tree);
+}
+
+TEST(Tree, OrderStatistics)
+{
+	bp_tree_t     *tree;
+	unsigned char  k[4];
+	unsigned char  lo[4];
+	unsigned char  hi[4];
+	unsigned char  key[4];
+	unsigned int   p;
+	unsigned int   i;
+	unsigned int   n;
+	int            layout;
+
+	n = 600;
+	for (layout = BP_LAYOUT_INTERLEAVED; layout <= BP_LAYOUT_PREFIX; layout++) {
+		tree = bp_create_tree_with_layout(4, 8, sizeof(k), sizeof(p), NULL,
+						  (bp_layout_e)layout);
+		ASSERT_TRUE(tree != NULL);
+
+		put_be32(k, 0);
+		EXPECT_EQ(0, bp_rank(tree, k, sizeof(k)));
+		EXPECT_EQ(0, bp_count_range(tree, NULL, NULL));
+		EXPECT_EQ(0, bp_select(tree, 0, key, NULL));
+
+		// 偶数 key 各插入三次，再删除 key 为 4 的倍数中的一个
+		for (i = 0; i < 3 * n; i++) {
+			p = i;
+			put_be32(k, 2 * ((i * 7919) % n));
+			ASSERT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&p, sizeof(p)));
+		}
+		for (i = 0; i < n; i += 2) {
+			put_be32(k, 2 * i);
+			ASSERT_EQ(1, bp_delete(tree, k, sizeof(k), NULL));
+		}
+		// key 2i 之前共有 3i - (i + 1) / 2 个项
+		for (i = 0; i < n; i++) {
+			put_be32(k, 2 * i);
+			EXPECT_EQ((int)(3 * i - (i + 1) / 2), bp_rank(tree, k, sizeof(k)));
+			put_be32(k, 2 * i + 1);
+			EXPECT_EQ((int)(3 * i + 3 - (i + 2) / 2), bp_rank(tree, k, sizeof(k)));
+		}
+		put_be32(k, 2 * n + 100);
+		EXPECT_EQ((int)(5 * n / 2), bp_rank(tree, k, sizeof(k)));
+
+		EXPECT_EQ((int)(5 * n / 2), bp_count_range(tree, NULL, NULL));
+		put_be32(lo, 4);
+		put_be32(hi, 8);
+		EXPECT_EQ(2 + 3 + 2, bp_count_range(tree, lo, hi));
+		EXPECT_EQ(5 * n / 2 - 5, (unsigned int)bp_count_range(tree, lo, NULL));
+		EXPECT_EQ(2 + 3 + 2 + 3 + 2, bp_count_range(tree, NULL, hi));
+		EXPECT_EQ(0, bp_count_range(tree, hi, lo));
+		put_be32(lo, 5);
+		EXPECT_EQ(0, bp_count_range(tree, lo, lo));
+
+		for (i = 0; i < 5 * n / 2; i++) {
+			ASSERT_EQ(1, bp_select(tree, i, key, (unsigned char *)&p));
+			put_be32(k, 2 * ((i / 5) * 2 + (i % 5 >= 2)));
+			EXPECT_EQ(0, memcmp(k, key, sizeof(k)));
+			EXPECT_EQ(2 * ((p * 7919) % n), get_be32(key));
+		}
+		EXPECT_EQ(0, bp_select(tree, 5 * n / 2, key, NULL));
+		EXPECT_EQ(0, bp_select(tree, -1, key, NULL));
+
+		bp_destroy_tree(tree);
+	}
+}
+
+TEST(Tree, BulkLoad)
+{
+	bp_tree_t     *tree;
+	bp_cursor_t   *cursor;
+	unsigned char *items;
+	unsigned char *run;
+	unsigned char  k[4];
+	unsigned int   p;
+	unsigned int   i;
+	unsigned int   n;
+	int            num;
+	int            leaf_num;
+	int            total;
+
+	n     = 10000;
+	items = (unsigned char *)malloc(n * 8);
+	for (i = 0; i < n; i++) {
+		put_be32(items + i * 8, i * 2);
+		p = i;
+		memcpy(items + i * 8 + 4, &p, sizeof(p));
+	}
+
+	tree = bp_bulk_load(8, 16, 4, 4, NULL, items, n, 100);
+	ASSERT_TRUE(tree != NULL);
+	EXPECT_EQ((int)n, bp_node_get_key_total(tree->head));
+
+	for (i = 0; i < n; i++) {
+		put_be32(k, i * 2);
+		ASSERT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+		EXPECT_EQ(i, p);
+		put_be32(k, i * 2 + 1);
+		ASSERT_EQ(0, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+	}
+
+	cursor   = bp_cursor_open(tree, NULL, NULL);
+	leaf_num = 0;
+	total    = 0;
+	while ((num = bp_cursor_next_run(cursor, &run)) > 0) {
+		leaf_num += 1;
+		total    += num;
+	}
+	bp_cursor_close(cursor);
+	EXPECT_EQ((int)n, total);
+	EXPECT_EQ((int)(n + 15) / 16, leaf_num);
+
+	// 批量构建后还可以继续插入
+	put_be32(k, 3);
+	p = 3;
+	EXPECT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&p, sizeof(p)));
+	EXPECT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+	EXPECT_EQ(3u, p);
+	EXPECT_EQ((int)n + 1, bp_node_get_key_total(tree->head));
+	bp_destroy_tree(tree);
+
+	tree = bp_bulk_load(8, 16, 4, 4, NULL, items, n, 70);
+	ASSERT_TRUE(tree != NULL);
+	put_be32(k, 5000);
+	EXPECT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+	EXPECT_EQ(2500u, p);
+	bp_destroy_tree(tree);
+
+	tree = bp_bulk_load(8, 16, 4, 4, NULL, items, 1, 100);
+	ASSERT_TRUE(tree != NULL);
+	put_be32(k, 0);
+	EXPECT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+	bp_destroy_tree(tree);
+
+	put_be32(items, 100);
+	EXPECT_TRUE(NULL == bp_bulk_load(8, 16, 4, 4, NULL, items, n, 100));
+	EXPECT_TRUE(NULL == bp_bulk_load(8, 16, 4, 4, NULL, items, n, 0));
+
+	free(items);
+}
+
+static int count_scan(void *arg, int part, unsigned char *items, int item_num)
+{
+	std::vector<unsigned long long> *sums = (std::vector<unsigned long long> *)arg;
+	int                              i;
+
+	for (i = 0; i < item_num; i++) {
+		(*sums)[2 * part]     += 1;
+		(*sums)[2 * part + 1] += get_be32(items + i * 8);
+	}
+
+	return 0;
+}
+
+static int stop_scan(void *, int, unsigned char *, int)
+{
+	return -1;
+}
+
+TEST(Tree, ParallelBulkLoad)
+{
+	static const int                threads[] = {1, 3, 8};
+	static const unsigned int       los[] = {0, 1234, 5000, 9999, 12000};
+	static const unsigned int       his[] = {9999, 1234, 6543, 20000, 13000};
+	std::vector<unsigned long long> sums;
+	bp_tree_t                      *tree;
+	bp_tree_t                      *expect;
+	bp_cursor_t                    *a;
+	bp_cursor_t                    *b;
+	unsigned char                  *items;
+	unsigned char                  *key_a;
+	unsigned char                  *key_b;
+	unsigned char                  *value_a;
+	unsigned char                  *value_b;
+	unsigned char                   lo[4];
+	unsigned char                   hi[4];
+	unsigned long long              num;
+	unsigned long long              sum;
+	unsigned int                    p;
+	unsigned int                    i;
+	unsigned int                    n;
+	unsigned int                    l;
+	unsigned int                    h;
+	size_t                          t;
+	size_t                          j;
+
+	// 每个 key 重复 3 次，重复的 key 可能跨越不同线程构建的数据结点
+	n     = 30000;
+	items = (unsigned char *)malloc(n * 8);
+	for (i = 0; i < n; i++) {
+		put_be32(items + i * 8, i / 3);
+		p = i;
+		memcpy(items + i * 8 + 4, &p, sizeof(p));
+	}
+
+	expect = bp_bulk_load(8, 16, 4, 4, NULL, items, n, 90);
+	ASSERT_TRUE(expect != NULL);
+	for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		tree = bp_parallel_bulk_load(8, 16, 4, 4, NULL, items, n, 90, threads[t]);
+		ASSERT_TRUE(tree != NULL);
+		EXPECT_EQ((int)n, bp_node_get_key_total(tree->head));
+
+		a = bp_cursor_open(tree, NULL, NULL);
+		b = bp_cursor_open(expect, NULL, NULL);
+		while (bp_cursor_next(b, &key_b, &value_b)) {
+			ASSERT_EQ(1, bp_cursor_next(a, &key_a, &value_a));
+			EXPECT_EQ(0, memcmp(key_a, key_b, 4));
+			EXPECT_EQ(0, memcmp(value_a, value_b, 4));
+		}
+		EXPECT_EQ(0, bp_cursor_next(a, &key_a, &value_a));
+		bp_cursor_close(a);
+		bp_cursor_close(b);
+
+		// 范围的两端落在重复的 key 上，或者在所有 key 之外
+		for (j = 0; j < sizeof(los) / sizeof(los[0]); j++) {
+			l = los[j];
+			h = his[j];
+			put_be32(lo, l);
+			put_be32(hi, h);
+			sums.assign(2 * threads[t], 0);
+			ASSERT_EQ(0, bp_parallel_scan(tree, lo, hi, count_scan, &sums,
+										  threads[t]));
+
+			num = 0;
+			sum = 0;
+			for (i = 0; i < sums.size() / 2; i++) {
+				num += sums[2 * i];
+				sum += sums[2 * i + 1];
+			}
+
+			h = h < n / 3 ? h : n / 3 - 1;
+			if (l > h) {
+				EXPECT_EQ(0u, num);
+				continue;
+			}
+			EXPECT_EQ(3ull * (h - l + 1), num);
+			EXPECT_EQ(3ull * (l + h) * (h - l + 1) / 2, sum);
+		}
+
+		sums.assign(2 * threads[t], 0);
+		ASSERT_EQ(0, bp_parallel_scan(tree, NULL, NULL, count_scan, &sums,
+									  threads[t]));
+		for (num = 0, i = 0; i < sums.size() / 2; i++)
+			num += sums[2 * i];
+		EXPECT_EQ(n, num);
+		EXPECT_EQ(-1, bp_parallel_scan(tree, NULL, NULL, stop_scan, NULL,
+									   threads[t]));
+		bp_destroy_tree(tree);
+	}
+	bp_destroy_tree(expect);
+
+	// 任何一段不是有序的都会失败
+	put_be32(items + (n - 2) * 8, 0);
+	EXPECT_TRUE(NULL == bp_parallel_bulk_load(8, 16, 4, 4, NULL, items, n, 90, 4));
+	EXPECT_TRUE(NULL == bp_parallel_bulk_load(8, 16, 4, 4, NULL, items, n, 90, 0));
+
+	free(items);
+}
+
+TEST(Tree, InsertBatch)
+{
+	bp_tree_t     *tree;
+	bp_cursor_t   *cursor;
+	unsigned char *keys;
+	unsigned char *key;
+	unsigned char *value;
+	unsigned char  k[4];
+	unsigned char  prev[4];
+	unsigned int  *positions;
+	unsigned int   p;
+	unsigned int   out[4];
+	unsigned int   i;
+	unsigned int   j;
+	unsigned int   n;
+
+	n         = 1000;
+	keys      = (unsigned char *)malloc(n * 4);
+	positions = (unsigned int *)malloc(n * sizeof(unsigned int));
+	tree      = bp_create_tree(4, 8, 4, 4, NULL);
+	ASSERT_TRUE(tree != NULL);
+
+	// 每一批都是相邻的一段 key ，批内顺序是打乱的
+	for (j = 0; j < 10; j++) {
+		for (i = 0; i < n; i++) {
+			p = ((j * 7) % 10) * n + (i * 13) % n;
+			put_be32(keys + i * 4, p * 2);
+			positions[i] = p;
+		}
+		ASSERT_EQ(0, bp_insert_batch(tree, keys, (unsigned char *)positions, n));
+	}
+	EXPECT_EQ((int)n * 10, bp_node_get_key_total(tree->head));
+
+	for (i = 0; i < n * 10; i++) {
+		put_be32(k, i * 2);
+		ASSERT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+		EXPECT_EQ(i, p);
+	}
+
+	// 批量插入重复的 key ，相同 key 的数据保持插入的顺序
+	for (i = 0; i < 4; i++) {
+		put_be32(keys + i * 4, 1001);
+		positions[i] = 50 + i;
+	}
+	ASSERT_EQ(0, bp_insert_batch(tree, keys, (unsigned char *)positions, 4));
+	put_be32(k, 1001);
+	ASSERT_EQ(4, bp_search_all(tree, k, sizeof(k), (unsigned char *)out, 4));
+	for (i = 0; i < 4; i++)
+		EXPECT_EQ(50 + i, out[i]);
+
+	cursor = bp_cursor_open(tree, NULL, NULL);
+	memset(prev, 0, sizeof(prev));
+	for (i = 0; bp_cursor_next(cursor, &key, &value); i++) {
+		EXPECT_LE(memcmp(prev, key, 4), 0);
+		memcpy(prev, key, 4);
+	}
+	EXPECT_EQ(n * 10 + 4, i);
+	bp_cursor_close(cursor);
+
+	bp_destroy_tree(tree);
+	free(keys);
+	free(positions);
+}
+
+TEST(Arena, Tree)
+{
+	bp_tree_t      *tree;
+	bp_tree_t      *shared[2];
+	bp_arena_t     *arena;
+	bp_allocator_t *allocator;
+	unsigned char   k[4];
+	unsigned int    p;
+	unsigned int    i;
+	unsigned int    j;
+	void           *block[2];
+	int             flags[] = {BP_ARENA_HUGE_THP, BP_ARENA_HUGE_2M | BP_ARENA_NUMA,
+							   BP_ARENA_NUMA};
+
+	arena     = bp_arena_create(4096);
+	allocator = bp_arena_get_allocator(arena);
+	block[0]  = allocator->alloc(allocator->ctx, 100);
+	block[1]  = allocator->alloc(allocator->ctx, 100);
+	EXPECT_EQ(0u, (uintptr_t)block[0] % 64);
+	EXPECT_EQ(128, (unsigned char *)block[1] - (unsigned char *)block[0]);
+	allocator->free(allocator->ctx, block[0], 100);
+	EXPECT_EQ(block[0], allocator->alloc(allocator->ctx, 128));
+
+	// 共用 arena 的树逐个释放结点
+	for (j = 0; j < 2; j++) {
+		shared[j] = bp_create_tree_with_allocator(4, 8, 4, 4, NULL, allocator);
+		ASSERT_TRUE(shared[j] != NULL);
+		for (i = 0; i < 1000; i++) {
+			p = (i * 31) % 1000;
+			put_be32(k, p);
+			ASSERT_EQ(0, bp_insert(shared[j], k, 4, (unsigned char *)&p, 4));
+		}
+	}
+	for (i = 0; i < 1000; i++) {
+		put_be32(k, i);
+		ASSERT_EQ(1, bp_search(shared[1], k, 4, (unsigned char *)&p));
+		EXPECT_EQ(i, p);
+	}
+	bp_destroy_tree(shared[0]);
+	bp_destroy_tree(shared[1]);
+	bp_arena_destroy(arena);
+
+	// 大页的 slab 按 2M 对齐，系统没有预留大页时退回到透明大页
+	EXPECT_TRUE(NULL == bp_arena_create_with_flags(0, 16, 0));
+	EXPECT_TRUE(NULL == bp_arena_create_with_flags(0, BP_ARENA_NUMA, -1));
+	EXPECT_TRUE(NULL == bp_arena_create_with_flags(0, BP_ARENA_HUGE_1G, 0));
+	EXPECT_TRUE(NULL == bp_arena_create_with_flags(1 << 20, BP_ARENA_HUGE_1G, 0));
+	for (j = 0; j < 3; j++) {
+		arena = bp_arena_create_with_flags(4096, flags[j], 0);
+		ASSERT_TRUE(arena != NULL);
+		allocator = bp_arena_get_allocator(arena);
+		block[0]  = allocator->alloc(allocator->ctx, 100);
+		ASSERT_TRUE(block[0] != NULL);
+		EXPECT_EQ(64u, (uintptr_t)block[0] % (BP_ARENA_NUMA == flags[j] ? 4096 : 2 << 20));
+		memset(block[0], 1, 100);
+
+		tree = bp_create_tree_on_arena(4, 8, 4, 4, NULL, arena);
+		ASSERT_TRUE(tree != NULL);
+		for (i = 0; i < 20000; i++) {
+			p = (i * 7919) % 20000;
+			put_be32(k, p);
+			ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&p, 4));
+		}
+		for (i = 0; i < 20000; i++) {
+			put_be32(k, i);
+			ASSERT_EQ(1, bp_search(tree, k, 4, (unsigned char *)&p));
+			EXPECT_EQ(i, p);
+		}
+		bp_destroy_tree(tree);
+	}
+
+	// 独占 arena 的树直接释放整个 arena
+	tree = bp_create_tree_with_arena(4, 8, 4, 4, NULL, 0);
+	ASSERT_TRUE(tree != NULL);
+	for (i = 0; i < 10000; i++) {
+		p = (i * 7919) % 10000;
+		put_be32(k, p);
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&p, 4));
+	}
+	EXPECT_EQ(0u, (uintptr_t)tree->head % 64);
+	for (i = 0; i < 10000; i++) {
+		put_be32(k, i);
+		ASSERT_EQ(1, bp_search(tree, k, 4, (unsigned char *)&p));
+		EXPECT_EQ(i, p);
+	}
+	bp_destroy_tree(tree);
+}
+
+TEST(Tree, AutoFanout)
+{
+	bp_tree_t          *tree;
+	unsigned char       k[8];
+	unsigned int        p;
+	unsigned int        i;
+	int                 idx_num[3];
+	int                 data_num[3];
+	int                 profile;
+	static const int    key_sizes[] = {4, 8, 16};
+	size_t              j;
+
+	for (j = 0; j < sizeof(key_sizes) / sizeof(key_sizes[0]); j++) {
+		for (profile = BP_PROFILE_MEMORY; profile <= BP_PROFILE_PAGE_16K; profile++) {
+			ASSERT_EQ(0, bp_tree_auto_fanout(key_sizes[j], 8, (bp_profile_e)profile,
+											 &idx_num[profile], &data_num[profile]));
+			EXPECT_LE(idx_num[profile], data_num[profile]);
+		}
+		// 页越大，结点上的数据项越多
+		EXPECT_LT(idx_num[BP_PROFILE_MEMORY], idx_num[BP_PROFILE_PAGE_4K]);
+		EXPECT_LT(data_num[BP_PROFILE_MEMORY], data_num[BP_PROFILE_PAGE_4K]);
+		EXPECT_LT(4 * idx_num[BP_PROFILE_PAGE_4K], idx_num[BP_PROFILE_PAGE_16K] + 4);
+		EXPECT_LT(4 * data_num[BP_PROFILE_PAGE_4K], data_num[BP_PROFILE_PAGE_16K] + 4);
+		EXPECT_GE(4096, bp_calc_data_node_content_len(data_num[BP_PROFILE_PAGE_4K],
+													  key_sizes[j], 8));
+	}
+
+	// 内存中的树在数据项很大时增加缓存行，页放不下时失败
+	ASSERT_EQ(0, bp_tree_auto_fanout(4, 1000, BP_PROFILE_MEMORY, &idx_num[0],
+									 &data_num[0]));
+	EXPECT_LE(8, data_num[0]);
+	EXPECT_EQ(data_num[0], idx_num[0]);
+	EXPECT_EQ(-1, bp_tree_auto_fanout(4, 2000, BP_PROFILE_PAGE_4K, &idx_num[0],
+									  &data_num[0]));
+	EXPECT_EQ(-1, bp_tree_auto_fanout(4, 8, (bp_profile_e)100, &idx_num[0],
+									  &data_num[0]));
+	EXPECT_TRUE(NULL == bp_create_tree_auto(4, 2000, NULL, BP_PROFILE_PAGE_4K));
+
+	tree = bp_create_tree_auto(sizeof(k), sizeof(p), NULL, BP_PROFILE_MEMORY);
+	ASSERT_TRUE(tree != NULL);
+	ASSERT_EQ(0, bp_tree_auto_fanout(sizeof(k), sizeof(p), BP_PROFILE_MEMORY,
+									 &idx_num[0], &data_num[0]));
+	EXPECT_EQ(idx_num[0], tree->max_idx_num);
+	EXPECT_EQ(data_num[0], tree->max_data_num);
+	EXPECT_TRUE(tree->arena != NULL);
+	for (i = 0; i < 20000; i++) {
+		p = i;
+		put_be32(k, 0);
+		put_be32(k + 4, (i * 7919) % 20000);
+		ASSERT_EQ(0, bp_insert(tree, k, sizeof(k), (unsigned char *)&p, sizeof(p)));
+	}
+	for (i = 0; i < 20000; i++) {
+		put_be32(k + 4, (i * 7919) % 20000);
+		ASSERT_EQ(1, bp_search(tree, k, sizeof(k), (unsigned char *)&p));
+		ASSERT_EQ(i, p);
+	}
+	bp_destroy_tree(tree);
+}
+
+TEST(Tree, Delete)
+{
+	bp_tree_t     *tree;
+	bp_cursor_t   *cursor;
+	unsigned char *key;
+	unsigned char *value;
+	unsigned char  k[4];
+	unsigned int   p;
+	unsigned int   out[4];
+	unsigned int   i;
+	unsigned int   n;
+
+	n    = 5000;
+	tree = bp_create_tree(4, 8, 4, 4, NULL);
+	ASSERT_TRUE(tree != NULL);
+	for (i = 0; i < n; i++) {
+		p = (i * 7919) % n;
+		put_be32(k, p);
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&p, 4));
+	}
+
+	put_be32(k, n + 1);
+	EXPECT_EQ(0, bp_delete(tree, k, 4, NULL));
+	EXPECT_EQ(-1, bp_delete(tree, k, 3, NULL));
+
+	// 删除所有的奇数
+	for (i = 0; i < n; i++) {
+		p = (i * 4999) % n;
+		if (p % 2 == 0)
+			continue;
+		put_be32(k, p);
+		ASSERT_EQ(1, bp_delete(tree, k, 4, NULL));
+	}
+	EXPECT_EQ((int)n / 2, bp_node_get_key_total(tree->head));
+
+	for (i = 0; i < n; i++) {
+		put_be32(k, i);
+		ASSERT_EQ(i % 2 == 0 ? 1 : 0,
+				  bp_search(tree, k, 4, (unsigned char *)&p));
+		if (i % 2 == 0) {
+			EXPECT_EQ(i, p);
+		}
+	}
+
+	cursor = bp_cursor_open(tree, NULL, NULL);
+	for (i = 0; bp_cursor_next(cursor, &key, &value); i++)
+		EXPECT_EQ(i * 2, *(unsigned int *)value);
+	EXPECT_EQ(n / 2, i);
+	bp_cursor_close(cursor);
+
+	// 只删除位置信息相同的重复 key
+	put_be32(k, 1);
+	for (i = 0; i < 3; i++) {
+		p = 10 + i;
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&p, 4));
+	}
+	p = 11;
+	EXPECT_EQ(1, bp_delete(tree, k, 4, (unsigned char *)&p));
+	EXPECT_EQ(0, bp_delete(tree, k, 4, (unsigned char *)&p));
+	ASSERT_EQ(2, bp_search_all(tree, k, 4, (unsigned char *)out, 4));
+	EXPECT_EQ(10u, out[0]);
+	EXPECT_EQ(12u, out[1]);
+
+	// 替换位置信息不移动数据项
+	p = 12;
+	i = 20;
+	EXPECT_EQ(1, bp_update(tree, k, 4, (unsigned char *)&p, (unsigned char *)&i));
+	EXPECT_EQ(0, bp_update(tree, k, 4, (unsigned char *)&p, (unsigned char *)&i));
+	i = 30;
+	EXPECT_EQ(1, bp_update(tree, k, 4, NULL, (unsigned char *)&i));
+	ASSERT_EQ(2, bp_search_all(tree, k, 4, (unsigned char *)out, 4));
+	EXPECT_EQ(30u, out[0]);
+	EXPECT_EQ(20u, out[1]);
+	put_be32(k, n + 1);
+	EXPECT_EQ(0, bp_update(tree, k, 4, NULL, (unsigned char *)&i));
+	put_be32(k, 1);
+	EXPECT_EQ(1, bp_delete(tree, k, 4, NULL));
+	EXPECT_EQ(1, bp_delete(tree, k, 4, NULL));
+	EXPECT_EQ(0, bp_delete(tree, k, 4, NULL));
+
+	// 全部删除后树恢复为空树，还可以继续插入
+	for (i = 0; i < n; i += 2) {
+		put_be32(k, i);
+		ASSERT_EQ(1, bp_delete(tree, k, 4, NULL));
+	}
+	EXPECT_EQ(BP_NODE_TYPE_INNER, tree->head->type);
+	EXPECT_EQ(0, bp_node_get_key_num(tree->head));
+	put_be32(k, 0);
+	EXPECT_EQ(0, bp_search(tree, k, 4, (unsigned char *)&p));
+	p = 7;
+	EXPECT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&p, 4));
+	EXPECT_EQ(1, bp_search(tree, k, 4, (unsigned char *)&p));
+	EXPECT_EQ(7u, p);
+
+	bp_destroy_tree(tree);
+}
+
+TEST(Tree, DeleteSmallFanout)
+{
+	bp_tree_t                *tree;
+	std::vector<unsigned int> count;
+	unsigned char             k[4];
+	unsigned int              p;
+	unsigned int              key;
+	int                       fanout[][2] = {{3, 3}, {3, 8}};
+	int                       layout;
+	int                       f;
+	int                       i;
+	unsigned int              q;
+
+	// 删除会留下比子树实际最大值大的分界，之后的分裂不能让下层结点的最大值比上层的
+	// 分界小，否则查找在内部结点上越界，找不到存在的 key
+	for (layout = BP_LAYOUT_INTERLEAVED; layout <= BP_LAYOUT_PREFIX; layout++) {
+		for (f = 0; f < 2; f++) {
+			tree = bp_create_tree_with_layout(fanout[f][0], fanout[f][1], 4, 4,
+											  NULL, (bp_layout_e)layout);
+			ASSERT_TRUE(tree != NULL);
+			count.assign(48, 0);
+			srand(layout * 2 + f);
+			for (i = 0; i < 3000; i++) {
+				key = rand() % 48;
+				p   = i;
+				put_be32(k, key);
+				if (rand() % 2) {
+					ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&p, 4));
+					count[key] += 1;
+				} else {
+					ASSERT_EQ(count[key] ? 1 : 0, bp_delete(tree, k, 4, NULL));
+					count[key] -= count[key] ? 1 : 0;
+				}
+
+				for (q = 0; q < 48; q++) {
+					put_be32(k, q);
+					ASSERT_EQ(count[q] ? 1 : 0,
+							  bp_search(tree, k, 4, (unsigned char *)&p))
+						<< "layout " << layout << " op " << i << " key " << q;
+				}
+			}
+			bp_destroy_tree(tree);
+		}
+	}
+}
+
+static int reverse_compare(unsigned char *a, unsigned char *b, int size)
+{
+	return memcmp(b, a, size);
+}
+
+TEST(Tree, FixedKey)
+{
+	static const int  sizes[] = {4, 8, 16, 3};
+	bp_tree_t        *tree;
+	bp_cursor_t      *cursor;
+	unsigned char    *keys;
+	unsigned char    *key;
+	unsigned char    *value;
+	unsigned char     prev[16];
+	unsigned int      p;
+	unsigned int      i;
+	unsigned int      j;
+	unsigned int      n;
+	int               size;
+
+	n    = 3000;
+	keys = (unsigned char *)malloc(n * 16);
+	for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+		size = sizes[j];
+		tree = bp_create_tree(8, 16, size, 4, NULL);
+		ASSERT_TRUE(tree != NULL);
+
+		// 每个 key 的每个字节都不一样，保证高位和低位都会参与比较
+		srand(j);
+		for (i = 0; i < n * size; i++)
+			keys[i] = rand() & 0xff;
+		for (i = 0; i < n; i++) {
+			keys[i * size] = i & 0xff;
+			keys[i * size + size - 1] = (i >> 8) & 0xff;
+			ASSERT_EQ(0, bp_insert(tree, keys + i * size, size,
+								   (unsigned char *)&i, 4));
+		}
+
+		for (i = 0; i < n; i++) {
+			ASSERT_EQ(1, bp_search(tree, keys + i * size, size,
+								   (unsigned char *)&p));
+			EXPECT_EQ(i, p);
+		}
+
+		cursor = bp_cursor_open(tree, NULL, NULL);
+		memset(prev, 0, sizeof(prev));
+		for (i = 0; bp_cursor_next(cursor, &key, &value); i++) {
+			EXPECT_LE(memcmp(prev, key, size), 0);
+			memcpy(prev, key, size);
+		}
+		EXPECT_EQ(n, i);
+		bp_cursor_close(cursor);
+		bp_destroy_tree(tree);
+	}
+
+	// 指定了比较函数时按比较函数的顺序排列
+	tree = bp_create_tree(8, 16, 4, 4, reverse_compare);
+	for (i = 0; i < 100; i++) {
+		put_be32(prev, i);
+		ASSERT_EQ(0, bp_insert(tree, prev, 4, (unsigned char *)&i, 4));
+	}
+	cursor = bp_cursor_open(tree, NULL, NULL);
+	for (i = 0; bp_cursor_next(cursor, &key, &value); i++)
+		EXPECT_EQ(99 - i, *(unsigned int *)value);
+	EXPECT_EQ(100u, i);
+	bp_cursor_close(cursor);
+	bp_destroy_tree(tree);
+
+	free(keys);
+}
+
+TEST(Tree, Freeze)
+{
+	static const int  key_sizes[] = {4, 8, 16, 6};
+	bp_tree_t        *tree;
+	bp_cursor_t      *cursor;
+	unsigned char     k[16];
+	unsigned char     hi[16];
+	unsigned char    *key;
+	unsigned char    *value;
+	unsigned int      values[4];
+	unsigned int      p;
+	unsigned int      i;
+	unsigned int      n;
+	size_t            t;
+	int               key_size;
+	int               expected;
+
+	n = 3000;
+	for (t = 0; t < 2 * sizeof(key_sizes) / sizeof(key_sizes[0]); t++) {
+		// 每种 key 的长度分别用 memcmp 的顺序和 reverse_compare 的顺序
+		key_size = key_sizes[t % 4];
+		tree = bp_create_tree(8, 37, key_size, sizeof(p),
+							  t < 4 ? NULL : reverse_compare);
+		ASSERT_TRUE(tree != NULL);
+
+		// 偶数的 key 插入两次，奇数的 key 不插入
+		memset(k, 0, sizeof(k));
+		for (i = 0; i < 2 * n; i++) {
+			p = i;
+			put_be32(k + key_size - 4, 2 * ((i * 7919) % n));
+			ASSERT_EQ(0, bp_insert(tree, k, key_size, (unsigned char *)&p,
+								   sizeof(p)));
+		}
+		ASSERT_EQ(0, bp_freeze(tree));
+		EXPECT_EQ(0, bp_freeze(tree));
+
+		// 冻结之后只能查找
+		EXPECT_EQ(-1, bp_insert(tree, k, key_size, (unsigned char *)&p, sizeof(p)));
+		EXPECT_EQ(-1, bp_insert_batch(tree, k, (unsigned char *)&p, 1));
+		EXPECT_EQ(-1, bp_delete(tree, k, key_size, NULL));
+
+		for (i = 0; i < 2 * n + 2; i++) {
+			put_be32(k + key_size - 4, i);
+			expected = i % 2 == 0 && i < 2 * n ? 2 : 0;
+			ASSERT_EQ(expected, bp_search_all(tree, k, key_size,
+											  (unsigned char *)values, 4));
+			ASSERT_EQ(expected / 2, bp_search(tree, k, key_size, (unsigned char *)&p));
+			if (expected) {
+				EXPECT_EQ(i / 2, (values[0] * 7919) % n);
+				EXPECT_EQ(values[0] + n, values[1]);
+			}
+		}
+
+		// 游标仍然按排好的顺序访问
+		memset(hi, 0, sizeof(hi));
+		put_be32(k + key_size - 4, t < 4 ? 101 : 899);
+		put_be32(hi + key_size - 4, t < 4 ? 899 : 101);
+		cursor = bp_cursor_open(tree, k, hi);
+		for (i = 0; bp_cursor_next(cursor, &key, &value); i++) {
+			if (t < 4) {
+				EXPECT_EQ(102 + i / 2 * 2, get_be32(key + key_size - 4));
+			} else {
+				EXPECT_EQ(898 - i / 2 * 2, get_be32(key + key_size - 4));
+			}
+		}
+		EXPECT_EQ(2 * 399u, i);
+		bp_cursor_close(cursor);
+
+		bp_thaw(tree);
+		put_be32(k + key_size - 4, 1);
+		EXPECT_EQ(0, bp_insert(tree, k, key_size, (unsigned char *)&p, sizeof(p)));
+		EXPECT_EQ(1, bp_delete(tree, k, key_size, NULL));
+
+		// 释放冻结的树时也会释放 Eytzinger 顺序的 key
+		ASSERT_EQ(0, bp_freeze(tree));
+		bp_destroy_tree(tree);
+	}
+}
+
+TEST(Tree, InsertBuffer)
+{
+	static const int  buf_sizes[] = {16, 1000};
+	bp_tree_t        *tree;
+	bp_cursor_t      *cursor;
+	unsigned char     k[8];
+	unsigned char    *key;
+	unsigned char    *value;
+	unsigned char     last[8];
+	unsigned int      values[8];
+	unsigned int      p;
+	unsigned int      i;
+	unsigned int      j;
+	unsigned int      n;
+	size_t            t;
+	bp_tree_stats_t   stats;
+	int               key_size;
+	int               ibuf_num;
+	int               rank;
+	int               num;
+
+	tree = bp_create_concurrent_tree(8, 16, 4, 4, NULL);
+	EXPECT_EQ(-1, bp_tree_set_insert_buffer(tree, 16));
+	bp_destroy_tree(tree);
+
+	n = 5000;
+	for (t = 0; t < 4; t++) {
+		// 按 memcmp 比较的 key 用基数排序，自定义的比较函数用归并排序
+		key_size = t < 2 ? 6 : 4;
+		tree = bp_create_tree(8, 37, key_size, sizeof(p),
+							  t < 2 ? NULL : reverse_compare);
+		ASSERT_TRUE(tree != NULL);
+		ASSERT_EQ(0, bp_tree_set_insert_buffer(tree, buf_sizes[t % 2]));
+
+		// 每个 key 插入 4 次，每插入一部分查找一次，查找可能在缓冲中也可能在树上
+		memset(k, 0, sizeof(k));
+		for (i = 0; i < 4 * n; i++) {
+			p = i;
+			put_be32(k + key_size - 4, (i * 7919) % n);
+			ASSERT_EQ(0, bp_insert(tree, k, key_size, (unsigned char *)&p,
+								   sizeof(p)));
+			if (i % 97)
+				continue;
+
+			j = i / n + 1;
+			ASSERT_EQ((int)j, bp_search_all(tree, k, key_size,
+											(unsigned char *)values, 8));
+			EXPECT_TRUE(std::find(values, values + j, i) != values + j);
+			ASSERT_EQ(1, bp_search(tree, k, key_size, (unsigned char *)&p));
+			EXPECT_EQ(i % n, p % n);
+		}
+
+		for (i = 0; i < n; i++) {
+			put_be32(k + key_size - 4, (i * 7919) % n);
+			ASSERT_EQ(4, bp_search_all(tree, k, key_size,
+									   (unsigned char *)values, 8));
+			std::sort(values, values + 4);
+			for (j = 0; j < 4; j++)
+				EXPECT_EQ(i + j * n, values[j]);
+		}
+		put_be32(k + key_size - 4, n);
+		EXPECT_EQ(0, bp_search(tree, k, key_size, (unsigned char *)&p));
+
+		// 删除之前先合并缓冲
+		put_be32(k + key_size - 4, 7919 % n);
+		p = 4 * n;
+		ASSERT_EQ(0, bp_insert(tree, k, key_size, (unsigned char *)&p, sizeof(p)));
+		EXPECT_LT(0, tree->ibuf_num);
+
+		// 统计、排名和游标直接访问缓冲，不合并
+		ibuf_num = tree->ibuf_num;
+		ASSERT_EQ(0, bp_tree_stats(tree, &stats));
+		EXPECT_EQ(ibuf_num, stats.ibuf_num);
+		EXPECT_EQ(4 * n + 1, stats.key_num + stats.ibuf_num);
+		EXPECT_EQ(5, bp_count_range(tree, k, k));
+		EXPECT_EQ(4 * n + 1, bp_count_range(tree, NULL, NULL));
+		for (i = 0; i < 4 * n + 1; i += 13) {
+			ASSERT_EQ(1, bp_select(tree, i, last, NULL));
+			rank = bp_rank(tree, last, key_size);
+			num  = bp_count_range(tree, last, last);
+			EXPECT_LE(rank, (int)i);
+			EXPECT_LT((int)i, rank + num);
+		}
+		EXPECT_EQ(0, bp_select(tree, 4 * n + 1, last, NULL));
+
+		cursor = bp_cursor_open(tree, NULL, NULL);
+		for (i = 0; bp_cursor_next(cursor, &key, &value); i++) {
+			if (i)
+				EXPECT_LE(bp_rank(tree, last, key_size),
+						  bp_rank(tree, key, key_size));
+			memcpy(last, key, key_size);
+		}
+		EXPECT_EQ(4 * n + 1, i);
+		bp_cursor_close(cursor);
+
+		cursor = bp_cursor_open(tree, k, k);
+		for (i = 0; (num = bp_cursor_next_run(cursor, &key)) > 0; i += num) {
+			for (j = 0; j < (unsigned int)num; j++)
+				EXPECT_EQ(0, memcmp(k, key + j * (key_size + sizeof(p)),
+									key_size));
+		}
+		EXPECT_EQ(0, num);
+		EXPECT_EQ(5, i);
+		bp_cursor_close(cursor);
+		EXPECT_EQ(ibuf_num, tree->ibuf_num);
+
+		p = 1;
+		ASSERT_EQ(1, bp_delete(tree, k, key_size, (unsigned char *)&p));
+		EXPECT_EQ(0, tree->ibuf_num);
+		ASSERT_EQ(4, bp_search_all(tree, k, key_size, (unsigned char *)values, 8));
+		EXPECT_TRUE(std::find(values, values + 4, 4 * n) != values + 4);
+
+		// 游标按顺序返回缓冲和树上的数据
+		p = 2;
+		ASSERT_EQ(0, bp_insert(tree, k, key_size, (unsigned char *)&p, sizeof(p)));
+		cursor = bp_cursor_open(tree, NULL, NULL);
+		for (i = 0; bp_cursor_next(cursor, &key, &value); i++)
+			;
+		EXPECT_EQ(4 * n + 1, i);
+		bp_cursor_close(cursor);
+
+		ASSERT_EQ(0, bp_insert(tree, k, key_size, (unsigned char *)&p, sizeof(p)));
+		ASSERT_EQ(0, bp_tree_set_insert_buffer(tree, 0));
+		EXPECT_EQ(6, bp_search_all(tree, k, key_size, (unsigned char *)values, 8));
+		ASSERT_EQ(0, bp_tree_set_insert_buffer(tree, 8));
+		ASSERT_EQ(0, bp_insert(tree, k, key_size, (unsigned char *)&p, sizeof(p)));
+		bp_destroy_tree(tree);
+	}
+}
+
+TEST(Simd, Count)
+{
+	static const int  strides[] = {4, 8, 12};
+	unsigned char     buf[40 * 16];
+	unsigned int      k;
+	int               level;
+	int               pass;
+	int               stride;
+	int               num;
+	int               expect;
+	int               i;
+	int               j;
+
+	// 支持 AVX2 时也检查 SSE4.2 的函数，不使用 SIMD 时结果一样
+	level = bp_simd_get_level();
+	for (k = 0; k < 3 * sizeof(strides) / sizeof(strides[0]); k++) {
+		pass          = k % 3;
+		stride        = strides[k / 3];
+		bp_simd_set_level(0 == pass ? level : (1 == pass && 2 == level ? 1 : 0));
+		// key 有重复，并且跨过了符号位
+		for (i = 0; i < 40; i++) {
+			put_be32(buf + i * stride, 0x7ffffff0u + i / 2 * 4);
+			if (stride >= 8)
+				put_be32(buf + i * stride + 4, i);
+		}
+
+		for (num = 0; num <= 40; num++) {
+			for (j = 0; j < 50; j++) {
+				uint32_t key = 0x7fffffeeu + j * 2;
+				expect = 0;
+				for (i = 0; i < num; i++)
+					expect += 0x7ffffff0u + i / 2 * 4 < key;
+				EXPECT_EQ(expect, bp_simd_count_be32(buf, num, stride, key, 0));
+				expect = 0;
+				for (i = 0; i < num; i++)
+					expect += 0x7ffffff0u + i / 2 * 4 <= key;
+				EXPECT_EQ(expect, bp_simd_count_be32(buf, num, stride, key, 1));
+
+				if (stride < 8)
+					continue;
+				uint64_t key64 = ((uint64_t)key << 32) | (j % 4);
+				expect = 0;
+				for (i = 0; i < num; i++)
+					expect += (((uint64_t)(0x7ffffff0u + i / 2 * 4) << 32) | i)
+						< key64;
+				EXPECT_EQ(expect,
+						  bp_simd_count_be64(buf, num, stride, key64, 0));
+				expect = 0;
+				for (i = 0; i < num; i++)
+					expect += (((uint64_t)(0x7ffffff0u + i / 2 * 4) << 32) | i)
+						<= key64;
+				EXPECT_EQ(expect,
+						  bp_simd_count_be64(buf, num, stride, key64, 1));
+			}
+		}
+	}
+	bp_simd_set_level(level);
+}
+
+TEST(Simd, Tree)
+{
+	bp_tree_t     *tree;
+	unsigned char  key[8];
+	unsigned int   p;
+	unsigned int   i;
+	int            level;
+	int            pass;
+
+	level = bp_simd_get_level();
+	for (pass = 0; pass < 2; pass++) {
+		bp_simd_set_level(pass ? 0 : level);
+
+		tree = bp_create_tree(64, 64, 4, 4, NULL);
+		for (i = 0; i < 5000; i++) {
+			put_be32(key, i * 2);
+			ASSERT_EQ(0, bp_insert(tree, key, 4, (unsigned char *)&i, 4));
+		}
+		for (i = 0; i < 10000; i++) {
+			put_be32(key, i);
+			EXPECT_EQ((int)(i % 2 == 0), bp_search(tree, key, 4,
+												   (unsigned char *)&p));
+			if (i % 2 == 0) {
+				EXPECT_EQ(i / 2, p);
+			}
+		}
+		bp_destroy_tree(tree);
+
+		tree = bp_create_tree(64, 64, 8, 4, NULL);
+		for (i = 0; i < 5000; i++) {
+			put_be32(key, i);
+			put_be32(key + 4, i * 2);
+			ASSERT_EQ(0, bp_insert(tree, key, 8, (unsigned char *)&i, 4));
+		}
+		for (i = 0; i < 5000; i++) {
+			put_be32(key, i);
+			put_be32(key + 4, i * 2);
+			ASSERT_EQ(1, bp_search(tree, key, 8, (unsigned char *)&p));
+			EXPECT_EQ(i, p);
+			put_be32(key + 4, i * 2 + 1);
+			EXPECT_EQ(0, bp_search(tree, key, 8, (unsigned char *)&p));
+		}
+		bp_destroy_tree(tree);
+	}
+	bp_simd_set_level(level);
+}
+
+TEST(Tree, SplitLayout)
+{
+	bp_tree_t     *tree;
+	bp_cursor_t   *cursor;
+	unsigned char *key;
+	unsigned char *value;
+	unsigned char *items;
+	unsigned char *content;
+	unsigned char  k[4];
+	unsigned int   values[4];
+	unsigned int   batch[200];
+	unsigned int   p;
+	unsigned int   i;
+	unsigned int   n;
+
+	tree = bp_create_tree_with_layout(4, 8, 4, 4, NULL, BP_LAYOUT_SPLIT);
+	ASSERT_TRUE(tree != NULL);
+	EXPECT_EQ(BP_LAYOUT_SPLIT, tree->layout);
+
+	// 每个 key 插入两次，相同的 key 会跨越数据结点
+	n = 1000;
+	for (i = 0; i < 2 * n; i++) {
+		put_be32(k, (i * 7) % n);
+		p = i;
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&p, 4));
+	}
+	for (i = 0; i < 200; i++)
+		put_be32((unsigned char *)&batch[i], n + i);
+	ASSERT_EQ(0, bp_insert_batch(tree, (unsigned char *)batch,
+								 (unsigned char *)batch, 200));
+
+	// 第一个数据结点上的 key 是连续保存的
+	content = bp_node_get_content(tree->data);
+	for (i = 0; i + 1 < (unsigned int)bp_node_get_key_num(tree->data); i++)
+		EXPECT_LE(memcmp(content + i * 4, content + (i + 1) * 4, 4), 0);
+
+	for (i = 0; i < n; i++) {
+		put_be32(k, i);
+		ASSERT_EQ(2, bp_search_all(tree, k, 4, (unsigned char *)values, 4));
+		EXPECT_EQ(i, (values[0] * 7) % n);
+		EXPECT_EQ(i, (values[1] * 7) % n);
+	}
+	for (i = 0; i < 200; i++) {
+		put_be32(k, n + i);
+		ASSERT_EQ(1, bp_search(tree, k, 4, (unsigned char *)&p));
+		EXPECT_EQ(batch[i], p);
+	}
+
+	cursor = bp_cursor_open(tree, NULL, NULL);
+	EXPECT_EQ(-1, bp_cursor_next_run(cursor, &items));
+	bp_cursor_close(cursor);
+
+	put_be32(k, 10);
+	cursor = bp_cursor_open(tree, k, NULL);
+	for (i = 0; bp_cursor_next(cursor, &key, &value) && i < 20; i++) {
+		put_be32(k, 10 + i / 2);
+		EXPECT_EQ(0, memcmp(k, key, 4));
+	}
+	bp_cursor_close(cursor);
+
+	// 删除所有数据，合并和借数据都会移动分开保存的 key 和 value
+	for (i = 0; i < 2 * n; i++) {
+		put_be32(k, (i * 7) % n);
+		p = i;
+		ASSERT_EQ(1, bp_delete(tree, k, 4, (unsigned char *)&p));
+	}
+	for (i = 0; i < 200; i++) {
+		put_be32(k, n + i);
+		ASSERT_EQ(1, bp_delete(tree, k, 4, NULL));
+	}
+	EXPECT_EQ(0, bp_node_get_key_num(tree->head));
+	put_be32(k, 1);
+	EXPECT_EQ(0, bp_search(tree, k, 4, (unsigned char *)&p));
+
+	bp_destroy_tree(tree);
+}
+
+static void put_prefix_key(unsigned char *k, unsigned int group, unsigned int i)
+{
+	static const unsigned char prefix[10] = {
+		0x20, 0x01, 0x0d, 0xb8, 0x85, 0xa3, 0x00, 0x00, 0x8a, 0x2e};
+
+	memcpy(k, prefix, sizeof(prefix));
+	k[10] = group >> 8;
+	k[11] = group & 0xff;
+	put_be32(k + 12, i);
+}
+
+static int inner_depth(bp_tree_t *tree, int key_size)
+{
+	bp_node_t *node;
+	int        depth;
+
+	// 内部结点的第一个子结点指针总是在前缀之后的第一个位置
+	node = tree->head;
+	for (depth = 0; BP_NODE_TYPE_INNER == node->type; depth++)
+		node = *(bp_node_t **)(bp_node_get_content(node)
+			+ (BP_LAYOUT_PREFIX == tree->layout ? (key_size + 7) & ~7 : 0));
+
+	return depth;
+}
+
+TEST(Tree, PrefixLayout)
+{
+	bp_tree_t     *tree;
+	bp_tree_t     *plain;
+	bp_cursor_t   *cursor;
+	bp_cursor_t   *expect;
+	unsigned char *key;
+	unsigned char *value;
+	unsigned char *expect_key;
+	unsigned char *expect_value;
+	unsigned char  k[16];
+	unsigned char  batch_keys[300 * 16];
+	unsigned int   batch_values[300];
+	unsigned int   p;
+	unsigned int   q;
+	unsigned int   i;
+	unsigned int   n;
+
+	EXPECT_TRUE(NULL == bp_create_tree_with_layout(4, 8, 16, 4, reverse_compare,
+												   BP_LAYOUT_PREFIX));
+
+	tree  = bp_create_tree_with_layout(4, 8, 16, 4, NULL, BP_LAYOUT_PREFIX);
+	plain = bp_create_tree(4, 8, 16, 4, NULL);
+	ASSERT_TRUE(tree != NULL);
+	ASSERT_TRUE(plain != NULL);
+
+	// 所有的 key 都有 12 字节相同的前缀，内部结点可以保存更多的子结点
+	n = 20000;
+	for (i = 0; i < n; i++) {
+		p = (i * 7919) % n;
+		put_prefix_key(k, 0, p);
+		ASSERT_EQ(0, bp_insert(tree, k, 16, (unsigned char *)&p, 4));
+		ASSERT_EQ(0, bp_insert(plain, k, 16, (unsigned char *)&p, 4));
+	}
+	EXPECT_LT(inner_depth(tree, 16), inner_depth(plain, 16));
+
+	// 前缀不同的 key 会让结点缩短前缀，结点放不下时先分裂
+	for (i = 0; i < 2000; i++) {
+		p = n + i;
+		put_prefix_key(k, (i * 37) % 300, i);
+		k[i % 10] ^= i & 1 ? 0x80 : 0x01;
+		ASSERT_EQ(0, bp_insert(tree, k, 16, (unsigned char *)&p, 4));
+		ASSERT_EQ(0, bp_insert(plain, k, 16, (unsigned char *)&p, 4));
+	}
+	for (i = 0; i < 300; i++) {
+		put_prefix_key(batch_keys + i * 16, 500 + i % 3, i * 11);
+		batch_values[i] = 2 * n + i;
+	}
+	ASSERT_EQ(0, bp_insert_batch(tree, batch_keys, (unsigned char *)batch_values,
+								 300));
+	ASSERT_EQ(0, bp_insert_batch(plain, batch_keys,
+								 (unsigned char *)batch_values, 300));
+	EXPECT_EQ(bp_node_get_key_total(plain->head),
+			  bp_node_get_key_total(tree->head));
+
+	// 删除一部分数据，合并和借数据时前缀也要变成两个结点共有的部分
+	for (i = 0; i < n; i += 2) {
+		put_prefix_key(k, 0, i);
+		ASSERT_EQ(1, bp_delete(tree, k, 16, NULL));
+		ASSERT_EQ(1, bp_delete(plain, k, 16, NULL));
+	}
+
+	for (i = 0; i < n; i++) {
+		put_prefix_key(k, 0, i);
+		ASSERT_EQ(bp_search(plain, k, 16, (unsigned char *)&q),
+				  bp_search(tree, k, 16, (unsigned char *)&p));
+		if (i % 2) {
+			EXPECT_EQ(q, p);
+		}
+	}
+
+	cursor = bp_cursor_open(tree, NULL, NULL);
+	expect = bp_cursor_open(plain, NULL, NULL);
+	for (i = 0; bp_cursor_next(expect, &expect_key, &expect_value); i++) {
+		ASSERT_EQ(1, bp_cursor_next(cursor, &key, &value));
+		EXPECT_EQ(0, memcmp(expect_key, key, 16));
+	}
+	EXPECT_EQ(0, bp_cursor_next(cursor, &key, &value));
+	EXPECT_EQ(n / 2 + 2300, i);
+	bp_cursor_close(expect);
+	bp_cursor_close(cursor);
+
+	put_prefix_key(k, 500, 0);
+	cursor = bp_cursor_open(tree, k, NULL);
+	ASSERT_EQ(1, bp_cursor_next(cursor, &key, &value));
+	EXPECT_EQ(0, memcmp(k, key, 16));
+	bp_cursor_close(cursor);
+
+	// 删除所有数据后恢复成空树，还可以继续插入
+	for (i = 1; i < n; i += 2) {
+		put_prefix_key(k, 0, i);
+		ASSERT_EQ(1, bp_delete(tree, k, 16, NULL));
+	}
+	for (i = 0; i < 2000; i++) {
+		put_prefix_key(k, (i * 37) % 300, i);
+		k[i % 10] ^= i & 1 ? 0x80 : 0x01;
+		ASSERT_EQ(1, bp_delete(tree, k, 16, NULL));
+	}
+	for (i = 0; i < 300; i++)
+		ASSERT_EQ(1, bp_delete(tree, batch_keys + i * 16, 16, NULL));
+	EXPECT_EQ(0, bp_node_get_key_num(tree->head));
+
+	put_prefix_key(k, 7, 7);
+	p = 7;
+	ASSERT_EQ(0, bp_insert(tree, k, 16, (unsigned char *)&p, 4));
+	ASSERT_EQ(1, bp_search(tree, k, 16, (unsigned char *)&q));
+	EXPECT_EQ(p, q);
+
+	bp_destroy_tree(plain);
+	bp_destroy_tree(tree);
+}
+
+static int reverse_var_compare(unsigned char *a, int a_len, unsigned char *b, int b_len)
+{
+	std::string x((char *)a, a_len);
+	std::string y((char *)b, b_len);
+
+	return y.compare(x);
+}
+
+TEST(Var, Tree)
+{
+	bp_var_tree_t                      *tree;
+	bp_var_cursor_t                    *cursor;
+	std::map<std::string, std::string>  expect;
+	std::map<std::string, std::string>::iterator it;
+	std::string                         k;
+	std::string                         v;
+	unsigned char                      *key;
+	unsigned char                      *value;
+	unsigned char                       buf[512];
+	int                                 key_len;
+	int                                 value_len;
+	unsigned int                        i;
+	unsigned int                        n;
+
+	EXPECT_TRUE(NULL == bp_create_var_tree(100, NULL));
+	tree = bp_create_var_tree(1024, NULL);
+	ASSERT_TRUE(tree != NULL);
+
+	// 长度不同的 URL ，结点按使用的字节数分裂
+	n = 20000;
+	for (i = 0; i < n; i++) {
+		k = "https://host" + std::to_string((i * 7919) % 97) + ".example.com/"
+			+ std::string((i * 31) % 40, 'p') + std::to_string(i);
+		v = std::string(i % 9, 'v') + std::to_string(i);
+		expect[k] = v;
+		ASSERT_EQ(0, bp_var_insert(tree, (unsigned char *)k.data(), k.size(),
+								   (unsigned char *)v.data(), v.size()));
+	}
+	EXPECT_EQ(-1, bp_var_insert(tree, buf, sizeof(buf), buf, 0));
+
+	// 空的 key 和 value 也可以保存，比所有的 key 都小
+	ASSERT_EQ(0, bp_var_insert(tree, buf, 0, buf, 0));
+	ASSERT_EQ(1, bp_var_search(tree, buf, 0, buf, sizeof(buf), &value_len));
+	EXPECT_EQ(0, value_len);
+	cursor = bp_var_cursor_open(tree, NULL, 0, NULL, 0);
+	ASSERT_EQ(1, bp_var_cursor_next(cursor, &key, &key_len, &value, &value_len));
+	EXPECT_EQ(0, key_len);
+	bp_var_cursor_close(cursor);
+	ASSERT_EQ(1, bp_var_delete(tree, buf, 0));
+
+	for (it = expect.begin(); it != expect.end(); ++it) {
+		ASSERT_EQ(1, bp_var_search(tree, (unsigned char *)it->first.data(),
+								   it->first.size(), buf, sizeof(buf),
+								   &value_len));
+		EXPECT_EQ(it->second, std::string((char *)buf, value_len));
+	}
+	k = "https://host1.example.com/x";
+	EXPECT_EQ(0, bp_var_search(tree, (unsigned char *)k.data(), k.size(), buf,
+							   sizeof(buf), NULL));
+
+	// 删除一半的数据，结点使用的字节数太少时和兄弟结点合并
+	for (i = 0, it = expect.begin(); it != expect.end(); i++) {
+		if (i % 2) {
+			++it;
+			continue;
+		}
+		ASSERT_EQ(1, bp_var_delete(tree, (unsigned char *)it->first.data(),
+								   it->first.size()));
+		expect.erase(it++);
+	}
+	EXPECT_EQ(0, bp_var_delete(tree, (unsigned char *)k.data(), k.size()));
+
+	cursor = bp_var_cursor_open(tree, NULL, 0, NULL, 0);
+	for (it = expect.begin(); it != expect.end(); ++it) {
+		ASSERT_EQ(1, bp_var_cursor_next(cursor, &key, &key_len, &value,
+										&value_len));
+		EXPECT_EQ(it->first, std::string((char *)key, key_len));
+		EXPECT_EQ(it->second, std::string((char *)value, value_len));
+	}
+	EXPECT_EQ(0, bp_var_cursor_next(cursor, &key, &key_len, &value, &value_len));
+	bp_var_cursor_close(cursor);
+
+	// 范围查找的上下限不需要在树上
+	k = "https://host3";
+	v = "https://host4";
+	cursor = bp_var_cursor_open(tree, (unsigned char *)k.data(), k.size(),
+								(unsigned char *)v.data(), v.size());
+	for (it = expect.lower_bound(k); it != expect.upper_bound(v); ++it) {
+		ASSERT_EQ(1, bp_var_cursor_next(cursor, &key, &key_len, &value,
+										&value_len));
+		EXPECT_EQ(it->first, std::string((char *)key, key_len));
+	}
+	EXPECT_EQ(0, bp_var_cursor_next(cursor, &key, &key_len, &value, &value_len));
+	bp_var_cursor_close(cursor);
+
+	for (it = expect.begin(); it != expect.end(); ++it)
+		ASSERT_EQ(1, bp_var_delete(tree, (unsigned char *)it->first.data(),
+								   it->first.size()));
+	cursor = bp_var_cursor_open(tree, NULL, 0, NULL, 0);
+	EXPECT_EQ(0, bp_var_cursor_next(cursor, &key, &key_len, &value, &value_len));
+	bp_var_cursor_close(cursor);
+	bp_destroy_var_tree(tree);
+
+	// 相同的 key 按插入的顺序保存，自定义的比较函数决定顺序
+	tree = bp_create_var_tree(256, reverse_var_compare);
+	ASSERT_TRUE(tree != NULL);
+	for (i = 0; i < 3000; i++) {
+		k = std::to_string(i % 300);
+		v = std::to_string(i);
+		ASSERT_EQ(0, bp_var_insert(tree, (unsigned char *)k.data(), k.size(),
+								   (unsigned char *)v.data(), v.size()));
+	}
+	cursor = bp_var_cursor_open(tree, NULL, 0, NULL, 0);
+	for (i = 0; bp_var_cursor_next(cursor, &key, &key_len, &value, &value_len);
+		 i++) {
+		v = std::string((char *)key, key_len);
+		if (i % 10) {
+			EXPECT_EQ(k, v);
+		} else if (i > 0) {
+			EXPECT_GT(k, v);
+		}
+		k = v;
+		v = std::string((char *)value, value_len);
+		EXPECT_EQ(std::to_string((i % 10) * 300 + std::stoi(k)), v);
+	}
+	EXPECT_EQ(3000u, i);
+	bp_var_cursor_close(cursor);
+
+	// 每次删除的都是最早插入的数据项
+	for (i = 0; i < 3000; i++) {
+		k = std::to_string(i % 300);
+		ASSERT_EQ(1, bp_var_search(tree, (unsigned char *)k.data(), k.size(),
+								   buf, sizeof(buf), &value_len));
+		EXPECT_EQ(std::to_string(i), std::string((char *)buf, value_len));
+		ASSERT_EQ(1, bp_var_delete(tree, (unsigned char *)k.data(), k.size()));
+	}
+	EXPECT_EQ(0, bp_var_delete(tree, (unsigned char *)k.data(), k.size()));
+	bp_destroy_var_tree(tree);
+}
+
+TEST(Posting, Tree)
+{
+	bp_posting_tree_t                          *tree;
+	std::map<unsigned int, std::multiset<unsigned int> >   expect;
+	std::map<unsigned int, std::multiset<unsigned int> >::iterator it;
+	std::multiset<unsigned int>::iterator       pos;
+	std::vector<unsigned char>                  out;
+	unsigned char                               k[4];
+	unsigned char                               v[4];
+	unsigned int                                i;
+	unsigned int                                n;
+	int                                         num;
+
+	EXPECT_TRUE(NULL == bp_create_posting_tree(16, 16, 4, 9, NULL));
+	tree = bp_create_posting_tree(16, 16, 4, 4, NULL);
+	ASSERT_TRUE(tree != NULL);
+
+	// 一个 key 上有大量按顺序追加的位置信息，其它 key 上的位置信息是乱序的
+	n = 100000;
+	put_be32(k, 7);
+	for (i = 0; i < n; i++) {
+		put_be32(v, i * 3);
+		ASSERT_EQ(0, bp_posting_tree_insert(tree, k, 4, v, 4));
+		expect[7].insert(i * 3);
+	}
+	for (i = 0; i < 20000; i++) {
+		put_be32(k, (i * 7919) % 301);
+		put_be32(v, (i * 104729) % 5003);
+		ASSERT_EQ(0, bp_posting_tree_insert(tree, k, 4, v, 4));
+		expect[(i * 7919) % 301].insert((i * 104729) % 5003);
+	}
+	EXPECT_EQ(-1, bp_posting_tree_insert(tree, k, 4, v, 3));
+
+	put_be32(k, 7);
+	EXPECT_EQ((int64_t)expect[7].size(), bp_posting_tree_count(tree, k, 4));
+	ASSERT_EQ(1, bp_posting_tree_search(tree, k, 4, v));
+	EXPECT_EQ(0u, get_be32(v));
+	ASSERT_EQ(1, bp_posting_tree_search_last(tree, k, 4, v));
+	EXPECT_EQ(*expect[7].rbegin(), get_be32(v));
+
+	out.resize(4 * 10);
+	ASSERT_EQ(10, bp_posting_tree_search_all(tree, k, 4, 50000, out.data(), 10));
+	pos = expect[7].begin();
+	std::advance(pos, 50000);
+	for (i = 0; i < 10; i++, ++pos)
+		EXPECT_EQ(*pos, get_be32(out.data() + i * 4));
+
+	put_be32(k, 1000);
+	EXPECT_EQ(0, bp_posting_tree_count(tree, k, 4));
+	EXPECT_EQ(0, bp_posting_tree_search(tree, k, 4, v));
+	EXPECT_EQ(0, bp_posting_tree_delete(tree, k, 4, NULL));
+
+	// 删除一部分位置信息，只剩一个位置信息的 key 重新保存在数据项中
+	for (it = expect.begin(); it != expect.end(); ++it) {
+		put_be32(k, it->first);
+		for (pos = it->second.begin(); pos != it->second.end();) {
+			if (it->second.size() > 1 && (*pos % 2 || it->first == 7)) {
+				put_be32(v, *pos);
+				ASSERT_EQ(1, bp_posting_tree_delete(tree, k, 4, v));
+				it->second.erase(pos++);
+			} else {
+				++pos;
+			}
+		}
+		put_be32(v, 5004);
+		EXPECT_EQ(0, bp_posting_tree_delete(tree, k, 4, v));
+	}
+
+	for (it = expect.begin(); it != expect.end(); ++it) {
+		put_be32(k, it->first);
+		ASSERT_EQ((int64_t)it->second.size(), bp_posting_tree_count(tree, k, 4));
+		out.resize(4 * it->second.size());
+		num = bp_posting_tree_search_all(tree, k, 4, 0, out.data(),
+										 it->second.size());
+		ASSERT_EQ((int)it->second.size(), num);
+		for (i = 0, pos = it->second.begin(); pos != it->second.end(); ++pos, i++)
+			EXPECT_EQ(*pos, get_be32(out.data() + i * 4));
+		ASSERT_EQ(1, bp_posting_tree_search(tree, k, 4, v));
+		EXPECT_EQ(*it->second.begin(), get_be32(v));
+		ASSERT_EQ(1, bp_posting_tree_search_last(tree, k, 4, v));
+		EXPECT_EQ(*it->second.rbegin(), get_be32(v));
+	}
+
+	// 和 bp_delete 一样， value 为 NULL 时每次只删除最小的位置信息
+	for (it = expect.begin(); it != expect.end(); ++it) {
+		put_be32(k, it->first);
+		for (pos = it->second.begin(); pos != it->second.end();) {
+			ASSERT_EQ(1, bp_posting_tree_search(tree, k, 4, v));
+			EXPECT_EQ(*pos, get_be32(v));
+			ASSERT_EQ(1, bp_posting_tree_delete(tree, k, 4, NULL));
+			it->second.erase(pos++);
+			EXPECT_EQ((int64_t)it->second.size(), bp_posting_tree_count(tree, k, 4));
+		}
+		EXPECT_EQ(0, bp_posting_tree_delete(tree, k, 4, NULL));
+	}
+	bp_destroy_posting_tree(tree);
+}
+
+TEST(Cxx, Tree)
+{
+	bplus::tree<int32_t, uint32_t>                 ints;
+	bplus::tree<uint64_t, std::string, 4, 8>       strs;
+	bplus::tree<int, int, 4, 8, std::greater<int>> desc;
+	std::vector<int32_t>                           keys;
+	std::string                                    s;
+	uint32_t                                       v;
+	int                                            i;
+
+	// 默认的结点大小按内存页计算，整数 key 在C核心里按大端整数比较
+	EXPECT_EQ(4096 / 12, (bplus::tree<int32_t, uint32_t>::inner_fanout));
+	EXPECT_EQ(4096 / 8, (bplus::tree<int32_t, uint32_t>::leaf_fanout));
+	EXPECT_EQ(4, ints.native_handle()->key_size);
+
+	for (i = 0; i < 1000; i++)
+		ASSERT_TRUE(ints.insert(i * 7919 % 1000 - 500, (uint32_t)i));
+	EXPECT_EQ(1000u, ints.size());
+	ASSERT_TRUE(ints.find(7919 % 1000 - 500, v));
+	EXPECT_EQ(1u, v);
+	EXPECT_FALSE(ints.contains(1000));
+
+	ints.for_each(-3, 3, [&](int32_t k, uint32_t) { keys.push_back(k); });
+	ASSERT_EQ(7u, keys.size());
+	for (i = 0; i < 7; i++)
+		EXPECT_EQ(i - 3, keys[i]);
+	keys.clear();
+	ints.for_each([&](int32_t k, uint32_t) { keys.push_back(k); });
+	ASSERT_EQ(1000u, keys.size());
+	EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()));
+
+	// std::string 不能按字节复制，移动到树里保存
+	for (i = 0; i < 300; i++) {
+		s = std::to_string(i) + std::string(40, 'x');
+		ASSERT_TRUE(strs.insert(i % 100, std::move(s)));
+	}
+	EXPECT_EQ(300u, strs.size());
+	EXPECT_EQ(3u, strs.count(42));
+	ASSERT_TRUE(strs.find(42, s));
+	EXPECT_EQ(42, std::stoi(s) % 100);
+	EXPECT_EQ(3u, strs.erase(42));
+	EXPECT_EQ(0u, strs.erase(42));
+	EXPECT_FALSE(strs.contains(42));
+	EXPECT_EQ(297u, strs.size());
+	i = 0;
+	strs.for_each(10, 11, [&](uint64_t k, const std::string &value) {
+		EXPECT_EQ(k, (uint64_t)std::stoi(value) % 100);
+		i++;
+	});
+	EXPECT_EQ(6, i);
+
+	// 自定义比较函数的 key 原样保存
+	for (i = 0; i < 100; i++)
+		ASSERT_TRUE(desc.insert(i, -i));
+	keys.clear();
+	desc.for_each([&](int k, int value) {
+		EXPECT_EQ(-k, value);
+		keys.push_back(k);
+	});
+	ASSERT_EQ(100u, keys.size());
+	EXPECT_EQ(99, keys.front());
+	EXPECT_EQ(0, keys.back());
+
+	bplus::tree<int, int, 4, 8, std::greater<int>> moved(std::move(desc));
+	EXPECT_EQ(100u, moved.size());
+}
+
+TEST(Tree, Concurrent)
+{
+	bp_tree_t                *tree;
+	std::vector<std::thread>  threads;
+	std::atomic<int>          stop(0);
+	std::atomic<int>          missed(0);
+	unsigned char             k[4];
+	unsigned int              p;
+	unsigned int              i;
+	unsigned int              n;
+	int                       t;
+
+	tree = bp_create_concurrent_tree(4, 8, 4, 4, NULL);
+	ASSERT_TRUE(tree != NULL);
+
+	// 偶数的 key 一直在树上，查找必须每次都能找到
+	n = 4000;
+	for (i = 0; i < n; i++) {
+		put_be32(k, i * 2);
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&i, 4));
+	}
+
+	for (t = 0; t < 3; t++)
+		threads.emplace_back([&, t]() {
+			unsigned char key[4];
+			unsigned int  value;
+			unsigned int  j;
+
+			for (j = t; !stop.load() || j < 20000; j += 7) {
+				put_be32(key, (j % n) * 2);
+				if (1 != bp_search(tree, key, 4, (unsigned char *)&value)
+					|| value != j % n)
+					missed += 1;
+			}
+		});
+
+	// 两个写线程分别插入和删除奇数的 key ，会让结点分裂、合并和借数据
+	for (t = 0; t < 2; t++)
+		threads.emplace_back([&, t]() {
+			unsigned char key[4];
+			unsigned int  value;
+			unsigned int  round;
+			unsigned int  j;
+
+			for (round = 0; round < 3; round++) {
+				for (j = t; j < n; j += 2) {
+					put_be32(key, j * 2 + 1);
+					value = j;
+					bp_insert(tree, key, 4, (unsigned char *)&value, 4);
+				}
+				for (j = t; j < n; j += 2) {
+					put_be32(key, j * 2 + 1);
+					value = j;
+					if (1 != bp_delete(tree, key, 4, (unsigned char *)&value))
+						missed += 1;
+				}
+			}
+		});
+
+	threads[3].join();
+	threads[4].join();
+	stop = 1;
+	for (t = 0; t < 3; t++)
+		threads[t].join();
+
+	EXPECT_EQ(0, missed.load());
+	for (i = 0; i < 2 * n; i++) {
+		put_be32(k, i);
+		EXPECT_EQ((int)(i % 2 == 0), bp_search(tree, k, 4, (unsigned char *)&p));
+	}
+
+	bp_tree_reclaim(tree);
+	bp_destroy_tree(tree);
+
+	// 相同的 key 跨越多个数据结点，两边的插入和删除会让数据项在结点之间移动，
+	// 查找必须每次都找到所有的数据项
+	tree = bp_create_concurrent_tree(4, 8, 4, 4, NULL);
+	ASSERT_TRUE(tree != NULL);
+	for (i = 0; i < 64; i++) {
+		put_be32(k, 1000);
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&i, 4));
+	}
+
+	threads.clear();
+	stop   = 0;
+	missed = 0;
+	threads.emplace_back([&]() {
+		unsigned char key[4];
+		unsigned int  values[80];
+
+		put_be32(key, 1000);
+		while (!stop.load()) {
+			if (64 != bp_search_all(tree, key, 4, (unsigned char *)values, 80))
+				missed += 1;
+		}
+	});
+	threads.emplace_back([&]() {
+		unsigned char key[4];
+		unsigned int  round;
+		unsigned int  j;
+
+		for (round = 0; round < 200; round++) {
+			for (j = 0; j < 40; j++) {
+				put_be32(key, round % 2 ? 999 - j : 1001 + j);
+				bp_insert(tree, key, 4, (unsigned char *)&j, 4);
+			}
+			for (j = 0; j < 40; j++) {
+				put_be32(key, round % 2 ? 999 - j : 1001 + j);
+				bp_delete(tree, key, 4, (unsigned char *)&j);
+			}
+		}
+	});
+
+	threads[1].join();
+	stop = 1;
+	threads[0].join();
+	EXPECT_EQ(0, missed.load());
+
+	bp_destroy_tree(tree);
+}
+
+TEST(Tree, CowSnapshot)
+{
+	bp_tree_t                *tree;
+	bp_snapshot_t            *snapshot;
+	bp_cursor_t              *cursor;
+	std::vector<std::thread>  threads;
+	std::atomic<int>          stop(0);
+	std::atomic<int>          broken(0);
+	unsigned char             k[4];
+	unsigned char            *key;
+	unsigned char            *value;
+	unsigned int              values[4];
+	unsigned int              i;
+	unsigned int              n;
+	int                       t;
+
+	// 只有写时复制模式的树可以打开快照
+	tree = bp_create_concurrent_tree(4, 8, 4, 4, NULL);
+	ASSERT_TRUE(tree != NULL);
+	EXPECT_TRUE(NULL == bp_snapshot_open(tree));
+	bp_destroy_tree(tree);
+
+	tree = bp_create_cow_tree(4, 8, 4, 4, NULL);
+	ASSERT_TRUE(tree != NULL);
+
+	n = 2000;
+	for (i = 0; i < n; i++) {
+		put_be32(k, i);
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&i, 4));
+	}
+
+	// 快照打开之后的删除和插入都看不到
+	snapshot = bp_snapshot_open(tree);
+	ASSERT_TRUE(snapshot != NULL);
+	for (i = 0; i < n; i += 2) {
+		put_be32(k, i);
+		ASSERT_EQ(1, bp_delete(tree, k, 4, NULL));
+	}
+	for (i = n; i < 2 * n; i++) {
+		put_be32(k, i);
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&i, 4));
+	}
+
+	for (i = 0; i < 2 * n; i++) {
+		put_be32(k, i);
+		EXPECT_EQ((int)(i < n), bp_snapshot_search_all(
+					  snapshot, k, 4, (unsigned char *)values, 4));
+		EXPECT_EQ((int)(i % 2 == 1 || i >= n),
+				  bp_search(tree, k, 4, (unsigned char *)values));
+	}
+
+	cursor = bp_snapshot_cursor_open(snapshot, NULL, NULL);
+	ASSERT_TRUE(cursor != NULL);
+	for (i = 0; bp_cursor_next(cursor, &key, &value); i++)
+		ASSERT_EQ(i, get_be32(key));
+	EXPECT_EQ(n, i);
+	bp_cursor_close(cursor);
+	bp_snapshot_close(snapshot);
+
+	cursor = bp_cursor_open(tree, NULL, NULL);
+	ASSERT_TRUE(cursor != NULL);
+	for (i = 0; bp_cursor_next(cursor, &key, &value); i++)
+		ASSERT_EQ(i < n / 2 ? i * 2 + 1 : i + n / 2, get_be32(key));
+	EXPECT_EQ(n + n / 2, i);
+	bp_cursor_close(cursor);
+	bp_destroy_tree(tree);
+
+	// 写线程按顺序插入新的 key 并删除最早的 key ，每个快照上都是一段连续的 key
+	tree = bp_create_cow_tree(4, 8, 4, 4, NULL);
+	ASSERT_TRUE(tree != NULL);
+	for (i = 0; i < 64; i++) {
+		put_be32(k, i);
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)&i, 4));
+	}
+
+	for (t = 0; t < 3; t++)
+		threads.emplace_back([&]() {
+			bp_cursor_t   *scan;
+			unsigned char *scan_key;
+			unsigned char *scan_value;
+			unsigned int   first;
+			unsigned int   last;
+			unsigned int   prev_first;
+			unsigned int   num;
+
+			prev_first = 0;
+			while (!stop.load()) {
+				scan = bp_cursor_open(tree, NULL, NULL);
+				if (NULL == scan || !bp_cursor_next(scan, &scan_key, &scan_value)) {
+					broken += 1;
+					break;
+				}
+
+				first = last = get_be32(scan_key);
+				for (num = 1; bp_cursor_next(scan, &scan_key, &scan_value); num++) {
+					if (get_be32(scan_key) != last + 1)
+						broken += 1;
+					last = get_be32(scan_key);
+				}
+				if (num < 64 || num > 65 || first < prev_first)
+					broken += 1;
+				prev_first = first;
+				bp_cursor_close(scan);
+			}
+		});
+
+	threads.emplace_back([&]() {
+		unsigned char key[4];
+		unsigned int  j;
+
+		for (j = 64; j < 20000; j++) {
+			put_be32(key, j);
+			bp_insert(tree, key, 4, (unsigned char *)&j, 4);
+			put_be32(key, j - 64);
+			if (1 != bp_delete(tree, key, 4, NULL))
+				broken += 1;
+		}
+	});
+
+	threads[3].join();
+	stop = 1;
+	for (t = 0; t < 3; t++)
+		threads[t].join();
+
+	EXPECT_EQ(0, broken.load());
+	for (i = 0; i < 20000; i++) {
+		put_be32(k, i);
+		EXPECT_EQ((int)(i >= 20000 - 64),
+				  bp_search(tree, k, 4, (unsigned char *)values));
+	}
+
+	bp_tree_reclaim(tree);
+	bp_destroy_tree(tree);
+}
+
+TEST(Shard, Tree)
+{
+	bp_sharded_tree_t        *tree;
+	bp_sharded_cursor_t      *cursor;
+	bp_shard_config_t         configs[4];
+	std::vector<std::thread>  threads;
+	unsigned char             bounds[3 * 4];
+	unsigned char             k[4];
+	unsigned char             hi[4];
+	unsigned char            *key;
+	unsigned char            *value;
+	unsigned int              keys[1000];
+	unsigned int              p;
+	unsigned int              i;
+	unsigned int              n;
+	int                       t;
+
+	for (t = 0; t < 4; t++) {
+		configs[t].max_idx_num  = 4 + t;
+		configs[t].max_data_num = 8 + t;
+		configs[t].concurrent   = 0;
+		// 最后一个分片的结点放在透明大页上，并绑定到 0 号 NUMA 结点
+		configs[t].arena_flags  = 3 == t ? BP_ARENA_HUGE_THP | BP_ARENA_NUMA : 0;
+		configs[t].numa_node    = 0;
+	}
+
+	// 按第一个字节划分只能用于 memcmp 的顺序
+	EXPECT_TRUE(NULL == bp_create_sharded_tree(4, 4, 4, reverse_compare, NULL,
+											   configs));
+
+	tree = bp_create_sharded_tree(4, 4, 4, NULL, NULL, configs);
+	ASSERT_TRUE(tree != NULL);
+	put_be32(k, 0x3fffffff);
+	EXPECT_EQ(0, bp_sharded_tree_route(tree, k));
+	put_be32(k, 0x40000000);
+	EXPECT_EQ(1, bp_sharded_tree_route(tree, k));
+	put_be32(k, 0xffffffff);
+	EXPECT_EQ(3, bp_sharded_tree_route(tree, k));
+
+	// 每个线程只写自己的分片
+	n = 40000;
+	for (t = 0; t < 4; t++)
+		threads.emplace_back([&, t]() {
+			unsigned char key[4];
+			unsigned int  j;
+			unsigned int  v;
+
+			for (j = 0; j < n; j++) {
+				v = j * 107361ull % n;
+				put_be32(key, v * 107361);
+				if (t == bp_sharded_tree_route(tree, key))
+					bp_insert(bp_sharded_tree_get_shard(tree, t), key, 4,
+							  (unsigned char *)&v, 4);
+			}
+		});
+	for (t = 0; t < 4; t++)
+		threads[t].join();
+
+	// 跨越所有分片的游标是有序的
+	cursor = bp_sharded_cursor_open(tree, NULL, NULL);
+	ASSERT_TRUE(cursor != NULL);
+	for (i = 0; 1 == bp_sharded_cursor_next(cursor, &key, &value); i++) {
+		memcpy(&p, value, 4);
+		ASSERT_EQ(i, p);
+		put_be32(k, i * 107361);
+		ASSERT_EQ(0, memcmp(k, key, 4));
+	}
+	EXPECT_EQ(n, i);
+	bp_sharded_cursor_close(cursor);
+
+	put_be32(k, 10000u * 107361);
+	put_be32(hi, 30000u * 107361);
+	cursor = bp_sharded_cursor_open(tree, k, hi);
+	ASSERT_TRUE(cursor != NULL);
+	for (i = 10000; 1 == bp_sharded_cursor_next(cursor, &key, &value); i++) {
+		memcpy(&p, value, 4);
+		ASSERT_EQ(i, p);
+	}
+	EXPECT_EQ(30001u, i);
+	bp_sharded_cursor_close(cursor);
+
+	for (i = 0; i < n; i += 2) {
+		put_be32(k, i * 107361);
+		ASSERT_EQ(1, bp_sharded_delete(tree, k, 4, NULL));
+	}
+	for (i = 0; i < n; i++) {
+		put_be32(k, i * 107361);
+		EXPECT_EQ((int)(i % 2),
+				  bp_sharded_search(tree, k, 4, (unsigned char *)&p));
+	}
+	bp_destroy_sharded_tree(tree);
+
+	// 自定义分界，分界 key 本身属于右边的分片
+	for (t = 0; t < 3; t++)
+		put_be32(bounds + t * 4, (t + 1) * 250);
+	tree = bp_create_sharded_tree(4, 4, 4, NULL, bounds, configs);
+	ASSERT_TRUE(tree != NULL);
+	put_be32(k, 249);
+	EXPECT_EQ(0, bp_sharded_tree_route(tree, k));
+	put_be32(k, 250);
+	EXPECT_EQ(1, bp_sharded_tree_route(tree, k));
+	put_be32(k, 1000);
+	EXPECT_EQ(3, bp_sharded_tree_route(tree, k));
+
+	for (i = 0; i < 1000; i++)
+		put_be32((unsigned char *)&keys[i], (i * 7) % 1000);
+	EXPECT_EQ(0, bp_sharded_insert_batch(tree, (unsigned char *)keys,
+										 (unsigned char *)keys, 1000));
+	for (t = 0; t < 4; t++)
+		EXPECT_EQ(250, bp_node_get_key_total(
+					  bp_sharded_tree_get_shard(tree, t)->head));
+
+	cursor = bp_sharded_cursor_open(tree, NULL, NULL);
+	ASSERT_TRUE(cursor != NULL);
+	for (i = 0; 1 == bp_sharded_cursor_next(cursor, &key, &value); i++) {
+		put_be32(k, i);
+		ASSERT_EQ(0, memcmp(k, key, 4));
+	}
+	EXPECT_EQ(1000u, i);
+	bp_sharded_cursor_close(cursor);
+	bp_destroy_sharded_tree(tree);
+}
+
+TEST(Tree, SaveMmap)
+{
+	bp_tree_t      *tree;
+	bp_mmap_tree_t *mmap_tree;
+	char            path[] = "/tmp/bplus_test_XXXXXX";
+	unsigned char   k[4];
+	unsigned int    values[8];
+	unsigned int    i;
+	unsigned int    n;
+	int             layout;
+	int             fd;
+	FILE           *file;
+
+	fd = mkstemp(path);
+	ASSERT_NE(-1, fd);
+	close(fd);
+
+	// 空树也可以保存和打开
+	tree = bp_create_tree(4, 8, 4, 4, NULL);
+	ASSERT_EQ(0, bp_save_tree(tree, path));
+	bp_destroy_tree(tree);
+	mmap_tree = bp_open_mmap(path, NULL);
+	ASSERT_TRUE(mmap_tree != NULL);
+	put_be32(k, 1);
+	EXPECT_EQ(0, bp_mmap_search(mmap_tree, k, 4, (unsigned char *)values));
+	bp_close_mmap(mmap_tree);
+
+	// 每个 key 有 3 个位置信息，会跨越文件中的数据结点
+	n = 300000;
+	for (layout = 0; layout < 2; layout++) {
+		tree = bp_create_tree_with_layout(5, 9, 4, 4, NULL, (bp_layout_e)layout);
+		for (i = 0; i < n; i++) {
+			put_be32(k, (i * 7 % n) / 3 * 2);
+			values[0] = i * 7 % n;
+			ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)values, 4));
+		}
+		ASSERT_EQ(0, bp_save_tree(tree, path));
+		bp_destroy_tree(tree);
+
+		mmap_tree = bp_open_mmap(path, NULL);
+		ASSERT_TRUE(mmap_tree != NULL);
+		for (i = 0; i < 2 * n / 3 + 2; i++) {
+			put_be32(k, i);
+			ASSERT_EQ(i % 2 == 0 && i < 2 * n / 3 ? 3 : 0,
+					  bp_mmap_search_all(mmap_tree, k, 4,
+										 (unsigned char *)values, 8));
+			if (i % 2 == 0 && i < 2 * n / 3) {
+				ASSERT_EQ(i / 2 * 3, std::min(values[0],
+											  std::min(values[1], values[2])));
+			}
+		}
+		EXPECT_EQ(-1, bp_mmap_search(mmap_tree, k, 3, (unsigned char *)values));
+		bp_close_mmap(mmap_tree);
+	}
+
+	// 比较函数和保存时不一致、文件头损坏时都不能打开
+	EXPECT_TRUE(NULL == bp_open_mmap(path, reverse_compare));
+	file = fopen(path, "r+b");
+	ASSERT_TRUE(file != NULL);
+	fputc('X', file);
+	fclose(file);
+	EXPECT_TRUE(NULL == bp_open_mmap(path, NULL));
+
+	unlink(path);
+}
+
+TEST(Tree, ExportDelta)
+{
+	bp_tree_t                                           *primary;
+	bp_tree_t                                           *replica;
+	char                                                 path[] = "/tmp/bplus_test_XXXXXX";
+	std::vector<std::pair<unsigned int, unsigned int>>   items;
+	unsigned char                                        k[4];
+	unsigned char                                        keys[64 * 4];
+	unsigned int                                         values[64];
+	unsigned int                                         seed;
+	unsigned int                                         v;
+	unsigned int                                         i;
+	uint64_t                                             gen;
+	uint64_t                                             applied;
+	off_t                                                size;
+	bp_node_t                                           *node;
+	int                                                  mode;
+	int                                                  round;
+	int                                                  empty;
+	int                                                  fd;
+
+	// 按 key 和 value 排序后的所有数据项，重复 key 的顺序不确定
+	auto dump = [](bp_tree_t *tree) {
+		std::vector<std::pair<unsigned int, unsigned int>>  out;
+		bp_cursor_t                                        *cursor;
+		unsigned char                                      *key;
+		unsigned char                                      *value;
+		unsigned int                                        p;
+
+		cursor = bp_cursor_open(tree, NULL, NULL);
+		while (bp_cursor_next(cursor, &key, &value)) {
+			memcpy(&p, value, 4);
+			out.emplace_back(get_be32(key), p);
+		}
+		bp_cursor_close(cursor);
+		std::sort(out.begin(), out.end());
+
+		return out;
+	};
+
+	// 导出到文件后从头应用到副本，返回导出的字节数
+	auto sync = [&](uint64_t since) {
+		EXPECT_EQ(0, ftruncate(fd, 0));
+		EXPECT_EQ(0, lseek(fd, 0, SEEK_SET));
+		EXPECT_EQ(0, bp_export_delta(primary, since, fd, &gen));
+		size = lseek(fd, 0, SEEK_CUR);
+		EXPECT_EQ(0, lseek(fd, 0, SEEK_SET));
+		EXPECT_EQ(0, bp_apply_delta(replica, fd, &applied));
+		EXPECT_EQ(gen, applied);
+
+		return size;
+	};
+
+	fd = mkstemp(path);
+	ASSERT_NE(-1, fd);
+	unlink(path);
+
+	// 三种排列方式、并发模式、写时复制模式和开启插入缓冲的树
+	for (mode = 0; mode < 6; mode++) {
+		if (mode < 3)
+			primary = bp_create_tree_with_layout(4, 8, 4, 4, NULL, (bp_layout_e)mode);
+		else if (3 == mode)
+			primary = bp_create_concurrent_tree(4, 8, 4, 4, NULL);
+		else if (4 == mode)
+			primary = bp_create_cow_tree(4, 8, 4, 4, NULL);
+		else {
+			primary = bp_create_tree(4, 8, 4, 4, NULL);
+			ASSERT_EQ(0, bp_tree_set_insert_buffer(primary, 64));
+		}
+		replica = bp_create_tree(5, 9, 4, 4, NULL);
+		ASSERT_TRUE(primary != NULL && replica != NULL);
+
+		// 空树的导出只有头部和结束标记
+		sync(0);
+		EXPECT_EQ(0, bp_count_range(replica, NULL, NULL));
+
+		seed = mode + 1;
+		for (i = 0; i < 3000; i++) {
+			seed = seed * 1103515245 + 12345;
+			put_be32(k, seed % 1000);
+			ASSERT_EQ(0, bp_insert(primary, k, 4, (unsigned char *)&i, 4));
+		}
+		sync(0);
+		ASSERT_EQ(dump(primary), dump(replica));
+
+		// 随机插入重复的 key 、删除、替换、批量插入和顺序追加，每轮导出一次增量
+		for (round = 0; round < 40; round++) {
+			for (i = 0; i < 50; i++) {
+				seed = seed * 1103515245 + 12345;
+				put_be32(k, seed % 1000);
+				v = 100000 * (round + 1) + i;
+				ASSERT_EQ(0, bp_insert(primary, k, 4, (unsigned char *)&v, 4));
+			}
+			items = dump(primary);
+			for (i = 0; i < 60 && !items.empty(); i++) {
+				seed = seed * 1103515245 + 12345;
+				auto item = items[seed % items.size()];
+				put_be32(k, item.first);
+				bp_delete(primary, k, 4, (unsigned char *)&item.second);
+			}
+			items = dump(primary);
+			for (i = 0; i < 10 && !items.empty(); i++) {
+				seed = seed * 1103515245 + 12345;
+				auto item = items[seed % items.size()];
+				put_be32(k, item.first);
+				v = 900000 + round * 10 + i;
+				bp_update(primary, k, 4, (unsigned char *)&item.second,
+						  (unsigned char *)&v);
+			}
+			for (i = 0; i < 64; i++) {
+				put_be32(keys + i * 4, 500 + round * 3 + i / 30);
+				values[i] = i;
+			}
+			ASSERT_EQ(0, bp_insert_batch(primary, keys, (unsigned char *)values, 64));
+			for (i = 0; i < 20; i++) {
+				put_be32(k, 1000 + round * 20 + i);
+				ASSERT_EQ(0, bp_insert(primary, k, 4, (unsigned char *)&i, 4));
+			}
+
+			sync(gen);
+			ASSERT_EQ(dump(primary), dump(replica)) << "mode " << mode << " round " << round;
+		}
+
+		// 没有修改时只导出头部和结束标记，修改一项只导出相邻的几个数据结点
+		EXPECT_EQ(48, sync(gen));
+		put_be32(k, 300);
+		ASSERT_EQ(0, bp_insert(primary, k, 4, (unsigned char *)&round, 4));
+		EXPECT_GT(600, sync(gen));
+		ASSERT_EQ(dump(primary), dump(replica));
+
+		// 删除所有数据项之后副本也为空
+		items = dump(primary);
+		for (auto &item: items) {
+			put_be32(k, item.first);
+			ASSERT_EQ(1, bp_delete(primary, k, 4, (unsigned char *)&item.second));
+		}
+		sync(gen);
+		EXPECT_EQ(0, bp_count_range(replica, NULL, NULL));
+
+		if (3 == mode || 4 == mode)
+			bp_tree_reclaim(primary);
+		bp_destroy_tree(primary);
+		bp_destroy_tree(replica);
+	}
+
+	// 删除后留下的空数据结点在没有修改过的子树的边上时，范围的上下限要从相邻的数据
+	// 结点上取
+	primary = bp_create_tree(3, 3, 4, 4, NULL);
+	replica = bp_create_tree(3, 3, 4, 4, NULL);
+	ASSERT_TRUE(primary != NULL && replica != NULL);
+	sync(0);
+	empty = 0;
+	seed  = 7;
+	for (round = 0; round < 300; round++) {
+		for (i = 0; i < 6; i++) {
+			seed = seed * 1103515245 + 12345;
+			put_be32(k, (seed >> 8) % 200 * 0x1000000u);
+			if ((seed >> 4) % 3)
+				ASSERT_EQ(0, bp_insert(primary, k, 4, (unsigned char *)&i, 4));
+			else
+				bp_delete(primary, k, 4, NULL);
+		}
+
+		for (node = primary->data; node; node = bp_data_node_get_pnext(node))
+			empty += 0 == bp_node_get_key_num(node);
+
+		sync(gen);
+		ASSERT_EQ(dump(primary), dump(replica)) << "round " << round;
+	}
+	EXPECT_LT(0, empty);
+	bp_destroy_tree(primary);
+	bp_destroy_tree(replica);
+
+	// 头部损坏或者 key 的大小不一致时不能应用
+	primary = bp_create_tree(4, 8, 4, 4, NULL);
+	replica = bp_create_tree(4, 8, 8, 4, NULL);
+	ASSERT_EQ(0, ftruncate(fd, 0));
+	ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
+	ASSERT_EQ(0, bp_export_delta(primary, 0, fd, NULL));
+	ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
+	EXPECT_EQ(-1, bp_apply_delta(replica, fd, NULL));
+	ASSERT_EQ(1, pwrite(fd, "X", 1, 0));
+	ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
+	EXPECT_EQ(-1, bp_apply_delta(primary, fd, NULL));
+	bp_destroy_tree(primary);
+	bp_destroy_tree(replica);
+
+	close(fd);
+}
+
+TEST(Tree, BufferPool)
+{
+	bp_tree_t        *tree;
+	bp_mmap_tree_t   *trees[2];
+	bp_mmap_cursor_t *cursor;
+	bp_pool_t        *pool;
+	char              path[] = "/tmp/bplus_test_XXXXXX";
+	unsigned char    *pages[3];
+	unsigned char    *key;
+	unsigned char    *value;
+	unsigned char     k[4];
+	unsigned char     hi[4];
+	unsigned int      values[8];
+	unsigned int      i;
+	unsigned int      n;
+	unsigned int      last;
+	int               count;
+	int               t;
+	int               fd;
+	struct stat       st;
+
+	fd = mkstemp(path);
+	ASSERT_NE(-1, fd);
+	close(fd);
+
+	// 文件末尾之后的页读出来是全 0 ，修改过的页在淘汰时写回文件
+	pool = bp_pool_open(path, 4096, 2, 1);
+	ASSERT_TRUE(pool != NULL);
+	for (i = 0; i < 4; i++) {
+		pages[0] = bp_pool_pin(pool, i, 1);
+		ASSERT_TRUE(pages[0] != NULL);
+		EXPECT_EQ(0, pages[0][0]);
+		EXPECT_EQ(0, pages[0][4095]);
+		memset(pages[0], 'a' + i, 4096);
+		bp_pool_unpin(pool, pages[0], 1);
+	}
+	for (i = 0; i < 4; i++) {
+		pages[0] = bp_pool_pin(pool, i, 1);
+		ASSERT_TRUE(pages[0] != NULL);
+		EXPECT_EQ('a' + i, pages[0][0]);
+		EXPECT_EQ('a' + i, pages[0][4095]);
+		bp_pool_unpin(pool, pages[0], 0);
+	}
+
+	// 所有的帧都被 pin 住时不能再读入新的页
+	pages[0] = bp_pool_pin(pool, 0, 1);
+	pages[1] = bp_pool_pin(pool, 1, 1);
+	ASSERT_TRUE(pages[0] != NULL && pages[1] != NULL);
+	pages[2] = bp_pool_pin(pool, 2, 1);
+	EXPECT_TRUE(NULL == pages[2]);
+	bp_pool_unpin(pool, pages[0], 0);
+	bp_pool_unpin(pool, pages[1], 0);
+	ASSERT_EQ(0, bp_pool_close(pool));
+	ASSERT_EQ(0, stat(path, &st));
+	EXPECT_EQ(4 * 4096, st.st_size);
+
+	// 多个线程同时读入和淘汰，读写文件时不持有锁，同一页只会被读入一次
+	pool = bp_pool_open(path, 4096, 4, 1);
+	ASSERT_TRUE(pool != NULL);
+	{
+		std::vector<std::thread> threads;
+		std::atomic<int>         broken(0);
+
+		for (t = 0; t < 4; t++)
+			threads.emplace_back([&, t]() {
+				unsigned char *page;
+				unsigned int   j;
+				unsigned int   idx;
+
+				for (j = 0; j < 2000; j++) {
+					idx  = (j * 7 + t) % 8;
+					page = bp_pool_pin(pool, idx, 1);
+					if (NULL == page) {
+						broken += 1;
+						continue;
+					}
+					if (page[4095] != (idx < 4 ? 'a' + idx : 0))
+						broken += 1;
+					bp_pool_unpin(pool, page, 0);
+
+					// 每个线程只修改自己的页，淘汰时写回的内容之后要能读出来
+					page = bp_pool_pin(pool, 8 + t, 1);
+					if (NULL == page) {
+						broken += 1;
+						continue;
+					}
+					if (j > 0 && page[0] != (unsigned char)(j - 1))
+						broken += 1;
+					page[0] = (unsigned char)j;
+					bp_pool_unpin(pool, page, 1);
+				}
+			});
+		for (t = 0; t < 4; t++)
+			threads[t].join();
+		EXPECT_EQ(0, broken.load());
+	}
+	ASSERT_EQ(0, bp_pool_close(pool));
+
+	n    = 300000;
+	tree = bp_create_tree(5, 9, 4, 4, NULL);
+	for (i = 0; i < n; i++) {
+		put_be32(k, i / 3 * 2);
+		values[0] = i;
+		ASSERT_EQ(0, bp_insert(tree, k, 4, (unsigned char *)values, 4));
+	}
+	ASSERT_EQ(0, bp_save_tree(tree, path));
+	bp_destroy_tree(tree);
+
+	// 缓冲池远小于文件，每次查找完都释放 pin 住的页
+	trees[0] = bp_open_mmap(path, NULL);
+	trees[1] = bp_open_pooled(path, NULL, 4);
+	ASSERT_TRUE(trees[0] != NULL && trees[1] != NULL);
+	for (i = 0; i < 2 * n / 3 + 2; i += 7) {
+		put_be32(k, i);
+		ASSERT_EQ(i % 2 == 0 && i < 2 * n / 3 ? 3 : 0,
+				  bp_mmap_search_all(trees[1], k, 4, (unsigned char *)values, 8));
+	}
+
+	for (t = 0; t < 2; t++) {
+		put_be32(k, 1001);
+		put_be32(hi, 150000);
+		cursor = bp_mmap_cursor_open(trees[t], k, hi);
+		ASSERT_TRUE(cursor != NULL);
+		count = 0;
+		last  = 0;
+		while (1 == bp_mmap_cursor_next(cursor, &key, &value)) {
+			ASSERT_LE(last, get_be32(key));
+			last   = get_be32(key);
+			count += 1;
+		}
+		EXPECT_EQ((150000 - 1002) / 2 * 3 + 3, count);
+		EXPECT_EQ(150000u, last);
+		bp_mmap_cursor_close(cursor);
+
+		cursor = bp_mmap_cursor_open(trees[t], NULL, NULL);
+		ASSERT_TRUE(cursor != NULL);
+		for (count = 0; 1 == bp_mmap_cursor_next(cursor, &key, &value); count++)
+			;
+		EXPECT_EQ((int)n, count);
+		bp_mmap_cursor_close(cursor);
+	}
+	bp_close_mmap(trees[0]);
+	bp_close_mmap(trees[1]);
+
+	// 比较函数和保存时不一致时不能打开
+	EXPECT_TRUE(NULL == bp_open_pooled(path, reverse_compare, 4));
+
+	unlink(path);
+}
+
+TEST(Tree, Durable)
+{
+	bp_durable_tree_t        *tree;
+	std::vector<std::thread>  threads;
+	std::string               dir;
+	std::string               path;
+	std::string               wal;
+	std::string               stale;
+	char                      tmpl[] = "/tmp/bplus_test_XXXXXX";
+	unsigned char             keys[4 * 100];
+	unsigned char             values[4 * 100];
+	unsigned char             k[4];
+	unsigned int              v;
+	unsigned int              i;
+	int                       t;
+	FILE                     *file;
+	struct stat               st;
+
+	ASSERT_TRUE(mkdtemp(tmpl) != NULL);
+	dir   = tmpl;
+	path  = dir + "/tree";
+	wal   = path + ".wal";
+	stale = dir + "/stale";
+
+	// 多个线程同时写入，日志一起提交
+	tree = bp_open_durable(path.c_str(), 5, 9, 4, 4, NULL, 0);
+	ASSERT_TRUE(tree != NULL);
+	for (t = 0; t < 4; t++)
+		threads.push_back(std::thread([tree, t]() {
+			unsigned char key[4];
+			unsigned int  value;
+			unsigned int  j;
+
+			for (j = t; j < 4000; j += 4) {
+				put_be32(key, j);
+				value = j;
+				ASSERT_EQ(0, bp_durable_insert(tree, key, 4,
+											   (unsigned char *)&value, 4));
+			}
+		}));
+	for (auto &thread : threads)
+		thread.join();
+
+	for (i = 0; i < 100; i++) {
+		put_be32(keys + i * 4, 4000 + i);
+		v = 4000 + i;
+		memcpy(values + i * 4, &v, 4);
+	}
+	ASSERT_EQ(0, bp_durable_insert_batch(tree, keys, values, 100));
+	for (i = 0; i < 4100; i += 3) {
+		put_be32(k, i);
+		v = i;
+		ASSERT_EQ(1, bp_durable_delete(tree, k, 4, (unsigned char *)&v));
+	}
+	put_be32(k, 1);
+	EXPECT_EQ(1, bp_durable_delete(tree, k, 4, NULL));
+	EXPECT_EQ(0, bp_durable_delete(tree, k, 4, NULL));
+	ASSERT_EQ(0, bp_close_durable(tree));
+
+	// 没有 checkpoint 时全部从日志恢复，末尾写到一半的日志被丢弃
+	file = fopen(wal.c_str(), "ab");
+	ASSERT_TRUE(file != NULL);
+	fwrite("torn", 1, 4, file);
+	fclose(file);
+	for (t = 0; t < 2; t++) {
+		tree = bp_open_durable(path.c_str(), 5, 9, 4, 4, NULL, 0);
+		ASSERT_TRUE(tree != NULL);
+		for (i = 0; i < 4100; i++) {
+			put_be32(k, i);
+			ASSERT_EQ(i % 3 == 0 || i == 1 ? 0 : 1,
+					  bp_durable_search(tree, k, 4, (unsigned char *)&v));
+			if (i % 3 != 0 && i != 1) {
+				ASSERT_EQ(i, v);
+			}
+		}
+		if (1 == t)
+			break;
+
+		// 保留 checkpoint 之前的日志，模拟 checkpoint 之后换日志之前崩溃
+		ASSERT_EQ(0, link(wal.c_str(), stale.c_str()));
+		ASSERT_EQ(0, bp_durable_checkpoint(tree));
+		ASSERT_EQ(0, stat(wal.c_str(), &st));
+		EXPECT_EQ(24, st.st_size);
+		ASSERT_EQ(0, bp_close_durable(tree));
+		ASSERT_EQ(0, rename(stale.c_str(), wal.c_str()));
+	}
+
+	// 旧日志的版本号比 checkpoint 小，不会被重复重放
+	put_be32(k, 2);
+	v = 2;
+	EXPECT_EQ(1, bp_durable_delete(tree, k, 4, (unsigned char *)&v));
+	EXPECT_EQ(0, bp_durable_delete(tree, k, 4, (unsigned char *)&v));
+	ASSERT_EQ(0, bp_close_durable(tree));
+
+	// 日志超过限制时自动 checkpoint
+	tree = bp_open_durable(path.c_str(), 5, 9, 4, 4, NULL, 4096);
+	ASSERT_TRUE(tree != NULL);
+	for (i = 0; i < 2000; i++) {
+		put_be32(k, 10000 + i);
+		ASSERT_EQ(0, bp_durable_insert(tree, k, 4, (unsigned char *)&i, 4));
+	}
+	ASSERT_EQ(0, stat(wal.c_str(), &st));
+	EXPECT_GT(4096, st.st_size);
+	ASSERT_EQ(0, bp_close_durable(tree));
+
+	tree = bp_open_durable(path.c_str(), 5, 9, 4, 4, NULL, 0);
+	ASSERT_TRUE(tree != NULL);
+	for (i = 0; i < 2000; i++) {
+		put_be32(k, 10000 + i);
+		ASSERT_EQ(1, bp_durable_search(tree, k, 4, (unsigned char *)&v));
+		ASSERT_EQ(i, v);
+	}
+	put_be32(k, 2);
+	EXPECT_EQ(0, bp_durable_search(tree, k, 4, (unsigned char *)&v));
+	ASSERT_EQ(0, bp_close_durable(tree));
+
+	// 参数和文件不一致时不能打开
+	EXPECT_TRUE(NULL == bp_open_durable(path.c_str(), 5, 9, 4, 8, NULL, 0));
+
+	unlink(path.c_str());
+	unlink(wal.c_str());
+	rmdir(dir.c_str());
+}